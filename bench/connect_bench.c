@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+/*
+ * connect_bench measures the client-connect path of the plugin under a
+ * connect storm without OpenVPN. It creates a synthetic database with the
+ * given number of clients and networks per client, opens a plugin instance
+ * on it and calls plugin_client_connect from several threads. Like the
+ * deferred client-connect of OpenVPN, every connect writes its config to a
+ * file, which should be on a tmpfs to keep the disk out of the measurement.
+ *
+ * With a rate, connects arrive at fixed times regardless of how long the
+ * previous ones took, and the latency is measured from the arrival time, so
+ * queueing behind slow connects is included. Without a rate, every thread
+ * connects as fast as it can.
+ *
+ * Usage: connect_bench [-c clients] [-m networks] [-t threads] [-r rate]
+ *                      [-d seconds] [-o dir] [-a admission rate] [-W] [-R]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "dao.h"
+#include "model.h"
+#include "plugin.h"
+#include "vector.h"
+
+#define BENCH_DEFAULT_CLIENTS  1000
+#define BENCH_DEFAULT_NETWORKS 2
+#define BENCH_DEFAULT_THREADS  4
+#define BENCH_DEFAULT_SECONDS  5
+#define BENCH_DEFAULT_DIR      "/dev/shm"
+
+#define BENCH_CREATE_TABLES \
+    "CREATE TABLE VPN_CLIENTS (ID INTEGER PRIMARY KEY AUTOINCREMENT, " \
+    "CN TEXT, IS_ACTIVE INTEGER NOT NULL DEFAULT(0), IPV4_ADDR TEXT NOT NULL, " \
+    "IPV4_REMOTE_ADDR NOT NULL, IPV6_ADDR TEXT, IPV6_REMOTE_ADDR TEXT); " \
+    "CREATE TABLE VPN_CLIENT_NETWORKS (ID INTEGER PRIMARY KEY AUTOINCREMENT, " \
+    "CLIENT_ID INTEGER NOT NULL, NETWORK_ADDR TEXT NOT NULL, " \
+    "FOREIGN KEY(CLIENT_ID) REFERENCES VPN_CLIENTS(ID))"
+
+struct bench_config {
+    size_t bc_clients;
+    size_t bc_networks;
+    size_t bc_threads;
+    double bc_rate;            /* Connects per second of all threads */
+    double bc_seconds;
+    double bc_admission_rate;  /* 0 disables the admission control */
+    bool bc_no_wait;           /* Start before the warm-up finished */
+    bool bc_replica;           /* Query an in-memory replica */
+    const char *bc_dir;
+};
+
+struct bench_thread {
+    pthread_t bt_thread;
+    size_t bt_index;
+    const struct bench_config *bt_config;
+    plugin_ctx_t *bt_ctx;
+    struct timespec bt_start;
+    vector_t *bt_latencies;    /* Nanoseconds of successful connects */
+    uint64_t bt_rejected;      /* Denied by the admission control */
+    uint64_t bt_failed;
+    uint64_t bt_missed;        /* Arrivals not started before the end */
+    int bt_error;
+};
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static uint64_t
+timespec_ns(const struct timespec *ts)
+{
+    return ((uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec);
+}
+
+static void
+ns_timespec(uint64_t ns, struct timespec *ts)
+{
+    ts->tv_sec = ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+}
+
+/*
+ * create_db creates a database with active clients named client1..clientN.
+ * Every client has a static address and alternating IPv4 and IPv6 networks,
+ * which don't overlap.
+ */
+static int
+create_db(const char *path, const struct bench_config *config)
+{
+    struct vpn_client client;
+    dao_config_t *daocfg = NULL;
+    sqlite3 *db = NULL;
+    char network[INET6_ADDRSTRLEN_W_PREFIX];
+    size_t i = 0, j = 0, v4 = 0, v6 = 0;
+    uint32_t addr = 0;
+    int id = 0, err = 0;
+
+    unlink(path);
+
+    if (sqlite3_open(path, &db) != SQLITE_OK ||
+        sqlite3_exec(db, BENCH_CREATE_TABLES, NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Failed to create %s: %s\n", path, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return (EIO);
+    }
+    sqlite3_close(db);
+
+    if ((err = dao_alloc(&daocfg, path)) != 0 ||
+        (err = dao_bulk_begin(daocfg)) != 0) {
+        goto out_free;
+    }
+
+    for (i = 0; i < config->bc_clients; i++) {
+        memset(&client, 0, sizeof(client));
+        snprintf(client.cn, sizeof(client.cn), "client%zu", i + 1);
+        client.is_active = 1;
+
+        /* 100.64.0.0/10 has room for four million clients. */
+        addr = 0x64400000 + (uint32_t)i + 1;
+        snprintf(client.ipv4_addr, sizeof(client.ipv4_addr), "%u.%u.%u.%u",
+            addr >> 24, (addr >> 16) & 0xff, (addr >> 8) & 0xff, addr & 0xff);
+        strcpy(client.ipv4_remote_addr, "255.192.0.0");
+
+        if ((err = dao_bulk_add_client(daocfg, &client, &id)) != 0) {
+            goto out_rollback;
+        }
+
+        for (j = 0; j < config->bc_networks; j++) {
+            if (j % 2 == 0) {
+                addr = 0x0a000000 + (uint32_t)(v4++ * 4);
+                snprintf(network, sizeof(network), "%u.%u.%u.%u/30",
+                    addr >> 24, (addr >> 16) & 0xff, (addr >> 8) & 0xff,
+                    addr & 0xff);
+            } else {
+                snprintf(network, sizeof(network), "2001:db8:%x:%x::/64",
+                    (unsigned)(v6 >> 16), (unsigned)(v6 & 0xffff));
+                v6++;
+            }
+
+            if ((err = dao_bulk_add_network(daocfg, id, network)) != 0) {
+                goto out_rollback;
+            }
+        }
+    }
+
+    err = dao_bulk_commit(daocfg);
+    goto out_free;
+
+out_rollback:
+    dao_bulk_rollback(daocfg);
+out_free:
+    dao_free(daocfg);
+    return (err);
+}
+
+static void *
+bench_thread(void *arg)
+{
+    struct bench_thread *bt = arg;
+    const struct bench_config *config = bt->bt_config;
+    struct timespec arrival, done;
+    char cn[RFC5280_CN_MAX_LENGTH], path[PATH_MAX];
+    uint64_t start_ns = timespec_ns(&(bt->bt_start)), end_ns = 0;
+    uint64_t arrival_ns = 0, latency = 0, k = 0;
+    unsigned int seed = (unsigned int)bt->bt_index + 1;
+    int fd = -1, err = 0;
+
+    end_ns = start_ns + (uint64_t)(config->bc_seconds * 1e9);
+
+    snprintf(path, sizeof(path), "%s/connect_bench-%d-%zu.ccd", config->bc_dir,
+        (int)getpid(), bt->bt_index);
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+        bt->bt_error = errno;
+        return (NULL);
+    }
+    unlink(path);
+
+    for (k = 0; ; k++) {
+        if (config->bc_rate > 0) {
+            /* The threads take turns, together they keep the rate. */
+            arrival_ns = start_ns + (uint64_t)((k * config->bc_threads +
+                bt->bt_index) * 1e9 / config->bc_rate);
+            if (arrival_ns >= end_ns) {
+                break;
+            }
+            ns_timespec(arrival_ns, &arrival);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &arrival,
+                   NULL) == EINTR) {
+            }
+
+            /* Arrivals, which are still waiting at the end, are missed. */
+            clock_gettime(CLOCK_MONOTONIC, &done);
+            if (timespec_ns(&done) >= end_ns) {
+                for (; arrival_ns < end_ns; k++) {
+                    bt->bt_missed++;
+                    arrival_ns = start_ns + (uint64_t)(((k + 1) * 
+                        config->bc_threads + bt->bt_index) * 1e9 / 
+                        config->bc_rate);
+                }
+                break;
+            }
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &arrival);
+            if ((arrival_ns = timespec_ns(&arrival)) >= end_ns) {
+                break;
+            }
+        }
+
+        snprintf(cn, sizeof(cn), "client%zu",
+            (size_t)(rand_r(&seed) % config->bc_clients) + 1);
+
+        if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+            bt->bt_error = errno;
+            break;
+        }
+
+        err = plugin_client_connect(bt->bt_ctx, cn, fd);
+        clock_gettime(CLOCK_MONOTONIC, &done);
+
+        if (err == EAGAIN || err == EALREADY || err == EBUSY) {
+            bt->bt_rejected++;
+            continue;
+        } else if (err != 0) {
+            bt->bt_failed++;
+            continue;
+        }
+
+        latency = timespec_ns(&done) - arrival_ns;
+        if ((err = vector_push_back(bt->bt_latencies, &latency)) != 0) {
+            bt->bt_error = err;
+            break;
+        }
+
+        plugin_client_disconnect(bt->bt_ctx, cn, 0, 0);
+    }
+
+    close(fd);
+    return (NULL);
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return ((x > y) - (x < y));
+}
+
+static double
+percentile_us(vector_t *sorted, double p)
+{
+    size_t n = vector_size(sorted);
+
+    if (n == 0) {
+        return (0);
+    }
+
+    return (*(uint64_t *)vector_at(sorted, (size_t)(p * (n - 1))) / 1e3);
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-c clients] [-m networks] [-t threads] "
+        "[-r rate] [-d seconds] [-o dir] [-a admission rate] [-W] [-R]\n", 
+        name);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct bench_config config = {
+        BENCH_DEFAULT_CLIENTS, BENCH_DEFAULT_NETWORKS, BENCH_DEFAULT_THREADS,
+        0, BENCH_DEFAULT_SECONDS, 0, false, false, BENCH_DEFAULT_DIR
+    };
+    struct bench_thread *threads = NULL;
+    struct plugin_warmup_stats warmup_stats;
+    struct timespec start_ts;
+    plugin_ctx_t *ctx = NULL;
+    vector_t *latencies = NULL;
+    uint64_t *latency = NULL, rejected = 0, failed = 0, missed = 0;
+    char db_path[PATH_MAX];
+    double start = 0, sec = 0;
+    size_t i = 0;
+    int opt = 0, err = 0;
+
+    while ((opt = getopt(argc, argv, "c:m:t:r:d:o:a:WR")) != -1) {
+        switch (opt) {
+        case 'c': config.bc_clients = strtoul(optarg, NULL, 10); break;
+        case 'm': config.bc_networks = strtoul(optarg, NULL, 10); break;
+        case 't': config.bc_threads = strtoul(optarg, NULL, 10); break;
+        case 'r': config.bc_rate = strtod(optarg, NULL); break;
+        case 'd': config.bc_seconds = strtod(optarg, NULL); break;
+        case 'o': config.bc_dir = optarg; break;
+        case 'a': config.bc_admission_rate = strtod(optarg, NULL); break;
+        case 'W': config.bc_no_wait = true; break;
+        case 'R': config.bc_replica = true; break;
+        default:
+            usage(argv[0]);
+            return (EINVAL);
+        }
+    }
+
+    if (config.bc_clients == 0 || config.bc_threads == 0 ||
+        config.bc_seconds <= 0) {
+        usage(argv[0]);
+        return (EINVAL);
+    }
+
+    snprintf(db_path, sizeof(db_path), "%s/connect_bench-%d.db", config.bc_dir,
+        (int)getpid());
+
+    start = now_sec();
+    if ((err = create_db(db_path, &config)) != 0) {
+        fprintf(stderr, "Failed to create database: %s\n", strerror(err));
+        return (err);
+    }
+    printf("database     %zu clients, %zu networks in %.2f s\n",
+        config.bc_clients, config.bc_clients * config.bc_networks,
+        now_sec() - start);
+
+    start = now_sec();
+    if ((err = plugin_open(&ctx, db_path)) != 0) {
+        fprintf(stderr, "Failed to open plugin: %s\n", strerror(err));
+        goto out_unlink;
+    }
+    if (config.bc_replica && (err = plugin_set_replica(ctx)) != 0) {
+        fprintf(stderr, "Failed to open replica: %s\n", strerror(err));
+        goto out_close;
+    }
+    if (!config.bc_no_wait && (err = plugin_warmup_wait(ctx)) != 0) {
+        fprintf(stderr, "Failed to warm up: %s\n", strerror(err));
+        goto out_close;
+    }
+    printf("open         %.2f s%s\n", now_sec() - start,
+        config.bc_no_wait ? " (warm-up in background)" : "");
+
+    plugin_set_admission(ctx, config.bc_admission_rate,
+        config.bc_admission_rate);
+
+    if ((threads = calloc(config.bc_threads, sizeof(struct bench_thread)))
+        == NULL || (err = vector_alloc(&latencies, sizeof(uint64_t))) != 0) {
+        err = ENOMEM;
+        goto out_close;
+    }
+
+    start = now_sec();
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+    for (i = 0; i < config.bc_threads; i++) {
+        threads[i].bt_index = i;
+        threads[i].bt_config = &config;
+        threads[i].bt_ctx = ctx;
+        threads[i].bt_start = start_ts;
+
+        if ((err = vector_alloc(&(threads[i].bt_latencies),
+             sizeof(uint64_t))) != 0 ||
+            (err = pthread_create(&(threads[i].bt_thread), NULL,
+             bench_thread, &(threads[i]))) != 0) {
+            fprintf(stderr, "Failed to start thread: %s\n", strerror(err));
+            config.bc_threads = i;
+            break;
+        }
+    }
+
+    for (i = 0; i < config.bc_threads; i++) {
+        pthread_join(threads[i].bt_thread, NULL);
+    }
+    sec = now_sec() - start;
+
+    for (i = 0; i < config.bc_threads; i++) {
+        if (threads[i].bt_error != 0 && err == 0) {
+            err = threads[i].bt_error;
+            fprintf(stderr, "Thread %zu failed: %s\n", i, strerror(err));
+        }
+
+        rejected += threads[i].bt_rejected;
+        failed += threads[i].bt_failed;
+        missed += threads[i].bt_missed;
+
+        for (latency = vector_begin(threads[i].bt_latencies);
+             latency != vector_end(threads[i].bt_latencies);
+             latency = vector_next(threads[i].bt_latencies, latency)) {
+            vector_push_back(latencies, latency);
+        }
+        vector_free(threads[i].bt_latencies);
+    }
+
+    vector_sort(latencies, compare_u64);
+    plugin_get_warmup_stats(ctx, &warmup_stats);
+
+    printf("connects     %zu in %.2f s, %.0f/s\n", vector_size(latencies), sec,
+        vector_size(latencies) / sec);
+    printf("rejected     %" PRIu64 "\nfailed       %" PRIu64 "\n"
+        "missed       %" PRIu64 "\n", rejected, failed, missed);
+    printf("direct       %" PRIu64 "\n", warmup_stats.ws_direct_connects);
+    printf("latency us   p50 %.1f p99 %.1f p999 %.1f max %.1f\n",
+        percentile_us(latencies, 0.5), percentile_us(latencies, 0.99),
+        percentile_us(latencies, 0.999), percentile_us(latencies, 1));
+
+    vector_free(latencies);
+    free(threads);
+
+out_close:
+    plugin_close(ctx);
+out_unlink:
+    unlink(db_path);
+    return (err);
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+/*
+ * inetx_bench compares the batch IPv4 functions against a loop over the
+ * single address functions inetx_str_to_ipv4_addr and inetx_ipv4_addr_to_str.
+ *
+ * Usage: inetx_bench [count]
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "inetx.h"
+
+#define BENCH_DEFAULT_COUNT 1000000
+#define BENCH_ROUNDS        5
+
+static const char *impl_names[] = { "auto", "scalar", "sse4", "avx2" };
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void
+report(const char *name, size_t count, double sec)
+{
+    printf("%-28s %8.2f ns/addr %10.2f Maddr/s\n", name, sec * 1e9 / count,
+        count / sec / 1e6);
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t count = BENCH_DEFAULT_COUNT, i = 0;
+    uint32_t *addrs = NULL, *parsed = NULL;
+    uint8_t *prefixes = NULL;
+    char *strs = NULL;
+    const char **str_ptrs = NULL;
+    struct in_addr addr = {0};
+    double start = 0, best = 0, sec = 0;
+    int impl = 0, round = 0, err = 0;
+    char name[64];
+
+    if (argc > 1) {
+        count = strtoul(argv[1], NULL, 10);
+    }
+
+    addrs = calloc(count, sizeof(uint32_t));
+    parsed = calloc(count, sizeof(uint32_t));
+    prefixes = calloc(count, sizeof(uint8_t));
+    strs = calloc(count, INET_ADDRSTRLEN);
+    str_ptrs = calloc(count, sizeof(char *));
+
+    if (addrs == NULL || parsed == NULL || prefixes == NULL || strs == NULL ||
+        str_ptrs == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return (ENOMEM);
+    }
+
+    srand(42);
+    for (i = 0; i < count; i++) {
+        addrs[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        str_ptrs[i] = strs + i * INET_ADDRSTRLEN;
+    }
+
+    /* Baseline: format every address with inet_ntop */
+    for (round = 0, best = 0; round < BENCH_ROUNDS; round++) {
+        start = now_sec();
+        for (i = 0; i < count; i++) {
+            addr.s_addr = htonl(addrs[i]);
+            inetx_ipv4_addr_to_str(&addr, strs + i * INET_ADDRSTRLEN,
+                INET_ADDRSTRLEN);
+        }
+        sec = now_sec() - start;
+        best = (round == 0 || sec < best) ? sec : best;
+    }
+    report("format inetx_ipv4_addr_to_str", count, best);
+
+    for (impl = INETX_BATCH_IMPL_SCALAR; impl <= INETX_BATCH_IMPL_AVX2; impl++) {
+        if (inetx_batch_select(impl) != 0) {
+            printf("format batch %-15s unsupported\n", impl_names[impl]);
+            continue;
+        }
+
+        for (round = 0, best = 0; round < BENCH_ROUNDS; round++) {
+            start = now_sec();
+            inetx_ipv4_addr_to_str_batch(addrs, count, strs, INET_ADDRSTRLEN);
+            sec = now_sec() - start;
+            best = (round == 0 || sec < best) ? sec : best;
+        }
+        snprintf(name, sizeof(name), "format batch %s", impl_names[impl]);
+        report(name, count, best);
+    }
+
+    /* Baseline: parse every address with inet_pton */
+    for (round = 0, best = 0; round < BENCH_ROUNDS; round++) {
+        start = now_sec();
+        for (i = 0; i < count; i++) {
+            inetx_str_to_ipv4_addr(str_ptrs[i], &addr);
+            parsed[i] = ntohl(addr.s_addr);
+        }
+        sec = now_sec() - start;
+        best = (round == 0 || sec < best) ? sec : best;
+    }
+    report("parse inetx_str_to_ipv4_addr", count, best);
+
+    for (impl = INETX_BATCH_IMPL_SCALAR; impl <= INETX_BATCH_IMPL_AVX2; impl++) {
+        if (inetx_batch_select(impl) != 0) {
+            printf("parse batch %-16s unsupported\n", impl_names[impl]);
+            continue;
+        }
+
+        for (round = 0, best = 0; round < BENCH_ROUNDS; round++) {
+            start = now_sec();
+            err = inetx_parse_ipv4_cidr_batch(str_ptrs, count, parsed,
+                prefixes, NULL);
+            sec = now_sec() - start;
+            best = (round == 0 || sec < best) ? sec : best;
+        }
+        snprintf(name, sizeof(name), "parse batch %s", impl_names[impl]);
+        report(name, count, best);
+
+        /* The batch results must match the generated addresses. */
+        if (err != 0 || memcmp(parsed, addrs, count * sizeof(uint32_t)) != 0) {
+            fprintf(stderr, "Batch %s returned wrong results\n",
+                impl_names[impl]);
+            return (EIO);
+        }
+    }
+
+    free(str_ptrs);
+    free(strs);
+    free(prefixes);
+    free(parsed);
+    free(addrs);
+
+    return (0);
+}
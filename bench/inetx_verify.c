@@ -0,0 +1,721 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+/*
+ * inetx_verify checks the optimized address parsers and formatters against
+ * the libc functions and reports mismatches and relative throughput.
+ *
+ * Formatting compares inet_ntop, through inetx_ipv4_addr_to_str, with every
+ * supported batch kernel. By default on random and edge case addresses, with
+ * -x on all 2^32 addresses, split over -t threads.
+ *
+ * Parsing compares the kernels with a reference built on inet_pton: the
+ * address syntax of inet_pton, followed by an optional "/" and one to three
+ * decimal digits up to the maximum length. The corpus contains addresses of
+ * every prefix length, edge cases and random mutations of them. The legacy
+ * inet_net_pton parsers accept a wider syntax by design, their differences
+ * are reported but don't fail the check. inetx_predict_address_family has to
+ * predict the family of every address the reference accepts.
+ *
+ * A new kernel is added to parse_kernels or to the format passes. Exits with
+ * 1 if a kernel mismatched.
+ *
+ * Usage: inetx_verify [-n count] [-m mutations] [-s seed] [-t threads] [-x]
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "inetx.h"
+
+#define VERIFY_DEFAULT_COUNT     (1 << 20)
+#define VERIFY_DEFAULT_MUTATIONS 4
+#define VERIFY_DEFAULT_SEED      42
+#define VERIFY_DEFAULT_THREADS   1
+
+/* Addresses formatted per batch call. */
+#define VERIFY_CHUNK             4096
+
+/* Mismatches printed per kernel. */
+#define VERIFY_REPORT_MAX        5
+
+/* Longest corpus string, longer than any valid one. */
+#define VERIFY_STR_MAX           64
+
+static const char *impl_names[] = { "auto", "scalar", "sse4", "avx2" };
+
+/* Octets at the boundaries of their number of digits */
+static const uint8_t octet_edges[6] = { 0, 9, 10, 99, 100, 255 };
+
+/*
+ * parse_result is the outcome of parsing a string, the address in network
+ * byte order.
+ */
+struct parse_result {
+    int pr_err;
+    int pr_family;
+    uint8_t pr_addr[16];
+    size_t pr_length;
+};
+
+/*
+ * parse_kernel parses a corpus of n strings into results. Kernels of a
+ * single family expect rejects for addresses of the other family.
+ */
+struct parse_kernel {
+    const char *pk_name;
+    int pk_family;   /* AF_INET, AF_INET6 or 0 for both */
+    int pk_impl;     /* Batch implementation or -1 */
+    bool pk_legacy;  /* Differences are informational */
+    void (*pk_parse)(const struct parse_kernel *, char **, size_t,
+        struct parse_result *);
+};
+
+struct format_thread {
+    pthread_t ft_thread;
+    uint64_t ft_begin;
+    uint64_t ft_end;
+    const uint32_t *ft_addrs;  /* Addresses to check instead of a range */
+    uint64_t ft_mismatches;
+    double ft_ref_sec;
+    double ft_sec;
+};
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void
+report(const char *name, size_t count, double sec, double ref_sec,
+       uint64_t mismatches, const char *note)
+{
+    printf("%-24s %8.2f ns/op %7.2fx %10" PRIu64 " mismatches%s\n", name,
+        sec * 1e9 / count, sec > 0 ? ref_sec / sec : 0, mismatches, note);
+}
+
+/*
+ * ref_parse parses a string with inet_pton and a strict decimal length.
+ */
+static void
+ref_parse_one(const char *str, struct parse_result *result)
+{
+    char addr[VERIFY_STR_MAX];
+    const char *slash = strchr(str, '/'), *p = NULL;
+    size_t len = (slash != NULL) ? (size_t)(slash - str) : strlen(str);
+    size_t max_length = 0, value = 0, digits = 0;
+
+    memset(result, 0, sizeof(struct parse_result));
+    result->pr_err = EINVAL;
+
+    if (len >= sizeof(addr)) {
+        return;
+    }
+    memcpy(addr, str, len);
+    addr[len] = '\0';
+
+    if (inet_pton(AF_INET, addr, result->pr_addr) == 1) {
+        result->pr_family = AF_INET;
+        max_length = 32;
+    } else if (inet_pton(AF_INET6, addr, result->pr_addr) == 1) {
+        result->pr_family = AF_INET6;
+        max_length = 128;
+    } else {
+        memset(result, 0, sizeof(struct parse_result));
+        result->pr_err = EINVAL;
+        return;
+    }
+
+    value = max_length;
+    if (slash != NULL) {
+        for (p = slash + 1, value = 0; *p >= '0' && *p <= '9'; p++) {
+            value = value * 10 + (*p - '0');
+            digits++;
+        }
+
+        if (digits == 0 || digits > 3 || *p != '\0' || value > max_length) {
+            memset(result, 0, sizeof(struct parse_result));
+            result->pr_err = EINVAL;
+            return;
+        }
+    }
+
+    result->pr_length = value;
+    result->pr_err = 0;
+}
+
+static void
+ref_parse(const struct parse_kernel *kernel, char **strs, size_t n,
+          struct parse_result *results)
+{
+    size_t i = 0;
+
+    (void)kernel;
+    for (i = 0; i < n; i++) {
+        ref_parse_one(strs[i], &(results[i]));
+    }
+}
+
+static void
+batch_parse(const struct parse_kernel *kernel, char **strs, size_t n,
+            struct parse_result *results)
+{
+    uint32_t *addrs = calloc(n, sizeof(uint32_t));
+    uint8_t *prefixes = calloc(n, sizeof(uint8_t));
+    int *errs = calloc(n, sizeof(int));
+    uint32_t addr = 0;
+    size_t i = 0;
+
+    if (addrs == NULL || prefixes == NULL || errs == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(ENOMEM);
+    }
+
+    inetx_batch_select(kernel->pk_impl);
+    inetx_parse_ipv4_cidr_batch((const char *const *)strs, n, addrs, prefixes,
+        errs);
+
+    for (i = 0; i < n; i++) {
+        memset(&(results[i]), 0, sizeof(struct parse_result));
+        if ((results[i].pr_err = errs[i]) == 0) {
+            addr = htonl(addrs[i]);
+            results[i].pr_family = AF_INET;
+            memcpy(results[i].pr_addr, &addr, 4);
+            results[i].pr_length = prefixes[i];
+        }
+    }
+
+    free(errs);
+    free(prefixes);
+    free(addrs);
+}
+
+static void
+prefix_parse(const struct parse_kernel *kernel, char **strs, size_t n,
+             struct parse_result *results)
+{
+    struct inetx_prefix prefix;
+    size_t i = 0;
+
+    (void)kernel;
+    for (i = 0; i < n; i++) {
+        memset(&(results[i]), 0, sizeof(struct parse_result));
+        if ((results[i].pr_err = inetx_parse_prefix(strs[i], &prefix)) != 0) {
+            continue;
+        }
+
+        results[i].pr_family = prefix.ip_family;
+        results[i].pr_length = prefix.ip_length;
+        memcpy(results[i].pr_addr, &(prefix.ip_ipv6_addr),
+            prefix.ip_family == AF_INET ? 4 : 16);
+    }
+}
+
+static void
+legacy_parse(const struct parse_kernel *kernel, char **strs, size_t n,
+             struct parse_result *results)
+{
+    size_t i = 0;
+
+    for (i = 0; i < n; i++) {
+        memset(&(results[i]), 0, sizeof(struct parse_result));
+        results[i].pr_err = (kernel->pk_family == AF_INET) ?
+            inetx_parse_ipv4_cidr(strs[i], (struct in_addr *)
+                results[i].pr_addr, &(results[i].pr_length)) :
+            inetx_parse_ipv6_cidr(strs[i], (struct in6_addr *)
+                results[i].pr_addr, &(results[i].pr_length));
+
+        if (results[i].pr_err == 0) {
+            results[i].pr_family = kernel->pk_family;
+        } else {
+            memset(&(results[i]), 0, sizeof(struct parse_result));
+            results[i].pr_err = EINVAL;
+        }
+    }
+}
+
+static const struct parse_kernel parse_kernels[] = {
+    { "batch scalar", AF_INET, INETX_BATCH_IMPL_SCALAR, false, batch_parse },
+    { "batch sse4", AF_INET, INETX_BATCH_IMPL_SSE4, false, batch_parse },
+    { "batch avx2", AF_INET, INETX_BATCH_IMPL_AVX2, false, batch_parse },
+    { "inetx_parse_prefix", 0, -1, false, prefix_parse },
+    { "inetx_parse_ipv4_cidr", AF_INET, -1, true, legacy_parse },
+    { "inetx_parse_ipv6_cidr", AF_INET6, -1, true, legacy_parse },
+    { NULL, 0, -1, false, NULL }
+};
+
+/*
+ * parse_equal compares a kernel result with the reference. A kernel of a
+ * single family has to reject the addresses of the other one.
+ */
+static bool
+parse_equal(const struct parse_kernel *kernel,
+            const struct parse_result *ref, const struct parse_result *result)
+{
+    bool accept = ref->pr_err == 0 &&
+        (kernel->pk_family == 0 || kernel->pk_family == ref->pr_family);
+
+    if (!accept || result->pr_err != 0) {
+        return (!accept == (result->pr_err != 0));
+    }
+
+    return (result->pr_family == ref->pr_family &&
+        result->pr_length == ref->pr_length &&
+        memcmp(result->pr_addr, ref->pr_addr,
+        ref->pr_family == AF_INET ? 4 : 16) == 0);
+}
+
+static void
+print_result(const struct parse_result *result, char *str, size_t str_sz)
+{
+    char addr[INET6_ADDRSTRLEN];
+
+    if (result->pr_err != 0) {
+        snprintf(str, str_sz, "error %d", result->pr_err);
+        return;
+    }
+
+    inet_ntop(result->pr_family, result->pr_addr, addr, sizeof(addr));
+    snprintf(str, str_sz, "%s/%zu", addr, result->pr_length);
+}
+
+/*
+ * mutate applies random edits to a string: replaced, inserted and removed
+ * characters, a truncation or a duplicated part.
+ */
+static void
+mutate(char *str, unsigned int *seed)
+{
+    static const char alphabet[] = "0123456789abcdefABCDEFgxX.:/ -+%";
+    size_t len = strlen(str), pos = 0, edits = 1 + rand_r(seed) % 3;
+    char c = 0;
+
+    for (; edits > 0; edits--) {
+        pos = (len > 0) ? (size_t)rand_r(seed) % (len + 1) : 0;
+        c = alphabet[rand_r(seed) % (sizeof(alphabet) - 1)];
+
+        switch (rand_r(seed) % 5) {
+        case 0:
+            if (pos < len) {
+                str[pos] = c;
+            }
+            break;
+        case 1:
+            if (len + 1 < VERIFY_STR_MAX) {
+                memmove(str + pos + 1, str + pos, len - pos + 1);
+                str[pos] = c;
+                len++;
+            }
+            break;
+        case 2:
+            if (pos < len) {
+                memmove(str + pos, str + pos + 1, len - pos);
+                len--;
+            }
+            break;
+        case 3:
+            str[pos] = '\0';
+            len = pos;
+            break;
+        default:
+            if (pos < len && len + (len - pos) < VERIFY_STR_MAX) {
+                memcpy(str + len, str + pos, len - pos);
+                len += len - pos;
+                str[len] = '\0';
+            }
+            break;
+        }
+    }
+}
+
+/*
+ * random_addr formats a random address of a family in one of the accepted
+ * spellings, with groups of zeros to exercise "::".
+ */
+static void
+random_addr(int family, char *str, unsigned int *seed)
+{
+    uint8_t addr[16];
+    size_t i = 0, len = (family == AF_INET) ? 4 : 16;
+
+    for (i = 0; i < len; i++) {
+        switch (rand_r(seed) % 4) {
+        case 0: addr[i] = 0; break;
+        case 1: addr[i] = 0xff; break;
+        default: addr[i] = (uint8_t)rand_r(seed); break;
+        }
+    }
+
+    if (family == AF_INET6 && rand_r(seed) % 4 == 0) {
+        /* Uncompressed with leading zeros and upper case */
+        for (i = 0; i < 8; i++) {
+            sprintf(str + i * 5, "%04X%s", (addr[2 * i] << 8) |
+                addr[2 * i + 1], i < 7 ? ":" : "");
+        }
+        return;
+    }
+
+    if (family == AF_INET6 && rand_r(seed) % 4 == 0) {
+        /* Embedded IPv4 address */
+        memset(addr, 0, 10);
+        addr[10] = addr[11] = 0xff;
+    }
+
+    inet_ntop(family, addr, str, INET6_ADDRSTRLEN);
+}
+
+/*
+ * build_corpus generates valid addresses of every prefix length, edge cases
+ * and mutations of them.
+ */
+static char **
+build_corpus(size_t count, size_t mutations, unsigned int seed, size_t *np)
+{
+    static const char *edges[] = {
+        "0.0.0.0", "255.255.255.255", "0.0.0.0/0", "1.2.3.4/32", "1.2.3.4/33",
+        "1.2.3.4/", "1.2.3.4//8", "/8", "", "1.2.3", "1.2.3.4.5", "01.2.3.4",
+        "1.2.3.04", "256.1.1.1", "1.2.3.4/08", "1.2.3.4/008", "1.2.3.4/0008",
+        "1.2.3.4/-1", "1.2.3.4/+8", "1.2.3.4 /8", " 1.2.3.4", "1.2.3.4/8 ",
+        "0x1.2.3.4", "1..2.3", "::", "::/0", "::/128", "::/129", "::1",
+        "1::", ":", ":::", "1:::2", "1::2::3", "1:2:3:4:5:6:7:8",
+        "1:2:3:4:5:6:7:8:9", "1:2:3:4:5:6:7::", "::2:3:4:5:6:7:8",
+        "1:2:3:4:5:6:7::8", "12345::", "::ffff:1.2.3.4", "::1.2.3.4",
+        "1.2.3.4::", "::ffff:1.2.3", "::ffff:1.2.3.4.5", "::ffff:01.2.3.4",
+        "1:2:3:4:5:6:1.2.3.4", "1:2:3:4:5:6:7:1.2.3.4", "fe80::1%eth0",
+        "FE80::A", "g::", "1.2.3.4/32/", "2001:db8::/032", NULL
+    };
+    char **strs = NULL, str[VERIFY_STR_MAX];
+    size_t n = 0, cap = 0, i = 0, j = 0, base = 0;
+    int family = 0;
+
+    for (i = 0; edges[i] != NULL; i++) {
+        cap++;
+    }
+    cap = (cap + 2 * 129 + count) * (1 + mutations);
+
+    if ((strs = calloc(cap, sizeof(char *))) == NULL) {
+        return (NULL);
+    }
+
+#define CORPUS_ADD(s) do { \
+        if (n < cap && (strs[n] = strdup(s)) != NULL) { n++; } \
+    } while (0)
+
+    for (i = 0; edges[i] != NULL; i++) {
+        CORPUS_ADD(edges[i]);
+    }
+
+    /* Every prefix length of both families and one past the maximum */
+    for (i = 0; i <= 33; i++) {
+        random_addr(AF_INET, str, &seed);
+        snprintf(str + strlen(str), 8, "/%zu", i);
+        CORPUS_ADD(str);
+    }
+    for (i = 0; i <= 129; i++) {
+        random_addr(AF_INET6, str, &seed);
+        snprintf(str + strlen(str), 8, "/%zu", i);
+        CORPUS_ADD(str);
+    }
+
+    for (i = 0; i < count; i++) {
+        family = (rand_r(&seed) % 2 == 0) ? AF_INET : AF_INET6;
+        random_addr(family, str, &seed);
+        if (rand_r(&seed) % 4 != 0) {
+            snprintf(str + strlen(str), 8, "/%d", rand_r(&seed) %
+                (family == AF_INET ? 33 : 129));
+        }
+        CORPUS_ADD(str);
+    }
+
+    /* Mutations of everything above */
+    for (base = n, i = 0; i < base; i++) {
+        for (j = 0; j < mutations; j++) {
+            snprintf(str, sizeof(str), "%s", strs[i]);
+            mutate(str, &seed);
+            CORPUS_ADD(str);
+        }
+    }
+
+#undef CORPUS_ADD
+
+    *np = n;
+    return (strs);
+}
+
+/*
+ * verify_parse runs every parse kernel over the corpus. Returns the number
+ * of mismatches of the non-legacy kernels.
+ */
+static uint64_t
+verify_parse(char **strs, size_t n)
+{
+    const struct parse_kernel *kernel = NULL;
+    struct parse_result *ref = NULL, *results = NULL;
+    char expected[64], got[64];
+    uint64_t mismatches = 0, failed = 0;
+    size_t i = 0, printed = 0, valid = 0;
+    double start = 0, ref_sec = 0, sec = 0;
+    int family = 0;
+
+    ref = calloc(n, sizeof(struct parse_result));
+    results = calloc(n, sizeof(struct parse_result));
+    if (ref == NULL || results == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(ENOMEM);
+    }
+
+    start = now_sec();
+    ref_parse(NULL, strs, n, ref);
+    ref_sec = now_sec() - start;
+
+    for (i = 0; i < n; i++) {
+        valid += (ref[i].pr_err == 0);
+    }
+    printf("parse corpus %zu strings, %zu valid\n", n, valid);
+    report("reference inet_pton", n, ref_sec, ref_sec, 0, "");
+
+    for (kernel = parse_kernels; kernel->pk_name != NULL; kernel++) {
+        if (kernel->pk_impl >= 0 && inetx_batch_select(kernel->pk_impl) != 0) {
+            printf("%-24s unsupported\n", kernel->pk_name);
+            continue;
+        }
+
+        start = now_sec();
+        kernel->pk_parse(kernel, strs, n, results);
+        sec = now_sec() - start;
+
+        for (i = 0, mismatches = 0, printed = 0; i < n; i++) {
+            if (parse_equal(kernel, &(ref[i]), &(results[i]))) {
+                continue;
+            }
+
+            mismatches++;
+            if (!kernel->pk_legacy && printed++ < VERIFY_REPORT_MAX) {
+                print_result(&(ref[i]), expected, sizeof(expected));
+                print_result(&(results[i]), got, sizeof(got));
+                printf("  \"%s\": expected %s, got %s\n", strs[i], expected,
+                    got);
+            }
+        }
+
+        report(kernel->pk_name, n, sec, ref_sec, mismatches,
+            kernel->pk_legacy ? " (inet_net_pton syntax)" : "");
+        failed += kernel->pk_legacy ? 0 : mismatches;
+    }
+
+    /* The prediction has to be right for every valid address. */
+    start = now_sec();
+    for (i = 0, mismatches = 0, printed = 0; i < n; i++) {
+        if (inetx_predict_address_family(strs[i], &family) != 0) {
+            family = 0;
+        }
+
+        if (ref[i].pr_err == 0 && family != ref[i].pr_family) {
+            mismatches++;
+            if (printed++ < VERIFY_REPORT_MAX) {
+                printf("  \"%s\": expected family %d, got %d\n", strs[i],
+                    ref[i].pr_family, family);
+            }
+        }
+    }
+    report("predict_address_family", n, now_sec() - start, ref_sec,
+        mismatches, "");
+    failed += mismatches;
+
+    free(results);
+    free(ref);
+    return (failed);
+}
+
+/*
+ * format_thread checks the current batch kernel on a range of addresses or
+ * on a list. Formatting is measured against inet_ntop chunk by chunk.
+ */
+static void *
+format_thread(void *arg)
+{
+    struct format_thread *ft = arg;
+    uint32_t addrs[VERIFY_CHUNK];
+    static __thread char ref[VERIFY_CHUNK][INET_ADDRSTRLEN];
+    static __thread char strs[VERIFY_CHUNK][INET_ADDRSTRLEN];
+    struct in_addr addr;
+    uint64_t pos = ft->ft_begin;
+    size_t i = 0, n = 0;
+    double start = 0;
+
+    while (pos < ft->ft_end) {
+        for (n = 0; n < VERIFY_CHUNK && pos < ft->ft_end; n++) {
+            addrs[n] = (ft->ft_addrs != NULL) ? ft->ft_addrs[pos] :
+                (uint32_t)pos;
+            pos++;
+        }
+
+        start = now_sec();
+        for (i = 0; i < n; i++) {
+            addr.s_addr = htonl(addrs[i]);
+            inetx_ipv4_addr_to_str(&addr, ref[i], INET_ADDRSTRLEN);
+        }
+        ft->ft_ref_sec += now_sec() - start;
+
+        start = now_sec();
+        inetx_ipv4_addr_to_str_batch(addrs, n, strs[0], INET_ADDRSTRLEN);
+        ft->ft_sec += now_sec() - start;
+
+        for (i = 0; i < n; i++) {
+            if (strcmp(ref[i], strs[i]) != 0 && ft->ft_mismatches++ <
+                VERIFY_REPORT_MAX) {
+                printf("  %08" PRIx32 ": expected %s, got %s\n", addrs[i],
+                    ref[i], strs[i]);
+            }
+        }
+    }
+
+    return (NULL);
+}
+
+/*
+ * verify_format checks every batch kernel on addrs, or on all addresses if
+ * addrs is NULL. Returns the number of mismatches.
+ */
+static uint64_t
+verify_format(const uint32_t *addrs, size_t count, size_t nthreads)
+{
+    struct format_thread *threads = NULL;
+    uint64_t total = addrs != NULL ? count : (1ULL << 32), mismatches = 0;
+    uint64_t failed = 0;
+    double ref_sec = 0, sec = 0;
+    char name[64];
+    size_t i = 0;
+    int impl = 0;
+
+    if ((threads = calloc(nthreads, sizeof(struct format_thread))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(ENOMEM);
+    }
+
+    printf("format %" PRIu64 " addresses, %zu threads\n", total, nthreads);
+
+    for (impl = INETX_BATCH_IMPL_SCALAR; impl <= INETX_BATCH_IMPL_AVX2;
+         impl++) {
+        snprintf(name, sizeof(name), "batch %s", impl_names[impl]);
+        if (inetx_batch_select(impl) != 0) {
+            printf("%-24s unsupported\n", name);
+            continue;
+        }
+
+        /* The kernel selection is global, all threads check one kernel. */
+        for (i = 0; i < nthreads; i++) {
+            memset(&(threads[i]), 0, sizeof(struct format_thread));
+            threads[i].ft_begin = total * i / nthreads;
+            threads[i].ft_end = total * (i + 1) / nthreads;
+            threads[i].ft_addrs = addrs;
+            pthread_create(&(threads[i].ft_thread), NULL, format_thread,
+                &(threads[i]));
+        }
+
+        for (i = 0, ref_sec = 0, sec = 0, mismatches = 0; i < nthreads; i++) {
+            pthread_join(threads[i].ft_thread, NULL);
+            ref_sec += threads[i].ft_ref_sec;
+            sec += threads[i].ft_sec;
+            mismatches += threads[i].ft_mismatches;
+        }
+
+        if (impl == INETX_BATCH_IMPL_SCALAR) {
+            report("reference inet_ntop", total, ref_sec, ref_sec, 0, "");
+        }
+        report(name, total, sec, ref_sec, mismatches, "");
+        failed += mismatches;
+    }
+
+    free(threads);
+    return (failed);
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n count] [-m mutations] [-s seed] "
+        "[-t threads] [-x]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t count = VERIFY_DEFAULT_COUNT, mutations = VERIFY_DEFAULT_MUTATIONS;
+    size_t nthreads = VERIFY_DEFAULT_THREADS, n = 0, i = 0;
+    unsigned int seed = VERIFY_DEFAULT_SEED;
+    uint32_t *addrs = NULL;
+    uint64_t failed = 0;
+    char **strs = NULL;
+    bool exhaustive = false;
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "n:m:s:t:x")) != -1) {
+        switch (opt) {
+        case 'n': count = strtoul(optarg, NULL, 10); break;
+        case 'm': mutations = strtoul(optarg, NULL, 10); break;
+        case 's': seed = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 't': nthreads = strtoul(optarg, NULL, 10); break;
+        case 'x': exhaustive = true; break;
+        default:
+            usage(argv[0]);
+            return (EINVAL);
+        }
+    }
+
+    if (nthreads == 0) {
+        usage(argv[0]);
+        return (EINVAL);
+    }
+
+    if (!exhaustive) {
+        /* Every combination of octet boundaries, then random addresses */
+        if ((addrs = calloc(count + 1296, sizeof(uint32_t))) == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            return (ENOMEM);
+        }
+        for (i = 0; i < 1296; i++) {
+            addrs[n++] = ((uint32_t)octet_edges[i % 6] << 24) |
+                ((uint32_t)octet_edges[i / 6 % 6] << 16) |
+                ((uint32_t)octet_edges[i / 36 % 6] << 8) |
+                octet_edges[i / 216];
+        }
+        for (i = 0; i < count; i++) {
+            addrs[n++] = ((uint32_t)rand_r(&seed) << 16) ^
+                (uint32_t)rand_r(&seed);
+        }
+    }
+
+    failed += verify_format(addrs, n, nthreads);
+
+    if ((strs = build_corpus(count, mutations, seed, &n)) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return (ENOMEM);
+    }
+    failed += verify_parse(strs, n);
+
+    for (i = 0; i < n; i++) {
+        free(strs[i]);
+    }
+    free(strs);
+    free(addrs);
+
+    printf("%s, %" PRIu64 " mismatches\n", failed == 0 ? "ok" : "FAILED",
+        failed);
+    return (failed == 0 ? 0 : 1);
+}
@@ -0,0 +1,487 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+/*
+ * mgmt_verify checks the management interface client against a fake OpenVPN
+ * management server on a unix socket, so no OpenVPN 2.7 is needed.
+ *
+ * The server answers "status 3" with a scripted client list and
+ * "push-update-cid" with SUCCESS for known client ids, and it interleaves
+ * real-time notifications like OpenVPN does. mgmt_clients is checked with the
+ * column layouts of different OpenVPN versions and mgmt_push_update with
+ * accepted, rejected and invalid updates. Finally a plugin instance pushes
+ * the route changes of a sync to the fake server, which has to receive them
+ * for every connected client except the changed one.
+ *
+ * Exits with 1 if a check failed.
+ *
+ * Usage: mgmt_verify [-o dir]
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sqlite3.h>
+
+#include "mgmt.h"
+#include "plugin.h"
+#include "vector.h"
+
+#define VERIFY_DEFAULT_DIR "/tmp"
+
+/* Commands recorded by the fake server. */
+#define VERIFY_COMMANDS_MAX 16
+
+#define VERIFY_CREATE_DB \
+    "CREATE TABLE VPN_CLIENTS (ID INTEGER PRIMARY KEY AUTOINCREMENT, " \
+    "CN TEXT, IS_ACTIVE INTEGER NOT NULL DEFAULT(0), IPV4_ADDR TEXT NOT NULL, " \
+    "IPV4_REMOTE_ADDR NOT NULL, IPV6_ADDR TEXT, IPV6_REMOTE_ADDR TEXT); " \
+    "CREATE TABLE VPN_CLIENT_NETWORKS (ID INTEGER PRIMARY KEY AUTOINCREMENT, " \
+    "CLIENT_ID INTEGER NOT NULL, NETWORK_ADDR TEXT NOT NULL, " \
+    "FOREIGN KEY(CLIENT_ID) REFERENCES VPN_CLIENTS(ID)); " \
+    "INSERT INTO VPN_CLIENTS (CN, IS_ACTIVE, IPV4_ADDR, IPV4_REMOTE_ADDR) " \
+    "VALUES ('client1', 1, '100.64.0.1', '255.192.0.0'), " \
+    "('client2', 1, '100.64.0.2', '255.192.0.0'), " \
+    "('client3', 1, '100.64.0.3', '255.192.0.0'); " \
+    "INSERT INTO VPN_CLIENT_NETWORKS (CLIENT_ID, NETWORK_ADDR) " \
+    "VALUES (1, '10.0.1.0/24'), (2, '10.0.2.0/24'), (3, '10.0.3.0/24')"
+
+/* The client list of OpenVPN 2.6 and later */
+#define STATUS_CURRENT \
+    "TITLE\tOpenVPN 2.7.0 x86_64-pc-linux-gnu\r\n" \
+    "TIME\t2024-01-01 00:00:00\t1704067200\r\n" \
+    "HEADER\tCLIENT_LIST\tCommon Name\tReal Address\tVirtual Address\t" \
+    "Virtual IPv6 Address\tBytes Received\tBytes Sent\tConnected Since\t" \
+    "Connected Since (time_t)\tUsername\tClient ID\tPeer ID\t" \
+    "Data Channel Cipher\r\n" \
+    "CLIENT_LIST\tclient1\t192.0.2.1:1194\t100.64.0.1\t\t10\t20\t" \
+    "2024-01-01 00:00:00\t1704067200\tUNDEF\t1\t0\tAES-256-GCM\r\n" \
+    ">CLIENT:ESTABLISHED,2\r\n" \
+    "CLIENT_LIST\tclient2\t192.0.2.2:1194\t100.64.0.2\t\t10\t20\t" \
+    "2024-01-01 00:00:00\t1704067200\tUNDEF\t2\t1\tAES-256-GCM\r\n" \
+    "CLIENT_LIST\tclient3\t192.0.2.3:1194\t100.64.0.3\t\t10\t20\t" \
+    "2024-01-01 00:00:00\t1704067200\tUNDEF\t3\t2\tAES-256-GCM\r\n" \
+    "CLIENT_LIST\tUNDEF\t192.0.2.4:1194\t\t\t0\t0\t" \
+    "2024-01-01 00:00:00\t1704067200\tUNDEF\t\t3\tNone\r\n" \
+    "HEADER\tROUTING_TABLE\tVirtual Address\tCommon Name\tReal Address\t" \
+    "Last Ref\tLast Ref (time_t)\r\n" \
+    "ROUTING_TABLE\t100.64.0.1\tclient1\t192.0.2.1:1194\t" \
+    "2024-01-01 00:00:00\t1704067200\r\n" \
+    "GLOBAL_STATS\tMax bcast/mcast queue length\t0\r\n" \
+    "END\r\n"
+
+/* Columns in another order, the header decides */
+#define STATUS_REORDERED \
+    "HEADER\tCLIENT_LIST\tClient ID\tCommon Name\r\n" \
+    "CLIENT_LIST\t9\tclient9\r\n" \
+    "CLIENT_LIST\tx1\tclient10\r\n" \
+    "END\r\n"
+
+/* OpenVPN 2.3 has no client ids, no client can be addressed */
+#define STATUS_LEGACY \
+    "HEADER\tCLIENT_LIST\tCommon Name\tReal Address\tVirtual Address\t" \
+    "Bytes Received\tBytes Sent\tConnected Since\tConnected Since (time_t)" \
+    "\r\n" \
+    "CLIENT_LIST\tclient1\t192.0.2.1:1194\t100.64.0.1\t10\t20\t" \
+    "2024-01-01 00:00:00\t1704067200\r\n" \
+    "END\r\n"
+
+#define STATUS_UNSUPPORTED \
+    "ERROR: status command failed\r\n"
+
+/*
+ * fake_server is a management interface which serves one connection at a
+ * time, like OpenVPN.
+ */
+struct fake_server {
+    int fs_fd;
+    pthread_t fs_thread;
+    pthread_mutex_t fs_lock;
+    const char *fs_status;  /* Answer of "status 3" */
+    char *fs_commands[VERIFY_COMMANDS_MAX];
+    size_t fs_ncommands;
+};
+
+static uint64_t failed = 0;
+
+static void
+check(bool ok, const char *what)
+{
+    printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        failed++;
+    }
+}
+
+static void
+fake_record(struct fake_server *fs, const char *cmd)
+{
+    pthread_mutex_lock(&(fs->fs_lock));
+    if (fs->fs_ncommands < VERIFY_COMMANDS_MAX) {
+        fs->fs_commands[fs->fs_ncommands++] = strdup(cmd);
+    }
+    pthread_mutex_unlock(&(fs->fs_lock));
+}
+
+static void
+fake_reset(struct fake_server *fs, const char *status)
+{
+    size_t i = 0;
+
+    pthread_mutex_lock(&(fs->fs_lock));
+    for (i = 0; i < fs->fs_ncommands; i++) {
+        free(fs->fs_commands[i]);
+    }
+    fs->fs_ncommands = 0;
+    fs->fs_status = status;
+    pthread_mutex_unlock(&(fs->fs_lock));
+}
+
+/*
+ * fake_find returns the recorded push-update-cid command for cid or NULL.
+ */
+static const char *
+fake_find(struct fake_server *fs, unsigned long cid)
+{
+    char prefix[64];
+    size_t i = 0;
+
+    snprintf(prefix, sizeof(prefix), "push-update-cid %lu ", cid);
+    for (i = 0; i < fs->fs_ncommands; i++) {
+        if (strncmp(fs->fs_commands[i], prefix, strlen(prefix)) == 0) {
+            return (fs->fs_commands[i]);
+        }
+    }
+
+    return (NULL);
+}
+
+static void
+fake_serve(struct fake_server *fs, int fd)
+{
+    FILE *in = NULL, *out = NULL;
+    char *line = NULL, *end = NULL;
+    size_t line_sz = 0;
+    unsigned long cid = 0;
+    ssize_t len = 0;
+
+    if ((in = fdopen(fd, "r")) == NULL ||
+        (out = fdopen(dup(fd), "w")) == NULL) {
+        goto out_close;
+    }
+
+    fputs(">INFO:OpenVPN Management Interface Version 5 -- type 'help' for "
+        "more info\r\n", out);
+    fflush(out);
+
+    while ((len = getline(&line, &line_sz, in)) > 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        fake_record(fs, line);
+
+        if (strcmp(line, "quit") == 0) {
+            break;
+        } else if (strcmp(line, "status 3") == 0) {
+            pthread_mutex_lock(&(fs->fs_lock));
+            fputs(fs->fs_status, out);
+            pthread_mutex_unlock(&(fs->fs_lock));
+        } else if (strncmp(line, "push-update-cid ", 16) == 0) {
+            /* Client ids 1 to 3 are connected. */
+            cid = strtoul(line + 16, &end, 10);
+            fputs(">NOTIFY:info,push-update\r\n", out);
+            if (*end == ' ' && cid >= 1 && cid <= 3) {
+                fputs("SUCCESS: push-update command succeeded\r\n", out);
+            } else {
+                fputs("ERROR: push-update-cid command failed\r\n", out);
+            }
+        } else {
+            fputs("ERROR: unknown command, enter 'help' for more options\r\n",
+                out);
+        }
+        fflush(out);
+    }
+
+out_close:
+    free(line);
+    if (out != NULL) {
+        fclose(out);
+    }
+    if (in != NULL) {
+        fclose(in);
+    } else {
+        close(fd);
+    }
+}
+
+static void *
+fake_thread(void *arg)
+{
+    struct fake_server *fs = arg;
+    int fd = -1;
+
+    /* The listener is shut down to stop. */
+    while ((fd = accept(fs->fs_fd, NULL, NULL)) >= 0 || errno == EINTR) {
+        if (fd >= 0) {
+            fake_serve(fs, fd);
+        }
+    }
+
+    return (NULL);
+}
+
+static int
+fake_start(struct fake_server *fs, const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int err = 0;
+
+    memset(fs, 0, sizeof(*fs));
+    pthread_mutex_init(&(fs->fs_lock), NULL);
+    fs->fs_status = STATUS_CURRENT;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return (ENAMETOOLONG);
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if ((fs->fs_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return (errno);
+    }
+
+    if (bind(fs->fs_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fs->fs_fd, 4) != 0) {
+        err = errno;
+        close(fs->fs_fd);
+        return (err);
+    }
+
+    if ((err = pthread_create(&(fs->fs_thread), NULL, fake_thread, fs))
+        != 0) {
+        close(fs->fs_fd);
+    }
+
+    return (err);
+}
+
+static void
+fake_stop(struct fake_server *fs, const char *path)
+{
+    shutdown(fs->fs_fd, SHUT_RDWR);
+    pthread_join(fs->fs_thread, NULL);
+    close(fs->fs_fd);
+    unlink(path);
+    fake_reset(fs, NULL);
+    pthread_mutex_destroy(&(fs->fs_lock));
+}
+
+/*
+ * verify_clients lists the clients with the given status answer.
+ */
+static int
+verify_clients(struct fake_server *fs, const char *path, const char *status,
+    vector_t *clients)
+{
+    mgmt_t *mgmt = NULL;
+    int err = 0;
+
+    fake_reset(fs, status);
+    vector_truncate(clients, 0);
+
+    if ((err = mgmt_open(&mgmt, path)) == 0) {
+        err = mgmt_clients(mgmt, clients);
+        mgmt_close(mgmt);
+    }
+
+    return (err);
+}
+
+static bool
+client_equal(vector_t *clients, size_t idx, const char *cn,
+    unsigned long cid)
+{
+    struct mgmt_client *client = NULL;
+
+    if (idx >= vector_size(clients)) {
+        return (false);
+    }
+
+    client = (struct mgmt_client *)vector_begin(clients) + idx;
+    return (strcmp(client->mc_cn, cn) == 0 && client->mc_cid == cid);
+}
+
+static void
+verify_status(struct fake_server *fs, const char *path)
+{
+    vector_t *clients = NULL;
+    int err = 0;
+
+    if (vector_alloc(&clients, sizeof(struct mgmt_client)) != 0) {
+        check(false, "allocate client list");
+        return;
+    }
+
+    err = verify_clients(fs, path, STATUS_CURRENT, clients);
+    check(err == 0 && vector_size(clients) == 3 &&
+        client_equal(clients, 0, "client1", 1) &&
+        client_equal(clients, 1, "client2", 2) &&
+        client_equal(clients, 2, "client3", 3),
+        "status 3 of OpenVPN 2.6+");
+
+    err = verify_clients(fs, path, STATUS_REORDERED, clients);
+    check(err == 0 && vector_size(clients) == 1 &&
+        client_equal(clients, 0, "client9", 9),
+        "status 3 with reordered columns");
+
+    err = verify_clients(fs, path, STATUS_LEGACY, clients);
+    check(err == 0 && vector_empty(clients),
+        "status 3 without client ids");
+
+    err = verify_clients(fs, path, STATUS_UNSUPPORTED, clients);
+    check(err == EPROTO, "status 3 error");
+
+    vector_free(clients);
+}
+
+static void
+verify_push(struct fake_server *fs, const char *path)
+{
+    const char *cmd = NULL;
+    mgmt_t *mgmt = NULL;
+    int err = 0;
+
+    fake_reset(fs, STATUS_CURRENT);
+    if ((err = mgmt_open(&mgmt, path)) != 0) {
+        check(false, "connect management interface");
+        return;
+    }
+
+    err = mgmt_push_update(mgmt, 2, "route 10.0.0.0 255.0.0.0");
+    cmd = fake_find(fs, 2);
+    check(err == 0 && cmd != NULL &&
+        strcmp(cmd, "push-update-cid 2 \"route 10.0.0.0 255.0.0.0\"") == 0,
+        "push-update-cid accepted");
+
+    err = mgmt_push_update(mgmt, 42, "route 10.0.0.0 255.0.0.0");
+    check(err == EPROTO, "push-update-cid of an unknown client");
+
+    err = mgmt_push_update(mgmt, 2, "route \"10.0.0.0\"");
+    check(err == EINVAL && fake_find(fs, 2) == cmd,
+        "push-update-cid with quotes not sent");
+
+    err = mgmt_push_update(mgmt, 3, "route-ipv6 2001:db8::/32");
+    check(err == 0 && fake_find(fs, 3) != NULL,
+        "push-update-cid after an error");
+
+    mgmt_close(mgmt);
+}
+
+/*
+ * verify_plugin moves the network of client2 and syncs a plugin instance.
+ * client1 and client3 get the change pushed, client2 itself doesn't.
+ */
+static void
+verify_plugin(struct fake_server *fs, const char *path, const char *dir)
+{
+    plugin_ctx_t *ctx = NULL;
+    sqlite3 *db = NULL;
+    const char *cmd = NULL;
+    char db_path[PATH_MAX];
+    bool ok = true;
+    unsigned long cid = 0;
+    int err = 0;
+
+    snprintf(db_path, sizeof(db_path), "%s/mgmt_verify-%d.db", dir,
+        (int)getpid());
+    unlink(db_path);
+
+    if (sqlite3_open(db_path, &db) != SQLITE_OK ||
+        sqlite3_exec(db, VERIFY_CREATE_DB, NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Failed to create %s: %s\n", db_path,
+            sqlite3_errmsg(db));
+        check(false, "create database");
+        goto out_close;
+    }
+
+    if ((err = plugin_open(&ctx, db_path)) != 0 ||
+        (err = plugin_warmup_wait(ctx)) != 0 ||
+        (err = plugin_set_mgmt(ctx, path)) != 0) {
+        fprintf(stderr, "Failed to open plugin: %s\n", strerror(err));
+        check(false, "open plugin");
+        goto out_close;
+    }
+
+    fake_reset(fs, STATUS_CURRENT);
+    if (sqlite3_exec(db, "UPDATE VPN_CLIENT_NETWORKS SET NETWORK_ADDR = "
+        "'10.9.2.0/24' WHERE CLIENT_ID = 2", NULL, NULL, NULL) != SQLITE_OK ||
+        (err = plugin_sync(ctx)) != 0) {
+        check(false, "sync changed network");
+        goto out_close;
+    }
+
+    for (cid = 1; cid <= 3; cid += 2) {
+        cmd = fake_find(fs, cid);
+        ok = ok && cmd != NULL &&
+            strstr(cmd, "-route 10.0.2.0 255.255.255.0") != NULL &&
+            strstr(cmd, ",route 10.9.2.0 255.255.255.0") != NULL;
+    }
+    check(ok, "sync pushes the change to other clients");
+    check(fake_find(fs, 2) == NULL, "sync leaves the changed client alone");
+
+out_close:
+    plugin_close(ctx);
+    sqlite3_close(db);
+    unlink(db_path);
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-o dir]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct fake_server fs;
+    const char *dir = VERIFY_DEFAULT_DIR;
+    char path[PATH_MAX];
+    int opt = 0, err = 0;
+
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        switch (opt) {
+        case 'o': dir = optarg; break;
+        default:
+            usage(argv[0]);
+            return (EINVAL);
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/mgmt_verify-%d.sock", dir,
+        (int)getpid());
+    if ((err = fake_start(&fs, path)) != 0) {
+        fprintf(stderr, "Failed to start management server at %s: %s\n",
+            path, strerror(err));
+        return (2);
+    }
+
+    verify_status(&fs, path);
+    verify_push(&fs, path);
+    verify_plugin(&fs, path, dir);
+
+    fake_stop(&fs, path);
+
+    printf("%" PRIu64 " checks failed\n", failed);
+    return (failed > 0 ? 1 : 0);
+}
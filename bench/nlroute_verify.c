@@ -0,0 +1,512 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+/*
+ * nlroute_verify checks the route installation against the kernel. It enters
+ * a new network namespace of a new user namespace, so it runs without root
+ * and without touching the routes of the host, creates a tun device and
+ * reads the routes back with an rtnetlink dump after every step.
+ *
+ * The checks cover IPv4 and IPv6 routes, networks shared by several clients,
+ * the aggregation of adjacent and covered networks and nlroute_reconcile
+ * with leftover, missing and foreign routes.
+ *
+ * Exits with 1 if a check failed. -n skips the namespaces, e.g. if the
+ * harness already runs in "unshare -rn".
+ *
+ * Usage: nlroute_verify [-n]
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/if_tun.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "nlroute.h"
+#include "prefix.h"
+
+#define VERIFY_IFNAME "evpn0"
+
+/* Routes read back at most, more than the checks install. */
+#define VERIFY_ROUTES_MAX 64
+
+/* Length of a route in text form, an IPv6 address and the length. */
+#define VERIFY_ROUTE_LEN (INET6_ADDRSTRLEN + 4)
+
+/* Protocol of the foreign routes, which nlroute has to leave alone. */
+#define VERIFY_FOREIGN_PROTOCOL RTPROT_STATIC
+
+static uint64_t failed = 0;
+
+static void
+check(bool ok, const char *what)
+{
+    printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        failed++;
+    }
+}
+
+static int
+write_file(const char *path, const char *data)
+{
+    int fd = 0, err = 0;
+
+    if ((fd = open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+        return (errno);
+    }
+    if (write(fd, data, strlen(data)) < 0) {
+        err = errno;
+    }
+    close(fd);
+
+    return (err);
+}
+
+/*
+ * enter_namespaces maps the user to root of a new user namespace, which owns
+ * a new network namespace.
+ */
+static int
+enter_namespaces(void)
+{
+    char map[64];
+    uid_t uid = getuid();
+    gid_t gid = getgid();
+    int err = 0;
+
+    if (unshare(CLONE_NEWUSER | CLONE_NEWNET) != 0) {
+        return (errno);
+    }
+
+    snprintf(map, sizeof(map), "0 %u 1", (unsigned int)uid);
+    if ((err = write_file("/proc/self/uid_map", map)) != 0) {
+        return (err);
+    }
+
+    /* setgroups has to be denied before an unprivileged gid_map. */
+    write_file("/proc/self/setgroups", "deny");
+    snprintf(map, sizeof(map), "0 %u 1", (unsigned int)gid);
+    return (write_file("/proc/self/gid_map", map));
+}
+
+/*
+ * tun_create creates the tun device and sets it up. The device exists as long
+ * as the returned descriptor is open.
+ */
+static int
+tun_create(const char *ifname, int *fdp)
+{
+    struct ifreq ifr;
+    int sock = 0, err = 0;
+
+    if ((*fdp = open("/dev/net/tun", O_RDWR | O_CLOEXEC)) < 0) {
+        return (errno);
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (ioctl(*fdp, TUNSETIFF, &ifr) != 0) {
+        err = errno;
+        goto out_close;
+    }
+
+    if ((sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) {
+        err = errno;
+        goto out_close;
+    }
+    if (ioctl(sock, SIOCGIFFLAGS, &ifr) != 0 ||
+        (ifr.ifr_flags |= IFF_UP, ioctl(sock, SIOCSIFFLAGS, &ifr)) != 0) {
+        err = errno;
+    }
+    close(sock);
+
+    if (err == 0) {
+        return (0);
+    }
+
+out_close:
+    close(*fdp);
+    *fdp = -1;
+    return (err);
+}
+
+static int
+parse_route(const char *route, struct prefix *px)
+{
+    char addr[INET6_ADDRSTRLEN];
+    uint8_t buf[sizeof(struct in6_addr)];
+    const char *slash = strchr(route, '/');
+    int family = strchr(route, ':') != NULL ? AF_INET6 : AF_INET;
+
+    if (slash == NULL || (size_t)(slash - route) >= sizeof(addr)) {
+        return (EINVAL);
+    }
+    memcpy(addr, route, slash - route);
+    addr[slash - route] = '\0';
+
+    if (inet_pton(family, addr, buf) != 1) {
+        return (EINVAL);
+    }
+
+    return (prefix_set(px, family, buf, strtoul(slash + 1, NULL, 10)));
+}
+
+/*
+ * kernel_request sends a route message with the given protocol through the
+ * device and waits for the acknowledgement, like "ip route add" does for
+ * other programs.
+ */
+static int
+kernel_request(int type, unsigned char protocol, const char *route)
+{
+    struct {
+        struct nlmsghdr nh;
+        struct rtmsg rtm;
+        char attrs[64];
+    } req;
+    char ack[1024];
+    struct nlmsghdr *nh = (struct nlmsghdr *)ack;
+    struct rtattr *rta = NULL;
+    struct prefix px;
+    uint8_t dst[sizeof(struct in6_addr)];
+    uint32_t oif = if_nametoindex(VERIFY_IFNAME);
+    size_t dst_len = 0;
+    int fd = 0, err = 0;
+
+    if ((err = parse_route(route, &px)) != 0) {
+        return (err);
+    }
+    prefix_get_addr(&px, dst);
+    dst_len = (px.px_family == AF_INET) ? 4 : 16;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    req.nh.nlmsg_type = type;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK |
+        (type == RTM_NEWROUTE ? NLM_F_CREATE | NLM_F_EXCL : 0);
+    req.rtm.rtm_family = px.px_family;
+    req.rtm.rtm_dst_len = px.px_length;
+    req.rtm.rtm_table = RT_TABLE_MAIN;
+    req.rtm.rtm_protocol = protocol;
+    req.rtm.rtm_scope = RT_SCOPE_LINK;
+    req.rtm.rtm_type = RTN_UNICAST;
+
+    rta = (struct rtattr *)((char *)&req + NLMSG_ALIGN(req.nh.nlmsg_len));
+    rta->rta_type = RTA_DST;
+    rta->rta_len = RTA_LENGTH(dst_len);
+    memcpy(RTA_DATA(rta), dst, dst_len);
+    req.nh.nlmsg_len = NLMSG_ALIGN(req.nh.nlmsg_len) +
+        RTA_ALIGN(rta->rta_len);
+
+    rta = (struct rtattr *)((char *)&req + NLMSG_ALIGN(req.nh.nlmsg_len));
+    rta->rta_type = RTA_OIF;
+    rta->rta_len = RTA_LENGTH(sizeof(oif));
+    memcpy(RTA_DATA(rta), &oif, sizeof(oif));
+    req.nh.nlmsg_len = NLMSG_ALIGN(req.nh.nlmsg_len) +
+        RTA_ALIGN(rta->rta_len);
+
+    if ((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+         NETLINK_ROUTE)) < 0) {
+        return (errno);
+    }
+
+    if (send(fd, &req, req.nh.nlmsg_len, 0) < 0 ||
+        recv(fd, ack, sizeof(ack), 0) < 0) {
+        err = errno;
+    } else if (nh->nlmsg_type == NLMSG_ERROR) {
+        err = -((struct nlmsgerr *)NLMSG_DATA(nh))->error;
+    }
+    close(fd);
+
+    return (err);
+}
+
+static int
+route_cmp(const void *a, const void *b)
+{
+    return (strcmp(a, b));
+}
+
+/*
+ * kernel_routes dumps the routes of the given protocol through the device
+ * and writes them sorted and separated by spaces to buf, e.g.
+ * "10.0.0.0/24 2001:db8::/64".
+ */
+static int
+kernel_routes(unsigned char protocol, char *buf, size_t size)
+{
+    struct {
+        struct nlmsghdr nh;
+        struct rtmsg rtm;
+    } req;
+    static char rbuf[NLROUTE_BATCH_SIZE];
+    char routes[VERIFY_ROUTES_MAX][VERIFY_ROUTE_LEN];
+    char addr[INET6_ADDRSTRLEN];
+    struct nlmsghdr *nh = NULL;
+    struct rtmsg *rtm = NULL;
+    struct rtattr *rta = NULL;
+    uint8_t dst[sizeof(struct in6_addr)];
+    uint32_t oif = 0, ifindex = if_nametoindex(VERIFY_IFNAME);
+    size_t n = 0, i = 0, off = 0;
+    ssize_t len = 0;
+    int fd = 0, attrlen = 0, err = 0;
+    bool done = false;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    req.nh.nlmsg_type = RTM_GETROUTE;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.rtm.rtm_family = AF_UNSPEC;
+
+    if ((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+         NETLINK_ROUTE)) < 0) {
+        return (errno);
+    }
+
+    if (send(fd, &req, req.nh.nlmsg_len, 0) < 0) {
+        err = errno;
+        goto out_close;
+    }
+
+    while (!done) {
+        if ((len = recv(fd, rbuf, sizeof(rbuf), 0)) < 0) {
+            err = errno;
+            goto out_close;
+        }
+
+        for (nh = (struct nlmsghdr *)rbuf; NLMSG_OK(nh, (size_t)len);
+             nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type == NLMSG_DONE) {
+                done = true;
+                break;
+            } else if (nh->nlmsg_type == NLMSG_ERROR) {
+                err = -((struct nlmsgerr *)NLMSG_DATA(nh))->error;
+                goto out_close;
+            } else if (nh->nlmsg_type != RTM_NEWROUTE) {
+                continue;
+            }
+
+            rtm = NLMSG_DATA(nh);
+            if (rtm->rtm_protocol != protocol ||
+                rtm->rtm_table != RT_TABLE_MAIN) {
+                continue;
+            }
+
+            memset(dst, 0, sizeof(dst));
+            oif = 0;
+            attrlen = RTM_PAYLOAD(nh);
+            for (rta = RTM_RTA(rtm); RTA_OK(rta, attrlen);
+                 rta = RTA_NEXT(rta, attrlen)) {
+                if (rta->rta_type == RTA_DST &&
+                    RTA_PAYLOAD(rta) <= sizeof(dst)) {
+                    memcpy(dst, RTA_DATA(rta), RTA_PAYLOAD(rta));
+                } else if (rta->rta_type == RTA_OIF) {
+                    memcpy(&oif, RTA_DATA(rta), sizeof(oif));
+                }
+            }
+
+            if (oif != ifindex || n == VERIFY_ROUTES_MAX) {
+                continue;
+            }
+
+            inet_ntop(rtm->rtm_family, dst, addr, sizeof(addr));
+            snprintf(routes[n++], VERIFY_ROUTE_LEN, "%s/%u", addr,
+                (unsigned int)rtm->rtm_dst_len);
+        }
+    }
+
+    qsort(routes, n, VERIFY_ROUTE_LEN, route_cmp);
+
+    buf[0] = '\0';
+    for (i = 0; i < n; i++) {
+        off += snprintf(buf + off, off < size ? size - off : 0, "%s%s",
+            i > 0 ? " " : "", routes[i]);
+    }
+
+out_close:
+    close(fd);
+    return (err);
+}
+
+/*
+ * check_routes compares our routes in the kernel to the expected ones, given
+ * sorted as kernel_routes writes them.
+ */
+static void
+check_routes(unsigned char protocol, const char *want, const char *what)
+{
+    char have[VERIFY_ROUTES_MAX * VERIFY_ROUTE_LEN];
+    bool ok = false;
+    int err = 0;
+
+    if ((err = kernel_routes(protocol, have, sizeof(have))) != 0) {
+        printf("Failed to dump the routes: %s\n", strerror(err));
+    } else if (!(ok = strcmp(have, want) == 0)) {
+        printf("kernel has \"%s\", expected \"%s\"\n", have, want);
+    }
+
+    check(ok, what);
+}
+
+/*
+ * set_client parses the networks of a client, separated by spaces, and
+ * installs them.
+ */
+static int
+set_client(nlroute_t *nl, const char *cn, const char *networks)
+{
+    struct prefix pxs[VERIFY_ROUTES_MAX];
+    char copy[VERIFY_ROUTES_MAX * VERIFY_ROUTE_LEN];
+    char *token = NULL, *save = NULL;
+    size_t n = 0;
+    int err = 0;
+
+    snprintf(copy, sizeof(copy), "%s", networks);
+    for (token = strtok_r(copy, " ", &save); token != NULL &&
+         n < VERIFY_ROUTES_MAX; token = strtok_r(NULL, " ", &save)) {
+        if ((err = parse_route(token, &(pxs[n++]))) != 0) {
+            return (err);
+        }
+    }
+
+    return (nlroute_client_set(nl, cn, pxs, n));
+}
+
+static void
+verify_add(nlroute_t *nl)
+{
+    check(set_client(nl, "alice", "10.1.0.0/24 2001:db8:1::/64") == 0,
+        "add IPv4 and IPv6 networks");
+    check_routes(NLROUTE_PROTOCOL, "10.1.0.0/24 2001:db8:1::/64",
+        "routes are in the kernel");
+
+    check(set_client(nl, "alice", "10.1.1.0/24") == 0 &&
+        set_client(nl, "alice", "10.1.1.0/24") == 0, "change networks, twice");
+    check_routes(NLROUTE_PROTOCOL, "10.1.1.0/24",
+        "old routes are replaced");
+}
+
+static void
+verify_shared(nlroute_t *nl)
+{
+    struct nlroute_stats stats;
+
+    check(set_client(nl, "bob", "10.1.1.0/24 10.1.2.0/24") == 0,
+        "add a network of another client");
+    nlroute_get_stats(nl, &stats);
+    check(stats.ns_routes == 2 && stats.ns_clients == 2,
+        "shared network is one route");
+
+    check(nlroute_client_clear(nl, "alice") == 0, "clear the first client");
+    check_routes(NLROUTE_PROTOCOL, "10.1.1.0/24 10.1.2.0/24",
+        "shared route stays for the second client");
+
+    check(nlroute_client_clear(nl, "bob") == 0, "clear the second client");
+    check_routes(NLROUTE_PROTOCOL, "", "last client removes the route");
+    nlroute_get_stats(nl, &stats);
+    check(stats.ns_routes == 0 && stats.ns_clients == 0,
+        "no routes and clients are left");
+}
+
+static void
+verify_aggregation(nlroute_t *nl)
+{
+    check(set_client(nl, "carol", "10.2.0.0/25 10.2.0.128/25 10.2.0.64/26 "
+        "2001:db8:2::/64 2001:db8:2::/48") == 0,
+        "add adjacent and covered networks");
+    check_routes(NLROUTE_PROTOCOL, "10.2.0.0/24 2001:db8:2::/48",
+        "networks are aggregated");
+}
+
+static void
+verify_reconcile(nlroute_t *nl)
+{
+    bool ok = false;
+
+    /* A route of a crashed process, a lost route and one of another one. */
+    ok = kernel_request(RTM_NEWROUTE, NLROUTE_PROTOCOL, "10.3.0.0/24") == 0 &&
+        kernel_request(RTM_DELROUTE, NLROUTE_PROTOCOL, "10.2.0.0/24") == 0 &&
+        kernel_request(RTM_NEWROUTE, VERIFY_FOREIGN_PROTOCOL,
+        "10.4.0.0/24") == 0;
+    check(ok, "change the routes behind nlroute");
+    check_routes(NLROUTE_PROTOCOL, "10.3.0.0/24 2001:db8:2::/48",
+        "kernel differs before reconcile");
+
+    check(nlroute_reconcile(nl) == 0, "reconcile");
+    check_routes(NLROUTE_PROTOCOL, "10.2.0.0/24 2001:db8:2::/48",
+        "leftover removed and missing route installed");
+    check_routes(VERIFY_FOREIGN_PROTOCOL, "10.4.0.0/24",
+        "foreign route is kept");
+
+    check(nlroute_reconcile(nl) == 0, "reconcile again");
+    check_routes(NLROUTE_PROTOCOL, "10.2.0.0/24 2001:db8:2::/48",
+        "reconcile without changes keeps the routes");
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+    nlroute_t *nl = NULL;
+    bool enter = true;
+    int opt = 0, tun = -1, err = 0;
+
+    while ((opt = getopt(argc, argv, "n")) != -1) {
+        switch (opt) {
+        case 'n': enter = false; break;
+        default:
+            usage(argv[0]);
+            return (EINVAL);
+        }
+    }
+
+    if (enter && (err = enter_namespaces()) != 0) {
+        fprintf(stderr, "Failed to enter a new network namespace: %s\n",
+            strerror(err));
+        return (2);
+    }
+
+    if ((err = tun_create(VERIFY_IFNAME, &tun)) != 0) {
+        fprintf(stderr, "Failed to create %s: %s\n", VERIFY_IFNAME,
+            strerror(err));
+        return (2);
+    }
+
+    if ((err = nlroute_open(&nl, VERIFY_IFNAME)) != 0) {
+        fprintf(stderr, "Failed to open nlroute: %s\n", strerror(err));
+        close(tun);
+        return (2);
+    }
+
+    verify_add(nl);
+    verify_shared(nl);
+    verify_aggregation(nl);
+    verify_reconcile(nl);
+
+    nlroute_close(nl);
+    close(tun);
+
+    printf("%" PRIu64 " checks failed\n", failed);
+    return (failed > 0 ? 1 : 0);
+}
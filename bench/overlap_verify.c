@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+/*
+ * overlap_verify checks network_overlap_find on tables which a database may
+ * hold but a sane one rarely does: long runs of duplicate networks, maximal
+ * nesting of IPv4 and IPv6 networks and duplicates inside a containing
+ * network. Random tables with many duplicates are compared to a quadratic
+ * reference built on prefix_contains.
+ *
+ * Exits with 1 if a check failed.
+ *
+ * Usage: overlap_verify [-n tables] [-s seed]
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "inetx.h"
+#include "network_overlap.h"
+#include "prefix.h"
+#include "vector.h"
+
+#define VERIFY_DEFAULT_TABLES 200
+#define VERIFY_DEFAULT_SEED   42
+
+/* Networks of a random table and the networks they are picked from. */
+#define VERIFY_TABLE_SIZE     300
+#define VERIFY_POOL_SIZE      12
+
+/* Duplicates of a network, more than the nesting depth of IPv6. */
+#define VERIFY_DUPLICATES     200
+
+static const char *pool[VERIFY_POOL_SIZE] = {
+    "10.0.0.0/8", "10.0.0.0/16", "10.0.0.0/24", "10.0.1.0/24",
+    "10.1.0.0/16", "192.168.0.0/24", "0.0.0.0/0", "2001:db8::/32",
+    "2001:db8::/48", "2001:db8:1::/48", "::/0", "2001:db8::1/128"
+};
+
+static uint64_t failed = 0;
+
+static void
+check(bool ok, const char *what)
+{
+    printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        failed++;
+    }
+}
+
+static int
+add_network(vector_t *networks, int client_id, const char *addr)
+{
+    struct vpn_client_network network;
+
+    memset(&network, 0, sizeof(network));
+    network.id = (int)vector_size(networks) + 1;
+    network.client_id = client_id;
+    snprintf(network.network_addr, sizeof(network.network_addr), "%s", addr);
+
+    return (vector_push_back(networks, &network));
+}
+
+/*
+ * count_overlaps runs network_overlap_find and returns the number of pairs
+ * or -1 on an error.
+ */
+static long
+count_overlaps(vector_t *networks)
+{
+    vector_t *overlaps = NULL;
+    long count = -1;
+    int err = 0;
+
+    if (vector_alloc(&overlaps, sizeof(struct network_overlap)) != 0) {
+        return (-1);
+    }
+
+    if ((err = network_overlap_find(networks, overlaps, NULL)) == 0) {
+        count = (long)vector_size(overlaps);
+    } else {
+        printf("network_overlap_find failed: %s\n", strerror(err));
+    }
+
+    vector_free(overlaps);
+    return (count);
+}
+
+/*
+ * reference_overlaps counts the pairs of networks of different clients, of
+ * which one contains the other, by comparing every pair.
+ */
+static long
+reference_overlaps(vector_t *networks)
+{
+    struct vpn_client_network *a = NULL, *b = NULL;
+    struct inetx_prefix inetx;
+    struct prefix *pxs = NULL;
+    size_t n = vector_size(networks), i = 0, j = 0;
+    long count = 0;
+
+    if ((pxs = calloc(n + 1, sizeof(struct prefix))) == NULL) {
+        return (-1);
+    }
+
+    for (i = 0; i < n; i++) {
+        a = vector_at(networks, i);
+        if (inetx_parse_prefix(a->network_addr, &inetx) != 0 ||
+            prefix_from_inetx(&(pxs[i]), &inetx) != 0) {
+            free(pxs);
+            return (-1);
+        }
+        prefix_mask(&(pxs[i]));
+    }
+
+    for (i = 0; i < n; i++) {
+        for (j = i + 1; j < n; j++) {
+            a = vector_at(networks, i);
+            b = vector_at(networks, j);
+            count += a->client_id != b->client_id &&
+                (prefix_contains(&(pxs[i]), &(pxs[j])) ||
+                 prefix_contains(&(pxs[j]), &(pxs[i])));
+        }
+    }
+
+    free(pxs);
+    return (count);
+}
+
+static void
+verify_duplicates(void)
+{
+    vector_t *networks = NULL;
+    size_t i = 0;
+
+    if (vector_alloc(&networks, sizeof(struct vpn_client_network)) != 0) {
+        check(false, "allocate networks");
+        return;
+    }
+
+    /* Half of the duplicates of each client overlap the other half. */
+    for (i = 0; i < VERIFY_DUPLICATES; i++) {
+        add_network(networks, 1 + (int)(i % 2), "10.0.0.0/24");
+    }
+    check(count_overlaps(networks) ==
+        (VERIFY_DUPLICATES / 2) * (VERIFY_DUPLICATES / 2),
+        "duplicates of two clients");
+
+    /* Duplicates of one client only overlap the network of the other. */
+    vector_truncate(networks, 0);
+    for (i = 0; i < VERIFY_DUPLICATES; i++) {
+        add_network(networks, 1, "2001:db8::/32");
+    }
+    add_network(networks, 2, "2001:db8:1::/48");
+    add_network(networks, 2, "2001:db9::/48");
+    check(count_overlaps(networks) == VERIFY_DUPLICATES,
+        "duplicates of one client containing another");
+
+    /* Duplicates inside a network of another client. */
+    vector_truncate(networks, 0);
+    add_network(networks, 1, "10.0.0.0/8");
+    for (i = 0; i < VERIFY_DUPLICATES; i++) {
+        add_network(networks, 2, "10.1.0.0/16");
+        add_network(networks, 3, "10.1.2.0/24");
+    }
+    check(count_overlaps(networks) ==
+        2 * VERIFY_DUPLICATES + VERIFY_DUPLICATES * VERIFY_DUPLICATES,
+        "duplicates nested in other networks");
+
+    vector_free(networks);
+}
+
+static void
+verify_nesting(void)
+{
+    vector_t *networks = NULL;
+    char addr[INET6_ADDRSTRLEN_W_PREFIX];
+    size_t length = 0;
+
+    if (vector_alloc(&networks, sizeof(struct vpn_client_network)) != 0) {
+        check(false, "allocate networks");
+        return;
+    }
+
+    /* Every length from /0 to the host, each of another client, twice. */
+    for (length = 0; length <= 32; length++) {
+        snprintf(addr, sizeof(addr), "10.0.0.0/%zu", length);
+        add_network(networks, (int)length + 1, addr);
+        add_network(networks, (int)length + 1, addr);
+    }
+    for (length = 0; length <= 128; length++) {
+        snprintf(addr, sizeof(addr), "2001:db8::/%zu", length);
+        add_network(networks, (int)length + 1, addr);
+        add_network(networks, (int)length + 1, addr);
+    }
+
+    check(count_overlaps(networks) == 4 * (33 * 32 / 2 + 129 * 128 / 2),
+        "deepest nesting with duplicates");
+
+    vector_free(networks);
+}
+
+static void
+verify_random(size_t tables, unsigned int seed)
+{
+    vector_t *networks = NULL;
+    size_t t = 0, i = 0, mismatches = 0;
+    long have = 0, want = 0;
+
+    if (vector_alloc(&networks, sizeof(struct vpn_client_network)) != 0) {
+        check(false, "allocate networks");
+        return;
+    }
+
+    srand(seed);
+    for (t = 0; t < tables; t++) {
+        vector_truncate(networks, 0);
+        for (i = 0; i < VERIFY_TABLE_SIZE; i++) {
+            add_network(networks, 1 + rand() % 4,
+                pool[rand() % VERIFY_POOL_SIZE]);
+        }
+
+        have = count_overlaps(networks);
+        want = reference_overlaps(networks);
+        if (have != want || have < 0) {
+            if (mismatches++ == 0) {
+                printf("table %zu: %ld pairs, expected %ld\n", t, have, want);
+            }
+        }
+    }
+
+    check(mismatches == 0, "random tables match the reference");
+    vector_free(networks);
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n tables] [-s seed]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t tables = VERIFY_DEFAULT_TABLES;
+    unsigned int seed = VERIFY_DEFAULT_SEED;
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n': tables = strtoul(optarg, NULL, 10); break;
+        case 's': seed = (unsigned int)strtoul(optarg, NULL, 10); break;
+        default:
+            usage(argv[0]);
+            return (EINVAL);
+        }
+    }
+
+    verify_duplicates();
+    verify_nesting();
+    verify_random(tables, seed);
+
+    printf("%" PRIu64 " checks failed\n", failed);
+    return (failed > 0 ? 1 : 0);
+}
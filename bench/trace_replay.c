@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+/*
+ * trace_replay feeds the connects and disconnects of a trace, recorded with
+ * plugin_set_trace, through a plugin instance without OpenVPN. Every connect
+ * builds its config from the database like in production and writes it to a
+ * file, which should be on a tmpfs to keep the disk out of the measurement.
+ *
+ * By default the events keep their original spacing, -s scales it and -s 0
+ * replays as fast as possible. The events are taken in order by several
+ * threads, so events close in time run concurrently like in production. The
+ * latency is measured from the time an event is due, so queueing behind slow
+ * connects is included.
+ *
+ * The plugin records the replayed sessions, so replay against a copy of the
+ * production database.
+ *
+ * Usage: trace_replay [-t threads] [-s speed] [-o dir] [-W] <db> <trace>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "plugin.h"
+#include "trace.h"
+#include "vector.h"
+
+#define REPLAY_DEFAULT_THREADS 4
+#define REPLAY_DEFAULT_SPEED   1.0
+#define REPLAY_DEFAULT_DIR     "/dev/shm"
+
+struct replay_config {
+    size_t rc_threads;
+    double rc_speed;     /* 0 replays as fast as possible */
+    bool rc_no_wait;     /* Start before the warm-up finished */
+    const char *rc_dir;
+};
+
+struct replay_thread {
+    pthread_t rt_thread;
+    size_t rt_index;
+    const struct replay_config *rt_config;
+    plugin_ctx_t *rt_ctx;
+    vector_t *rt_events;        /* Shared, read-only */
+    atomic_size_t *rt_next;     /* Index of the next event to replay */
+    uint64_t rt_start_ns;
+    vector_t *rt_latencies;     /* Nanoseconds of successful connects */
+    vector_t *rt_lags;          /* Nanoseconds events started after due */
+    uint64_t rt_disconnects;
+    uint64_t rt_rejected;       /* Denied by the admission control */
+    uint64_t rt_failed;
+    int rt_error;
+};
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static uint64_t
+timespec_ns(const struct timespec *ts)
+{
+    return ((uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec);
+}
+
+static void
+ns_timespec(uint64_t ns, struct timespec *ts)
+{
+    ts->tv_sec = ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+}
+
+/*
+ * load_trace reads all events of a trace. A truncated last record, e.g. of a
+ * trace still being written, ends the trace with a warning.
+ */
+static int
+load_trace(const char *path, vector_t *events)
+{
+    struct trace_event event;
+    trace_reader_t *reader = NULL;
+    int err = 0;
+
+    if ((err = trace_reader_open(&reader, path)) != 0) {
+        return (err);
+    }
+
+    while ((err = trace_reader_next(reader, &event)) == 0) {
+        if ((err = vector_push_back(events, &event)) != 0) {
+            break;
+        }
+    }
+
+    if (err == EPROTO) {
+        fprintf(stderr, "Invalid record after %zu events, ignoring the rest\n",
+            vector_size(events));
+        err = ENOENT;
+    }
+
+    trace_reader_close(reader);
+    return (err == ENOENT ? 0 : err);
+}
+
+static void *
+replay_thread(void *arg)
+{
+    struct replay_thread *rt = arg;
+    const struct replay_config *config = rt->rt_config;
+    const struct trace_event *first = vector_at(rt->rt_events, 0);
+    const struct trace_event *event = NULL;
+    struct timespec due, started, done;
+    char path[PATH_MAX];
+    uint64_t due_ns = 0, offset = 0, ns = 0;
+    size_t i = 0;
+    int fd = -1, err = 0;
+
+    snprintf(path, sizeof(path), "%s/trace_replay-%d-%zu.ccd", config->rc_dir,
+        (int)getpid(), rt->rt_index);
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+        rt->rt_error = errno;
+        return (NULL);
+    }
+    unlink(path);
+
+    while ((i = atomic_fetch_add(rt->rt_next, 1)) <
+           vector_size(rt->rt_events)) {
+        event = vector_at(rt->rt_events, i);
+
+        if (config->rc_speed > 0) {
+            /* Events of concurrent threads may be recorded out of order. */
+            offset = (event->te_time > first->te_time) ?
+                event->te_time - first->te_time : 0;
+            due_ns = rt->rt_start_ns + (uint64_t)(offset / config->rc_speed);
+            ns_timespec(due_ns, &due);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due,
+                   NULL) == EINTR) {
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        if (config->rc_speed <= 0) {
+            due_ns = timespec_ns(&started);
+        }
+
+        ns = timespec_ns(&started) - due_ns;
+        if ((err = vector_push_back(rt->rt_lags, &ns)) != 0) {
+            rt->rt_error = err;
+            break;
+        }
+
+        if (event->te_type == TRACE_DISCONNECT) {
+            plugin_client_disconnect(rt->rt_ctx, event->te_cn,
+                event->te_bytes_received, event->te_bytes_sent);
+            rt->rt_disconnects++;
+            continue;
+        }
+
+        if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+            rt->rt_error = errno;
+            break;
+        }
+
+        err = plugin_client_connect(rt->rt_ctx, event->te_cn, fd);
+        clock_gettime(CLOCK_MONOTONIC, &done);
+
+        if (err == EAGAIN || err == EALREADY || err == EBUSY) {
+            rt->rt_rejected++;
+            continue;
+        } else if (err != 0) {
+            rt->rt_failed++;
+            continue;
+        }
+
+        ns = timespec_ns(&done) - due_ns;
+        if ((err = vector_push_back(rt->rt_latencies, &ns)) != 0) {
+            rt->rt_error = err;
+            break;
+        }
+    }
+
+    close(fd);
+    return (NULL);
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return ((x > y) - (x < y));
+}
+
+static double
+percentile_us(vector_t *sorted, double p)
+{
+    size_t n = vector_size(sorted);
+
+    if (n == 0) {
+        return (0);
+    }
+
+    return (*(uint64_t *)vector_at(sorted, (size_t)(p * (n - 1))) / 1e3);
+}
+
+/*
+ * merge appends the values of src to dst and frees src.
+ */
+static void
+merge(vector_t *dst, vector_t *src)
+{
+    uint64_t *value = NULL;
+
+    for (value = vector_begin(src); value != vector_end(src);
+         value = vector_next(src, value)) {
+        vector_push_back(dst, value);
+    }
+    vector_free(src);
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-t threads] [-s speed] [-o dir] [-W] "
+        "<db> <trace>\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct replay_config config = {
+        REPLAY_DEFAULT_THREADS, REPLAY_DEFAULT_SPEED, false, REPLAY_DEFAULT_DIR
+    };
+    struct replay_thread *threads = NULL;
+    struct plugin_warmup_stats warmup_stats;
+    struct timespec start_ts;
+    plugin_ctx_t *ctx = NULL;
+    vector_t *events = NULL, *latencies = NULL, *lags = NULL;
+    atomic_size_t next = 0;
+    uint64_t disconnects = 0, rejected = 0, failed = 0;
+    double start = 0, sec = 0;
+    size_t i = 0;
+    int opt = 0, err = 0;
+
+    while ((opt = getopt(argc, argv, "t:s:o:W")) != -1) {
+        switch (opt) {
+        case 't': config.rc_threads = strtoul(optarg, NULL, 10); break;
+        case 's': config.rc_speed = strtod(optarg, NULL); break;
+        case 'o': config.rc_dir = optarg; break;
+        case 'W': config.rc_no_wait = true; break;
+        default:
+            usage(argv[0]);
+            return (EINVAL);
+        }
+    }
+
+    if (argc - optind != 2 || config.rc_threads == 0 || config.rc_speed < 0) {
+        usage(argv[0]);
+        return (EINVAL);
+    }
+
+    if ((err = vector_alloc(&events, sizeof(struct trace_event))) != 0 ||
+        (err = vector_alloc(&latencies, sizeof(uint64_t))) != 0 ||
+        (err = vector_alloc(&lags, sizeof(uint64_t))) != 0) {
+        goto out_free;
+    }
+
+    start = now_sec();
+    if ((err = load_trace(argv[optind + 1], events)) != 0) {
+        fprintf(stderr, "Failed to read %s: %s\n", argv[optind + 1],
+            strerror(err));
+        goto out_free;
+    }
+    if (vector_empty(events)) {
+        fprintf(stderr, "No events in %s\n", argv[optind + 1]);
+        goto out_free;
+    }
+    printf("trace        %zu events, %.1f s recorded, read in %.2f s\n",
+        vector_size(events), (((struct trace_event *)vector_at(events,
+        vector_size(events) - 1))->te_time - ((struct trace_event *)
+        vector_at(events, 0))->te_time) / 1e9, now_sec() - start);
+
+    start = now_sec();
+    if ((err = plugin_open(&ctx, argv[optind])) != 0) {
+        fprintf(stderr, "Failed to open plugin: %s\n", strerror(err));
+        goto out_free;
+    }
+    if (!config.rc_no_wait && (err = plugin_warmup_wait(ctx)) != 0) {
+        fprintf(stderr, "Failed to warm up: %s\n", strerror(err));
+        goto out_close;
+    }
+    printf("open         %.2f s%s\n", now_sec() - start,
+        config.rc_no_wait ? " (warm-up in background)" : "");
+
+    if ((threads = calloc(config.rc_threads, sizeof(struct replay_thread)))
+        == NULL) {
+        err = ENOMEM;
+        goto out_close;
+    }
+
+    start = now_sec();
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+    for (i = 0; i < config.rc_threads; i++) {
+        threads[i].rt_index = i;
+        threads[i].rt_config = &config;
+        threads[i].rt_ctx = ctx;
+        threads[i].rt_events = events;
+        threads[i].rt_next = &next;
+        threads[i].rt_start_ns = timespec_ns(&start_ts);
+
+        if ((err = vector_alloc(&(threads[i].rt_latencies),
+             sizeof(uint64_t))) != 0 ||
+            (err = vector_alloc(&(threads[i].rt_lags),
+             sizeof(uint64_t))) != 0 ||
+            (err = pthread_create(&(threads[i].rt_thread), NULL,
+             replay_thread, &(threads[i]))) != 0) {
+            fprintf(stderr, "Failed to start thread: %s\n", strerror(err));
+            vector_free(threads[i].rt_latencies);
+            vector_free(threads[i].rt_lags);
+            config.rc_threads = i;
+            break;
+        }
+    }
+
+    for (i = 0; i < config.rc_threads; i++) {
+        pthread_join(threads[i].rt_thread, NULL);
+    }
+    sec = now_sec() - start;
+
+    for (i = 0; i < config.rc_threads; i++) {
+        if (threads[i].rt_error != 0 && err == 0) {
+            err = threads[i].rt_error;
+            fprintf(stderr, "Thread %zu failed: %s\n", i, strerror(err));
+        }
+
+        disconnects += threads[i].rt_disconnects;
+        rejected += threads[i].rt_rejected;
+        failed += threads[i].rt_failed;
+        merge(latencies, threads[i].rt_latencies);
+        merge(lags, threads[i].rt_lags);
+    }
+
+    vector_sort(latencies, compare_u64);
+    vector_sort(lags, compare_u64);
+    plugin_get_warmup_stats(ctx, &warmup_stats);
+
+    printf("replayed     %zu events in %.2f s, %.0f/s\n", vector_size(lags),
+        sec, vector_size(lags) / sec);
+    printf("connects     %zu\ndisconnects  %" PRIu64 "\n",
+        vector_size(latencies), disconnects);
+    printf("rejected     %" PRIu64 "\nfailed       %" PRIu64 "\n", rejected,
+        failed);
+    printf("direct       %" PRIu64 "\n", warmup_stats.ws_direct_connects);
+    printf("latency us   p50 %.1f p99 %.1f p999 %.1f max %.1f\n",
+        percentile_us(latencies, 0.5), percentile_us(latencies, 0.99),
+        percentile_us(latencies, 0.999), percentile_us(latencies, 1));
+    if (config.rc_speed > 0) {
+        printf("lag us       p50 %.1f p99 %.1f max %.1f\n",
+            percentile_us(lags, 0.5), percentile_us(lags, 0.99),
+            percentile_us(lags, 1));
+    }
+
+    free(threads);
+
+out_close:
+    plugin_close(ctx);
+out_free:
+    vector_free(lags);
+    vector_free(latencies);
+    vector_free(events);
+    return (err);
+}
@@ -0,0 +1,47 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_ACCT_H_
+#define EASYVPN_PLUGIN_ACCT_H_
+
+#include <stdint.h>
+
+#include "model.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Number of session events the queue holds, has to be a power of two. */
+#define ACCT_QUEUE_SIZE        16384
+
+/* Number of queued events which wake up the writer before the interval. */
+#define ACCT_BATCH_SIZE        256
+
+/* Milliseconds after which queued events are committed at the latest. */
+#define ACCT_FLUSH_INTERVAL_MS 1000
+
+typedef struct acct acct_t;
+
+/*
+ * acct_stats contains the counters of the accounting writer.
+ */
+struct acct_stats {
+    uint64_t as_queued;     /* Events accepted by acct_submit */
+    uint64_t as_dropped;    /* Events rejected, because the queue was full */
+    uint64_t as_committed;  /* Events stored in the database */
+    uint64_t as_failed;     /* Events lost by failed transactions */
+    uint64_t as_batches;    /* Committed transactions */
+};
+
+int acct_open(acct_t **, const char *);
+void acct_close(acct_t *);
+int acct_submit(acct_t *, const struct vpn_session *);
+void acct_get_stats(acct_t *, struct acct_stats *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_ACCT_H_ */
@@ -0,0 +1,53 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_ADDRPOOL_H_
+#define EASYVPN_PLUGIN_ADDRPOOL_H_
+
+#include <stddef.h>
+
+#include "dao.h"
+#include "model.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Smallest IPv4 pool prefix, a /8 holds 16M addresses. */
+#define ADDRPOOL_IPV4_MIN_PREFIX 8
+
+/* Upper limit of addresses handed out of an IPv6 pool. */
+#define ADDRPOOL_IPV6_MAX_SLOTS  (1UL << 24)
+
+/* Number of changed leases after which they should be flushed. */
+#define ADDRPOOL_FLUSH_BATCH     64
+
+typedef struct addrpool addrpool_t;
+
+/*
+ * addrpool_stats contains the usage of an address pool.
+ */
+struct addrpool_stats {
+    size_t aps_ipv4_size;    /* Assignable IPv4 addresses */
+    size_t aps_ipv4_used;
+    size_t aps_ipv6_size;    /* Assignable IPv6 addresses, 0 without pool */
+    size_t aps_ipv6_used;
+    size_t aps_leases;       /* Known leases, active and released */
+    size_t aps_dirty;        /* Leases not yet flushed */
+};
+
+int addrpool_alloc(addrpool_t **, const char *, const char *);
+void addrpool_free(addrpool_t *);
+int addrpool_load(addrpool_t *, dao_config_t *);
+int addrpool_acquire(addrpool_t *, struct vpn_client *);
+int addrpool_release(addrpool_t *, int);
+int addrpool_flush(addrpool_t *, dao_config_t *);
+size_t addrpool_dirty_count(addrpool_t *);
+void addrpool_get_stats(addrpool_t *, struct addrpool_stats *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_ADDRPOOL_H_ */
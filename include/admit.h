@@ -0,0 +1,49 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_ADMIT_H_
+#define EASYVPN_PLUGIN_ADMIT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Connects which may be processed at the same time. */
+#define ADMIT_MAX_IN_FLIGHT 256
+
+/* Share of the burst, which only warm connects may use. */
+#define ADMIT_WARM_RESERVE  0.25
+
+typedef struct admit admit_t;
+
+/*
+ * admit_stats contains the counters of the admission control.
+ */
+struct admit_stats {
+    uint64_t as_warm;           /* Admitted connects served from memory */
+    uint64_t as_cold;           /* Admitted connects served by the database */
+    uint64_t as_rate_rejects;   /* Rejected by the token bucket */
+    uint64_t as_dup_rejects;    /* Rejected, the CN was already in flight */
+    uint64_t as_full_rejects;   /* Rejected, too many connects in flight */
+    size_t as_in_flight;        /* Connects in progress */
+    size_t as_max_in_flight;    /* Highest number of connects in progress */
+    double as_tokens;           /* Tokens left in the bucket */
+};
+
+int admit_alloc(admit_t **, double, double);
+void admit_free(admit_t *);
+void admit_set_rate(admit_t *, double, double);
+int admit_enter(admit_t *, const char *, bool);
+void admit_leave(admit_t *, const char *);
+void admit_get_stats(admit_t *, struct admit_stats *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_ADMIT_H_ */
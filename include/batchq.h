@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_BATCHQ_H_
+#define EASYVPN_PLUGIN_BATCHQ_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+typedef struct batchq batchq_t;
+
+/*
+ * batchq_drain_fn is called on the writer thread whenever it wakes up. It
+ * takes the queued items with batchq_dequeue and writes them.
+ */
+typedef void (*batchq_drain_fn)(batchq_t *, void *);
+
+/*
+ * batchq_stats contains the counters of the producers.
+ */
+struct batchq_stats {
+    uint64_t bs_queued;   /* Items accepted by batchq_submit */
+    uint64_t bs_dropped;  /* Items rejected, because the queue was full */
+};
+
+int batchq_open(batchq_t **, size_t, size_t, size_t, unsigned int,
+    batchq_drain_fn, void *);
+void batchq_close(batchq_t *);
+int batchq_submit(batchq_t *, const void *);
+bool batchq_dequeue(batchq_t *, void *);
+void batchq_get_stats(batchq_t *, struct batchq_stats *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_BATCHQ_H_ */
@@ -0,0 +1,59 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_CCD_H_
+#define EASYVPN_PLUGIN_CCD_H_
+
+#include "dao.h"
+#include "model.h"
+#include "ovpn_client_config.h"
+#include "section.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Number of client ids a pre-generation thread takes at once. */
+#define CCD_PREGEN_CHUNK_SIZE 64
+
+typedef struct ccd_directory ccd_directory_t;
+
+/*
+ * ccd_pregen_stats reports the result of ccd_pregenerate.
+ */
+struct ccd_pregen_stats {
+    size_t ps_clients;    /* Active clients found in the database */
+    size_t ps_generated;  /* Configs written */
+    size_t ps_failed;     /* Configs failed */
+    size_t ps_threads;
+    double ps_seconds;    /* Wall clock time of the generation */
+};
+
+int ccd_directory_load(ccd_directory_t **, dao_config_t *);
+int ccd_directory_apply(ccd_directory_t *, dao_config_t *, vector_t *, 
+    vector_t *, ccd_directory_t **);
+size_t ccd_directory_image_size(ccd_directory_t *);
+void ccd_directory_image_write(ccd_directory_t *, void *);
+int ccd_directory_map(ccd_directory_t **, const void *, size_t);
+int ccd_directory_find_client(ccd_directory_t *, const char *, 
+    struct vpn_client *);
+vector_t *ccd_directory_clients(ccd_directory_t *);
+int ccd_directory_diff(ccd_directory_t *, ccd_directory_t *, int, 
+    vector_t *, vector_t *);
+int ccd_client_prefixes(ccd_directory_t *, dao_config_t *, int, vector_t *);
+void ccd_directory_get_section_stats(ccd_directory_t *, 
+    struct section_stats *);
+void ccd_directory_free(ccd_directory_t *);
+int ccd_build(ccd_directory_t *, const struct vpn_client *, int);
+int ccd_build_direct(dao_config_t *, const struct vpn_client *, int);
+int ccd_write_file(ccd_directory_t *, const struct vpn_client *, const char *);
+int ccd_sync_dir(const char *);
+int ccd_pregenerate(const char *, const char *, size_t, 
+    struct ccd_pregen_stats *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_CCD_H_ */
@@ -0,0 +1,33 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_CTLSOCK_H_
+#define EASYVPN_PLUGIN_CTLSOCK_H_
+
+#include <stdio.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Seconds an idle control connection is kept open. */
+#define CTLSOCK_IDLE_TIMEOUT 10
+
+typedef struct ctlsock ctlsock_t;
+
+/*
+ * ctlsock_handler_fn answers a single command line without the trailing 
+ * newline. The answer is written to the given stream. The control socket 
+ * terminates every answer with an empty line.
+ */
+typedef int (*ctlsock_handler_fn)(void *, char *, FILE *);
+
+int ctlsock_open(ctlsock_t **, const char *, ctlsock_handler_fn, void *);
+void ctlsock_close(ctlsock_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_CTLSOCK_H_ */
@@ -14,17 +14,41 @@
 extern "C" {
 #endif
 
+/* Milliseconds a statement waits for a lock held by another connection. */
+#define DAO_BUSY_TIMEOUT_MS 1000
+
 typedef struct dao_config dao_config_t;
 
 int dao_alloc(dao_config_t **, const char *);
 void dao_free(dao_config_t *);
+const char *dao_db_filename(dao_config_t *);
 int dao_db_open(dao_config_t *);
 int dao_db_close(dao_config_t *);
+int dao_replica_open(dao_config_t *);
 int dao_create_vpn_client(dao_config_t *, const char *, const char *, 
     const char *, const char *, const char *);
 int dao_vpn_client_find_by_cn(dao_config_t *, const char *, 
     struct vpn_client *);
+int dao_vpn_client_find_by_id(dao_config_t *, int, struct vpn_client *);
+int dao_vpn_client_find_active_ids(dao_config_t *, vector_t *);
+int dao_vpn_client_find_active_cns(dao_config_t *, vector_t *);
+int dao_vpn_client_find_active(dao_config_t *, vector_t *);
 int dao_vpn_client_network_find_by_client_id(dao_config_t *, int, vector_t *);
+int dao_vpn_client_network_find_all(dao_config_t *, vector_t *);
+int dao_vpn_client_lease_find_all(dao_config_t *, vector_t *);
+int dao_vpn_client_lease_save_all(dao_config_t *, vector_t *);
+int dao_vpn_session_save_all(dao_config_t *, vector_t *);
+
+int dao_change_feed_ensure(dao_config_t *);
+int dao_change_generation(dao_config_t *, long long *);
+int dao_change_find_since(dao_config_t *, long long, vector_t *);
+int dao_change_prune(dao_config_t *, long long);
+
+int dao_bulk_begin(dao_config_t *);
+int dao_bulk_add_client(dao_config_t *, const struct vpn_client *, int *);
+int dao_bulk_add_network(dao_config_t *, int, const char *);
+int dao_bulk_commit(dao_config_t *);
+void dao_bulk_rollback(dao_config_t *);
 
 #ifdef	__cplusplus
 }
@@ -0,0 +1,36 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_DBWATCH_H_
+#define EASYVPN_PLUGIN_DBWATCH_H_
+
+#include <stddef.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Quiet period after the last change before the handler runs. */
+#define DBWATCH_DEBOUNCE_MS 200
+
+/* Longest delay of the handler while changes keep arriving. */
+#define DBWATCH_MAX_DELAY_MS 2000
+
+typedef struct dbwatch dbwatch_t;
+
+/*
+ * dbwatch_handler_fn is called on the watcher thread after a burst of changes
+ * of the watched files has settled.
+ */
+typedef void (*dbwatch_handler_fn)(void *);
+
+int dbwatch_open(dbwatch_t **, const char *const *, size_t, 
+    dbwatch_handler_fn, void *);
+void dbwatch_close(dbwatch_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_DBWATCH_H_ */
@@ -0,0 +1,36 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_IMPORT_H_
+#define EASYVPN_PLUGIN_IMPORT_H_
+
+#include <stdio.h>
+
+#include "dao.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Number of invalid lines reported before the import stays quiet. */
+#define IMPORT_MAX_REPORTED_ERRORS 20
+
+/*
+ * import_stats reports the result of an import.
+ */
+struct import_stats {
+    size_t is_lines;     /* Read lines including comments */
+    size_t is_clients;   /* Inserted clients */
+    size_t is_networks;  /* Inserted networks */
+    size_t is_invalid;   /* Invalid lines */
+    double is_seconds;
+};
+
+int import_csv(dao_config_t *, FILE *, struct import_stats *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_IMPORT_H_ */
@@ -17,6 +17,25 @@ typedef enum {
     ADDRESS_FAMILY_IPV6 = AF_INET6
 } address_family_t;
 
+/*
+ * inetx_prefix is a parsed IPv4 or IPv6 address with a prefix length.
+ */
+struct inetx_prefix {
+    address_family_t ip_family;
+    union {
+        struct in_addr ip_ipv4_addr;
+        struct in6_addr ip_ipv6_addr;
+    };
+    size_t ip_length;  /* 32 or 128 if the string had no length */
+};
+
+typedef enum {
+    INETX_BATCH_IMPL_AUTO = 0,
+    INETX_BATCH_IMPL_SCALAR,
+    INETX_BATCH_IMPL_SSE4,
+    INETX_BATCH_IMPL_AVX2
+} inetx_batch_impl_t;
+
 int inetx_parse_ipv4_cidr(const char *, struct in_addr *, size_t *);
 int inetx_parse_ipv6_cidr(const char *, struct in6_addr *, size_t *);
 int inetx_str_to_ipv4_addr(const char *, struct in_addr *);
@@ -25,6 +44,13 @@ int inetx_ipv4_addr_to_str(const struct in_addr *, char *, size_t);
 int inetx_ipv6_addr_to_str(const struct in6_addr *, char *, size_t);
 int inetx_ipv4_prefix_to_netmask(size_t, struct in_addr *);
 int inetx_predict_address_family(const char *, int *);
+int inetx_parse_prefix(const char *, struct inetx_prefix *);
+int inetx_parse_addr(const char *, struct inetx_prefix *);
+
+int inetx_batch_select(inetx_batch_impl_t);
+int inetx_parse_ipv4_cidr_batch(const char *const *, size_t, uint32_t *, 
+    uint8_t *, int *);
+int inetx_ipv4_addr_to_str_batch(const uint32_t *, size_t, char *, size_t);
 
 #ifdef	__cplusplus
 }
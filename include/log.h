@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_LOG_H_
+#define EASYVPN_PLUGIN_LOG_H_
+
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN  1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+
+/* Statements above this level are removed by the compiler. */
+#ifndef LOG_LEVEL_COMPILED
+#define LOG_LEVEL_COMPILED LOG_LEVEL_DEBUG
+#endif
+
+/* Records per thread buffered for the writer thread, a power of two. */
+#define LOG_RING_SIZE 256
+
+/* Longest message of a record, longer messages are truncated. */
+#define LOG_MESSAGE_MAX 192
+
+/* Runtime level, change it with log_set_level. */
+extern int log_level;
+
+/*
+ * log_at logs a printf style message. A disabled level costs a single branch
+ * and the arguments aren't evaluated.
+ */
+#define log_at(level, ...) do {                                            \
+    if ((level) <= LOG_LEVEL_COMPILED &&                                   \
+        (level) <= __atomic_load_n(&log_level, __ATOMIC_RELAXED)) {       \
+        log_write((level), __FILE__, __LINE__, __VA_ARGS__);               \
+    }                                                                      \
+} while (0)
+
+#define log_error(...) log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warn(...)  log_at(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_info(...)  log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/*
+ * log_stats counts the records since the process started.
+ */
+struct log_stats {
+    uint64_t ls_records;  /* Records queued for the writer thread */
+    uint64_t ls_dropped;  /* Records dropped, the ring was full */
+    uint64_t ls_written;  /* Records written by the writer thread */
+    size_t ls_rings;      /* Rings of threads, which logged */
+};
+
+int log_start(const char *);
+void log_stop(void);
+void log_set_level(int);
+int log_parse_level(const char *, int *);
+const char *log_level_name(int);
+void log_write(int, const char *, int, const char *, ...)
+    __attribute__((format(printf, 4, 5)));
+void log_get_stats(struct log_stats *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_LOG_H_ */
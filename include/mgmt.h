@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_MGMT_H_
+#define EASYVPN_PLUGIN_MGMT_H_
+
+#include "model.h"
+#include "vector.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Seconds to wait for the management interface before giving up. */
+#define MGMT_TIMEOUT 5
+
+typedef struct mgmt mgmt_t;
+
+/*
+ * mgmt_client is a client listed by the management interface. The client id
+ * is assigned by OpenVPN and addresses the client in commands.
+ */
+struct mgmt_client {
+    char mc_cn[RFC5280_CN_MAX_LENGTH];
+    unsigned long mc_cid;
+};
+
+int mgmt_open(mgmt_t **, const char *);
+void mgmt_close(mgmt_t *);
+int mgmt_clients(mgmt_t *, vector_t *);
+int mgmt_push_update(mgmt_t *, unsigned long, const char *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_MGMT_H_ */
@@ -33,6 +33,39 @@ struct vpn_client_network {
     char network_addr[INET6_ADDRSTRLEN_W_PREFIX];
 };
 
+struct vpn_client_lease {
+    int client_id;
+    int is_active; /* Boolean: 0 || 1 */
+    char ipv4_addr[INET_ADDRSTRLEN];
+    char ipv6_addr[INET6_ADDRSTRLEN];
+};
+
+struct vpn_session {
+    int is_end; /* Boolean: 0 || 1, end event of a session */
+    char cn[RFC5280_CN_MAX_LENGTH];
+    char ipv4_addr[INET_ADDRSTRLEN];
+    char ipv6_addr[INET6_ADDRSTRLEN_W_PREFIX];
+    long long started_at; /* Unix time, 0 if unknown */
+    long long ended_at;
+    unsigned long long bytes_received;
+    unsigned long long bytes_sent;
+};
+
+enum vpn_change_op {
+    VPN_CHANGE_INSERT = 0,
+    VPN_CHANGE_UPDATE,
+    VPN_CHANGE_DELETE,
+    VPN_CHANGE_RELOAD  /* Bulk load, everything may have changed */
+};
+
+struct vpn_change {
+    long long generation;
+    int is_network; /* Boolean: 0 || 1, change of VPN_CLIENT_NETWORKS */
+    enum vpn_change_op operation;
+    int row_id;
+    int client_id;
+};
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,51 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_NEGCACHE_H_
+#define EASYVPN_PLUGIN_NEGCACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dao.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Default lifetime of a recorded miss in seconds. */
+#define NEGCACHE_DEFAULT_MISS_TTL 30
+
+/* Number of slots of the recent miss set, has to be a power of two. */
+#define NEGCACHE_MISS_SLOTS 4096
+
+typedef struct negcache negcache_t;
+
+/*
+ * negcache_stats contains the counters of a negative cache.
+ */
+struct negcache_stats {
+    uint64_t ns_filter_rejects;  /* Rejected by the active CN filter */
+    uint64_t ns_miss_rejects;    /* Rejected by the recent miss set */
+    uint64_t ns_passes;          /* Passed to the client lookup */
+    uint64_t ns_misses;          /* Recorded misses */
+    uint64_t ns_builds;          /* Filter (re)builds */
+    size_t ns_filter_cns;        /* Active CNs in the filter */
+};
+
+int negcache_alloc(negcache_t **, unsigned int);
+void negcache_free(negcache_t *);
+int negcache_build(negcache_t *, dao_config_t *);
+void negcache_invalidate(negcache_t *);
+bool negcache_reject(negcache_t *, const char *);
+void negcache_add_miss(negcache_t *, const char *);
+void negcache_add_active(negcache_t *, const char *);
+void negcache_clear_misses(negcache_t *);
+void negcache_get_stats(negcache_t *, struct negcache_stats *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_NEGCACHE_H_ */
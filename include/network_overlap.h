@@ -0,0 +1,35 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_NETWORK_OVERLAP_H_
+#define EASYVPN_PLUGIN_NETWORK_OVERLAP_H_
+
+#include <stdio.h>
+
+#include "dao.h"
+#include "model.h"
+#include "vector.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * network_overlap is a pair of networks of two different clients, where the
+ * network a contains the network b.
+ */
+struct network_overlap {
+    struct vpn_client_network no_a;
+    struct vpn_client_network no_b;
+};
+
+int network_overlap_find(vector_t *, vector_t *, size_t *);
+int network_overlap_check_db(dao_config_t *, vector_t *, size_t *);
+void network_overlap_print(FILE *, vector_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_NETWORK_OVERLAP_H_ */
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_NLROUTE_H_
+#define EASYVPN_PLUGIN_NLROUTE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "prefix.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Routing protocol of the installed routes, unassigned in rtnetlink.h. It
+ * tells our routes apart from all others, e.g. "ip route show proto 99".
+ */
+#define NLROUTE_PROTOCOL 99
+
+/* Size of a netlink batch, about a thousand routes. */
+#define NLROUTE_BATCH_SIZE 65536
+
+/* Requested receive buffer, the kernel limits it to net.core.rmem_max. */
+#define NLROUTE_RCVBUF_SIZE (1 << 20)
+
+/* Seconds to wait for the kernel before giving up. */
+#define NLROUTE_TIMEOUT 5
+
+typedef struct nlroute nlroute_t;
+
+/*
+ * nlroute_stats counts the kernel route changes.
+ */
+struct nlroute_stats {
+    uint64_t ns_added;
+    uint64_t ns_removed;
+    uint64_t ns_failed;   /* Routes the kernel refused */
+    uint64_t ns_batches;  /* Netlink messages sent, one per batch */
+    size_t ns_routes;     /* Installed routes */
+    size_t ns_clients;    /* Clients with routes */
+};
+
+int nlroute_open(nlroute_t **, const char *);
+void nlroute_close(nlroute_t *);
+int nlroute_client_set(nlroute_t *, const char *, const struct prefix *,
+    size_t);
+int nlroute_client_clear(nlroute_t *, const char *);
+int nlroute_reconcile(nlroute_t *);
+void nlroute_get_stats(nlroute_t *, struct nlroute_stats *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_NLROUTE_H_ */
@@ -7,6 +7,8 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
 #include <netinet/in.h>
 
 #include "inetx.h"
@@ -16,17 +18,79 @@
 extern "C" {
 #endif
 
+/* Size of the chunks emitted by the streaming config builders. */
+#define OVPN_CLIENT_CONFIG_CHUNK_SIZE 4096
+
 typedef struct ovpn_client_config ovpn_client_config_t;
 
+struct ovpn_client_network {
+    address_family_t vpncn_family;
+    union {
+        struct in_addr vpncn_ipv4_addr;
+        struct in6_addr vpncn_ipv6_addr;
+    };
+    size_t vpncn_prefix;
+};
+
+struct ovpn_client_route {
+    address_family_t vpncr_family;
+    union {
+        struct {
+            struct in_addr vpncr_ipv4_addr;
+            struct in_addr vpncr_ipv4_gateway_addr;
+        };
+        struct {
+            struct in6_addr vpncr_ipv6_addr;
+            struct in6_addr vpncr_ipv6_gateway_addr;
+        };
+    };
+    size_t vpncr_prefix;
+    short vpncr_metric;
+};
+
+/*
+ * ovpn_client_config_write_fn writes a chunk of the config. It returns the 
+ * number of bytes written or -1 and sets errno. Writing nothing fails the 
+ * build with EIO.
+ */
+typedef ssize_t (*ovpn_client_config_write_fn)(void *, const char *, size_t);
+
+/*
+ * ovpn_client_route_iter_fn stores the next route in the given entry. It 
+ * returns 0 on success, ENOENT after the last route or any other error.
+ */
+typedef int (*ovpn_client_route_iter_fn)(void *, struct ovpn_client_route *);
+
+/*
+ * ovpn_client_config_canon reports the entries touched by 
+ * ovpn_client_config_canonicalize.
+ */
+struct ovpn_client_config_canon {
+    size_t canon_networks_masked;     /* Networks with host bits cleared */
+    size_t canon_networks_duplicates; /* Removed exact duplicates */
+    size_t canon_networks_covered;    /* Removed, covered by a broader one */
+    size_t canon_routes_masked;
+    size_t canon_routes_duplicates;
+    size_t canon_routes_covered;
+};
+
 int ovpn_client_config_alloc(ovpn_client_config_t **, const char *, const char *);
 void ovpn_client_config_free(ovpn_client_config_t *);
 int ovpn_client_config_build(ovpn_client_config_t *, FILE *);
+int ovpn_client_config_build_stream(ovpn_client_config_t *, 
+    ovpn_client_config_write_fn, void *, ovpn_client_route_iter_fn, void *);
+int ovpn_client_config_build_fd(ovpn_client_config_t *, int, 
+    ovpn_client_route_iter_fn, void *);
 int ovpn_client_config_set_ipv6_addr(ovpn_client_config_t *, const char *, 
     const char *);
 
 int ovpn_client_config_add_ipv4_network(ovpn_client_config_t *, const char *);
 int ovpn_client_config_add_ipv6_network(ovpn_client_config_t *, const char *);
 int ovpn_client_config_add_network(ovpn_client_config_t *, const char *);
+int ovpn_client_config_add_network_entry(ovpn_client_config_t *, 
+    const struct ovpn_client_network *);
+int ovpn_client_network_parse(struct ovpn_client_network *, const char *);
+int ovpn_client_route_print(FILE *, const struct ovpn_client_route *);
 
 int ovpn_client_config_add_ipv4_route(ovpn_client_config_t *, const char *, 
     const char *, short);
@@ -35,6 +99,9 @@ int ovpn_client_config_add_ipv6_route(ovpn_client_config_t *, const char *,
 int ovpn_client_config_add_route(ovpn_client_config_t *, const char *, 
     const char *, short);
 
+int ovpn_client_config_canonicalize(ovpn_client_config_t *, 
+    struct ovpn_client_config_canon *);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,61 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_PLUGIN_H_
+#define EASYVPN_PLUGIN_PLUGIN_H_
+
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+typedef struct plugin_ctx plugin_ctx_t;
+
+/*
+ * plugin_warmup_state is the progress of the background load started by 
+ * plugin_open. Until the state is PLUGIN_WARMUP_READY, connects are served by
+ * direct database queries.
+ */
+enum plugin_warmup_state {
+    PLUGIN_WARMUP_PENDING = 0,
+    PLUGIN_WARMUP_OVERLAPS,   /* Checking the client networks */
+    PLUGIN_WARMUP_DIRECTORY,  /* Loading the client directory */
+    PLUGIN_WARMUP_NEGCACHE,   /* Building the negative cache */
+    PLUGIN_WARMUP_READY,
+    PLUGIN_WARMUP_FAILED
+};
+
+struct plugin_warmup_stats {
+    enum plugin_warmup_state ws_state;
+    int ws_error;                 /* Error of a failed warm-up */
+    double ws_seconds;            /* Duration once ready or failed */
+    uint64_t ws_direct_connects;  /* Connects served without the caches */
+};
+
+int plugin_open(plugin_ctx_t **, const char *);
+void plugin_close(plugin_ctx_t *);
+int plugin_reload(plugin_ctx_t *);
+int plugin_warmup_wait(plugin_ctx_t *);
+void plugin_get_warmup_stats(plugin_ctx_t *, struct plugin_warmup_stats *);
+int plugin_sync(plugin_ctx_t *);
+int plugin_watch_start(plugin_ctx_t *);
+int plugin_attach_shm(plugin_ctx_t *, const char *);
+int plugin_set_admission(plugin_ctx_t *, double, double);
+int plugin_set_mgmt(plugin_ctx_t *, const char *);
+int plugin_set_pool(plugin_ctx_t *, const char *, const char *);
+int plugin_set_replica(plugin_ctx_t *);
+int plugin_set_routes(plugin_ctx_t *, const char *);
+int plugin_set_trace(plugin_ctx_t *, const char *);
+int plugin_client_connect(plugin_ctx_t *, const char *, int);
+int plugin_client_disconnect(plugin_ctx_t *, const char *, uint64_t, uint64_t);
+int plugin_learn_address(plugin_ctx_t *, const char *, const char *, 
+    const char *);
+int plugin_control_open(plugin_ctx_t *, const char *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_PLUGIN_H_ */
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_PREFIX_H_
+#define EASYVPN_PLUGIN_PREFIX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "inetx.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* An address as 128 bit integer, most significant bit first. */
+typedef unsigned __int128 prefix_addr_t;
+
+/*
+ * prefix is an IPv4 or IPv6 prefix in host byte order. IPv4 addresses are
+ * stored left aligned in the upper 32 bits, so a prefix length means the same
+ * mask for both families and all operations are shared.
+ */
+struct prefix {
+    prefix_addr_t px_addr;
+    uint8_t px_family;  /* AF_INET or AF_INET6 */
+    uint8_t px_length;  /* 0-32 for IPv4, 0-128 for IPv6 */
+};
+
+int prefix_set(struct prefix *, int, const void *, size_t);
+void prefix_set_ipv4(struct prefix *, uint32_t, size_t);
+void prefix_get_addr(const struct prefix *, void *);
+int prefix_from_inetx(struct prefix *, const struct inetx_prefix *);
+void prefix_to_inetx(const struct prefix *, struct inetx_prefix *);
+
+prefix_addr_t prefix_netmask(size_t);
+void prefix_get_netmask(const struct prefix *, void *);
+prefix_addr_t prefix_last(const struct prefix *);
+bool prefix_mask(struct prefix *);
+bool prefix_contains(const struct prefix *, const struct prefix *);
+bool prefix_adjacent(const struct prefix *, const struct prefix *);
+bool prefix_merge(const struct prefix *, const struct prefix *,
+    struct prefix *);
+int prefix_next(struct prefix *);
+int prefix_prev(struct prefix *);
+
+int prefix_cmp(const void *, const void *);
+void prefix_sort(struct prefix *, size_t);
+size_t prefix_aggregate(struct prefix *, size_t);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_PREFIX_H_ */
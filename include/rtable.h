@@ -0,0 +1,56 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_RTABLE_H_
+#define EASYVPN_PLUGIN_RTABLE_H_
+
+#include <stddef.h>
+#include <time.h>
+
+#include "model.h"
+#include "vector.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Number of independently locked shards of the host address map. */
+#define RTABLE_HOST_SHARDS 64
+
+typedef struct rtable rtable_t;
+
+/*
+ * rtable_client describes a connected client.
+ */
+struct rtable_client {
+    char rc_cn[RFC5280_CN_MAX_LENGTH];
+    time_t rc_since;   /* Time of connect */
+    size_t rc_routes;  /* Learned addresses and iroute prefixes */
+    int rc_client_id;  /* Database id of the connect, 0 if unknown */
+};
+
+/*
+ * rtable_stats contains the size of a routing table.
+ */
+struct rtable_stats {
+    size_t rs_clients;
+    size_t rs_hosts;     /* Learned host addresses */
+    size_t rs_prefixes;  /* Learned iroute prefixes */
+};
+
+int rtable_alloc(rtable_t **);
+void rtable_free(rtable_t *);
+int rtable_client_add(rtable_t *, const char *, int);
+int rtable_client_remove(rtable_t *, const char *, struct rtable_client *);
+int rtable_learn(rtable_t *, const char *, const char *);
+int rtable_unlearn(rtable_t *, const char *);
+int rtable_lookup(rtable_t *, const char *, char *, size_t);
+int rtable_online(rtable_t *, vector_t *);
+void rtable_get_stats(rtable_t *, struct rtable_stats *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_RTABLE_H_ */
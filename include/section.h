@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_SECTION_H_
+#define EASYVPN_PLUGIN_SECTION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+typedef struct section_store section_store_t;
+
+/*
+ * section is an interned block of a rendered config. Sections are immutable,
+ * equal blocks are stored only once.
+ */
+struct section {
+    const char *sc_data;
+    size_t sc_len;
+};
+
+/*
+ * section_stats describes the memory of a section store.
+ */
+struct section_stats {
+    size_t ss_sections;    /* Unique sections */
+    size_t ss_bytes;       /* Bytes of the unique sections */
+    size_t ss_refs;        /* References to the sections */
+    uint64_t ss_interned;  /* Calls of section_intern */
+    uint64_t ss_shared;    /* Calls which found an equal section */
+};
+
+int section_store_alloc(section_store_t **);
+section_store_t *section_store_retain(section_store_t *);
+void section_store_free(section_store_t *);
+int section_intern(section_store_t *, const void *, size_t,
+    const struct section **);
+const struct section *section_retain(section_store_t *,
+    const struct section *);
+void section_release(section_store_t *, const struct section *);
+void section_store_get_stats(section_store_t *, struct section_stats *);
+int section_writev(int, struct iovec *, size_t);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_SECTION_H_ */
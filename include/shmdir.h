@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_SHMDIR_H_
+#define EASYVPN_PLUGIN_SHMDIR_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ccd.h"
+#include "dao.h"
+#include "model.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Maximum length of a shared directory name. */
+#define SHMDIR_NAME_MAX 64
+
+typedef struct shmdir shmdir_t;
+
+/*
+ * shmdir_stats describes the snapshot a reader has mapped.
+ */
+struct shmdir_stats {
+    uint64_t ss_generation;  /* Generation of the mapped snapshot */
+    uint64_t ss_remaps;      /* Snapshots mapped since shmdir_open */
+    size_t ss_clients;       /* Active clients of the snapshot */
+    size_t ss_bytes;         /* Size of the snapshot */
+};
+
+int shmdir_publish(const char *, dao_config_t *, uint64_t *);
+int shmdir_unlink(const char *);
+int shmdir_open(shmdir_t **, const char *);
+void shmdir_close(shmdir_t *);
+bool shmdir_stale(shmdir_t *);
+int shmdir_refresh(shmdir_t *);
+int shmdir_find_client(shmdir_t *, const char *, struct vpn_client *);
+ccd_directory_t *shmdir_directory(shmdir_t *);
+void shmdir_get_stats(shmdir_t *, struct shmdir_stats *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_SHMDIR_H_ */
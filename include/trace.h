@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#ifndef EASYVPN_PLUGIN_TRACE_H_
+#define EASYVPN_PLUGIN_TRACE_H_
+
+#include <stdint.h>
+
+#include "model.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Number of events the queue holds, has to be a power of two. */
+#define TRACE_QUEUE_SIZE        16384
+
+/* Number of queued events which wake up the writer before the interval. */
+#define TRACE_BATCH_SIZE        256
+
+/* Milliseconds after which queued events are written at the latest. */
+#define TRACE_FLUSH_INTERVAL_MS 1000
+
+/* First bytes of a trace file, the version is the last character. */
+#define TRACE_MAGIC             "EVPNTRC1"
+#define TRACE_MAGIC_LEN         8
+
+typedef struct trace trace_t;
+typedef struct trace_reader trace_reader_t;
+
+enum trace_event_type {
+    TRACE_CONNECT = 1,
+    TRACE_DISCONNECT = 2
+};
+
+/*
+ * trace_event is a connect or disconnect as the plugin received it. The byte
+ * counters are only set for disconnects.
+ */
+struct trace_event {
+    uint64_t te_time;  /* Nanoseconds since the epoch */
+    enum trace_event_type te_type;
+    char te_cn[RFC5280_CN_MAX_LENGTH];
+    uint64_t te_bytes_received;
+    uint64_t te_bytes_sent;
+};
+
+/*
+ * trace_stats contains the counters of the trace writer.
+ */
+struct trace_stats {
+    uint64_t ts_queued;   /* Events accepted by trace_submit */
+    uint64_t ts_dropped;  /* Events rejected, because the queue was full */
+    uint64_t ts_written;  /* Events written to the file */
+    uint64_t ts_failed;   /* Events lost by failed writes */
+};
+
+int trace_open(trace_t **, const char *);
+void trace_close(trace_t *);
+int trace_submit(trace_t *, enum trace_event_type, const char *, uint64_t, 
+    uint64_t);
+void trace_get_stats(trace_t *, struct trace_stats *);
+int trace_reader_open(trace_reader_t **, const char *);
+void trace_reader_close(trace_reader_t *);
+int trace_reader_next(trace_reader_t *, struct trace_event *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* EASYVPN_PLUGIN_TRACE_H_ */
@@ -24,6 +24,8 @@ void * vector_at(vector_t *, size_t);
 void * vector_begin(vector_t *);
 void * vector_end(vector_t *);
 void * vector_next(vector_t *, void *);
+void vector_sort(vector_t *, int (*)(const void *, const void *));
+void vector_truncate(vector_t *, size_t);
 
 /* void vector_erase(vector_t *, size_t); */
 
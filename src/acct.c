@@ -0,0 +1,155 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acct.h"
+#include "batchq.h"
+#include "dao.h"
+#include "log.h"
+#include "vector.h"
+
+/*
+ * acct writes session events asynchronously. Producers put the events into a
+ * batchq and never wait; if the queue is full the event is dropped. The
+ * writer thread of the queue with its own database connection commits the 
+ * queued events in a single transaction whenever ACCT_BATCH_SIZE events are 
+ * queued or ACCT_FLUSH_INTERVAL_MS has passed.
+ */
+struct acct {
+    batchq_t *a_queue;
+    dao_config_t *a_dao;
+    vector_t *a_batch;
+    atomic_uint_fast64_t a_committed;
+    atomic_uint_fast64_t a_failed;
+    atomic_uint_fast64_t a_batches;
+};
+
+/*
+ * i_acct_commit drains the queue and stores the events in transactions of at
+ * most ACCT_QUEUE_SIZE events.
+ */
+static void
+i_acct_commit(batchq_t *queue, void *arg)
+{
+    acct_t *acct = arg;
+    vector_t *batch = acct->a_batch;
+    struct vpn_session session;
+
+    do {
+        vector_truncate(batch, 0);
+
+        while (vector_size(batch) < ACCT_QUEUE_SIZE && 
+               batchq_dequeue(queue, &session)) {
+            if (vector_push_back(batch, &session) != 0) {
+                atomic_fetch_add(&(acct->a_failed), 1);
+            }
+        }
+
+        if (vector_empty(batch)) {
+            break;
+        }
+
+        if (dao_vpn_session_save_all(acct->a_dao, batch) != 0) {
+            log_error("Failed to store %zu session events", 
+                vector_size(batch));
+            atomic_fetch_add(&(acct->a_failed), vector_size(batch));
+        } else {
+            atomic_fetch_add(&(acct->a_committed), vector_size(batch));
+            atomic_fetch_add(&(acct->a_batches), 1);
+        }
+    } while (vector_size(batch) == ACCT_QUEUE_SIZE);
+}
+
+/*
+ * acct_open starts the accounting writer for the given SQLite database.
+ */
+int
+acct_open(acct_t **acctp, const char *db_filename)
+{
+    int err = 0;
+
+    if (acctp == NULL || db_filename == NULL) {
+        return (EINVAL);
+    }
+
+    if ((*acctp = calloc(1, sizeof(acct_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    if ((err = dao_alloc(&((*acctp)->a_dao), db_filename)) != 0 ||
+        (err = vector_alloc(&((*acctp)->a_batch), 
+         sizeof(struct vpn_session))) != 0) {
+        goto out_free;
+    }
+
+    if ((err = batchq_open(&((*acctp)->a_queue), ACCT_QUEUE_SIZE, 
+        sizeof(struct vpn_session), ACCT_BATCH_SIZE, ACCT_FLUSH_INTERVAL_MS, 
+        i_acct_commit, *acctp)) != 0) {
+        goto out_free;
+    }
+
+    return (0);
+
+out_free:
+    vector_free((*acctp)->a_batch);
+    dao_free((*acctp)->a_dao);
+    free(*acctp);
+    *acctp = NULL;
+    return (err);
+}
+
+/*
+ * acct_close commits all queued events and stops the writer.
+ */
+void
+acct_close(acct_t *acct)
+{
+    if (acct == NULL) {
+        return;
+    }
+
+    batchq_close(acct->a_queue);
+    vector_free(acct->a_batch);
+    dao_free(acct->a_dao);
+    free(acct);
+}
+
+/*
+ * acct_submit queues a session event without blocking. Returns EAGAIN if the
+ * queue is full and the event was dropped.
+ */
+int
+acct_submit(acct_t *acct, const struct vpn_session *session)
+{
+    if (acct == NULL || session == NULL) {
+        return (EINVAL);
+    }
+
+    return (batchq_submit(acct->a_queue, session));
+}
+
+void
+acct_get_stats(acct_t *acct, struct acct_stats *stats)
+{
+    struct batchq_stats queue_stats;
+
+    if (acct == NULL || stats == NULL) {
+        return;
+    }
+
+    batchq_get_stats(acct->a_queue, &queue_stats);
+    stats->as_queued = queue_stats.bs_queued;
+    stats->as_dropped = queue_stats.bs_dropped;
+    stats->as_committed = atomic_load(&(acct->a_committed));
+    stats->as_failed = atomic_load(&(acct->a_failed));
+    stats->as_batches = atomic_load(&(acct->a_batches));
+}
@@ -0,0 +1,773 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "addrpool.h"
+#include "inetx.h"
+#include "ovpn_client_config.h"
+#include "vector.h"
+
+/* Levels of the hierarchical bitmap, 64^5 covers more than 2^24 bits. */
+#define I_BITMAP_MAX_LEVELS 5
+
+/* Marks an unassigned address index of a lease. */
+#define I_ADDRPOOL_NO_INDEX UINT32_MAX
+
+/* Initial number of slots of the lease table, has to be a power of two. */
+#define I_ADDRPOOL_LEASES_INIT 1024
+
+/*
+ * i_bitmap is a hierarchical bitmap. Level 0 contains one bit per address, a 
+ * set bit marks a used address. Every bit of the levels above marks a full 
+ * word of the level below, so a free address is found by following the first
+ * zero bit from the single top level word down to level 0.
+ */
+struct i_bitmap {
+    size_t bm_levels;
+    size_t bm_words[I_BITMAP_MAX_LEVELS];
+    uint64_t *bm_level[I_BITMAP_MAX_LEVELS];
+};
+
+/*
+ * addrpool_lease tracks the addresses of a client. Released leases keep their
+ * address indices, so the client gets the same addresses on reconnect if they
+ * weren't handed out in the meantime.
+ */
+struct addrpool_lease {
+    int al_client_id;  /* 0 marks an empty slot */
+    bool al_active;
+    bool al_dirty;     /* Changed since the last flush */
+    uint32_t al_ipv4_index;
+    uint32_t al_ipv6_index;
+};
+
+/*
+ * addrpool hands out IPv4 addresses of an IPv4 network and optionally IPv6 
+ * addresses of an IPv6 network with a prefix length of 64 or more. The first
+ * address of both networks is the server, the network and the IPv4 broadcast
+ * address are never handed out.
+ */
+struct addrpool {
+    pthread_mutex_t ap_lock;
+    uint32_t ap_ipv4_base;           /* Network address in host byte order */
+    struct in_addr ap_ipv4_netmask;
+    size_t ap_ipv4_size;             /* Addresses of the network */
+    size_t ap_ipv4_used;
+    struct i_bitmap ap_ipv4_bitmap;
+    bool ap_has_ipv6;
+    struct in6_addr ap_ipv6_base;
+    size_t ap_ipv6_prefix;
+    size_t ap_ipv6_size;
+    size_t ap_ipv6_used;
+    struct i_bitmap ap_ipv6_bitmap;
+    struct addrpool_lease *ap_leases;
+    size_t ap_leases_cap;
+    size_t ap_leases_count;
+    vector_t *ap_dirty;              /* Client ids of changed leases */
+};
+
+static void
+i_bitmap_set(struct i_bitmap *bm, size_t level, size_t bit)
+{
+    uint64_t *word = NULL;
+
+    for (; level < bm->bm_levels; level++, bit /= 64) {
+        word = &(bm->bm_level[level][bit / 64]);
+        *word |= (uint64_t)1 << (bit % 64);
+
+        /* Only a full word has to be marked on the level above. */
+        if (*word != UINT64_MAX) {
+            break;
+        }
+    }
+}
+
+static void
+i_bitmap_clear(struct i_bitmap *bm, size_t bit)
+{
+    uint64_t *word = NULL;
+    size_t level = 0;
+    bool was_full = false;
+
+    for (level = 0; level < bm->bm_levels; level++, bit /= 64) {
+        word = &(bm->bm_level[level][bit / 64]);
+        was_full = (*word == UINT64_MAX);
+        *word &= ~((uint64_t)1 << (bit % 64));
+
+        if (!was_full) {
+            break;
+        }
+    }
+}
+
+static bool
+i_bitmap_test(const struct i_bitmap *bm, size_t bit)
+{
+    return ((bm->bm_level[0][bit / 64] & ((uint64_t)1 << (bit % 64))) != 0);
+}
+
+/*
+ * i_bitmap_find_zero returns the first unused bit in O(levels) or ENOSPC if 
+ * all bits are used.
+ */
+static int
+i_bitmap_find_zero(const struct i_bitmap *bm, size_t *bit)
+{
+    size_t level = bm->bm_levels - 1, idx = 0;
+
+    if (bm->bm_level[level][0] == UINT64_MAX) {
+        return (ENOSPC);
+    }
+
+    for (;;) {
+        idx = idx * 64 + __builtin_ctzll(~(bm->bm_level[level][idx]));
+        if (level-- == 0) {
+            break;
+        }
+    }
+
+    *bit = idx;
+    return (0);
+}
+
+static void
+i_bitmap_destroy(struct i_bitmap *bm)
+{
+    size_t level = 0;
+
+    for (level = 0; level < I_BITMAP_MAX_LEVELS; level++) {
+        free(bm->bm_level[level]);
+        bm->bm_level[level] = NULL;
+    }
+}
+
+/*
+ * i_bitmap_init allocates a bitmap of nbits. The padding bits of every level 
+ * are marked as used, so they are never found.
+ */
+static int
+i_bitmap_init(struct i_bitmap *bm, size_t nbits)
+{
+    size_t level = 0, bits = nbits, bit = 0;
+
+    memset(bm, 0, sizeof(struct i_bitmap));
+
+    do {
+        if (level == I_BITMAP_MAX_LEVELS) {
+            i_bitmap_destroy(bm);
+            return (EINVAL);
+        }
+
+        bm->bm_words[level] = (bits + 63) / 64;
+        if ((bm->bm_level[level] = calloc(bm->bm_words[level], 
+             sizeof(uint64_t))) == NULL) {
+            i_bitmap_destroy(bm);
+            return (ENOMEM);
+        }
+
+        bits = bm->bm_words[level++];
+    } while (bits > 1);
+
+    bm->bm_levels = level;
+
+    for (level = 0, bits = nbits; level < bm->bm_levels; level++) {
+        for (bit = bits; bit < bm->bm_words[level] * 64; bit++) {
+            i_bitmap_set(bm, level, bit);
+        }
+        bits = bm->bm_words[level];
+    }
+
+    return (0);
+}
+
+static struct addrpool_lease *
+i_addrpool_lease_slot(struct addrpool_lease *leases, size_t cap, int client_id)
+{
+    size_t slot = ((uint32_t)client_id * 2654435761U) & (cap - 1);
+
+    while (leases[slot].al_client_id != 0 && 
+           leases[slot].al_client_id != client_id) {
+        slot = (slot + 1) & (cap - 1);
+    }
+
+    return (&(leases[slot]));
+}
+
+static struct addrpool_lease *
+i_addrpool_lease_find(addrpool_t *pool, int client_id)
+{
+    struct addrpool_lease *lease = NULL;
+
+    lease = i_addrpool_lease_slot(pool->ap_leases, pool->ap_leases_cap, 
+        client_id);
+
+    return (lease->al_client_id == client_id ? lease : NULL);
+}
+
+/*
+ * i_addrpool_lease_get returns the lease of the client, a new lease is added 
+ * with unassigned addresses. The lease table is kept at most half full.
+ */
+static int
+i_addrpool_lease_get(addrpool_t *pool, int client_id, 
+    struct addrpool_lease **leasep)
+{
+    struct addrpool_lease *leases = NULL, *lease = NULL;
+    size_t cap = 0, i = 0;
+
+    assert(client_id != 0);
+
+    lease = i_addrpool_lease_slot(pool->ap_leases, pool->ap_leases_cap, 
+        client_id);
+    if (lease->al_client_id == client_id) {
+        *leasep = lease;
+        return (0);
+    }
+
+    if ((pool->ap_leases_count + 1) * 2 > pool->ap_leases_cap) {
+        cap = pool->ap_leases_cap * 2;
+        if ((leases = calloc(cap, sizeof(struct addrpool_lease))) == NULL) {
+            return (ENOMEM);
+        }
+
+        for (i = 0; i < pool->ap_leases_cap; i++) {
+            if (pool->ap_leases[i].al_client_id != 0) {
+                *i_addrpool_lease_slot(leases, cap, 
+                    pool->ap_leases[i].al_client_id) = pool->ap_leases[i];
+            }
+        }
+
+        free(pool->ap_leases);
+        pool->ap_leases = leases;
+        pool->ap_leases_cap = cap;
+
+        lease = i_addrpool_lease_slot(leases, cap, client_id);
+    }
+
+    lease->al_client_id = client_id;
+    lease->al_active = false;
+    lease->al_dirty = false;
+    lease->al_ipv4_index = I_ADDRPOOL_NO_INDEX;
+    lease->al_ipv6_index = I_ADDRPOOL_NO_INDEX;
+    pool->ap_leases_count++;
+
+    *leasep = lease;
+    return (0);
+}
+
+static int
+i_addrpool_mark_dirty(addrpool_t *pool, struct addrpool_lease *lease)
+{
+    int err = 0;
+
+    if (lease->al_dirty) {
+        return (0);
+    }
+
+    if ((err = vector_push_back(pool->ap_dirty, &(lease->al_client_id))) 
+        != 0) {
+        return (err);
+    }
+
+    lease->al_dirty = true;
+    return (0);
+}
+
+static void
+i_addrpool_ipv4_addr(addrpool_t *pool, uint32_t idx, struct in_addr *addr)
+{
+    addr->s_addr = htonl(pool->ap_ipv4_base + idx);
+}
+
+static uint64_t
+i_addrpool_ipv6_low(const struct in6_addr *addr)
+{
+    uint64_t low = 0;
+    int i = 0;
+
+    for (i = 8; i < 16; i++) {
+        low = (low << 8) | addr->s6_addr[i];
+    }
+
+    return (low);
+}
+
+/*
+ * i_addrpool_ipv6_addr returns the address of an index. The pool prefix is at
+ * least 64 bits, so only the lower half of the base address changes.
+ */
+static void
+i_addrpool_ipv6_addr(addrpool_t *pool, uint32_t idx, struct in6_addr *addr)
+{
+    uint64_t low = i_addrpool_ipv6_low(&(pool->ap_ipv6_base)) + idx;
+    int i = 0;
+
+    *addr = pool->ap_ipv6_base;
+
+    for (i = 15; i >= 8; i--, low >>= 8) {
+        addr->s6_addr[i] = low & 0xff;
+    }
+}
+
+/*
+ * i_addrpool_ipv4_index maps an address string to its index in the pool. It 
+ * returns I_ADDRPOOL_NO_INDEX if the address isn't assignable.
+ */
+static uint32_t
+i_addrpool_ipv4_index(addrpool_t *pool, const char *str)
+{
+    struct in_addr addr = {0};
+    uint32_t idx = 0;
+
+    if (str[0] == '\0' || inetx_str_to_ipv4_addr(str, &addr) != 0) {
+        return (I_ADDRPOOL_NO_INDEX);
+    }
+
+    idx = ntohl(addr.s_addr) - pool->ap_ipv4_base;
+
+    return ((idx > 1 && idx < pool->ap_ipv4_size - 1) ? idx : 
+        I_ADDRPOOL_NO_INDEX);
+}
+
+static uint32_t
+i_addrpool_ipv6_index(addrpool_t *pool, const char *str)
+{
+    struct in6_addr addr = {0};
+    uint64_t idx = 0;
+
+    if (!pool->ap_has_ipv6 || str[0] == '\0' || 
+        inetx_str_to_ipv6_addr(str, &addr) != 0 ||
+        memcmp(addr.s6_addr, pool->ap_ipv6_base.s6_addr, 8) != 0) {
+        return (I_ADDRPOOL_NO_INDEX);
+    }
+
+    idx = i_addrpool_ipv6_low(&addr) - 
+        i_addrpool_ipv6_low(&(pool->ap_ipv6_base));
+
+    return ((idx > 1 && idx < pool->ap_ipv6_size) ? (uint32_t)idx : 
+        I_ADDRPOOL_NO_INDEX);
+}
+
+/*
+ * i_addrpool_assign marks the previous index of a lease as used if it's still 
+ * free, otherwise the first free index.
+ */
+static int
+i_addrpool_assign(struct i_bitmap *bm, uint32_t *idx, size_t *used)
+{
+    size_t bit = 0;
+    int err = 0;
+
+    if (*idx != I_ADDRPOOL_NO_INDEX && !i_bitmap_test(bm, *idx)) {
+        bit = *idx;
+    } else if ((err = i_bitmap_find_zero(bm, &bit)) != 0) {
+        return (err);
+    }
+
+    i_bitmap_set(bm, 0, bit);
+    *idx = (uint32_t)bit;
+    (*used)++;
+
+    return (0);
+}
+
+static void
+i_addrpool_lease_to_model(addrpool_t *pool, const struct addrpool_lease *lease,
+    struct vpn_client_lease *model)
+{
+    struct in_addr addr = {0};
+    struct in6_addr addr6 = {0};
+
+    memset(model, 0, sizeof(struct vpn_client_lease));
+
+    model->client_id = lease->al_client_id;
+    model->is_active = lease->al_active ? 1 : 0;
+
+    if (lease->al_ipv4_index != I_ADDRPOOL_NO_INDEX) {
+        i_addrpool_ipv4_addr(pool, lease->al_ipv4_index, &addr);
+        inetx_ipv4_addr_to_str(&addr, model->ipv4_addr, INET_ADDRSTRLEN);
+    }
+
+    if (lease->al_ipv6_index != I_ADDRPOOL_NO_INDEX) {
+        i_addrpool_ipv6_addr(pool, lease->al_ipv6_index, &addr6);
+        inetx_ipv6_addr_to_str(&addr6, model->ipv6_addr, INET6_ADDRSTRLEN);
+    }
+}
+
+/*
+ * addrpool_alloc allocates an address pool for the IPv4 network and the 
+ * optional IPv6 network given in CIDR notation.
+ */
+int
+addrpool_alloc(addrpool_t **poolp, const char *ipv4_pool, 
+    const char *ipv6_pool)
+{
+    struct ovpn_client_network network;
+    size_t i = 0;
+    int err = 0;
+
+    if (poolp == NULL || ipv4_pool == NULL) {
+        return (EINVAL);
+    }
+
+    if ((*poolp = calloc(1, sizeof(addrpool_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    pthread_mutex_init(&((*poolp)->ap_lock), NULL);
+
+    if ((err = ovpn_client_network_parse(&network, ipv4_pool)) != 0 ||
+        network.vpncn_family != ADDRESS_FAMILY_IPV4 ||
+        network.vpncn_prefix < ADDRPOOL_IPV4_MIN_PREFIX || 
+        network.vpncn_prefix > 30) {
+        err = EINVAL;
+        goto out_free;
+    }
+
+    (*poolp)->ap_ipv4_size = (size_t)1 << (32 - network.vpncn_prefix);
+    (*poolp)->ap_ipv4_base = ntohl(network.vpncn_ipv4_addr.s_addr) & 
+        ~(uint32_t)((*poolp)->ap_ipv4_size - 1);
+    inetx_ipv4_prefix_to_netmask(network.vpncn_prefix, 
+        &((*poolp)->ap_ipv4_netmask));
+
+    if ((err = i_bitmap_init(&((*poolp)->ap_ipv4_bitmap), 
+        (*poolp)->ap_ipv4_size)) != 0) {
+        goto out_free;
+    }
+
+    /* Reserve the network, the server and the broadcast address. */
+    i_bitmap_set(&((*poolp)->ap_ipv4_bitmap), 0, 0);
+    i_bitmap_set(&((*poolp)->ap_ipv4_bitmap), 0, 1);
+    i_bitmap_set(&((*poolp)->ap_ipv4_bitmap), 0, (*poolp)->ap_ipv4_size - 1);
+
+    if (ipv6_pool != NULL) {
+        if ((err = ovpn_client_network_parse(&network, ipv6_pool)) != 0 ||
+            network.vpncn_family != ADDRESS_FAMILY_IPV6 ||
+            network.vpncn_prefix < 64 || network.vpncn_prefix > 126) {
+            err = EINVAL;
+            goto out_free;
+        }
+
+        (*poolp)->ap_has_ipv6 = true;
+        (*poolp)->ap_ipv6_base = network.vpncn_ipv6_addr;
+        for (i = network.vpncn_prefix; i < 128; i++) {
+            (*poolp)->ap_ipv6_base.s6_addr[i / 8] &= ~(0x80 >> (i % 8));
+        }
+        (*poolp)->ap_ipv6_prefix = network.vpncn_prefix;
+        (*poolp)->ap_ipv6_size = (128 - network.vpncn_prefix >= 24) ? 
+            ADDRPOOL_IPV6_MAX_SLOTS : (size_t)1 << (128 - network.vpncn_prefix);
+
+        if ((err = i_bitmap_init(&((*poolp)->ap_ipv6_bitmap), 
+            (*poolp)->ap_ipv6_size)) != 0) {
+            goto out_free;
+        }
+
+        /* Reserve the subnet-router anycast and the server address. */
+        i_bitmap_set(&((*poolp)->ap_ipv6_bitmap), 0, 0);
+        i_bitmap_set(&((*poolp)->ap_ipv6_bitmap), 0, 1);
+    }
+
+    (*poolp)->ap_leases_cap = I_ADDRPOOL_LEASES_INIT;
+    if (((*poolp)->ap_leases = calloc((*poolp)->ap_leases_cap, 
+         sizeof(struct addrpool_lease))) == NULL) {
+        err = ENOMEM;
+        goto out_free;
+    }
+
+    if ((err = vector_alloc(&((*poolp)->ap_dirty), sizeof(int))) != 0) {
+        goto out_free;
+    }
+
+    return (0);
+
+out_free:
+    addrpool_free(*poolp);
+    *poolp = NULL;
+    return (err);
+}
+
+void
+addrpool_free(addrpool_t *pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    vector_free(pool->ap_dirty);
+    free(pool->ap_leases);
+    i_bitmap_destroy(&(pool->ap_ipv6_bitmap));
+    i_bitmap_destroy(&(pool->ap_ipv4_bitmap));
+    pthread_mutex_destroy(&(pool->ap_lock));
+
+    free(pool);
+}
+
+/*
+ * addrpool_load restores the leases stored in the database. All leases are 
+ * restored as released, because no client is connected after a restart, but 
+ * their addresses stay sticky. Addresses outside of the pool are dropped.
+ */
+int
+addrpool_load(addrpool_t *pool, dao_config_t *daocfg)
+{
+    vector_t *leases = NULL;
+    struct vpn_client_lease *model = NULL;
+    struct addrpool_lease *lease = NULL;
+    int err = 0;
+
+    if (pool == NULL || daocfg == NULL) {
+        return (EINVAL);
+    }
+
+    if ((err = vector_alloc(&leases, sizeof(struct vpn_client_lease))) != 0) {
+        return (err);
+    }
+
+    if ((err = dao_vpn_client_lease_find_all(daocfg, leases)) != 0) {
+        goto out_free;
+    }
+
+    pthread_mutex_lock(&(pool->ap_lock));
+
+    for (model = vector_begin(leases); model != vector_end(leases); 
+         model = vector_next(leases, model)) {
+        if (model->client_id == 0) {
+            continue;
+        }
+
+        if ((err = i_addrpool_lease_get(pool, model->client_id, &lease)) 
+            != 0) {
+            break;
+        }
+
+        if (lease->al_active) {
+            continue;
+        }
+
+        lease->al_ipv4_index = i_addrpool_ipv4_index(pool, model->ipv4_addr);
+        lease->al_ipv6_index = i_addrpool_ipv6_index(pool, model->ipv6_addr);
+
+        /* Store the released state of formerly active leases. */
+        if (model->is_active && (err = i_addrpool_mark_dirty(pool, lease)) 
+            != 0) {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&(pool->ap_lock));
+
+out_free:
+    vector_free(leases);
+    return (err);
+}
+
+/*
+ * addrpool_acquire assigns pool addresses to a connecting client and stores 
+ * them in the address fields of the client. A reconnecting client gets its 
+ * previous addresses, if they are still free. Returns ENOSPC if the pool is 
+ * exhausted.
+ */
+int
+addrpool_acquire(addrpool_t *pool, struct vpn_client *client)
+{
+    struct addrpool_lease *lease = NULL;
+    struct vpn_client_lease model;
+    uint32_t ipv4_index = 0;
+    int err = 0;
+
+    if (pool == NULL || client == NULL || client->id == 0) {
+        return (EINVAL);
+    }
+
+    pthread_mutex_lock(&(pool->ap_lock));
+
+    if ((err = i_addrpool_lease_get(pool, client->id, &lease)) != 0) {
+        goto out_unlock;
+    }
+
+    if (!lease->al_active) {
+        ipv4_index = lease->al_ipv4_index;
+
+        if ((err = i_addrpool_assign(&(pool->ap_ipv4_bitmap), 
+            &(lease->al_ipv4_index), &(pool->ap_ipv4_used))) != 0) {
+            goto out_unlock;
+        }
+
+        if (pool->ap_has_ipv6 && (err = i_addrpool_assign(
+            &(pool->ap_ipv6_bitmap), &(lease->al_ipv6_index), 
+            &(pool->ap_ipv6_used))) != 0) {
+            i_bitmap_clear(&(pool->ap_ipv4_bitmap), lease->al_ipv4_index);
+            pool->ap_ipv4_used--;
+            lease->al_ipv4_index = ipv4_index;
+            goto out_unlock;
+        }
+
+        lease->al_active = true;
+
+        if ((err = i_addrpool_mark_dirty(pool, lease)) != 0) {
+            goto out_unlock;
+        }
+    }
+
+    i_addrpool_lease_to_model(pool, lease, &model);
+
+    memcpy(client->ipv4_addr, model.ipv4_addr, INET_ADDRSTRLEN);
+    inetx_ipv4_addr_to_str(&(pool->ap_ipv4_netmask), client->ipv4_remote_addr, 
+        INET_ADDRSTRLEN);
+
+    if (pool->ap_has_ipv6) {
+        struct in6_addr server = {0};
+
+        snprintf(client->ipv6_addr, INET6_ADDRSTRLEN_W_PREFIX, "%s/%zu", 
+            model.ipv6_addr, pool->ap_ipv6_prefix);
+        i_addrpool_ipv6_addr(pool, 1, &server);
+        inetx_ipv6_addr_to_str(&server, client->ipv6_remote_addr, 
+            INET6_ADDRSTRLEN);
+    }
+
+out_unlock:
+    pthread_mutex_unlock(&(pool->ap_lock));
+    return (err);
+}
+
+/*
+ * addrpool_release returns the addresses of a disconnected client to the 
+ * pool. Returns ENOENT if the client has no active lease.
+ */
+int
+addrpool_release(addrpool_t *pool, int client_id)
+{
+    struct addrpool_lease *lease = NULL;
+    int err = 0;
+
+    if (pool == NULL) {
+        return (EINVAL);
+    }
+
+    pthread_mutex_lock(&(pool->ap_lock));
+
+    if ((lease = i_addrpool_lease_find(pool, client_id)) == NULL || 
+        !lease->al_active) {
+        err = ENOENT;
+        goto out_unlock;
+    }
+
+    i_bitmap_clear(&(pool->ap_ipv4_bitmap), lease->al_ipv4_index);
+    pool->ap_ipv4_used--;
+
+    if (pool->ap_has_ipv6) {
+        i_bitmap_clear(&(pool->ap_ipv6_bitmap), lease->al_ipv6_index);
+        pool->ap_ipv6_used--;
+    }
+
+    lease->al_active = false;
+    err = i_addrpool_mark_dirty(pool, lease);
+
+out_unlock:
+    pthread_mutex_unlock(&(pool->ap_lock));
+    return (err);
+}
+
+/*
+ * addrpool_flush stores all changed leases in a single transaction. The 
+ * database is written without holding the pool lock. On error the leases stay
+ * marked as changed.
+ */
+int
+addrpool_flush(addrpool_t *pool, dao_config_t *daocfg)
+{
+    vector_t *models = NULL;
+    struct vpn_client_lease model, *saved = NULL;
+    struct addrpool_lease *lease = NULL;
+    int *client_id = NULL;
+    int err = 0;
+
+    if (pool == NULL || daocfg == NULL) {
+        return (EINVAL);
+    }
+
+    if ((err = vector_alloc(&models, sizeof(struct vpn_client_lease))) != 0) {
+        return (err);
+    }
+
+    pthread_mutex_lock(&(pool->ap_lock));
+
+    for (client_id = vector_begin(pool->ap_dirty); 
+         client_id != vector_end(pool->ap_dirty);
+         client_id = vector_next(pool->ap_dirty, client_id)) {
+        lease = i_addrpool_lease_find(pool, *client_id);
+        assert(lease != NULL);
+
+        i_addrpool_lease_to_model(pool, lease, &model);
+        if ((err = vector_push_back(models, &model)) != 0) {
+            pthread_mutex_unlock(&(pool->ap_lock));
+            goto out_free;
+        }
+
+        lease->al_dirty = false;
+    }
+
+    vector_truncate(pool->ap_dirty, 0);
+
+    pthread_mutex_unlock(&(pool->ap_lock));
+
+    if ((err = dao_vpn_client_lease_save_all(daocfg, models)) != 0) {
+        pthread_mutex_lock(&(pool->ap_lock));
+        for (saved = vector_begin(models); saved != vector_end(models); 
+             saved = vector_next(models, saved)) {
+            lease = i_addrpool_lease_find(pool, saved->client_id);
+            i_addrpool_mark_dirty(pool, lease);
+        }
+        pthread_mutex_unlock(&(pool->ap_lock));
+    }
+
+out_free:
+    vector_free(models);
+    return (err);
+}
+
+/*
+ * addrpool_dirty_count returns the number of leases changed since the last 
+ * flush.
+ */
+size_t
+addrpool_dirty_count(addrpool_t *pool)
+{
+    size_t count = 0;
+
+    if (pool == NULL) {
+        return (0);
+    }
+
+    pthread_mutex_lock(&(pool->ap_lock));
+    count = vector_size(pool->ap_dirty);
+    pthread_mutex_unlock(&(pool->ap_lock));
+
+    return (count);
+}
+
+void
+addrpool_get_stats(addrpool_t *pool, struct addrpool_stats *stats)
+{
+    if (pool == NULL || stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(pool->ap_lock));
+    stats->aps_ipv4_size = pool->ap_ipv4_size - 3;
+    stats->aps_ipv4_used = pool->ap_ipv4_used;
+    stats->aps_ipv6_size = pool->ap_has_ipv6 ? pool->ap_ipv6_size - 2 : 0;
+    stats->aps_ipv6_used = pool->ap_ipv6_used;
+    stats->aps_leases = pool->ap_leases_count;
+    stats->aps_dirty = vector_size(pool->ap_dirty);
+    pthread_mutex_unlock(&(pool->ap_lock));
+}
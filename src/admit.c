@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "admit.h"
+#include "model.h"
+
+/*
+ * admit_entry is a connect in progress.
+ */
+struct admit_entry {
+    uint64_t ae_hash;
+    char ae_cn[RFC5280_CN_MAX_LENGTH];
+};
+
+/*
+ * admit decides whether a connect may start. A token bucket limits the rate
+ * of connects, with a rate of 0 it is disabled. Cold connects, which have to
+ * query the database, may only take tokens above the warm reserve, so warm
+ * connects are still served when a reconnect storm drains the bucket. A CN
+ * may only be in flight once, retries of a CN in progress are rejected
+ * without any work.
+ *
+ * The connects in flight are few, they are kept in an unordered array, which
+ * is searched by hash. All state is protected by ad_lock.
+ */
+struct admit {
+    pthread_mutex_t ad_lock;
+    double ad_rate;           /* Tokens per second, 0 for unlimited */
+    double ad_burst;          /* Bucket size */
+    double ad_tokens;
+    struct timespec ad_refilled;
+    struct admit_entry ad_in_flight[ADMIT_MAX_IN_FLIGHT];
+    size_t ad_in_flight_count;
+    size_t ad_max_in_flight;
+    uint64_t ad_warm;
+    uint64_t ad_cold;
+    uint64_t ad_rate_rejects;
+    uint64_t ad_dup_rejects;
+    uint64_t ad_full_rejects;
+};
+
+static uint64_t
+i_admit_hash(const char *cn)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (*cn != '\0') {
+        h ^= (unsigned char)*cn++;
+        h *= 0x100000001b3ULL;
+    }
+
+    return (h);
+}
+
+/*
+ * i_admit_find returns the index of a CN in flight or ad_in_flight_count.
+ */
+static size_t
+i_admit_find(admit_t *adm, uint64_t h, const char *cn)
+{
+    size_t i = 0;
+
+    for (i = 0; i < adm->ad_in_flight_count; i++) {
+        if (adm->ad_in_flight[i].ae_hash == h &&
+            strcmp(adm->ad_in_flight[i].ae_cn, cn) == 0) {
+            break;
+        }
+    }
+
+    return (i);
+}
+
+/*
+ * i_admit_refill adds the tokens earned since the last refill.
+ */
+static void
+i_admit_refill(admit_t *adm)
+{
+    struct timespec now;
+    double elapsed = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - adm->ad_refilled.tv_sec) +
+        (now.tv_nsec - adm->ad_refilled.tv_nsec) / 1e9;
+    adm->ad_refilled = now;
+
+    adm->ad_tokens += elapsed * adm->ad_rate;
+    if (adm->ad_tokens > adm->ad_burst) {
+        adm->ad_tokens = adm->ad_burst;
+    }
+}
+
+/*
+ * admit_alloc allocates the admission control with a rate in connects per
+ * second and a burst size. A rate of 0 admits every connect, which isn't
+ * already in flight.
+ */
+int
+admit_alloc(admit_t **admp, double rate, double burst)
+{
+    if (admp == NULL) {
+        return (EINVAL);
+    }
+
+    if ((*admp = calloc(1, sizeof(admit_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    pthread_mutex_init(&((*admp)->ad_lock), NULL);
+    admit_set_rate(*admp, rate, burst);
+
+    return (0);
+}
+
+void
+admit_free(admit_t *adm)
+{
+    if (adm == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&(adm->ad_lock));
+    free(adm);
+}
+
+/*
+ * admit_set_rate changes the rate and the burst size. The bucket starts full.
+ * A burst smaller than one connect is raised to one.
+ */
+void
+admit_set_rate(admit_t *adm, double rate, double burst)
+{
+    pthread_mutex_lock(&(adm->ad_lock));
+    adm->ad_rate = (rate > 0) ? rate : 0;
+    adm->ad_burst = (burst > 1) ? burst : 1;
+    adm->ad_tokens = adm->ad_burst;
+    clock_gettime(CLOCK_MONOTONIC, &(adm->ad_refilled));
+    pthread_mutex_unlock(&(adm->ad_lock));
+}
+
+/*
+ * admit_enter admits a connect of a CN. A warm connect is served from memory,
+ * a cold one queries the database. Returns EALREADY if the CN is in flight,
+ * EBUSY if too many connects are in flight and EAGAIN if the rate is
+ * exceeded. An admitted connect has to be finished with admit_leave.
+ */
+int
+admit_enter(admit_t *adm, const char *cn, bool warm)
+{
+    struct admit_entry *entry = NULL;
+    uint64_t h = 0;
+    double needed = 0;
+    int err = 0;
+
+    if (adm == NULL || cn == NULL || strlen(cn) >= RFC5280_CN_MAX_LENGTH) {
+        return (EINVAL);
+    }
+
+    h = i_admit_hash(cn);
+
+    pthread_mutex_lock(&(adm->ad_lock));
+
+    if (i_admit_find(adm, h, cn) < adm->ad_in_flight_count) {
+        adm->ad_dup_rejects++;
+        err = EALREADY;
+        goto out_unlock;
+    }
+
+    if (adm->ad_in_flight_count == ADMIT_MAX_IN_FLIGHT) {
+        adm->ad_full_rejects++;
+        err = EBUSY;
+        goto out_unlock;
+    }
+
+    if (adm->ad_rate > 0) {
+        i_admit_refill(adm);
+
+        /* Cold connects leave the reserve to the warm ones. */
+        needed = warm ? 1 : 1 + adm->ad_burst * ADMIT_WARM_RESERVE;
+        if (adm->ad_tokens < needed) {
+            adm->ad_rate_rejects++;
+            err = EAGAIN;
+            goto out_unlock;
+        }
+        adm->ad_tokens -= 1;
+    }
+
+    entry = &(adm->ad_in_flight[adm->ad_in_flight_count++]);
+    entry->ae_hash = h;
+    strcpy(entry->ae_cn, cn);
+
+    if (adm->ad_in_flight_count > adm->ad_max_in_flight) {
+        adm->ad_max_in_flight = adm->ad_in_flight_count;
+    }
+
+    if (warm) {
+        adm->ad_warm++;
+    } else {
+        adm->ad_cold++;
+    }
+
+out_unlock:
+    pthread_mutex_unlock(&(adm->ad_lock));
+    return (err);
+}
+
+/*
+ * admit_leave finishes an admitted connect.
+ */
+void
+admit_leave(admit_t *adm, const char *cn)
+{
+    size_t i = 0;
+    uint64_t h = 0;
+
+    if (adm == NULL || cn == NULL) {
+        return;
+    }
+
+    h = i_admit_hash(cn);
+
+    pthread_mutex_lock(&(adm->ad_lock));
+
+    if ((i = i_admit_find(adm, h, cn)) < adm->ad_in_flight_count) {
+        adm->ad_in_flight[i] =
+            adm->ad_in_flight[--(adm->ad_in_flight_count)];
+    }
+
+    pthread_mutex_unlock(&(adm->ad_lock));
+}
+
+/*
+ * admit_get_stats copies the counters of the admission control.
+ */
+void
+admit_get_stats(admit_t *adm, struct admit_stats *stats)
+{
+    if (adm == NULL || stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(adm->ad_lock));
+
+    if (adm->ad_rate > 0) {
+        i_admit_refill(adm);
+    }
+
+    stats->as_warm = adm->ad_warm;
+    stats->as_cold = adm->ad_cold;
+    stats->as_rate_rejects = adm->ad_rate_rejects;
+    stats->as_dup_rejects = adm->ad_dup_rejects;
+    stats->as_full_rejects = adm->ad_full_rejects;
+    stats->as_in_flight = adm->ad_in_flight_count;
+    stats->as_max_in_flight = adm->ad_max_in_flight;
+    stats->as_tokens = adm->ad_tokens;
+
+    pthread_mutex_unlock(&(adm->ad_lock));
+}
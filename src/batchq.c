@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "batchq.h"
+
+/*
+ * i_batchq_cell is a slot of the queue, followed by the item. The sequence
+ * number tells the producers and the consumer whose turn it is: a slot is
+ * free for position p if its sequence is p and holds the item of position p
+ * if it's p + 1.
+ */
+struct i_batchq_cell {
+    atomic_size_t bc_seq;
+    alignas(max_align_t) unsigned char bc_item[];
+};
+
+/*
+ * batchq is a lock-free bounded queue with many producers and a writer
+ * thread as its only consumer. Producers never wait; if the queue is full the
+ * item is dropped. The writer drains the queue whenever bq_batch items are
+ * queued or bq_interval_ms has passed, and once more when the queue is
+ * closed.
+ */
+struct batchq {
+    unsigned char *bq_cells;
+    size_t bq_size;           /* Number of cells, a power of two */
+    size_t bq_item_size;
+    size_t bq_cell_size;
+    size_t bq_batch;
+    unsigned int bq_interval_ms;
+    batchq_drain_fn bq_drain;
+    void *bq_arg;
+    atomic_size_t bq_enqueue_pos;
+    atomic_size_t bq_dequeue_pos;
+    sem_t bq_wakeup;
+    atomic_bool bq_stop;
+    pthread_t bq_thread;
+    atomic_uint_fast64_t bq_queued;
+    atomic_uint_fast64_t bq_dropped;
+};
+
+static struct i_batchq_cell *
+i_batchq_cell(batchq_t *q, size_t pos)
+{
+    return ((struct i_batchq_cell *)(q->bq_cells +
+        (pos & (q->bq_size - 1)) * q->bq_cell_size));
+}
+
+static void *
+i_batchq_thread(void *arg)
+{
+    batchq_t *q = arg;
+    struct timespec deadline;
+    bool stop = false;
+
+    while (!stop) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (q->bq_interval_ms % 1000) * 1000000L;
+        deadline.tv_sec += q->bq_interval_ms / 1000 +
+            deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        while (sem_timedwait(&(q->bq_wakeup), &deadline) != 0 &&
+               errno == EINTR) {
+        }
+
+        /* Check the stop first, then drain what was queued before close. */
+        stop = atomic_load(&(q->bq_stop));
+        q->bq_drain(q, q->bq_arg);
+    }
+
+    return (NULL);
+}
+
+/*
+ * batchq_open allocates a queue of size items of item_size bytes and starts
+ * its writer thread, which calls drain with arg. The size has to be a power
+ * of two. The writer is woken up every batch items and after interval_ms at
+ * the latest.
+ */
+int
+batchq_open(batchq_t **qp, size_t size, size_t item_size, size_t batch,
+    unsigned int interval_ms, batchq_drain_fn drain, void *arg)
+{
+    size_t i = 0;
+    int err = 0;
+
+    if (qp == NULL || size == 0 || (size & (size - 1)) != 0 ||
+        item_size == 0 || batch == 0 || drain == NULL) {
+        return (EINVAL);
+    }
+
+    if ((*qp = calloc(1, sizeof(batchq_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    (*qp)->bq_size = size;
+    (*qp)->bq_item_size = item_size;
+    (*qp)->bq_cell_size = (sizeof(struct i_batchq_cell) + item_size +
+        alignof(struct i_batchq_cell) - 1) &
+        ~(alignof(struct i_batchq_cell) - 1);
+    (*qp)->bq_batch = batch;
+    (*qp)->bq_interval_ms = interval_ms;
+    (*qp)->bq_drain = drain;
+    (*qp)->bq_arg = arg;
+
+    if (((*qp)->bq_cells = calloc(size, (*qp)->bq_cell_size)) == NULL) {
+        free(*qp);
+        *qp = NULL;
+        return (ENOMEM);
+    }
+
+    for (i = 0; i < size; i++) {
+        atomic_init(&(i_batchq_cell(*qp, i)->bc_seq), i);
+    }
+
+    sem_init(&((*qp)->bq_wakeup), 0, 0);
+
+    if ((err = pthread_create(&((*qp)->bq_thread), NULL, i_batchq_thread,
+        *qp)) != 0) {
+        sem_destroy(&((*qp)->bq_wakeup));
+        free((*qp)->bq_cells);
+        free(*qp);
+        *qp = NULL;
+        return (err);
+    }
+
+    return (0);
+}
+
+/*
+ * batchq_close drains the queued items a last time, stops the writer and
+ * frees the queue.
+ */
+void
+batchq_close(batchq_t *q)
+{
+    if (q == NULL) {
+        return;
+    }
+
+    atomic_store(&(q->bq_stop), true);
+    sem_post(&(q->bq_wakeup));
+    pthread_join(q->bq_thread, NULL);
+
+    sem_destroy(&(q->bq_wakeup));
+    free(q->bq_cells);
+    free(q);
+}
+
+/*
+ * batchq_submit copies an item into the queue without blocking. Returns
+ * EAGAIN if the queue is full and the item was dropped.
+ */
+int
+batchq_submit(batchq_t *q, const void *item)
+{
+    struct i_batchq_cell *cell = NULL;
+    size_t pos = 0, seq = 0;
+
+    if (q == NULL || item == NULL) {
+        return (EINVAL);
+    }
+
+    pos = atomic_load_explicit(&(q->bq_enqueue_pos), memory_order_relaxed);
+    for (;;) {
+        cell = i_batchq_cell(q, pos);
+        seq = atomic_load_explicit(&(cell->bc_seq), memory_order_acquire);
+
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&(q->bq_enqueue_pos),
+                &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if ((intptr_t)(seq - pos) < 0) {
+            atomic_fetch_add(&(q->bq_dropped), 1);
+            return (EAGAIN);
+        } else {
+            pos = atomic_load_explicit(&(q->bq_enqueue_pos),
+                memory_order_relaxed);
+        }
+    }
+
+    memcpy(cell->bc_item, item, q->bq_item_size);
+    atomic_store_explicit(&(cell->bc_seq), pos + 1, memory_order_release);
+    atomic_fetch_add(&(q->bq_queued), 1);
+
+    if ((pos + 1) % q->bq_batch == 0) {
+        sem_post(&(q->bq_wakeup));
+    }
+
+    return (0);
+}
+
+/*
+ * batchq_dequeue copies the oldest item to item. Returns false if the queue
+ * is empty. Only the drain function of the writer may dequeue.
+ */
+bool
+batchq_dequeue(batchq_t *q, void *item)
+{
+    struct i_batchq_cell *cell = NULL;
+    size_t pos = atomic_load_explicit(&(q->bq_dequeue_pos),
+        memory_order_relaxed);
+
+    cell = i_batchq_cell(q, pos);
+    if (atomic_load_explicit(&(cell->bc_seq), memory_order_acquire) !=
+        pos + 1) {
+        return (false);
+    }
+
+    memcpy(item, cell->bc_item, q->bq_item_size);
+    atomic_store_explicit(&(cell->bc_seq), pos + q->bq_size,
+        memory_order_release);
+    atomic_store_explicit(&(q->bq_dequeue_pos), pos + 1,
+        memory_order_relaxed);
+
+    return (true);
+}
+
+void
+batchq_get_stats(batchq_t *q, struct batchq_stats *stats)
+{
+    if (q == NULL || stats == NULL) {
+        return;
+    }
+
+    stats->bs_queued = atomic_load(&(q->bq_queued));
+    stats->bs_dropped = atomic_load(&(q->bq_dropped));
+}
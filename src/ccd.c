@@ -0,0 +1,1305 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "ccd.h"
+#include "log.h"
+#include "prefix.h"
+#include "section.h"
+#include "vector.h"
+
+/*
+ * ccd_network is a parsed client network of the directory.
+ */
+struct ccd_network {
+    int cn_client_id;
+    struct ovpn_client_network cn_network;
+};
+
+/*
+ * ccd_directory contains the parsed networks of all clients ordered by client 
+ * id and the rows of the active clients ordered by CN. A directory is never 
+ * modified after it has been loaded, so it may be shared between threads. A 
+ * mapped directory doesn't own its networks, they point into an image written
+ * by ccd_directory_image_write, and cd_networks and cd_clients are NULL.
+ *
+ * An owned directory also holds the push routes of every client with 
+ * networks, rendered once as a section. Equal sections are stored once and 
+ * the updated copies of a directory share the unchanged ones, so a config is
+ * written as its own head followed by the sections of all other clients.
+ */
+struct ccd_directory {
+    vector_t *cd_networks;
+    vector_t *cd_clients;  /* Active clients as struct vpn_client */
+    const struct ccd_network *cd_base;
+    size_t cd_count;
+    section_store_t *cd_store;
+    const struct section **cd_sections;
+    int *cd_section_ids;  /* Client id of each section, ascending */
+    size_t cd_nsections;
+};
+
+/*
+ * i_ccd_route_iter walks all networks of the directory except the networks of 
+ * one client and returns them as routes without gateway.
+ */
+struct i_ccd_route_iter {
+    ccd_directory_t *ri_directory;
+    size_t ri_idx;
+    size_t ri_skip_begin;
+    size_t ri_skip_end;
+};
+
+/*
+ * i_ccd_network_at returns the network at the given index or NULL if the index
+ * is out of range.
+ */
+static const struct ccd_network *
+i_ccd_network_at(ccd_directory_t *directory, size_t idx)
+{
+    return (idx < directory->cd_count ? &(directory->cd_base[idx]) : NULL);
+}
+
+/*
+ * i_ccd_directory_attach points the lookups at the networks vector.
+ */
+static void
+i_ccd_directory_attach(ccd_directory_t *directory)
+{
+    directory->cd_base = vector_begin(directory->cd_networks);
+    directory->cd_count = vector_size(directory->cd_networks);
+}
+
+/*
+ * i_ccd_network_route converts a network into a route without gateway.
+ */
+static void
+i_ccd_network_route(const struct ccd_network *network, 
+                    struct ovpn_client_route *route)
+{
+    memset(route, 0, sizeof(struct ovpn_client_route));
+    route->vpncr_family = network->cn_network.vpncn_family;
+    route->vpncr_prefix = network->cn_network.vpncn_prefix;
+
+    if (route->vpncr_family == ADDRESS_FAMILY_IPV4) {
+        route->vpncr_ipv4_addr = network->cn_network.vpncn_ipv4_addr;
+    }
+    else {
+        route->vpncr_ipv6_addr = network->cn_network.vpncn_ipv6_addr;
+    }
+}
+
+static int
+i_ccd_network_cmp(const void *a, const void *b)
+{
+    const struct ccd_network *na = a, *nb = b;
+
+    return ((na->cn_client_id > nb->cn_client_id) - 
+        (na->cn_client_id < nb->cn_client_id));
+}
+
+/*
+ * i_ccd_lower_bound returns the index of the first network of the client or 
+ * of the first network of a greater client id.
+ */
+static size_t
+i_ccd_lower_bound(ccd_directory_t *directory, int client_id)
+{
+    const struct ccd_network *network = NULL;
+    size_t lo = 0, hi = directory->cd_count, mid = 0;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        network = i_ccd_network_at(directory, mid);
+
+        if (network->cn_client_id < client_id) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    return (lo);
+}
+
+/*
+ * i_ccd_networks_parse parses the network rows and appends them to networks.
+ * Networks which can't be parsed are skipped with a warning.
+ */
+static int
+i_ccd_networks_parse(vector_t *rows, vector_t *networks)
+{
+    struct vpn_client_network *row = NULL;
+    struct ccd_network network = {0};
+    int err = 0;
+
+    for (row = vector_begin(rows); row != vector_end(rows); 
+         row = vector_next(rows, row)) {
+        network.cn_client_id = row->client_id;
+
+        if (ovpn_client_network_parse(&(network.cn_network), 
+            row->network_addr) != 0) {
+            log_warn("Skip invalid network %s of client %d", 
+                row->network_addr, row->client_id);
+            continue;
+        }
+
+        if ((err = vector_push_back(networks, &network)) != 0) {
+            return (err);
+        }
+    }
+
+    return (0);
+}
+
+static int
+i_ccd_int_cmp(const void *a, const void *b)
+{
+    return ((*(const int *)a > *(const int *)b) - 
+        (*(const int *)a < *(const int *)b));
+}
+
+static int
+i_ccd_client_cmp(const void *a, const void *b)
+{
+    return (strcmp(((const struct vpn_client *)a)->cn, 
+        ((const struct vpn_client *)b)->cn));
+}
+
+static int
+i_ccd_client_cn_cmp(const void *key, const void *elem)
+{
+    return (strcmp(key, ((const struct vpn_client *)elem)->cn));
+}
+
+/*
+ * i_ccd_clients_apply merges the kept rows of clients with the reloaded rows 
+ * of the clients in client_ids into merged, ordered by CN. Deleted and 
+ * inactive clients are dropped. client_ids has to be sorted.
+ */
+static int
+i_ccd_clients_apply(vector_t *clients, dao_config_t *daocfg, 
+    vector_t *client_ids, vector_t *merged)
+{
+    vector_t *fresh = NULL;
+    struct vpn_client client, *old = NULL, *new = NULL;
+    int *id = NULL, *last = NULL;
+    int err = 0;
+
+    if ((err = vector_alloc(&fresh, sizeof(struct vpn_client))) != 0) {
+        return (err);
+    }
+
+    for (id = vector_begin(client_ids); id != vector_end(client_ids); 
+         id = vector_next(client_ids, id)) {
+        if (last != NULL && *last == *id) {
+            continue;
+        }
+        last = id;
+
+        if ((err = dao_vpn_client_find_by_id(daocfg, *id, &client)) == 
+            ENOENT) {
+            continue;
+        } else if (err != 0) {
+            goto out_free;
+        }
+
+        if (client.is_active && client.cn[0] != '\0' && 
+            (err = vector_push_back(fresh, &client)) != 0) {
+            goto out_free;
+        }
+    }
+    err = 0;
+
+    vector_sort(fresh, i_ccd_client_cmp);
+
+    new = vector_begin(fresh);
+    for (old = vector_begin(clients); old != vector_end(clients); 
+         old = vector_next(clients, old)) {
+        if (bsearch(&(old->id), vector_begin(client_ids), 
+            vector_size(client_ids), sizeof(int), i_ccd_int_cmp) != NULL) {
+            continue;
+        }
+
+        for (; new != vector_end(fresh) && strcmp(new->cn, old->cn) < 0; 
+             new = vector_next(fresh, new)) {
+            if ((err = vector_push_back(merged, new)) != 0) {
+                goto out_free;
+            }
+        }
+
+        if ((err = vector_push_back(merged, old)) != 0) {
+            goto out_free;
+        }
+    }
+
+    for (; new != vector_end(fresh); new = vector_next(fresh, new)) {
+        if ((err = vector_push_back(merged, new)) != 0) {
+            goto out_free;
+        }
+    }
+
+out_free:
+    vector_free(fresh);
+    return (err);
+}
+
+/*
+ * i_ccd_section_find returns the section of a client or NULL.
+ */
+static const struct section *
+i_ccd_section_find(ccd_directory_t *directory, int client_id)
+{
+    const int *id = NULL;
+
+    if (directory->cd_store == NULL || (id = bsearch(&client_id, 
+        directory->cd_section_ids, directory->cd_nsections, sizeof(int), 
+        i_ccd_int_cmp)) == NULL) {
+        return (NULL);
+    }
+
+    return (directory->cd_sections[id - directory->cd_section_ids]);
+}
+
+/*
+ * i_ccd_directory_render renders the push routes of every client into the 
+ * sections of the directory. The sections of an old directory are reused, 
+ * except for the clients in changed, which is sorted and may be NULL. All 
+ * other clients are rendered into one buffer first and interned afterwards.
+ */
+static int
+i_ccd_directory_render(ccd_directory_t *directory, ccd_directory_t *old, 
+                       vector_t *changed)
+{
+    struct ovpn_client_route route;
+    const struct ccd_network *network = NULL;
+    const struct section *reuse = NULL;
+    FILE *stream = NULL;
+    char *buf = NULL;
+    size_t bufsz = 0, *offsets = NULL, n = 0, i = 0, j = 0;
+    int err = 0;
+
+    for (i = 0; i < directory->cd_count; i++) {
+        n += (i == 0 || directory->cd_base[i].cn_client_id != 
+            directory->cd_base[i - 1].cn_client_id);
+    }
+
+    if (old != NULL && old->cd_store != NULL) {
+        directory->cd_store = section_store_retain(old->cd_store);
+    } else if ((err = section_store_alloc(&(directory->cd_store))) != 0) {
+        return (err);
+    }
+
+    if ((directory->cd_sections = calloc(n + 1, sizeof(struct section *))) 
+        == NULL ||
+        (directory->cd_section_ids = calloc(n + 1, sizeof(int))) == NULL ||
+        (offsets = calloc(n + 1, sizeof(size_t))) == NULL) {
+        err = ENOMEM;
+        goto out_free;
+    }
+    directory->cd_nsections = n;
+
+    if ((stream = open_memstream(&buf, &bufsz)) == NULL) {
+        err = errno;
+        goto out_free;
+    }
+
+    for (i = 0, n = 0; (network = i_ccd_network_at(directory, i)) != NULL; 
+         n++) {
+        directory->cd_section_ids[n] = network->cn_client_id;
+
+        reuse = NULL;
+        if (old != NULL && (changed == NULL || bsearch(
+            &(network->cn_client_id), vector_begin(changed), 
+            vector_size(changed), sizeof(int), i_ccd_int_cmp) == NULL)) {
+            reuse = i_ccd_section_find(old, network->cn_client_id);
+        }
+
+        if (reuse != NULL) {
+            directory->cd_sections[n] = section_retain(directory->cd_store, 
+                reuse);
+        }
+        offsets[n] = ftello(stream);
+
+        for (; network != NULL && network->cn_client_id == 
+             directory->cd_section_ids[n]; 
+             network = i_ccd_network_at(directory, ++i)) {
+            if (reuse != NULL) {
+                continue;
+            }
+
+            i_ccd_network_route(network, &route);
+            if ((err = ovpn_client_route_print(stream, &route)) != 0) {
+                goto out_close;
+            }
+        }
+    }
+    offsets[n] = ftello(stream);
+
+out_close:
+    if (fclose(stream) != 0 && err == 0) {
+        err = EIO;
+    }
+    if (err != 0) {
+        goto out_free;
+    }
+
+    for (j = 0; j < n; j++) {
+        if (directory->cd_sections[j] == NULL &&
+            (err = section_intern(directory->cd_store, buf + offsets[j], 
+             offsets[j + 1] - offsets[j], &(directory->cd_sections[j]))) 
+            != 0) {
+            goto out_free;
+        }
+    }
+
+out_free:
+    free(offsets);
+    free(buf);
+    return (err);
+}
+
+/*
+ * ccd_directory_load reads the active clients and parses the networks of all
+ * clients. Networks which can't be parsed are skipped with a warning.
+ */
+int
+ccd_directory_load(ccd_directory_t **directoryp, dao_config_t *daocfg)
+{
+    vector_t *rows = NULL;
+    int err = 0;
+
+    if (directoryp == NULL || daocfg == NULL) {
+        return (EINVAL);
+    }
+
+    if ((*directoryp = calloc(1, sizeof(ccd_directory_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    if ((err = vector_alloc(&rows, sizeof(struct vpn_client_network))) != 0 ||
+        (err = vector_alloc(&((*directoryp)->cd_networks), 
+         sizeof(struct ccd_network))) != 0 ||
+        (err = vector_alloc(&((*directoryp)->cd_clients), 
+         sizeof(struct vpn_client))) != 0) {
+        goto out_free;
+    }
+
+    if ((err = dao_vpn_client_find_active(daocfg, 
+         (*directoryp)->cd_clients)) != 0 ||
+        (err = dao_vpn_client_network_find_all(daocfg, rows)) != 0) {
+        goto out_free;
+    }
+
+    if ((err = i_ccd_networks_parse(rows, (*directoryp)->cd_networks)) != 0) {
+        goto out_free;
+    }
+
+    /* Keep the networks of a client together for the lookups. */
+    vector_sort((*directoryp)->cd_networks, i_ccd_network_cmp);
+    i_ccd_directory_attach(*directoryp);
+
+    if ((err = i_ccd_directory_render(*directoryp, NULL, NULL)) != 0) {
+        goto out_free;
+    }
+
+    vector_free(rows);
+    return (0);
+
+out_free:
+    vector_free(rows);
+    ccd_directory_free(*directoryp);
+    *directoryp = NULL;
+    return (err);
+}
+
+/*
+ * ccd_directory_apply creates an updated copy of the directory, in which the 
+ * networks of the clients in network_ids and the rows of the clients in 
+ * client_ids are reloaded, e.g. the clients reported by the change feed. Only
+ * these clients are read from the database, the rest of the directory is 
+ * copied and merged in a single pass. The directory itself is left untouched,
+ * so readers can keep using it until they switch to the copy. Both vectors
+ * contain int and are sorted by the call.
+ */
+int
+ccd_directory_apply(ccd_directory_t *directory, dao_config_t *daocfg, 
+    vector_t *network_ids, vector_t *client_ids, ccd_directory_t **updatedp)
+{
+    vector_t *rows = NULL, *fresh = NULL, *merged = NULL, *clients = NULL;
+    const struct ccd_network *old = NULL;
+    struct ccd_network *new = NULL;
+    int *id = NULL, *last = NULL;
+    size_t i = 0;
+    int err = 0;
+
+    if (directory == NULL || directory->cd_clients == NULL || 
+        daocfg == NULL || network_ids == NULL || client_ids == NULL || 
+        updatedp == NULL) {
+        return (EINVAL);
+    }
+
+    if ((err = vector_alloc(&rows, sizeof(struct vpn_client_network))) != 0 ||
+        (err = vector_alloc(&fresh, sizeof(struct ccd_network))) != 0 ||
+        (err = vector_alloc(&merged, sizeof(struct ccd_network))) != 0 ||
+        (err = vector_alloc(&clients, sizeof(struct vpn_client))) != 0) {
+        goto out_free;
+    }
+
+    vector_sort(client_ids, i_ccd_int_cmp);
+    if ((err = i_ccd_clients_apply(directory->cd_clients, daocfg, client_ids,
+         clients)) != 0) {
+        goto out_free;
+    }
+
+    /* Read the networks of every client once, the rows stay ordered. */
+    vector_sort(network_ids, i_ccd_int_cmp);
+    for (id = vector_begin(network_ids); id != vector_end(network_ids); 
+         id = vector_next(network_ids, id)) {
+        if (last != NULL && *last == *id) {
+            continue;
+        }
+        last = id;
+
+        vector_truncate(rows, 0);
+        if ((err = dao_vpn_client_network_find_by_client_id(daocfg, *id, 
+             rows)) != 0 ||
+            (err = i_ccd_networks_parse(rows, fresh)) != 0) {
+            goto out_free;
+        }
+    }
+
+    /* Merge the kept networks with the fresh ones by client id. */
+    new = vector_begin(fresh);
+    for (i = 0; (old = i_ccd_network_at(directory, i)) != NULL; i++) {
+        if (bsearch(&(old->cn_client_id), vector_begin(network_ids), 
+            vector_size(network_ids), sizeof(int), i_ccd_int_cmp) != NULL) {
+            continue;
+        }
+
+        for (; new != vector_end(fresh) && 
+             new->cn_client_id < old->cn_client_id; 
+             new = vector_next(fresh, new)) {
+            if ((err = vector_push_back(merged, new)) != 0) {
+                goto out_free;
+            }
+        }
+
+        if ((err = vector_push_back(merged, (void *)old)) != 0) {
+            goto out_free;
+        }
+    }
+
+    for (; new != vector_end(fresh); new = vector_next(fresh, new)) {
+        if ((err = vector_push_back(merged, new)) != 0) {
+            goto out_free;
+        }
+    }
+
+    if ((*updatedp = calloc(1, sizeof(ccd_directory_t))) == NULL) {
+        err = ENOMEM;
+        goto out_free;
+    }
+
+    (*updatedp)->cd_networks = merged;
+    (*updatedp)->cd_clients = clients;
+    merged = NULL;
+    clients = NULL;
+    i_ccd_directory_attach(*updatedp);
+
+    /* Only the reloaded clients are rendered again. */
+    if ((err = i_ccd_directory_render(*updatedp, directory, network_ids)) 
+        != 0) {
+        ccd_directory_free(*updatedp);
+        *updatedp = NULL;
+    }
+
+out_free:
+    vector_free(clients);
+    vector_free(merged);
+    vector_free(fresh);
+    vector_free(rows);
+    return (err);
+}
+
+/*
+ * ccd_directory_image_size returns the size of the image of the directory in 
+ * bytes.
+ */
+size_t
+ccd_directory_image_size(ccd_directory_t *directory)
+{
+    return (directory->cd_count * sizeof(struct ccd_network));
+}
+
+/*
+ * ccd_directory_image_write copies the parsed networks into a buffer of 
+ * ccd_directory_image_size bytes. The image contains no pointers and can be 
+ * mapped by other processes of the same build with ccd_directory_map.
+ */
+void
+ccd_directory_image_write(ccd_directory_t *directory, void *buf)
+{
+    if (directory->cd_count > 0) {
+        memcpy(buf, directory->cd_base, ccd_directory_image_size(directory));
+    }
+}
+
+/*
+ * ccd_directory_map creates a read-only directory on top of an image. The 
+ * image must stay mapped until the directory is freed.
+ */
+int
+ccd_directory_map(ccd_directory_t **directoryp, const void *image, 
+    size_t size)
+{
+    if (directoryp == NULL || (image == NULL && size > 0) ||
+        size % sizeof(struct ccd_network) != 0 ||
+        (uintptr_t)image % _Alignof(struct ccd_network) != 0) {
+        return (EINVAL);
+    }
+
+    if ((*directoryp = calloc(1, sizeof(ccd_directory_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    (*directoryp)->cd_base = image;
+    (*directoryp)->cd_count = size / sizeof(struct ccd_network);
+
+    return (0);
+}
+
+/*
+ * ccd_directory_find_client copies the active client with the given common 
+ * name. Returns ENOENT for unknown and inactive clients and if the directory
+ * is mapped, which has no clients.
+ */
+int
+ccd_directory_find_client(ccd_directory_t *directory, const char *cn, 
+    struct vpn_client *client)
+{
+    const struct vpn_client *found = NULL;
+
+    if (directory == NULL || cn == NULL || client == NULL) {
+        return (EINVAL);
+    }
+
+    if (directory->cd_clients == NULL || (found = bsearch(cn, 
+        vector_begin(directory->cd_clients), 
+        vector_size(directory->cd_clients), sizeof(struct vpn_client), 
+        i_ccd_client_cn_cmp)) == NULL) {
+        return (ENOENT);
+    }
+
+    memcpy(client, found, sizeof(struct vpn_client));
+    return (0);
+}
+
+/*
+ * ccd_directory_clients returns the active clients ordered by CN as struct 
+ * vpn_client, or NULL if the directory is mapped.
+ */
+vector_t *
+ccd_directory_clients(ccd_directory_t *directory)
+{
+    return (directory->cd_clients);
+}
+
+/*
+ * i_ccd_network_find checks if a network is in the range [begin, end) of the
+ * directory. The ranges are the networks of one client, which are few.
+ */
+static bool
+i_ccd_network_find(ccd_directory_t *directory, size_t begin, size_t end, 
+                   const struct ccd_network *network)
+{
+    const struct ovpn_client_network *a = &(network->cn_network), *b = NULL;
+
+    for (; begin < end; begin++) {
+        b = &(directory->cd_base[begin].cn_network);
+        if (a->vpncn_family == b->vpncn_family && 
+            a->vpncn_prefix == b->vpncn_prefix &&
+            memcmp(&(a->vpncn_ipv6_addr), &(b->vpncn_ipv6_addr), 
+            a->vpncn_family == ADDRESS_FAMILY_IPV4 ? 
+            sizeof(struct in_addr) : sizeof(struct in6_addr)) == 0) {
+            return (true);
+        }
+    }
+
+    return (false);
+}
+
+/*
+ * i_ccd_client_range returns the range of the networks of a client.
+ */
+static void
+i_ccd_client_range(ccd_directory_t *directory, int client_id, size_t *begin,
+                   size_t *end)
+{
+    const struct ccd_network *network = NULL;
+
+    *begin = i_ccd_lower_bound(directory, client_id);
+    for (*end = *begin; (network = i_ccd_network_at(directory, *end)) 
+         != NULL && network->cn_client_id == client_id; (*end)++) {
+    }
+}
+
+/*
+ * ccd_directory_diff compares the networks of a client in two directories. 
+ * The networks only in updated are appended to added, the networks only in 
+ * directory to removed, both as ovpn_client_route without gateway. These are
+ * the route changes of all other clients.
+ */
+int
+ccd_directory_diff(ccd_directory_t *directory, ccd_directory_t *updated, 
+                   int client_id, vector_t *added, vector_t *removed)
+{
+    struct ovpn_client_route route;
+    size_t old_begin = 0, old_end = 0, new_begin = 0, new_end = 0, i = 0;
+    int err = 0;
+
+    if (directory == NULL || updated == NULL || added == NULL || 
+        removed == NULL) {
+        return (EINVAL);
+    }
+
+    i_ccd_client_range(directory, client_id, &old_begin, &old_end);
+    i_ccd_client_range(updated, client_id, &new_begin, &new_end);
+
+    for (i = new_begin; i < new_end; i++) {
+        if (!i_ccd_network_find(directory, old_begin, old_end, 
+            &(updated->cd_base[i]))) {
+            i_ccd_network_route(&(updated->cd_base[i]), &route);
+            if ((err = vector_push_back(added, &route)) != 0) {
+                return (err);
+            }
+        }
+    }
+
+    for (i = old_begin; i < old_end; i++) {
+        if (!i_ccd_network_find(updated, new_begin, new_end, 
+            &(directory->cd_base[i]))) {
+            i_ccd_network_route(&(directory->cd_base[i]), &route);
+            if ((err = vector_push_back(removed, &route)) != 0) {
+                return (err);
+            }
+        }
+    }
+
+    return (0);
+}
+
+/*
+ * i_ccd_network_prefix converts a parsed network into a prefix.
+ */
+static int
+i_ccd_network_prefix(const struct ovpn_client_network *network, 
+                     struct prefix *px)
+{
+    if (network->vpncn_family == ADDRESS_FAMILY_IPV4) {
+        return (prefix_set(px, AF_INET, &(network->vpncn_ipv4_addr), 
+            network->vpncn_prefix));
+    }
+
+    return (prefix_set(px, AF_INET6, &(network->vpncn_ipv6_addr), 
+        network->vpncn_prefix));
+}
+
+/*
+ * ccd_client_prefixes appends the networks of a client as prefix to pxs. 
+ * Without a directory the networks are read from the database.
+ */
+int
+ccd_client_prefixes(ccd_directory_t *directory, dao_config_t *daocfg, 
+                    int client_id, vector_t *pxs)
+{
+    struct vpn_client_network *row = NULL;
+    struct ovpn_client_network network;
+    struct prefix px;
+    vector_t *rows = NULL;
+    size_t begin = 0, end = 0, i = 0;
+    int err = 0;
+
+    if ((directory == NULL && daocfg == NULL) || pxs == NULL) {
+        return (EINVAL);
+    }
+
+    if (directory != NULL) {
+        i_ccd_client_range(directory, client_id, &begin, &end);
+        for (i = begin; i < end; i++) {
+            if (i_ccd_network_prefix(
+                &(i_ccd_network_at(directory, i)->cn_network), &px) == 0 &&
+                (err = vector_push_back(pxs, &px)) != 0) {
+                return (err);
+            }
+        }
+
+        return (0);
+    }
+
+    if ((err = vector_alloc(&rows, sizeof(struct vpn_client_network))) != 0) {
+        return (err);
+    }
+
+    if ((err = dao_vpn_client_network_find_by_client_id(daocfg, client_id, 
+         rows)) != 0) {
+        goto out_free;
+    }
+
+    for (row = vector_begin(rows); row != vector_end(rows); 
+         row = vector_next(rows, row)) {
+        if (ovpn_client_network_parse(&network, row->network_addr) == 0 &&
+            i_ccd_network_prefix(&network, &px) == 0 &&
+            (err = vector_push_back(pxs, &px)) != 0) {
+            goto out_free;
+        }
+    }
+
+out_free:
+    vector_free(rows);
+    return (err);
+}
+
+/*
+ * ccd_directory_get_section_stats reports the memory of the rendered 
+ * sections. A mapped directory has no sections and reports zeros.
+ */
+void
+ccd_directory_get_section_stats(ccd_directory_t *directory, 
+                                struct section_stats *stats)
+{
+    memset(stats, 0, sizeof(struct section_stats));
+
+    if (directory != NULL && directory->cd_store != NULL) {
+        section_store_get_stats(directory->cd_store, stats);
+    }
+}
+
+/*
+ * ccd_directory_free frees the directory.
+ */
+void
+ccd_directory_free(ccd_directory_t *directory)
+{
+    size_t i = 0;
+
+    if (directory == NULL) {
+        return;
+    }
+
+    for (i = 0; directory->cd_sections != NULL && 
+         i < directory->cd_nsections; i++) {
+        section_release(directory->cd_store, directory->cd_sections[i]);
+    }
+
+    free(directory->cd_sections);
+    free(directory->cd_section_ids);
+    section_store_free(directory->cd_store);
+    vector_free(directory->cd_clients);
+    vector_free(directory->cd_networks);
+
+    free(directory);
+}
+
+static int
+i_ccd_route_next(void *ctx, struct ovpn_client_route *route)
+{
+    struct i_ccd_route_iter *iter = ctx;
+    const struct ccd_network *network = NULL;
+
+    /* Skip the networks of the client itself. */
+    if (iter->ri_idx == iter->ri_skip_begin) {
+        iter->ri_idx = iter->ri_skip_end;
+    }
+
+    if ((network = i_ccd_network_at(iter->ri_directory, iter->ri_idx)) 
+        == NULL) {
+        return (ENOENT);
+    }
+    iter->ri_idx++;
+
+    i_ccd_network_route(network, route);
+    return (0);
+}
+
+/*
+ * i_ccd_build_sections writes the config of a client from the sections of the
+ * directory. Only the head with the addresses and iroutes is rendered, the 
+ * push routes are the sections of all other clients, written with writev.
+ */
+static int
+i_ccd_build_sections(ccd_directory_t *directory, ovpn_client_config_t *vpncc,
+                     int client_id, int fd)
+{
+    struct iovec *iov = NULL;
+    FILE *stream = NULL;
+    char *head = NULL;
+    size_t head_len = 0, i = 0, n = 0;
+    int err = 0;
+
+    if ((iov = calloc(directory->cd_nsections + 1, sizeof(struct iovec))) 
+        == NULL) {
+        return (ENOMEM);
+    }
+
+    if ((stream = open_memstream(&head, &head_len)) == NULL) {
+        err = errno;
+        goto out_free;
+    }
+
+    err = ovpn_client_config_build(vpncc, stream);
+    if (fclose(stream) != 0 && err == 0) {
+        err = EIO;
+    }
+    if (err != 0) {
+        goto out_free;
+    }
+
+    iov[n].iov_base = head;
+    iov[n++].iov_len = head_len;
+
+    for (i = 0; i < directory->cd_nsections; i++) {
+        if (directory->cd_section_ids[i] != client_id) {
+            iov[n].iov_base = (void *)directory->cd_sections[i]->sc_data;
+            iov[n++].iov_len = directory->cd_sections[i]->sc_len;
+        }
+    }
+
+    err = section_writev(fd, iov, n);
+
+out_free:
+    free(head);
+    free(iov);
+    return (err);
+}
+
+/*
+ * ccd_build writes the client-connect config of a client to a file descriptor.
+ * The networks of the client become iroutes, the networks of all other 
+ * clients become routes through the VPN server.
+ */
+int
+ccd_build(ccd_directory_t *directory, const struct vpn_client *client, int fd)
+{
+    ovpn_client_config_t *vpncc = NULL;
+    struct i_ccd_route_iter iter = {0};
+    const struct ccd_network *network = NULL;
+    size_t i = 0;
+    int err = 0;
+
+    if (directory == NULL || client == NULL || fd < 0) {
+        return (EINVAL);
+    }
+
+    if ((err = ovpn_client_config_alloc(&vpncc, client->ipv4_addr, 
+         client->ipv4_remote_addr)) != 0) {
+        return (err);
+    }
+
+    if (client->ipv6_addr[0] != '\0' &&
+        (err = ovpn_client_config_set_ipv6_addr(vpncc, client->ipv6_addr, 
+         client->ipv6_remote_addr[0] != '\0' ? client->ipv6_remote_addr : 
+         NULL)) != 0) {
+        goto out_free;
+    }
+
+    iter.ri_directory = directory;
+    iter.ri_skip_begin = i_ccd_lower_bound(directory, client->id);
+    iter.ri_skip_end = iter.ri_skip_begin;
+
+    /* Add the networks of the client as iroutes. */
+    for (i = iter.ri_skip_begin; 
+         (network = i_ccd_network_at(directory, i)) != NULL && 
+         network->cn_client_id == client->id; i++) {
+        if ((err = ovpn_client_config_add_network_entry(vpncc, 
+             &(network->cn_network))) != 0) {
+            goto out_free;
+        }
+        iter.ri_skip_end = i + 1;
+    }
+
+    if ((err = ovpn_client_config_canonicalize(vpncc, NULL)) != 0) {
+        goto out_free;
+    }
+
+    /* Mapped directories have no sections and render the routes. */
+    if (directory->cd_store != NULL) {
+        err = i_ccd_build_sections(directory, vpncc, client->id, fd);
+    } else {
+        err = ovpn_client_config_build_fd(vpncc, fd, i_ccd_route_next, 
+            &iter);
+    }
+
+out_free:
+    ovpn_client_config_free(vpncc);
+    return (err);
+}
+
+/*
+ * i_ccd_row_iter walks unparsed network rows except the rows of one client and
+ * returns them as routes without gateway. Invalid rows are skipped.
+ */
+struct i_ccd_row_iter {
+    vector_t *ri_rows;
+    size_t ri_idx;
+    int ri_skip_client_id;
+};
+
+static int
+i_ccd_row_next(void *ctx, struct ovpn_client_route *route)
+{
+    struct i_ccd_row_iter *iter = ctx;
+    struct vpn_client_network *row = NULL;
+    struct ovpn_client_network network;
+
+    while ((row = vector_at(iter->ri_rows, iter->ri_idx)) != NULL) {
+        iter->ri_idx++;
+
+        if (row->client_id == iter->ri_skip_client_id ||
+            ovpn_client_network_parse(&network, row->network_addr) != 0) {
+            continue;
+        }
+
+        memset(route, 0, sizeof(struct ovpn_client_route));
+        route->vpncr_family = network.vpncn_family;
+        route->vpncr_prefix = network.vpncn_prefix;
+
+        if (route->vpncr_family == ADDRESS_FAMILY_IPV4) {
+            route->vpncr_ipv4_addr = network.vpncn_ipv4_addr;
+        }
+        else {
+            route->vpncr_ipv6_addr = network.vpncn_ipv6_addr;
+        }
+
+        return (0);
+    }
+
+    return (ENOENT);
+}
+
+/*
+ * ccd_build_direct writes the same config as ccd_build, but reads the 
+ * networks straight from the database instead of a loaded directory. It 
+ * costs a query of all networks per call and is meant for the time until a 
+ * directory is available.
+ */
+int
+ccd_build_direct(dao_config_t *daocfg, const struct vpn_client *client, 
+    int fd)
+{
+    ovpn_client_config_t *vpncc = NULL;
+    struct i_ccd_row_iter iter = {0};
+    struct vpn_client_network *row = NULL;
+    struct ovpn_client_network network;
+    vector_t *rows = NULL;
+    int err = 0;
+
+    if (daocfg == NULL || client == NULL || fd < 0) {
+        return (EINVAL);
+    }
+
+    if ((err = vector_alloc(&rows, sizeof(struct vpn_client_network))) != 0) {
+        return (err);
+    }
+
+    if ((err = dao_vpn_client_network_find_all(daocfg, rows)) != 0 ||
+        (err = ovpn_client_config_alloc(&vpncc, client->ipv4_addr, 
+         client->ipv4_remote_addr)) != 0) {
+        goto out_free;
+    }
+
+    if (client->ipv6_addr[0] != '\0' &&
+        (err = ovpn_client_config_set_ipv6_addr(vpncc, client->ipv6_addr, 
+         client->ipv6_remote_addr[0] != '\0' ? client->ipv6_remote_addr : 
+         NULL)) != 0) {
+        goto out_free;
+    }
+
+    /* Add the networks of the client as iroutes. */
+    for (row = vector_begin(rows); row != vector_end(rows); 
+         row = vector_next(rows, row)) {
+        if (row->client_id != client->id ||
+            ovpn_client_network_parse(&network, row->network_addr) != 0) {
+            continue;
+        }
+
+        if ((err = ovpn_client_config_add_network_entry(vpncc, &network)) 
+            != 0) {
+            goto out_free;
+        }
+    }
+
+    if ((err = ovpn_client_config_canonicalize(vpncc, NULL)) != 0) {
+        goto out_free;
+    }
+
+    iter.ri_rows = rows;
+    iter.ri_skip_client_id = client->id;
+    err = ovpn_client_config_build_fd(vpncc, fd, i_ccd_row_next, &iter);
+
+out_free:
+    ovpn_client_config_free(vpncc);
+    vector_free(rows);
+    return (err);
+}
+
+/*
+ * i_ccd_valid_filename checks if a common name can be used as file name in 
+ * the config directory. Names starting with a dot are reserved for temporary 
+ * files.
+ */
+static int
+i_ccd_valid_filename(const char *cn)
+{
+    return (cn[0] != '\0' && cn[0] != '.' && strchr(cn, '/') == NULL);
+}
+
+/*
+ * ccd_write_file writes the client-connect config of a client atomically into
+ * the config directory, the file is named by the common name. Readers see 
+ * either the previous or the new file, never a partial one. The rename itself
+ * survives a crash only after the directory is synced, see ccd_sync_dir.
+ */
+int
+ccd_write_file(ccd_directory_t *directory, const struct vpn_client *client,
+               const char *dir)
+{
+    char tmp_path[PATH_MAX], path[PATH_MAX];
+    int fd = -1, err = 0;
+
+    if (directory == NULL || client == NULL || dir == NULL) {
+        return (EINVAL);
+    }
+
+    if (!i_ccd_valid_filename(client->cn)) {
+        return (EINVAL);
+    }
+
+    if (snprintf(path, sizeof(path), "%s/%s", dir, client->cn) 
+        >= (int)sizeof(path) ||
+        snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.XXXXXX", dir, client->cn) 
+        >= (int)sizeof(tmp_path)) {
+        return (ENAMETOOLONG);
+    }
+
+    if ((fd = mkstemp(tmp_path)) == -1) {
+        return (errno);
+    }
+
+    if ((err = ccd_build(directory, client, fd)) != 0) {
+        goto out_unlink;
+    }
+
+    /* The data has to be on disk before the rename makes it visible. */
+    if (fchmod(fd, 0644) == -1 || fsync(fd) == -1 || close(fd) == -1) {
+        fd = -1;
+        err = errno;
+        goto out_unlink;
+    }
+    fd = -1;
+
+    if (rename(tmp_path, path) == -1) {
+        err = errno;
+        goto out_unlink;
+    }
+
+    return (0);
+
+out_unlink:
+    if (fd != -1) {
+        close(fd);
+    }
+    unlink(tmp_path);
+    return (err);
+}
+
+/*
+ * ccd_sync_dir flushes the entries of the config directory to disk, so the
+ * files renamed into it by ccd_write_file survive a crash. A batch of writes
+ * needs a single sync at its end.
+ */
+int
+ccd_sync_dir(const char *dir)
+{
+    int fd = -1, err = 0;
+
+    if (dir == NULL) {
+        return (EINVAL);
+    }
+
+    if ((fd = open(dir, O_RDONLY | O_DIRECTORY)) == -1) {
+        return (errno);
+    }
+
+    if (fsync(fd) == -1) {
+        err = errno;
+    }
+
+    close(fd);
+    return (err);
+}
+
+/*
+ * i_ccd_pregen contains the state shared by the pre-generation threads. The 
+ * threads take chunks of client ids by incrementing pg_next_chunk.
+ */
+struct i_ccd_pregen {
+    const char *pg_db_filename;
+    const char *pg_dir;
+    ccd_directory_t *pg_directory;
+    vector_t *pg_ids;
+    atomic_size_t pg_next_chunk;
+    atomic_size_t pg_generated;
+};
+
+static void *
+i_ccd_pregen_thread(void *arg)
+{
+    struct i_ccd_pregen *pg = arg;
+    struct vpn_client client;
+    dao_config_t *daocfg = NULL;
+    size_t chunk = 0, i = 0, n = vector_size(pg->pg_ids);
+    int err = 0;
+
+    /* Every thread uses its own database connection. */
+    if ((err = dao_alloc(&daocfg, pg->pg_db_filename)) != 0 ||
+        (err = dao_db_open(daocfg)) != 0) {
+        dao_free(daocfg);
+        return ((void *)(intptr_t)err);
+    }
+
+    while ((chunk = atomic_fetch_add(&(pg->pg_next_chunk), 1)) * 
+           CCD_PREGEN_CHUNK_SIZE < n) {
+        for (i = chunk * CCD_PREGEN_CHUNK_SIZE; 
+             i < n && i < (chunk + 1) * CCD_PREGEN_CHUNK_SIZE; i++) {
+            if ((err = dao_vpn_client_find_by_id(daocfg, 
+                 *(int *)vector_at(pg->pg_ids, i), &client)) != 0 ||
+                (err = ccd_write_file(pg->pg_directory, &client, 
+                 pg->pg_dir)) != 0) {
+                log_error("Failed to generate config of client %d: "
+                    "%s", *(int *)vector_at(pg->pg_ids, i), strerror(err));
+                continue;
+            }
+
+            atomic_fetch_add(&(pg->pg_generated), 1);
+        }
+    }
+
+    dao_free(daocfg);
+    return (NULL);
+}
+
+/*
+ * ccd_pregenerate writes the client-connect configs of all active clients 
+ * into a config directory. The clients are split into chunks, which are 
+ * processed by the given number of threads. With 0 threads one thread per 
+ * online CPU is used. Returns an error if not every config was generated, 
+ * the error of a thread without database connection takes precedence, or if
+ * the directory couldn't be synced after the files were written.
+ */
+int
+ccd_pregenerate(const char *db_filename, const char *dir, size_t threads,
+                struct ccd_pregen_stats *stats)
+{
+    struct i_ccd_pregen pg = {0};
+    struct ccd_pregen_stats local_stats = {0};
+    struct timespec start, end;
+    dao_config_t *daocfg = NULL;
+    pthread_t *tids = NULL;
+    void *result = NULL;
+    size_t i = 0, started = 0;
+    int thread_err = 0, sync_err = 0, err = 0;
+
+    if (db_filename == NULL || dir == NULL) {
+        return (EINVAL);
+    }
+
+    if (stats == NULL) {
+        stats = &local_stats;
+    }
+    memset(stats, 0, sizeof(struct ccd_pregen_stats));
+
+    if (threads == 0 && (long)(threads = sysconf(_SC_NPROCESSORS_ONLN)) <= 0) {
+        threads = 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pg.pg_db_filename = db_filename;
+    pg.pg_dir = dir;
+
+    if ((err = dao_alloc(&daocfg, db_filename)) != 0 ||
+        (err = vector_alloc(&(pg.pg_ids), sizeof(int))) != 0 ||
+        (err = dao_vpn_client_find_active_ids(daocfg, pg.pg_ids)) != 0 ||
+        (err = ccd_directory_load(&(pg.pg_directory), daocfg)) != 0) {
+        goto out_free;
+    }
+
+    if ((tids = calloc(threads, sizeof(pthread_t))) == NULL) {
+        err = ENOMEM;
+        goto out_free;
+    }
+
+    for (started = 0; started < threads; started++) {
+        if ((err = pthread_create(&tids[started], NULL, i_ccd_pregen_thread, 
+             &pg)) != 0) {
+            break;
+        }
+    }
+
+    for (i = 0; i < started; i++) {
+        pthread_join(tids[i], &result);
+        if (result != NULL && thread_err == 0) {
+            thread_err = (int)(intptr_t)result;
+        }
+    }
+
+    /* One sync of the directory covers the renames of all threads. */
+    if (atomic_load(&(pg.pg_generated)) > 0 && 
+        (sync_err = ccd_sync_dir(dir)) != 0) {
+        log_error("Failed to sync the config directory %s: %s", dir, 
+            strerror(sync_err));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    stats->ps_clients = vector_size(pg.pg_ids);
+    stats->ps_generated = atomic_load(&(pg.pg_generated));
+    stats->ps_threads = started;
+    stats->ps_seconds = (end.tv_sec - start.tv_sec) + 
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    /* Chunks no thread could process count as failed, too. */
+    stats->ps_failed = stats->ps_clients - stats->ps_generated;
+
+    /* Threads which failed to start are fine if the others did the work. */
+    if (stats->ps_generated < stats->ps_clients) {
+        err = (thread_err != 0 ? thread_err : (err != 0 ? err : EIO));
+    } else {
+        err = sync_err;
+    }
+
+out_free:
+    free(tids);
+    ccd_directory_free(pg.pg_directory);
+    vector_free(pg.pg_ids);
+    dao_free(daocfg);
+    return (err);
+}
@@ -0,0 +1,223 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "ctlsock.h"
+
+/*
+ * ctlsock is a local stream socket, which answers line based commands. A 
+ * single thread serves the connections one after another, so the handler 
+ * never runs concurrently with itself.
+ */
+struct ctlsock {
+    char *cs_path;
+    int cs_fd;
+    int cs_wakeup[2];  /* Pipe to stop the thread */
+    pthread_t cs_thread;
+    ctlsock_handler_fn cs_handler;
+    void *cs_handler_ctx;
+};
+
+/*
+ * i_ctlsock_serve reads command lines until the peer closes the connection or
+ * stays idle for CTLSOCK_IDLE_TIMEOUT seconds.
+ */
+static void
+i_ctlsock_serve(ctlsock_t *cs, int fd)
+{
+    FILE *in = NULL, *out = NULL;
+    struct timeval timeout = { CTLSOCK_IDLE_TIMEOUT, 0 };
+    char *line = NULL;
+    size_t line_sz = 0;
+    ssize_t len = 0;
+    int out_fd = -1;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if ((out_fd = dup(fd)) < 0 || (in = fdopen(fd, "r")) == NULL) {
+        close(fd);
+        goto out_close;
+    }
+
+    if ((out = fdopen(out_fd, "w")) == NULL) {
+        goto out_close;
+    }
+    out_fd = -1;
+
+    while ((len = getline(&line, &line_sz, in)) > 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+
+        if (len > 0 && cs->cs_handler(cs->cs_handler_ctx, line, out) != 0) {
+            fprintf(out, "error\n");
+        }
+
+        fprintf(out, "\n");
+        if (fflush(out) != 0) {
+            break;
+        }
+    }
+
+out_close:
+    free(line);
+    if (out != NULL) {
+        fclose(out);
+    }
+    if (out_fd >= 0) {
+        close(out_fd);
+    }
+    if (in != NULL) {
+        fclose(in);
+    }
+}
+
+static void *
+i_ctlsock_thread(void *arg)
+{
+    ctlsock_t *cs = arg;
+    struct pollfd fds[2];
+    int fd = -1;
+
+    fds[0].fd = cs->cs_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = cs->cs_wakeup[0];
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (fds[1].revents != 0) {
+            break;
+        }
+
+        if ((fd = accept(cs->cs_fd, NULL, NULL)) >= 0) {
+            i_ctlsock_serve(cs, fd);
+        }
+    }
+
+    return (NULL);
+}
+
+/*
+ * ctlsock_open creates the control socket at path and starts serving it. An
+ * existing socket file is replaced. The socket is only accessible by the 
+ * owner.
+ */
+int
+ctlsock_open(ctlsock_t **csp, const char *path, ctlsock_handler_fn handler, 
+    void *handler_ctx)
+{
+    struct sockaddr_un addr;
+    mode_t mask = 0;
+    int err = 0, rc = 0;
+
+    if (csp == NULL || path == NULL || handler == NULL) {
+        return (EINVAL);
+    }
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return (ENAMETOOLONG);
+    }
+
+    if ((*csp = calloc(1, sizeof(ctlsock_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    (*csp)->cs_fd = -1;
+    (*csp)->cs_wakeup[0] = (*csp)->cs_wakeup[1] = -1;
+    (*csp)->cs_handler = handler;
+    (*csp)->cs_handler_ctx = handler_ctx;
+
+    if (((*csp)->cs_path = strdup(path)) == NULL) {
+        err = ENOMEM;
+        goto out_free;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (pipe((*csp)->cs_wakeup) != 0 ||
+        ((*csp)->cs_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        err = errno;
+        goto out_free;
+    }
+
+    unlink(path);
+
+    /* The socket is created with 0600, it's never accessible by others. */
+    mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    rc = bind((*csp)->cs_fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+
+    if (rc != 0 || listen((*csp)->cs_fd, 16) != 0) {
+        err = errno;
+        goto out_free;
+    }
+
+    if ((err = pthread_create(&((*csp)->cs_thread), NULL, i_ctlsock_thread, 
+        *csp)) != 0) {
+        goto out_free;
+    }
+
+    return (0);
+
+out_free:
+    if ((*csp)->cs_fd >= 0) {
+        close((*csp)->cs_fd);
+        unlink(path);
+    }
+    if ((*csp)->cs_wakeup[0] >= 0) {
+        close((*csp)->cs_wakeup[0]);
+        close((*csp)->cs_wakeup[1]);
+    }
+    free((*csp)->cs_path);
+    free(*csp);
+    *csp = NULL;
+    return (err);
+}
+
+/*
+ * ctlsock_close stops the thread and removes the control socket. A connection
+ * in progress is finished first.
+ */
+void
+ctlsock_close(ctlsock_t *cs)
+{
+    if (cs == NULL) {
+        return;
+    }
+
+    /* The pipe is empty and blocking, only a signal interrupts the write. */
+    while (write(cs->cs_wakeup[1], "", 1) < 0 && errno == EINTR) {
+    }
+    pthread_join(cs->cs_thread, NULL);
+
+    close(cs->cs_fd);
+    unlink(cs->cs_path);
+    close(cs->cs_wakeup[0]);
+    close(cs->cs_wakeup[1]);
+
+    free(cs->cs_path);
+    free(cs);
+}
@@ -4,11 +4,14 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 
 #include "dao.h"
+#include "log.h"
 
 /* 
  * dao_config contains all attributes to connect the SQLite database and it's 
@@ -17,6 +20,9 @@
 struct dao_config {
     char *db_filename;
     sqlite3 *db;
+    sqlite3_stmt *bulk_client_stmt;   /* Prepared by dao_bulk_begin */
+    sqlite3_stmt *bulk_network_stmt;
+    bool is_replica;  /* db is an in-memory copy, see dao_replica_open */
 };
 
 /* 
@@ -74,9 +80,71 @@ dao_free(dao_config_t *daocfg)
     free(daocfg);
 }
 
+/* 
+ * dao_db_filename returns the filename of the SQLite database, e.g. to open 
+ * another connection for a worker thread. 
+ */ 
+const char *
+dao_db_filename(dao_config_t *daocfg)
+{
+    return (daocfg != NULL ? daocfg->db_filename : NULL);
+}
+
+/*
+ * i_dao_replica_copy copies the database file into a new in-memory database
+ * with the online backup API. The copy is made in a single step, so it is a 
+ * consistent snapshot and the read lock on the file is held only once.
+ */
+static int
+i_dao_replica_copy(dao_config_t *daocfg)
+{
+    sqlite3 *src = NULL, *dst = NULL;
+    sqlite3_backup *backup = NULL;
+    int rc = 0, err = 0;
+
+    if (sqlite3_open_v2(daocfg->db_filename, &src, SQLITE_OPEN_READONLY, 
+        NULL) != SQLITE_OK) {
+        log_error("Cannot open database: %s", sqlite3_errmsg(src));
+        err = EIO;
+        goto out_close;
+    }
+
+    if (sqlite3_open(":memory:", &dst) != SQLITE_OK) {
+        log_error("Cannot open replica: %s", sqlite3_errmsg(dst));
+        err = EIO;
+        goto out_close;
+    }
+
+    /* Writers of other connections delay the copy like a query. */
+    sqlite3_busy_timeout(src, DAO_BUSY_TIMEOUT_MS);
+
+    if ((backup = sqlite3_backup_init(dst, "main", src, "main")) == NULL) {
+        log_error("Failed to copy database: %s", sqlite3_errmsg(dst));
+        err = EIO;
+        goto out_close;
+    }
+
+    rc = sqlite3_backup_step(backup, -1);
+    sqlite3_backup_finish(backup);
+
+    if (rc != SQLITE_DONE) {
+        log_error("Failed to copy database: %s", sqlite3_errstr(rc));
+        err = (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) ? EBUSY : EIO;
+        goto out_close;
+    }
+
+    daocfg->db = dst;
+    dst = NULL;
+
+out_close:
+    sqlite3_close(dst);
+    sqlite3_close(src);
+    return (err);
+}
+
 /* 
  * dao_db_open opens the SQLite database and stores the handler in the 
- * dao_config. 
+ * dao_config. A replica is copied from the file again.
  */ 
 int
 dao_db_open(dao_config_t *daocfg)
@@ -84,9 +152,13 @@ dao_db_open(dao_config_t *daocfg)
     if (daocfg == NULL) {
         return (EINVAL);
     }
+
+    if (daocfg->is_replica) {
+        return (i_dao_replica_copy(daocfg));
+    }
     
     if (sqlite3_open(daocfg->db_filename, &(daocfg->db)) != SQLITE_OK) {
-        fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(daocfg->db));
+        log_error("Cannot open database: %s", sqlite3_errmsg(daocfg->db));
         sqlite3_close(daocfg->db);
 
         /* Reset db pointer to NULL */
@@ -95,6 +167,9 @@ dao_db_open(dao_config_t *daocfg)
         return (EIO);
     }
 
+    /* Wait for writers of other connections instead of failing at once. */
+    sqlite3_busy_timeout(daocfg->db, DAO_BUSY_TIMEOUT_MS);
+
     return (0);
 }
 
@@ -109,6 +184,12 @@ dao_db_close(dao_config_t *daocfg)
     }
 
     if (daocfg->db != NULL) {
+        /* Statements of an unfinished bulk load prevent closing the db. */
+        sqlite3_finalize(daocfg->bulk_client_stmt);
+        sqlite3_finalize(daocfg->bulk_network_stmt);
+        daocfg->bulk_client_stmt = NULL;
+        daocfg->bulk_network_stmt = NULL;
+
         sqlite3_close(daocfg->db);
         
         /* Reset db pointer to NULL */
@@ -118,6 +199,37 @@ dao_db_close(dao_config_t *daocfg)
     return (0);
 }
 
+/*
+ * dao_replica_open opens an in-memory replica of the database instead of the
+ * file. The query functions run against the replica unchanged, without disk
+ * I/O and without waiting for the locks of other writers. The replica is a 
+ * snapshot, changes of the file are seen after the next dao_replica_open 
+ * with a new dao_config. Writes return EROFS, they would get lost.
+ */
+int
+dao_replica_open(dao_config_t *daocfg)
+{
+    if (daocfg == NULL || daocfg->db != NULL) {
+        return (EINVAL);
+    }
+
+    daocfg->is_replica = true;
+    return (dao_db_open(daocfg));
+}
+
+/*
+ * i_dao_writable opens the database for a write, replicas are read-only.
+ */
+static int
+i_dao_writable(dao_config_t *daocfg)
+{
+    if (daocfg->is_replica) {
+        return (EROFS);
+    }
+
+    return (daocfg->db == NULL ? dao_db_open(daocfg) : 0);
+}
+
 int
 dao_create_vpn_client(dao_config_t *daocfg, const char *cn, 
     const char *ipv4_addr, const char *ipv4_remote_addr, const char *ipv6_addr, 
@@ -131,7 +243,7 @@ dao_create_vpn_client(dao_config_t *daocfg, const char *cn,
         return (EINVAL);
     }
 
-    if (daocfg->db == NULL && (err = dao_db_open(daocfg)) != 0) {
+    if ((err = i_dao_writable(daocfg)) != 0) {
         return (err);
     }
 
@@ -140,7 +252,7 @@ dao_create_vpn_client(dao_config_t *daocfg, const char *cn,
         "VALUES (?, ?, ?, ?, ?);";
 
     if (sqlite3_prepare_v2(daocfg->db, sql, -1, &stmt, 0) != SQLITE_OK) {
-        fprintf(stderr, "Failed to execute statement: %s\n", 
+        log_error("Failed to execute statement: %s", 
             sqlite3_errmsg(daocfg->db));
         err = EIO;
         goto out_sql_finalize;
@@ -152,7 +264,7 @@ dao_create_vpn_client(dao_config_t *daocfg, const char *cn,
         != SQLITE_OK ||
         sqlite3_bind_text(stmt, 3, ipv4_remote_addr, strlen(ipv4_remote_addr), 
          SQLITE_STATIC) != SQLITE_OK) {
-        fprintf(stderr, "Failed to bind value to statement: %s\n", 
+        log_error("Failed to bind value to statement: %s", 
             sqlite3_errmsg(daocfg->db));
         err = EINVAL;
         goto out_sql_finalize;
@@ -187,7 +299,7 @@ dao_create_vpn_client(dao_config_t *daocfg, const char *cn,
     }
 
     if (sqlite3_step(stmt) != SQLITE_DONE) {
-        fprintf(stderr, "Failed to step statement: %s\n", 
+        log_error("Failed to step statement: %s", 
             sqlite3_errmsg(daocfg->db));
         err = EIO;
         goto out_sql_finalize;
@@ -217,6 +329,55 @@ i_dao_copy_nullable_str(char *dst, const char *src, size_t num)
     }
 }
 
+/*
+ * i_dao_vpn_client_from_stmt copies the current result row of a VPN client 
+ * statement into the model. The columns have to be selected in the order of
+ * I_DAO_VPN_CLIENT_COLUMNS.
+ */
+#define I_DAO_VPN_CLIENT_COLUMNS \
+    "ID, CN, IS_ACTIVE, IPV4_ADDR, IPV4_REMOTE_ADDR, IPV6_ADDR, " \
+    "IPV6_REMOTE_ADDR "
+
+static void
+i_dao_vpn_client_from_stmt(sqlite3_stmt *stmt, struct vpn_client *model)
+{
+    assert(stmt != NULL);
+    assert(model != NULL);
+
+    /* Zero model to receive a clean result. */
+    memset(model, 0, sizeof(struct vpn_client));
+
+    model->id = sqlite3_column_int(stmt, 0);
+    i_dao_copy_str(model->cn, (const char *)sqlite3_column_text(stmt, 1), 
+        RFC5280_CN_MAX_LENGTH - 1);
+    model->is_active = sqlite3_column_int(stmt, 2);
+    i_dao_copy_str(model->ipv4_addr,
+        (const char *)sqlite3_column_text(stmt, 3), INET_ADDRSTRLEN - 1);
+    i_dao_copy_str(model->ipv4_remote_addr, 
+        (const char *)sqlite3_column_text(stmt, 4), INET_ADDRSTRLEN - 1);
+    i_dao_copy_nullable_str(model->ipv6_addr, 
+        (const char *)sqlite3_column_text(stmt, 5), 
+        INET6_ADDRSTRLEN_W_PREFIX - 1);
+    i_dao_copy_nullable_str(model->ipv6_remote_addr, 
+        (const char *)sqlite3_column_text(stmt, 6), INET6_ADDRSTRLEN - 1);
+}
+
+/*
+ * i_dao_step_error maps the result of a step without row to an error. A locked
+ * database must not look like a missing row.
+ */
+static int
+i_dao_step_error(dao_config_t *daocfg, int rc)
+{
+    if (rc == SQLITE_DONE) {
+        return (ENOENT);
+    }
+
+    log_error("Failed to step statement: %s", 
+        sqlite3_errmsg(daocfg->db));
+    return (rc == SQLITE_BUSY || rc == SQLITE_LOCKED ? EBUSY : EIO);
+}
+
 /* 
  * dao_vpn_client_find_by_cn searches the SQLite database for a VPN client entry
  * with the given common name (cn). 
@@ -226,7 +387,7 @@ dao_vpn_client_find_by_cn(dao_config_t *daocfg, const char *cn,
                           struct vpn_client *model)
 {
     sqlite3_stmt *stmt = NULL;
-    int err = 0;
+    int err = 0, rc = 0;
 
     if (daocfg == NULL || cn == NULL || model == NULL) {
         return (EINVAL);
@@ -238,45 +399,238 @@ dao_vpn_client_find_by_cn(dao_config_t *daocfg, const char *cn,
     }
 
     char *sql = 
-        "SELECT ID, CN, IS_ACTIVE, IPV4_ADDR, IPV4_REMOTE_ADDR, IPV6_ADDR, "
-        "    IPV6_REMOTE_ADDR "
+        "SELECT " I_DAO_VPN_CLIENT_COLUMNS
         "FROM VPN_CLIENTS "
         "WHERE CN = ?";
 
     if (sqlite3_prepare_v2(daocfg->db, sql, -1, &stmt, 0) != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare statement: %s\n", 
+        log_error("Failed to prepare statement: %s", 
             sqlite3_errmsg(daocfg->db));
         err = EIO;
         goto out_sql_finalize;
     }
 
     if (sqlite3_bind_text(stmt, 1, cn, strlen(cn), SQLITE_STATIC) != SQLITE_OK) {
-        fprintf(stderr, "Failed to bind param: %s\n", 
+        log_error("Failed to bind param: %s", 
             sqlite3_errmsg(daocfg->db));
         err = EIO;
         goto out_sql_finalize;
     }
 
-    if (sqlite3_step(stmt) != SQLITE_ROW) {
-        err = ENOENT;
+    if ((rc = sqlite3_step(stmt)) != SQLITE_ROW) {
+        err = i_dao_step_error(daocfg, rc);
         goto out_sql_finalize;
     }
 
-    /* Zero model to receive a clean result. */
-    memset(model, 0, sizeof(struct vpn_client));
+    i_dao_vpn_client_from_stmt(stmt, model);
 
-    model->id = sqlite3_column_int(stmt, 0);
-    i_dao_copy_str(model->cn, (const char *)sqlite3_column_text(stmt, 1), 
-        RFC5280_CN_MAX_LENGTH);
-    model->is_active = sqlite3_column_int(stmt, 2);
-    i_dao_copy_str(model->ipv4_addr,
-        (const char *)sqlite3_column_text(stmt, 3), INET_ADDRSTRLEN);
-    i_dao_copy_str(model->ipv4_remote_addr, 
-        (const char *)sqlite3_column_text(stmt, 4), INET_ADDRSTRLEN);
-    i_dao_copy_nullable_str(model->ipv6_addr, 
-        (const char *)sqlite3_column_text(stmt, 5), INET6_ADDRSTRLEN_W_PREFIX);
-    i_dao_copy_nullable_str(model->ipv6_addr, 
-        (const char *)sqlite3_column_text(stmt, 6), INET6_ADDRSTRLEN);
+out_sql_finalize:
+    sqlite3_finalize(stmt);
+    return (err);
+}
+
+/* 
+ * dao_vpn_client_find_by_id searches the SQLite database for a VPN client entry
+ * with the given id. 
+ */ 
+int
+dao_vpn_client_find_by_id(dao_config_t *daocfg, int id, 
+                          struct vpn_client *model)
+{
+    sqlite3_stmt *stmt = NULL;
+    int err = 0, rc = 0;
+
+    if (daocfg == NULL || model == NULL) {
+        return (EINVAL);
+    }
+
+    /* Ensure that the SQLite database is open. On error exit. */
+    if (daocfg->db == NULL && (err = dao_db_open(daocfg)) != 0) {
+        return (err);
+    }
+
+    char *sql = 
+        "SELECT " I_DAO_VPN_CLIENT_COLUMNS
+        "FROM VPN_CLIENTS "
+        "WHERE ID = ?";
+
+    if (sqlite3_prepare_v2(daocfg->db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        log_error("Failed to prepare statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+        goto out_sql_finalize;
+    }
+
+    if (sqlite3_bind_int(stmt, 1, id) != SQLITE_OK) {
+        log_error("Failed to bind param: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+        goto out_sql_finalize;
+    }
+
+    if ((rc = sqlite3_step(stmt)) != SQLITE_ROW) {
+        err = i_dao_step_error(daocfg, rc);
+        goto out_sql_finalize;
+    }
+
+    i_dao_vpn_client_from_stmt(stmt, model);
+
+out_sql_finalize:
+    sqlite3_finalize(stmt);
+    return (err);
+}
+
+/* 
+ * dao_vpn_client_find_active_ids reads the ids of all active VPN clients in
+ * ascending order. The ids are stored as int in results.
+ */ 
+int
+dao_vpn_client_find_active_ids(dao_config_t *daocfg, vector_t *results)
+{
+    sqlite3_stmt *stmt = NULL;
+    int err = 0, rc = 0, id = 0;
+
+    if (daocfg == NULL || results == NULL) {
+        return (EINVAL);
+    }
+
+    /* Ensure that the SQLite database is open. On error exit. */
+    if (daocfg->db == NULL && (err = dao_db_open(daocfg)) != 0) {
+        return (err);
+    }
+
+    char *sql = 
+        "SELECT ID "
+        "FROM VPN_CLIENTS "
+        "WHERE IS_ACTIVE = 1 "
+        "ORDER BY ID";
+
+    if (sqlite3_prepare_v2(daocfg->db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        log_error("Failed to prepare statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+        goto out_sql_finalize;
+    }
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        id = sqlite3_column_int(stmt, 0);
+
+        if ((err = vector_push_back(results, &id)) != 0) {
+            goto out_sql_finalize;
+        }
+    }
+
+    if (rc != SQLITE_DONE) {
+        log_error("Failed to step statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+    }
+
+out_sql_finalize:
+    sqlite3_finalize(stmt);
+    return (err);
+}
+
+/* 
+ * dao_vpn_client_find_active_cns reads the common names of all active VPN 
+ * clients. The names are stored as char[RFC5280_CN_MAX_LENGTH] in results.
+ */ 
+int
+dao_vpn_client_find_active_cns(dao_config_t *daocfg, vector_t *results)
+{
+    sqlite3_stmt *stmt = NULL;
+    char cn[RFC5280_CN_MAX_LENGTH];
+    int err = 0, rc = 0;
+
+    if (daocfg == NULL || results == NULL) {
+        return (EINVAL);
+    }
+
+    /* Ensure that the SQLite database is open. On error exit. */
+    if (daocfg->db == NULL && (err = dao_db_open(daocfg)) != 0) {
+        return (err);
+    }
+
+    char *sql = 
+        "SELECT CN "
+        "FROM VPN_CLIENTS "
+        "WHERE IS_ACTIVE = 1 AND CN IS NOT NULL";
+
+    if (sqlite3_prepare_v2(daocfg->db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        log_error("Failed to prepare statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+        goto out_sql_finalize;
+    }
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        memset(cn, 0, sizeof(cn));
+        i_dao_copy_str(cn, (const char *)sqlite3_column_text(stmt, 0), 
+            RFC5280_CN_MAX_LENGTH - 1);
+
+        if ((err = vector_push_back(results, cn)) != 0) {
+            goto out_sql_finalize;
+        }
+    }
+
+    if (rc != SQLITE_DONE) {
+        log_error("Failed to step statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+    }
+
+out_sql_finalize:
+    sqlite3_finalize(stmt);
+    return (err);
+}
+
+/* 
+ * dao_vpn_client_find_active reads all active VPN clients ordered by common 
+ * name. The order matches strcmp, the clients are stored as struct vpn_client 
+ * in results.
+ */ 
+int
+dao_vpn_client_find_active(dao_config_t *daocfg, vector_t *results)
+{
+    sqlite3_stmt *stmt = NULL;
+    struct vpn_client model;
+    int err = 0, rc = 0;
+
+    if (daocfg == NULL || results == NULL) {
+        return (EINVAL);
+    }
+
+    /* Ensure that the SQLite database is open. On error exit. */
+    if (daocfg->db == NULL && (err = dao_db_open(daocfg)) != 0) {
+        return (err);
+    }
+
+    char *sql = 
+        "SELECT " I_DAO_VPN_CLIENT_COLUMNS
+        "FROM VPN_CLIENTS "
+        "WHERE IS_ACTIVE = 1 AND CN IS NOT NULL "
+        "ORDER BY CN COLLATE BINARY";
+
+    if (sqlite3_prepare_v2(daocfg->db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        log_error("Failed to prepare statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+        goto out_sql_finalize;
+    }
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        i_dao_vpn_client_from_stmt(stmt, &model);
+
+        if ((err = vector_push_back(results, &model)) != 0) {
+            goto out_sql_finalize;
+        }
+    }
+
+    if (rc != SQLITE_DONE) {
+        log_error("Failed to step statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+    }
 
 out_sql_finalize:
     sqlite3_finalize(stmt);
@@ -293,7 +647,7 @@ dao_vpn_client_network_find_by_client_id(dao_config_t *daocfg, int client_id,
 {
     sqlite3_stmt *stmt = NULL;
     struct vpn_client_network row = {0};
-    int err = 0;
+    int err = 0, rc = 0;
 
     if (daocfg == NULL || results == NULL || client_id == 0) {
         return (EINVAL);
@@ -310,20 +664,20 @@ dao_vpn_client_network_find_by_client_id(dao_config_t *daocfg, int client_id,
         "WHERE CLIENT_ID = ?";
 
     if (sqlite3_prepare_v2(daocfg->db, sql, -1, &stmt, 0) != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare statement: %s\n", 
+        log_error("Failed to prepare statement: %s", 
             sqlite3_errmsg(daocfg->db));
         err = EIO;
         goto out_sql_finalize;
     }
 
     if (sqlite3_bind_int(stmt, 1, client_id) != SQLITE_OK) {
-        fprintf(stderr, "Failed to bind param: %s\n", 
+        log_error("Failed to bind param: %s", 
             sqlite3_errmsg(daocfg->db));
         err = EIO;
         goto out_sql_finalize;
     }
 
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
         /* Zero model to receive a clean result. */
         memset(&row, 0, sizeof(struct vpn_client_network));
 
@@ -333,10 +687,889 @@ dao_vpn_client_network_find_by_client_id(dao_config_t *daocfg, int client_id,
             (const char *)sqlite3_column_text(stmt, 2), 
             INET6_ADDRSTRLEN_W_PREFIX);
 
-        vector_push_back(results, &row);
+        if ((err = vector_push_back(results, &row)) != 0) {
+            goto out_sql_finalize;
+        }
+    }
+
+    /* A partial list must not look like a client without networks. */
+    if (rc != SQLITE_DONE) {
+        err = i_dao_step_error(daocfg, rc);
     }
 
 out_sql_finalize:
     sqlite3_finalize(stmt);
     return (err);
 }
+
+/* 
+ * dao_vpn_client_network_find_all reads all VPN client network entries of the
+ * SQLite database, ordered by client_id.
+ */ 
+int
+dao_vpn_client_network_find_all(dao_config_t *daocfg, vector_t *results)
+{
+    sqlite3_stmt *stmt = NULL;
+    struct vpn_client_network row = {0};
+    int err = 0, rc = 0;
+
+    if (daocfg == NULL || results == NULL) {
+        return (EINVAL);
+    }
+
+    /* Ensure that the SQLite database is open. On error exit. */
+    if (daocfg->db == NULL && (err = dao_db_open(daocfg)) != 0) {
+        return (err);
+    }
+
+    char *sql = 
+        "SELECT ID, CLIENT_ID, NETWORK_ADDR "
+        "FROM VPN_CLIENT_NETWORKS "
+        "ORDER BY CLIENT_ID";
+
+    if (sqlite3_prepare_v2(daocfg->db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        log_error("Failed to prepare statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+        goto out_sql_finalize;
+    }
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        /* Zero model to receive a clean result. */
+        memset(&row, 0, sizeof(struct vpn_client_network));
+
+        row.id = sqlite3_column_int(stmt, 0);
+        row.client_id = sqlite3_column_int(stmt, 1);
+        i_dao_copy_str(row.network_addr, 
+            (const char *)sqlite3_column_text(stmt, 2), 
+            INET6_ADDRSTRLEN_W_PREFIX - 1);
+
+        if ((err = vector_push_back(results, &row)) != 0) {
+            goto out_sql_finalize;
+        }
+    }
+
+    if (rc != SQLITE_DONE) {
+        log_error("Failed to step statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+    }
+
+out_sql_finalize:
+    sqlite3_finalize(stmt);
+    return (err);
+}
+
+/*
+ * i_dao_lease_table_ensure creates the VPN_CLIENT_LEASES table, which is owned
+ * by the plugin and therefore created on first use.
+ */
+static int
+i_dao_lease_table_ensure(dao_config_t *daocfg)
+{
+    char *errmsg = NULL;
+
+    assert(daocfg != NULL);
+    assert(daocfg->db != NULL);
+
+    char *sql = 
+        "CREATE TABLE IF NOT EXISTS VPN_CLIENT_LEASES ("
+        "CLIENT_ID INTEGER PRIMARY KEY, "
+        "IS_ACTIVE INTEGER NOT NULL DEFAULT(0), "
+        "IPV4_ADDR TEXT, "
+        "IPV6_ADDR TEXT, "
+        "FOREIGN KEY(CLIENT_ID) REFERENCES VPN_CLIENTS(ID))";
+
+    if (sqlite3_exec(daocfg->db, sql, NULL, NULL, &errmsg) != SQLITE_OK) {
+        log_error("Failed to create lease table: %s", errmsg);
+        sqlite3_free(errmsg);
+        return (EIO);
+    }
+
+    return (0);
+}
+
+/*
+ * dao_vpn_client_lease_find_all reads all address leases. The leases are 
+ * stored as struct vpn_client_lease in results.
+ */
+int
+dao_vpn_client_lease_find_all(dao_config_t *daocfg, vector_t *results)
+{
+    sqlite3_stmt *stmt = NULL;
+    struct vpn_client_lease lease;
+    int err = 0, rc = 0;
+
+    if (daocfg == NULL || results == NULL) {
+        return (EINVAL);
+    }
+
+    /* Ensure that the SQLite database is open. On error exit. */
+    if (daocfg->db == NULL && (err = dao_db_open(daocfg)) != 0) {
+        return (err);
+    }
+
+    if ((err = i_dao_lease_table_ensure(daocfg)) != 0) {
+        return (err);
+    }
+
+    char *sql = 
+        "SELECT CLIENT_ID, IS_ACTIVE, IPV4_ADDR, IPV6_ADDR "
+        "FROM VPN_CLIENT_LEASES "
+        "ORDER BY CLIENT_ID";
+
+    if (sqlite3_prepare_v2(daocfg->db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        log_error("Failed to prepare statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+        goto out_sql_finalize;
+    }
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        memset(&lease, 0, sizeof(lease));
+
+        lease.client_id = sqlite3_column_int(stmt, 0);
+        lease.is_active = sqlite3_column_int(stmt, 1);
+        i_dao_copy_nullable_str(lease.ipv4_addr, 
+            (const char *)sqlite3_column_text(stmt, 2), INET_ADDRSTRLEN - 1);
+        i_dao_copy_nullable_str(lease.ipv6_addr, 
+            (const char *)sqlite3_column_text(stmt, 3), INET6_ADDRSTRLEN - 1);
+
+        if ((err = vector_push_back(results, &lease)) != 0) {
+            goto out_sql_finalize;
+        }
+    }
+
+    if (rc != SQLITE_DONE) {
+        log_error("Failed to step statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+    }
+
+out_sql_finalize:
+    sqlite3_finalize(stmt);
+    return (err);
+}
+
+static int
+i_dao_bind_nullable_text(sqlite3_stmt *stmt, int idx, const char *str)
+{
+    if (str[0] == '\0') {
+        return (sqlite3_bind_null(stmt, idx));
+    }
+
+    return (sqlite3_bind_text(stmt, idx, str, strlen(str), SQLITE_STATIC));
+}
+
+/*
+ * dao_vpn_client_lease_save_all inserts or replaces the given leases of type 
+ * struct vpn_client_lease within a single transaction. Either all or none of
+ * the leases are stored.
+ */
+int
+dao_vpn_client_lease_save_all(dao_config_t *daocfg, vector_t *leases)
+{
+    sqlite3_stmt *stmt = NULL;
+    struct vpn_client_lease *lease = NULL;
+    int err = 0;
+
+    if (daocfg == NULL || leases == NULL) {
+        return (EINVAL);
+    }
+
+    if (vector_empty(leases)) {
+        return (0);
+    }
+
+    /* Ensure that the SQLite database is open for writes. On error exit. */
+    if ((err = i_dao_writable(daocfg)) != 0) {
+        return (err);
+    }
+
+    if ((err = i_dao_lease_table_ensure(daocfg)) != 0) {
+        return (err);
+    }
+
+    char *sql = 
+        "INSERT OR REPLACE INTO VPN_CLIENT_LEASES "
+        "(CLIENT_ID, IS_ACTIVE, IPV4_ADDR, IPV6_ADDR) "
+        "VALUES (?, ?, ?, ?)";
+
+    if (sqlite3_exec(daocfg->db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK) {
+        log_error("Failed to begin transaction: %s", 
+            sqlite3_errmsg(daocfg->db));
+        return (EIO);
+    }
+
+    if (sqlite3_prepare_v2(daocfg->db, sql, -1, &stmt, 0) != SQLITE_OK) {
+        log_error("Failed to prepare statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+        goto out_rollback;
+    }
+
+    for (lease = vector_begin(leases); lease != vector_end(leases); 
+         lease = vector_next(leases, lease)) {
+        if (sqlite3_bind_int(stmt, 1, lease->client_id) != SQLITE_OK ||
+            sqlite3_bind_int(stmt, 2, lease->is_active) != SQLITE_OK ||
+            i_dao_bind_nullable_text(stmt, 3, lease->ipv4_addr) != SQLITE_OK ||
+            i_dao_bind_nullable_text(stmt, 4, lease->ipv6_addr) != SQLITE_OK) {
+            log_error("Failed to bind param: %s", 
+                sqlite3_errmsg(daocfg->db));
+            err = EIO;
+            goto out_rollback;
+        }
+
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            log_error("Failed to step statement: %s", 
+                sqlite3_errmsg(daocfg->db));
+            err = EIO;
+            goto out_rollback;
+        }
+
+        sqlite3_reset(stmt);
+    }
+
+    sqlite3_finalize(stmt);
+
+    if (sqlite3_exec(daocfg->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+        log_error("Failed to commit transaction: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+        goto out_rollback_finalized;
+    }
+
+    return (0);
+
+out_rollback:
+    sqlite3_finalize(stmt);
+out_rollback_finalized:
+    sqlite3_exec(daocfg->db, "ROLLBACK", NULL, NULL, NULL);
+    return (err);
+}
+
+/*
+ * i_dao_session_table_ensure creates the VPN_SESSIONS table and its index, 
+ * which are owned by the plugin and therefore created on first use.
+ */
+static int
+i_dao_session_table_ensure(dao_config_t *daocfg)
+{
+    char *errmsg = NULL;
+
+    assert(daocfg != NULL);
+    assert(daocfg->db != NULL);
+
+    char *sql = 
+        "CREATE TABLE IF NOT EXISTS VPN_SESSIONS ("
+        "ID INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "CN TEXT NOT NULL, "
+        "IPV4_ADDR TEXT, "
+        "IPV6_ADDR TEXT, "
+        "STARTED_AT INTEGER, "
+        "ENDED_AT INTEGER, "
+        "BYTES_RECEIVED INTEGER, "
+        "BYTES_SENT INTEGER); "
+        "CREATE INDEX IF NOT EXISTS VPN_SESSIONS_CN_ENDED_AT "
+        "ON VPN_SESSIONS (CN, ENDED_AT)";
+
+    if (sqlite3_exec(daocfg->db, sql, NULL, NULL, &errmsg) != SQLITE_OK) {
+        log_error("Failed to create session table: %s", errmsg);
+        sqlite3_free(errmsg);
+        return (EIO);
+    }
+
+    return (0);
+}
+
+static int
+i_dao_bind_time(sqlite3_stmt *stmt, int idx, long long t)
+{
+    if (t == 0) {
+        return (sqlite3_bind_null(stmt, idx));
+    }
+
+    return (sqlite3_bind_int64(stmt, idx, t));
+}
+
+/*
+ * i_dao_vpn_session_close closes the latest open session of the CN. closed is
+ * false if there is no open session, e.g. the start event got lost.
+ */
+static int
+i_dao_vpn_session_close(dao_config_t *daocfg, sqlite3_stmt *stmt, 
+    const struct vpn_session *session, bool *closed)
+{
+    int rc = 0;
+
+    if (sqlite3_bind_int64(stmt, 1, session->ended_at) != SQLITE_OK ||
+        sqlite3_bind_int64(stmt, 2, session->bytes_received) != SQLITE_OK ||
+        sqlite3_bind_int64(stmt, 3, session->bytes_sent) != SQLITE_OK ||
+        sqlite3_bind_text(stmt, 4, session->cn, strlen(session->cn), 
+         SQLITE_STATIC) != SQLITE_OK) {
+        return (EIO);
+    }
+
+    rc = sqlite3_step(stmt);
+    *closed = (rc == SQLITE_DONE && sqlite3_changes(daocfg->db) > 0);
+    sqlite3_reset(stmt);
+
+    return (rc == SQLITE_DONE ? 0 : EIO);
+}
+
+/*
+ * i_dao_vpn_session_insert inserts a session. The end and the byte counters 
+ * are only stored for end events.
+ */
+static int
+i_dao_vpn_session_insert(sqlite3_stmt *stmt, const struct vpn_session *session)
+{
+    int rc = 0;
+
+    if (sqlite3_bind_text(stmt, 1, session->cn, strlen(session->cn), 
+         SQLITE_STATIC) != SQLITE_OK ||
+        i_dao_bind_nullable_text(stmt, 2, session->ipv4_addr) != SQLITE_OK ||
+        i_dao_bind_nullable_text(stmt, 3, session->ipv6_addr) != SQLITE_OK ||
+        i_dao_bind_time(stmt, 4, session->started_at) != SQLITE_OK) {
+        return (EIO);
+    }
+
+    if (session->is_end &&
+        (i_dao_bind_time(stmt, 5, session->ended_at) != SQLITE_OK ||
+         sqlite3_bind_int64(stmt, 6, session->bytes_received) != SQLITE_OK ||
+         sqlite3_bind_int64(stmt, 7, session->bytes_sent) != SQLITE_OK)) {
+        return (EIO);
+    }
+
+    rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    return (rc == SQLITE_DONE ? 0 : EIO);
+}
+
+/*
+ * dao_vpn_session_save_all stores the given session events of type struct 
+ * vpn_session within a single transaction. A start event inserts a session, 
+ * an end event closes the latest open session of the CN.
+ */
+int
+dao_vpn_session_save_all(dao_config_t *daocfg, vector_t *sessions)
+{
+    sqlite3_stmt *insert_stmt = NULL, *update_stmt = NULL;
+    struct vpn_session *session = NULL;
+    bool closed = false;
+    int err = 0;
+
+    if (daocfg == NULL || sessions == NULL) {
+        return (EINVAL);
+    }
+
+    if (vector_empty(sessions)) {
+        return (0);
+    }
+
+    /* Ensure that the SQLite database is open for writes. On error exit. */
+    if ((err = i_dao_writable(daocfg)) != 0) {
+        return (err);
+    }
+
+    if ((err = i_dao_session_table_ensure(daocfg)) != 0) {
+        return (err);
+    }
+
+    char *insert_sql = 
+        "INSERT INTO VPN_SESSIONS (CN, IPV4_ADDR, IPV6_ADDR, STARTED_AT, "
+        "ENDED_AT, BYTES_RECEIVED, BYTES_SENT) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?)";
+
+    char *update_sql = 
+        "UPDATE VPN_SESSIONS "
+        "SET ENDED_AT = ?, BYTES_RECEIVED = ?, BYTES_SENT = ? "
+        "WHERE ID = (SELECT MAX(ID) FROM VPN_SESSIONS "
+        "WHERE CN = ? AND ENDED_AT IS NULL)";
+
+    if (sqlite3_exec(daocfg->db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK) {
+        log_error("Failed to begin transaction: %s", 
+            sqlite3_errmsg(daocfg->db));
+        return (EIO);
+    }
+
+    if (sqlite3_prepare_v2(daocfg->db, insert_sql, -1, &insert_stmt, 0) 
+        != SQLITE_OK ||
+        sqlite3_prepare_v2(daocfg->db, update_sql, -1, &update_stmt, 0) 
+        != SQLITE_OK) {
+        log_error("Failed to prepare statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+        goto out_rollback;
+    }
+
+    for (session = vector_begin(sessions); session != vector_end(sessions); 
+         session = vector_next(sessions, session)) {
+        closed = false;
+
+        if ((session->is_end && (err = i_dao_vpn_session_close(daocfg, 
+             update_stmt, session, &closed)) != 0) ||
+            (!closed && (err = i_dao_vpn_session_insert(insert_stmt, session)) 
+             != 0)) {
+            log_error("Failed to store session: %s", 
+                sqlite3_errmsg(daocfg->db));
+            goto out_rollback;
+        }
+    }
+
+    sqlite3_finalize(update_stmt);
+    sqlite3_finalize(insert_stmt);
+
+    if (sqlite3_exec(daocfg->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+        log_error("Failed to commit transaction: %s", 
+            sqlite3_errmsg(daocfg->db));
+        sqlite3_exec(daocfg->db, "ROLLBACK", NULL, NULL, NULL);
+        return (EIO);
+    }
+
+    return (0);
+
+out_rollback:
+    sqlite3_finalize(update_stmt);
+    sqlite3_finalize(insert_stmt);
+    sqlite3_exec(daocfg->db, "ROLLBACK", NULL, NULL, NULL);
+    return (err);
+}
+
+/*
+ * The change feed logs every change of the client tables in VPN_CHANGES. The
+ * log is written by triggers, so it's complete regardless of the writer. The
+ * generation of a change is its AUTOINCREMENT key, which is never reused, so
+ * the generation counter is monotonic even after pruning.
+ */
+#define I_DAO_CHANGE_TRIGGER(name, event, table, op, row, row_id, client_id) \
+    "CREATE TRIGGER IF NOT EXISTS " name " AFTER " event " ON " table " " \
+    "BEGIN INSERT INTO VPN_CHANGES (TABLE_NAME, OPERATION, ROW_ID, " \
+    "CLIENT_ID) VALUES ('" table "', '" op "', " row "." row_id ", " \
+    row "." client_id "); END; "
+
+#define I_DAO_CREATE_CHANGE_FEED \
+    "CREATE TABLE IF NOT EXISTS VPN_CHANGES (" \
+    "GENERATION INTEGER PRIMARY KEY AUTOINCREMENT, " \
+    "TABLE_NAME TEXT NOT NULL, " \
+    "OPERATION TEXT NOT NULL, " \
+    "ROW_ID INTEGER, " \
+    "CLIENT_ID INTEGER); " \
+    I_DAO_CHANGE_TRIGGER("VPN_CLIENTS_INSERT_CHANGE", "INSERT", \
+        "VPN_CLIENTS", "INSERT", "NEW", "ID", "ID") \
+    I_DAO_CHANGE_TRIGGER("VPN_CLIENTS_UPDATE_CHANGE", "UPDATE", \
+        "VPN_CLIENTS", "UPDATE", "NEW", "ID", "ID") \
+    I_DAO_CHANGE_TRIGGER("VPN_CLIENTS_DELETE_CHANGE", "DELETE", \
+        "VPN_CLIENTS", "DELETE", "OLD", "ID", "ID") \
+    I_DAO_CHANGE_TRIGGER("VPN_CLIENT_NETWORKS_INSERT_CHANGE", "INSERT", \
+        "VPN_CLIENT_NETWORKS", "INSERT", "NEW", "ID", "CLIENT_ID") \
+    I_DAO_CHANGE_TRIGGER("VPN_CLIENT_NETWORKS_UPDATE_CHANGE", "UPDATE", \
+        "VPN_CLIENT_NETWORKS", "UPDATE", "NEW", "ID", "CLIENT_ID") \
+    I_DAO_CHANGE_TRIGGER("VPN_CLIENT_NETWORKS_DELETE_CHANGE", "DELETE", \
+        "VPN_CLIENT_NETWORKS", "DELETE", "OLD", "ID", "CLIENT_ID") \
+    "CREATE TRIGGER IF NOT EXISTS VPN_CLIENT_NETWORKS_MOVE_CHANGE " \
+    "AFTER UPDATE OF CLIENT_ID ON VPN_CLIENT_NETWORKS " \
+    "WHEN OLD.CLIENT_ID <> NEW.CLIENT_ID " \
+    "BEGIN INSERT INTO VPN_CHANGES (TABLE_NAME, OPERATION, ROW_ID, " \
+    "CLIENT_ID) VALUES ('VPN_CLIENT_NETWORKS', 'DELETE', OLD.ID, " \
+    "OLD.CLIENT_ID); END"
+
+#define I_DAO_DROP_CHANGE_TRIGGERS \
+    "DROP TRIGGER IF EXISTS VPN_CLIENTS_INSERT_CHANGE; " \
+    "DROP TRIGGER IF EXISTS VPN_CLIENTS_UPDATE_CHANGE; " \
+    "DROP TRIGGER IF EXISTS VPN_CLIENTS_DELETE_CHANGE; " \
+    "DROP TRIGGER IF EXISTS VPN_CLIENT_NETWORKS_INSERT_CHANGE; " \
+    "DROP TRIGGER IF EXISTS VPN_CLIENT_NETWORKS_UPDATE_CHANGE; " \
+    "DROP TRIGGER IF EXISTS VPN_CLIENT_NETWORKS_DELETE_CHANGE; " \
+    "DROP TRIGGER IF EXISTS VPN_CLIENT_NETWORKS_MOVE_CHANGE"
+
+/*
+ * dao_change_feed_ensure creates the change log and its triggers.
+ */
+int
+dao_change_feed_ensure(dao_config_t *daocfg)
+{
+    char *errmsg = NULL;
+    int err = 0;
+
+    if (daocfg == NULL) {
+        return (EINVAL);
+    }
+
+    /* Ensure that the SQLite database is open. On error exit. */
+    if (daocfg->db == NULL && (err = dao_db_open(daocfg)) != 0) {
+        return (err);
+    }
+
+    if (sqlite3_exec(daocfg->db, I_DAO_CREATE_CHANGE_FEED, NULL, NULL, 
+        &errmsg) != SQLITE_OK) {
+        log_error("Failed to create change feed: %s", errmsg);
+        sqlite3_free(errmsg);
+        return (EIO);
+    }
+
+    return (0);
+}
+
+static int
+i_dao_select_int64(dao_config_t *daocfg, const char *sql, long long param, 
+    long long *result)
+{
+    sqlite3_stmt *stmt = NULL;
+    int err = 0;
+
+    if (sqlite3_prepare_v2(daocfg->db, sql, -1, &stmt, 0) != SQLITE_OK ||
+        sqlite3_bind_int64(stmt, 1, param) != SQLITE_OK ||
+        sqlite3_step(stmt) != SQLITE_ROW) {
+        log_error("Failed to query: %s", sqlite3_errmsg(daocfg->db));
+        err = EIO;
+        goto out_sql_finalize;
+    }
+
+    *result = sqlite3_column_int64(stmt, 0);
+
+out_sql_finalize:
+    sqlite3_finalize(stmt);
+    return (err);
+}
+
+/*
+ * dao_change_generation reads the generation of the latest change, 0 if 
+ * nothing has changed yet.
+ */
+int
+dao_change_generation(dao_config_t *daocfg, long long *generation)
+{
+    int err = 0;
+
+    if (daocfg == NULL || generation == NULL) {
+        return (EINVAL);
+    }
+
+    if ((err = dao_change_feed_ensure(daocfg)) != 0) {
+        return (err);
+    }
+
+    return (i_dao_select_int64(daocfg, 
+        "SELECT COALESCE((SELECT SEQ FROM SQLITE_SEQUENCE "
+        "WHERE NAME = 'VPN_CHANGES'), ?)", 0, generation));
+}
+
+/*
+ * dao_change_find_since reads all changes after the given generation in 
+ * ascending order. They are stored as struct vpn_change in results. Returns 
+ * ESTALE if changes after the generation were pruned already, then the 
+ * caller has to reload everything.
+ */
+int
+dao_change_find_since(dao_config_t *daocfg, long long generation, 
+    vector_t *results)
+{
+    sqlite3_stmt *stmt = NULL;
+    struct vpn_change change;
+    long long horizon = 0;
+    const char *op = NULL;
+    int err = 0, rc = 0;
+
+    if (daocfg == NULL || results == NULL) {
+        return (EINVAL);
+    }
+
+    if ((err = dao_change_feed_ensure(daocfg)) != 0) {
+        return (err);
+    }
+
+    /* All changes up to the horizon were pruned. */
+    if ((err = i_dao_select_int64(daocfg, 
+        "SELECT COALESCE((SELECT MIN(GENERATION) - 1 FROM VPN_CHANGES), "
+        "(SELECT SEQ FROM SQLITE_SEQUENCE WHERE NAME = 'VPN_CHANGES'), ?)", 
+        0, &horizon)) != 0) {
+        return (err);
+    }
+
+    if (generation < horizon) {
+        return (ESTALE);
+    }
+
+    char *sql = 
+        "SELECT GENERATION, TABLE_NAME, OPERATION, ROW_ID, CLIENT_ID "
+        "FROM VPN_CHANGES "
+        "WHERE GENERATION > ? "
+        "ORDER BY GENERATION";
+
+    if (sqlite3_prepare_v2(daocfg->db, sql, -1, &stmt, 0) != SQLITE_OK ||
+        sqlite3_bind_int64(stmt, 1, generation) != SQLITE_OK) {
+        log_error("Failed to prepare statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+        goto out_sql_finalize;
+    }
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        memset(&change, 0, sizeof(change));
+
+        change.generation = sqlite3_column_int64(stmt, 0);
+        change.is_network = (strcmp((const char *)sqlite3_column_text(stmt, 1),
+            "VPN_CLIENT_NETWORKS") == 0);
+        change.row_id = sqlite3_column_int(stmt, 3);
+        change.client_id = sqlite3_column_int(stmt, 4);
+
+        op = (const char *)sqlite3_column_text(stmt, 2);
+        if (strcmp(op, "INSERT") == 0) {
+            change.operation = VPN_CHANGE_INSERT;
+        } else if (strcmp(op, "UPDATE") == 0) {
+            change.operation = VPN_CHANGE_UPDATE;
+        } else if (strcmp(op, "DELETE") == 0) {
+            change.operation = VPN_CHANGE_DELETE;
+        } else {
+            change.operation = VPN_CHANGE_RELOAD;
+        }
+
+        if ((err = vector_push_back(results, &change)) != 0) {
+            goto out_sql_finalize;
+        }
+    }
+
+    if (rc != SQLITE_DONE) {
+        log_error("Failed to step statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+    }
+
+out_sql_finalize:
+    sqlite3_finalize(stmt);
+    return (err);
+}
+
+/*
+ * dao_change_prune deletes all changes up to the given generation.
+ */
+int
+dao_change_prune(dao_config_t *daocfg, long long generation)
+{
+    sqlite3_stmt *stmt = NULL;
+    int err = 0;
+
+    if (daocfg == NULL) {
+        return (EINVAL);
+    }
+
+    if ((err = i_dao_writable(daocfg)) != 0 ||
+        (err = dao_change_feed_ensure(daocfg)) != 0) {
+        return (err);
+    }
+
+    if (sqlite3_prepare_v2(daocfg->db, 
+         "DELETE FROM VPN_CHANGES WHERE GENERATION <= ?", -1, &stmt, 0) 
+        != SQLITE_OK ||
+        sqlite3_bind_int64(stmt, 1, generation) != SQLITE_OK ||
+        sqlite3_step(stmt) != SQLITE_DONE) {
+        log_error("Failed to prune changes: %s", 
+            sqlite3_errmsg(daocfg->db));
+        err = EIO;
+    }
+
+    sqlite3_finalize(stmt);
+    return (err);
+}
+
+/* 
+ * Secondary indexes of the client tables. They are dropped during a bulk 
+ * load and rebuilt once afterwards, which is much faster than updating them 
+ * for every inserted row.
+ */
+#define I_DAO_DROP_INDEXES \
+    "DROP INDEX IF EXISTS VPN_CLIENTS_CN; " \
+    "DROP INDEX IF EXISTS VPN_CLIENT_NETWORKS_CLIENT_ID"
+
+#define I_DAO_CREATE_INDEXES \
+    "CREATE INDEX IF NOT EXISTS VPN_CLIENTS_CN ON VPN_CLIENTS (CN); " \
+    "CREATE INDEX IF NOT EXISTS VPN_CLIENT_NETWORKS_CLIENT_ID " \
+    "ON VPN_CLIENT_NETWORKS (CLIENT_ID)"
+
+static void
+i_dao_bulk_finalize(dao_config_t *daocfg)
+{
+    sqlite3_finalize(daocfg->bulk_client_stmt);
+    sqlite3_finalize(daocfg->bulk_network_stmt);
+    daocfg->bulk_client_stmt = NULL;
+    daocfg->bulk_network_stmt = NULL;
+}
+
+/*
+ * dao_bulk_begin starts a bulk load. All clients and networks added until 
+ * dao_bulk_commit are inserted within a single transaction with statements 
+ * prepared once. The secondary indexes and the change feed triggers are 
+ * dropped within the transaction, so a rollback restores them.
+ */
+int
+dao_bulk_begin(dao_config_t *daocfg)
+{
+    char *errmsg = NULL;
+    int err = 0;
+
+    if (daocfg == NULL || daocfg->bulk_client_stmt != NULL) {
+        return (EINVAL);
+    }
+
+    /* Ensure that the SQLite database is open for writes. On error exit. */
+    if ((err = i_dao_writable(daocfg)) != 0) {
+        return (err);
+    }
+
+    char *client_sql = 
+        "INSERT INTO VPN_CLIENTS (CN, IS_ACTIVE, IPV4_ADDR, IPV4_REMOTE_ADDR, "
+        "IPV6_ADDR, IPV6_REMOTE_ADDR) "
+        "VALUES (?, ?, ?, ?, ?, ?)";
+
+    char *network_sql = 
+        "INSERT INTO VPN_CLIENT_NETWORKS (CLIENT_ID, NETWORK_ADDR) "
+        "VALUES (?, ?)";
+
+    if (sqlite3_exec(daocfg->db, "BEGIN; " I_DAO_DROP_INDEXES "; " 
+        I_DAO_DROP_CHANGE_TRIGGERS, NULL, NULL, &errmsg) != SQLITE_OK) {
+        log_error("Failed to begin bulk load: %s", errmsg);
+        sqlite3_free(errmsg);
+        sqlite3_exec(daocfg->db, "ROLLBACK", NULL, NULL, NULL);
+        return (EIO);
+    }
+
+    if (sqlite3_prepare_v2(daocfg->db, client_sql, -1, 
+         &(daocfg->bulk_client_stmt), 0) != SQLITE_OK ||
+        sqlite3_prepare_v2(daocfg->db, network_sql, -1, 
+         &(daocfg->bulk_network_stmt), 0) != SQLITE_OK) {
+        log_error("Failed to prepare statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        dao_bulk_rollback(daocfg);
+        return (EIO);
+    }
+
+    return (0);
+}
+
+/*
+ * dao_bulk_add_client inserts a client of a bulk load and stores its new id.
+ * Empty addresses are stored as empty IPv4 and NULL IPv6 addresses.
+ */
+int
+dao_bulk_add_client(dao_config_t *daocfg, const struct vpn_client *client, 
+    int *id)
+{
+    sqlite3_stmt *stmt = NULL;
+    int rc = 0;
+
+    if (daocfg == NULL || client == NULL || id == NULL || 
+        daocfg->bulk_client_stmt == NULL) {
+        return (EINVAL);
+    }
+
+    stmt = daocfg->bulk_client_stmt;
+
+    if (sqlite3_bind_text(stmt, 1, client->cn, strlen(client->cn), 
+         SQLITE_STATIC) != SQLITE_OK ||
+        sqlite3_bind_int(stmt, 2, client->is_active ? 1 : 0) != SQLITE_OK ||
+        sqlite3_bind_text(stmt, 3, client->ipv4_addr, 
+         strlen(client->ipv4_addr), SQLITE_STATIC) != SQLITE_OK ||
+        sqlite3_bind_text(stmt, 4, client->ipv4_remote_addr, 
+         strlen(client->ipv4_remote_addr), SQLITE_STATIC) != SQLITE_OK ||
+        i_dao_bind_nullable_text(stmt, 5, client->ipv6_addr) != SQLITE_OK ||
+        i_dao_bind_nullable_text(stmt, 6, client->ipv6_remote_addr) 
+        != SQLITE_OK) {
+        log_error("Failed to bind param: %s", 
+            sqlite3_errmsg(daocfg->db));
+        return (EIO);
+    }
+
+    rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+
+    if (rc != SQLITE_DONE) {
+        log_error("Failed to step statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        return (EIO);
+    }
+
+    *id = (int)sqlite3_last_insert_rowid(daocfg->db);
+    return (0);
+}
+
+/*
+ * dao_bulk_add_network inserts a network of a bulk load for the given client.
+ */
+int
+dao_bulk_add_network(dao_config_t *daocfg, int client_id, const char *network)
+{
+    sqlite3_stmt *stmt = NULL;
+    int rc = 0;
+
+    if (daocfg == NULL || network == NULL || 
+        daocfg->bulk_network_stmt == NULL) {
+        return (EINVAL);
+    }
+
+    stmt = daocfg->bulk_network_stmt;
+
+    if (sqlite3_bind_int(stmt, 1, client_id) != SQLITE_OK ||
+        sqlite3_bind_text(stmt, 2, network, strlen(network), SQLITE_STATIC) 
+        != SQLITE_OK) {
+        log_error("Failed to bind param: %s", 
+            sqlite3_errmsg(daocfg->db));
+        return (EIO);
+    }
+
+    rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+
+    if (rc != SQLITE_DONE) {
+        log_error("Failed to step statement: %s", 
+            sqlite3_errmsg(daocfg->db));
+        return (EIO);
+    }
+
+    return (0);
+}
+
+/*
+ * dao_bulk_commit rebuilds the secondary indexes and commits the bulk load. 
+ * Instead of a change per row, a single reload change is logged.
+ */
+int
+dao_bulk_commit(dao_config_t *daocfg)
+{
+    char *errmsg = NULL;
+
+    if (daocfg == NULL || daocfg->bulk_client_stmt == NULL) {
+        return (EINVAL);
+    }
+
+    i_dao_bulk_finalize(daocfg);
+
+    if (sqlite3_exec(daocfg->db, I_DAO_CREATE_INDEXES "; " 
+        I_DAO_CREATE_CHANGE_FEED "; "
+        "INSERT INTO VPN_CHANGES (TABLE_NAME, OPERATION) "
+        "VALUES ('VPN_CLIENTS', 'RELOAD'); COMMIT", NULL, NULL, &errmsg) 
+        != SQLITE_OK) {
+        log_error("Failed to commit bulk load: %s", errmsg);
+        sqlite3_free(errmsg);
+        sqlite3_exec(daocfg->db, "ROLLBACK", NULL, NULL, NULL);
+        return (EIO);
+    }
+
+    return (0);
+}
+
+/*
+ * dao_bulk_rollback discards a bulk load.
+ */
+void
+dao_bulk_rollback(dao_config_t *daocfg)
+{
+    if (daocfg == NULL || daocfg->db == NULL) {
+        return;
+    }
+
+    i_dao_bulk_finalize(daocfg);
+    sqlite3_exec(daocfg->db, "ROLLBACK", NULL, NULL, NULL);
+}
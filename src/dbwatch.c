@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <libgen.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "dbwatch.h"
+
+#define I_DBWATCH_MASK \
+    (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO)
+
+/*
+ * dbwatch_file is a watched file. The parent directory is watched instead of
+ * the file itself, so files which are replaced by a rename or created later,
+ * like the WAL of a SQLite database, are noticed as well.
+ */
+struct dbwatch_file {
+    int wf_wd;
+    char *wf_name;
+};
+
+/*
+ * dbwatch runs a thread, which sleeps in poll until inotify reports a change
+ * of a watched file. Changes are collected until no change arrived for
+ * DBWATCH_DEBOUNCE_MS, then the handler is called once. Nothing is polled
+ * periodically, an unchanged file costs no work at all.
+ */
+struct dbwatch {
+    int dw_fd;
+    int dw_wakeup[2];  /* Pipe to stop the thread */
+    pthread_t dw_thread;
+    struct dbwatch_file *dw_files;
+    size_t dw_nfiles;
+    dbwatch_handler_fn dw_handler;
+    void *dw_handler_ctx;
+};
+
+static int64_t
+i_dbwatch_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/*
+ * i_dbwatch_read drains the inotify descriptor and returns 1 if one of the
+ * events concerns a watched file.
+ */
+static int
+i_dbwatch_read(dbwatch_t *dw)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev = NULL;
+    ssize_t len = 0;
+    size_t i = 0;
+    int changed = 0;
+
+    while ((len = read(dw->dw_fd, buf, sizeof(buf))) > 0) {
+        for (ev = (const struct inotify_event *)buf;
+             (const char *)ev < buf + len;
+             ev = (const struct inotify_event *)((const char *)ev +
+             sizeof(struct inotify_event) + ev->len)) {
+            /* The queue overflowed, assume that everything changed. */
+            if ((ev->mask & IN_Q_OVERFLOW) != 0) {
+                changed = 1;
+                continue;
+            }
+
+            for (i = 0; i < dw->dw_nfiles && ev->len > 0; i++) {
+                if (dw->dw_files[i].wf_wd == ev->wd &&
+                    strcmp(dw->dw_files[i].wf_name, ev->name) == 0) {
+                    changed = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    return (changed);
+}
+
+static void *
+i_dbwatch_thread(void *arg)
+{
+    dbwatch_t *dw = arg;
+    struct pollfd fds[2];
+    int64_t first = 0, last = 0, now = 0, due = 0;
+    int pending = 0, timeout = -1;
+
+    fds[0].fd = dw->dw_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = dw->dw_wakeup[0];
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        if (poll(fds, 2, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (fds[1].revents != 0) {
+            break;
+        }
+
+        now = i_dbwatch_now_ms();
+
+        if (fds[0].revents != 0 && i_dbwatch_read(dw)) {
+            if (!pending) {
+                pending = 1;
+                first = now;
+            }
+            last = now;
+        }
+
+        if (!pending) {
+            timeout = -1;
+            continue;
+        }
+
+        /* Wait for a quiet period, but not forever under constant writes. */
+        due = last + DBWATCH_DEBOUNCE_MS;
+        if (due > first + DBWATCH_MAX_DELAY_MS) {
+            due = first + DBWATCH_MAX_DELAY_MS;
+        }
+
+        if (now >= due) {
+            pending = 0;
+            timeout = -1;
+            dw->dw_handler(dw->dw_handler_ctx);
+        } else {
+            timeout = (int)(due - now);
+        }
+    }
+
+    return (NULL);
+}
+
+/*
+ * i_dbwatch_add watches the parent directory of a file for changes of the
+ * file.
+ */
+static int
+i_dbwatch_add(dbwatch_t *dw, const char *path)
+{
+    char dir_buf[PATH_MAX], name_buf[PATH_MAX];
+    struct dbwatch_file *file = &(dw->dw_files[dw->dw_nfiles]);
+
+    if (strlen(path) >= PATH_MAX) {
+        return (ENAMETOOLONG);
+    }
+
+    /* dirname and basename may modify their argument. */
+    strcpy(dir_buf, path);
+    strcpy(name_buf, path);
+
+    if ((file->wf_name = strdup(basename(name_buf))) == NULL) {
+        return (ENOMEM);
+    }
+
+    if ((file->wf_wd = inotify_add_watch(dw->dw_fd, dirname(dir_buf),
+         I_DBWATCH_MASK)) < 0) {
+        free(file->wf_name);
+        return (errno);
+    }
+
+    dw->dw_nfiles++;
+    return (0);
+}
+
+/*
+ * dbwatch_open starts watching the given files and calls the handler on the
+ * watcher thread after they changed. The files don't have to exist yet, but
+ * their directories must.
+ */
+int
+dbwatch_open(dbwatch_t **dwp, const char *const *paths, size_t npaths,
+    dbwatch_handler_fn handler, void *handler_ctx)
+{
+    size_t i = 0;
+    int err = 0;
+
+    if (dwp == NULL || paths == NULL || npaths == 0 || handler == NULL) {
+        return (EINVAL);
+    }
+
+    if ((*dwp = calloc(1, sizeof(dbwatch_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    (*dwp)->dw_fd = -1;
+    (*dwp)->dw_wakeup[0] = (*dwp)->dw_wakeup[1] = -1;
+    (*dwp)->dw_handler = handler;
+    (*dwp)->dw_handler_ctx = handler_ctx;
+
+    if (((*dwp)->dw_files = calloc(npaths, sizeof(struct dbwatch_file)))
+        == NULL) {
+        err = ENOMEM;
+        goto out_free;
+    }
+
+    if (((*dwp)->dw_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ||
+        pipe((*dwp)->dw_wakeup) != 0) {
+        err = errno;
+        goto out_free;
+    }
+
+    for (i = 0; i < npaths; i++) {
+        if ((err = i_dbwatch_add(*dwp, paths[i])) != 0) {
+            goto out_free;
+        }
+    }
+
+    if ((err = pthread_create(&((*dwp)->dw_thread), NULL, i_dbwatch_thread,
+        *dwp)) != 0) {
+        goto out_free;
+    }
+
+    return (0);
+
+out_free:
+    for (i = 0; i < (*dwp)->dw_nfiles; i++) {
+        free((*dwp)->dw_files[i].wf_name);
+    }
+    if ((*dwp)->dw_fd >= 0) {
+        close((*dwp)->dw_fd);
+    }
+    if ((*dwp)->dw_wakeup[0] >= 0) {
+        close((*dwp)->dw_wakeup[0]);
+        close((*dwp)->dw_wakeup[1]);
+    }
+    free((*dwp)->dw_files);
+    free(*dwp);
+    *dwp = NULL;
+    return (err);
+}
+
+/*
+ * dbwatch_close stops the watcher thread. A running handler is finished
+ * first.
+ */
+void
+dbwatch_close(dbwatch_t *dw)
+{
+    size_t i = 0;
+
+    if (dw == NULL) {
+        return;
+    }
+
+    /* The thread never reads the pipe, a write only fails on a signal. */
+    while (write(dw->dw_wakeup[1], "", 1) < 0 && errno == EINTR) {
+    }
+    pthread_join(dw->dw_thread, NULL);
+
+    for (i = 0; i < dw->dw_nfiles; i++) {
+        free(dw->dw_files[i].wf_name);
+    }
+
+    close(dw->dw_fd);
+    close(dw->dw_wakeup[0]);
+    close(dw->dw_wakeup[1]);
+
+    free(dw->dw_files);
+    free(dw);
+}
@@ -0,0 +1,241 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "import.h"
+#include "inetx.h"
+#include "model.h"
+#include "ovpn_client_config.h"
+#include "vector.h"
+
+/*
+ * The CSV format contains one client per line:
+ *
+ *   cn,is_active,ipv4_addr,ipv4_remote_addr,ipv6_addr,ipv6_remote_addr,networks
+ *
+ * The networks are separated by spaces. Empty addresses are allowed, clients
+ * without an IPv4 address get one from the address pool. Fields can't be 
+ * quoted. Empty lines, lines starting with # and a header line starting with
+ * "cn," are skipped.
+ */
+#define I_IMPORT_FIELDS 7
+
+static int
+i_import_copy(char *dst, const char *src, size_t dst_sz)
+{
+    if (strlen(src) >= dst_sz) {
+        return (EINVAL);
+    }
+
+    strcpy(dst, src);
+    return (0);
+}
+
+static int
+i_import_check_ipv4(const char *str)
+{
+    struct in_addr addr;
+
+    return (str[0] == '\0' ? 0 : inetx_str_to_ipv4_addr(str, &addr));
+}
+
+static int
+i_import_check_ipv6(const char *str, bool with_prefix)
+{
+    struct in6_addr addr;
+    size_t prefix = 0;
+
+    if (str[0] == '\0') {
+        return (0);
+    }
+
+    if (with_prefix && strchr(str, '/') != NULL) {
+        return (inetx_parse_ipv6_cidr(str, &addr, &prefix));
+    }
+
+    return (inetx_str_to_ipv6_addr(str, &addr));
+}
+
+/*
+ * i_import_parse_line splits and validates a line. The networks are stored as
+ * pointers into the line. Returns a static error description or NULL.
+ */
+static const char *
+i_import_parse_line(char *line, struct vpn_client *client, vector_t *networks)
+{
+    struct ovpn_client_network network;
+    char *fields[I_IMPORT_FIELDS] = {0}, *token = NULL, *saveptr = NULL;
+    size_t i = 0;
+
+    memset(client, 0, sizeof(struct vpn_client));
+    vector_truncate(networks, 0);
+
+    for (i = 0; i < I_IMPORT_FIELDS && line != NULL; i++) {
+        fields[i] = strsep(&line, ",");
+    }
+
+    if (i < I_IMPORT_FIELDS - 1 || line != NULL) {
+        return ("wrong number of fields");
+    }
+
+    if (fields[0][0] == '\0' || 
+        i_import_copy(client->cn, fields[0], sizeof(client->cn)) != 0) {
+        return ("invalid cn");
+    }
+
+    if (strcmp(fields[1], "0") != 0 && strcmp(fields[1], "1") != 0) {
+        return ("is_active must be 0 or 1");
+    }
+    client->is_active = (fields[1][0] == '1');
+
+    if (i_import_copy(client->ipv4_addr, fields[2], 
+         sizeof(client->ipv4_addr)) != 0 ||
+        i_import_check_ipv4(client->ipv4_addr) != 0) {
+        return ("invalid ipv4_addr");
+    }
+
+    if (i_import_copy(client->ipv4_remote_addr, fields[3], 
+         sizeof(client->ipv4_remote_addr)) != 0 ||
+        i_import_check_ipv4(client->ipv4_remote_addr) != 0) {
+        return ("invalid ipv4_remote_addr");
+    }
+
+    if (i_import_copy(client->ipv6_addr, fields[4], 
+         sizeof(client->ipv6_addr)) != 0 ||
+        i_import_check_ipv6(client->ipv6_addr, true) != 0) {
+        return ("invalid ipv6_addr");
+    }
+
+    if (i_import_copy(client->ipv6_remote_addr, fields[5], 
+         sizeof(client->ipv6_remote_addr)) != 0 ||
+        i_import_check_ipv6(client->ipv6_remote_addr, false) != 0) {
+        return ("invalid ipv6_remote_addr");
+    }
+
+    if (fields[6] == NULL) {
+        return (NULL);
+    }
+
+    for (token = strtok_r(fields[6], " ", &saveptr); token != NULL; 
+         token = strtok_r(NULL, " ", &saveptr)) {
+        if (strlen(token) >= INET6_ADDRSTRLEN_W_PREFIX ||
+            ovpn_client_network_parse(&network, token) != 0) {
+            return ("invalid network");
+        }
+
+        if (vector_push_back(networks, &token) != 0) {
+            return ("out of memory");
+        }
+    }
+
+    return (NULL);
+}
+
+/*
+ * import_csv inserts the clients and networks read from a CSV stream within a
+ * single transaction. All lines are validated, if any line is invalid nothing
+ * is inserted and EINVAL is returned.
+ */
+int
+import_csv(dao_config_t *daocfg, FILE *stream, struct import_stats *stats)
+{
+    struct vpn_client client;
+    struct timespec start, end;
+    vector_t *networks = NULL;
+    const char *reason = NULL;
+    char *line = NULL, **network = NULL;
+    size_t line_sz = 0;
+    ssize_t len = 0;
+    int err = 0, id = 0;
+
+    if (daocfg == NULL || stream == NULL || stats == NULL) {
+        return (EINVAL);
+    }
+
+    memset(stats, 0, sizeof(struct import_stats));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if ((err = vector_alloc(&networks, sizeof(char *))) != 0) {
+        return (err);
+    }
+
+    if ((err = dao_bulk_begin(daocfg)) != 0) {
+        goto out_free;
+    }
+
+    while ((len = getline(&line, &line_sz, stream)) > 0) {
+        stats->is_lines++;
+
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+
+        if (len == 0 || line[0] == '#' || 
+            (stats->is_lines == 1 && strncmp(line, "cn,", 3) == 0)) {
+            continue;
+        }
+
+        if ((reason = i_import_parse_line(line, &client, networks)) != NULL) {
+            if (stats->is_invalid++ < IMPORT_MAX_REPORTED_ERRORS) {
+                fprintf(stderr, "Line %zu: %s\n", stats->is_lines, reason);
+            }
+            continue;
+        }
+
+        /* Keep validating, but don't insert after the first invalid line. */
+        if (stats->is_invalid > 0) {
+            continue;
+        }
+
+        if ((err = dao_bulk_add_client(daocfg, &client, &id)) != 0) {
+            goto out_rollback;
+        }
+        stats->is_clients++;
+
+        for (network = vector_begin(networks); network != vector_end(networks);
+             network = vector_next(networks, network)) {
+            if ((err = dao_bulk_add_network(daocfg, id, *network)) != 0) {
+                goto out_rollback;
+            }
+            stats->is_networks++;
+        }
+    }
+
+    if (ferror(stream)) {
+        err = EIO;
+        goto out_rollback;
+    }
+
+    if (stats->is_invalid > 0) {
+        fprintf(stderr, "%zu invalid lines, nothing imported\n", 
+            stats->is_invalid);
+        err = EINVAL;
+        goto out_rollback;
+    }
+
+    err = dao_bulk_commit(daocfg);
+    goto out_stats;
+
+out_rollback:
+    dao_bulk_rollback(daocfg);
+out_stats:
+    if (err != 0) {
+        stats->is_clients = 0;
+        stats->is_networks = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stats->is_seconds = (end.tv_sec - start.tv_sec) + 
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+out_free:
+    free(line);
+    vector_free(networks);
+    return (err);
+}
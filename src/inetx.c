@@ -4,8 +4,10 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <strings.h>
 #include <arpa/inet.h>
 
@@ -291,3 +293,189 @@ inetx_predict_address_family(const char *str, int *af)
     return (0);
 }
 
+
+/*
+ * i_parse_prefix parses an IPv4 or IPv6 address with an optional prefix 
+ * length in a single pass over the string. The family is decided by the first
+ * separator: a dot after decimal digits starts an IPv4 address, a colon an 
+ * IPv6 address. Hex groups are accumulated both as hex and as decimal value,
+ * so a dotted quad embedded in an IPv6 address doesn't need a second scan.
+ */
+static int
+i_parse_prefix(const char *str, struct inetx_prefix *prefix, bool with_length)
+{
+    uint8_t addr[16];
+    const char *p = str;
+    size_t n = 0, i = 0, max_length = 0;
+    unsigned int hex = 0, dec = 0, digits = 0, v = 0;
+    bool decimal = true, zero = false;
+    int family = 0, gap = -1;
+
+    if (str == NULL || prefix == NULL) {
+        return (EINVAL);
+    }
+
+    memset(prefix, 0, sizeof(struct inetx_prefix));
+
+    /* A leading "::" */
+    if (p[0] == ':') {
+        if (p[1] != ':') {
+            return (EINVAL);
+        }
+        family = AF_INET6;
+        gap = 0;
+        p += 2;
+    }
+
+    for (;;) {
+        /* "::" may end the address. */
+        if (gap == (int)n && (*p == '\0' || *p == '/')) {
+            break;
+        }
+
+        hex = dec = digits = 0;
+        decimal = true;
+        zero = (*p == '0');
+
+        for (;; p++) {
+            if (*p >= '0' && *p <= '9') {
+                v = *p - '0';
+            } else if ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'f') {
+                v = (*p | 0x20) - 'a' + 10;
+                decimal = false;
+            } else {
+                break;
+            }
+
+            if (++digits > 4) {
+                return (EINVAL);
+            }
+            hex = (hex << 4) | v;
+            dec = dec * 10 + v;
+        }
+
+        if (digits == 0) {
+            return (EINVAL);
+        }
+
+        /* A dotted quad, either the IPv4 address or the end of an IPv6 one */
+        if (*p == '.') {
+            if (family == 0) {
+                family = AF_INET;
+            }
+            if (n + 4 > (family == AF_INET ? 4 : 16)) {
+                return (EINVAL);
+            }
+
+            for (i = 0; ; i++) {
+                /* Leading zeros could be meant as octal, like inet_pton. */
+                if (!decimal || digits > 3 || dec > 255 || 
+                    (zero && digits > 1)) {
+                    return (EINVAL);
+                }
+                addr[n++] = dec;
+
+                if (i == 3) {
+                    break;
+                }
+                if (*p++ != '.') {
+                    return (EINVAL);
+                }
+
+                zero = (*p == '0');
+                for (dec = digits = 0; *p >= '0' && *p <= '9'; p++) {
+                    if (++digits > 3) {
+                        return (EINVAL);
+                    }
+                    dec = dec * 10 + (*p - '0');
+                }
+                if (digits == 0) {
+                    return (EINVAL);
+                }
+            }
+            break;
+        }
+
+        family = AF_INET6;
+        if (n + 2 > 16) {
+            return (EINVAL);
+        }
+        addr[n++] = hex >> 8;
+        addr[n++] = hex & 0xff;
+
+        if (*p != ':') {
+            break;
+        }
+        p++;
+
+        if (*p == ':') {
+            if (gap >= 0) {
+                return (EINVAL);
+            }
+            gap = n;
+            p++;
+        }
+    }
+
+    if (family == AF_INET) {
+        max_length = 32;
+        memcpy(&(prefix->ip_ipv4_addr), addr, 4);
+    } else {
+        /* "::" stands for at least one group of zeros. */
+        if ((gap < 0 && n != 16) || (gap >= 0 && n > 14)) {
+            return (EINVAL);
+        }
+
+        max_length = 128;
+        memset(&(prefix->ip_ipv6_addr), 0, sizeof(struct in6_addr));
+        if (gap < 0) {
+            memcpy(&(prefix->ip_ipv6_addr), addr, 16);
+        } else {
+            memcpy(&(prefix->ip_ipv6_addr), addr, gap);
+            memcpy(prefix->ip_ipv6_addr.s6_addr + 16 - (n - gap), addr + gap,
+                n - gap);
+        }
+    }
+
+    prefix->ip_family = family;
+    prefix->ip_length = max_length;
+
+    if (*p == '/') {
+        if (!with_length) {
+            return (EINVAL);
+        }
+
+        for (p++, dec = digits = 0; *p >= '0' && *p <= '9'; p++) {
+            if (++digits > 3) {
+                return (EINVAL);
+            }
+            dec = dec * 10 + (*p - '0');
+        }
+        if (digits == 0 || dec > max_length) {
+            return (EINVAL);
+        }
+        prefix->ip_length = dec;
+    }
+
+    return (*p == '\0' ? 0 : EINVAL);
+}
+
+/*
+ * inetx_parse_prefix parses an IPv4 or IPv6 address with an optional prefix
+ * length like "10.0.0.0/8" or "2001:db8::/32" and detects its family. Without
+ * a length the address is a host prefix. Host bits are kept.
+ */
+int
+inetx_parse_prefix(const char *str, struct inetx_prefix *prefix)
+{
+    return (i_parse_prefix(str, prefix, true));
+}
+
+/*
+ * inetx_parse_addr parses an IPv4 or IPv6 address without prefix length.
+ */
+int
+inetx_parse_addr(const char *str, struct inetx_prefix *prefix)
+{
+    return (i_parse_prefix(str, prefix, false));
+}
@@ -0,0 +1,671 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inetx.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define INETX_BATCH_X86
+#include <immintrin.h>
+#endif
+
+/* 
+ * i_batch_impl is the implementation forced by inetx_batch_select. Auto 
+ * selects the best kernel supported by the CPU on every batch call.
+ */
+static inetx_batch_impl_t i_batch_impl = INETX_BATCH_IMPL_AUTO;
+
+static bool
+i_batch_impl_supported(inetx_batch_impl_t impl)
+{
+    switch (impl) {
+    case INETX_BATCH_IMPL_AUTO:
+    case INETX_BATCH_IMPL_SCALAR:
+        return (true);
+#ifdef INETX_BATCH_X86
+    case INETX_BATCH_IMPL_SSE4:
+        return (__builtin_cpu_supports("sse4.1") != 0);
+    case INETX_BATCH_IMPL_AVX2:
+        return (__builtin_cpu_supports("avx2") != 0);
+#endif
+    default:
+        return (false);
+    }
+}
+
+static inetx_batch_impl_t
+i_batch_impl_resolve(void)
+{
+    if (i_batch_impl != INETX_BATCH_IMPL_AUTO) {
+        return (i_batch_impl);
+    }
+
+    if (i_batch_impl_supported(INETX_BATCH_IMPL_AVX2)) {
+        return (INETX_BATCH_IMPL_AVX2);
+    }
+
+    if (i_batch_impl_supported(INETX_BATCH_IMPL_SSE4)) {
+        return (INETX_BATCH_IMPL_SSE4);
+    }
+
+    return (INETX_BATCH_IMPL_SCALAR);
+}
+
+/* 
+ * inetx_batch_select forces the implementation of the batch functions. It's
+ * intended for benchmarks and verification only and isn't thread safe.
+ */
+int
+inetx_batch_select(inetx_batch_impl_t impl)
+{
+    if (!i_batch_impl_supported(impl)) {
+        return (ENOTSUP);
+    }
+
+    i_batch_impl = impl;
+
+    return (0);
+}
+
+/*
+ * i_parse_ipv4_prefix parses the optional "/prefix" suffix of a dotted-quad.
+ * Without a suffix the prefix is 32. Like inetx_parse_prefix, up to three
+ * digits are accepted, so "/024" is a prefix of 24.
+ */
+static int
+i_parse_ipv4_prefix(const char *str, uint8_t *prefix)
+{
+    unsigned int value = 0;
+    int i = 0;
+
+    assert(str != NULL);
+    assert(prefix != NULL);
+
+    if (str[0] == '\0') {
+        *prefix = 32;
+        return (0);
+    }
+
+    if (str[0] != '/' || str[1] < '0' || str[1] > '9') {
+        return (EINVAL);
+    }
+
+    value = str[1] - '0';
+    str += 2;
+
+    for (i = 0; i < 2 && *str >= '0' && *str <= '9'; i++, str++) {
+        value = value * 10 + (*str - '0');
+    }
+
+    if (*str != '\0' || value > 32) {
+        return (EINVAL);
+    }
+
+    *prefix = value;
+
+    return (0);
+}
+
+/*
+ * i_parse_ipv4_cidr_scalar parses a dotted-quad with an optional prefix. The
+ * address syntax is the one of inet_pton: exact four decimal octets without
+ * leading zeros. The address is returned in host byte order.
+ */
+static int
+i_parse_ipv4_cidr_scalar(const char *str, uint32_t *addr, uint8_t *prefix)
+{
+    uint32_t result = 0;
+    unsigned int octet = 0, digits = 0;
+    int i = 0;
+
+    assert(str != NULL);
+
+    for (i = 0; i < 4; i++) {
+        octet = 0;
+        digits = 0;
+
+        while (*str >= '0' && *str <= '9') {
+            /* Reject leading zeros and more than three digits. */
+            if ((digits == 1 && octet == 0) || digits == 3) {
+                return (EINVAL);
+            }
+            octet = octet * 10 + (*str - '0');
+            digits++;
+            str++;
+        }
+
+        if (digits == 0 || octet > 255) {
+            return (EINVAL);
+        }
+
+        if (i < 3 && *str++ != '.') {
+            return (EINVAL);
+        }
+
+        result = (result << 8) | octet;
+    }
+
+    if (i_parse_ipv4_prefix(str, prefix) != 0) {
+        return (EINVAL);
+    }
+
+    *addr = result;
+
+    return (0);
+}
+
+/*
+ * i_ipv4_addr_to_str_scalar formats an address in host byte order as a null
+ * terminated dotted-quad. str has to hold at least INET_ADDRSTRLEN bytes.
+ */
+static void
+i_ipv4_addr_to_str_scalar(uint32_t addr, char *str)
+{
+    unsigned int octet = 0;
+    int i = 0;
+
+    assert(str != NULL);
+
+    for (i = 3; i >= 0; i--) {
+        octet = (addr >> (i * 8)) & 0xff;
+
+        if (octet >= 100) {
+            *str++ = '0' + octet / 100;
+        }
+        if (octet >= 10) {
+            *str++ = '0' + (octet / 10) % 10;
+        }
+        *str++ = '0' + octet % 10;
+
+        if (i > 0) {
+            *str++ = '.';
+        }
+    }
+
+    *str = '\0';
+}
+
+#ifdef INETX_BATCH_X86
+
+/*
+ * i_octet_lane contains the pshufb lanes, which right align an octet of one 
+ * to three digits into the first three bytes of a 32-bit lane. The octet start
+ * is added to every byte, the zeroing bytes (0x80) stay negative.
+ */
+static const uint32_t i_octet_lane[4] = {
+    0x80808080, 0x80008080, 0x80010080, 0x80020100
+};
+
+/*
+ * i_fmt_shuffle compacts four "hto." lanes (hundreds, tens, ones and a dot) 
+ * into a null terminated dotted-quad. It's indexed by the octet lengths minus
+ * one in base 3, the first octet is the most significant digit.
+ */
+#define Z 0x80
+static const uint8_t i_fmt_shuffle[81][16] __attribute__((aligned(16))) = {
+    { 2, 3, 6, 7, 10, 11, 14, Z, Z, Z, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 6, 7, 10, 11, 13, 14, Z, Z, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 6, 7, 10, 11, 12, 13, 14, Z, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 6, 7, 9, 10, 11, 14, Z, Z, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 6, 7, 9, 10, 11, 13, 14, Z, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 6, 7, 9, 10, 11, 12, 13, 14, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 6, 7, 8, 9, 10, 11, 14, Z, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 6, 7, 8, 9, 10, 11, 13, 14, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 6, 7, 8, 9, 10, 11, 12, 13, 14, Z, Z, Z, Z, Z },
+    { 2, 3, 5, 6, 7, 10, 11, 14, Z, Z, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 5, 6, 7, 10, 11, 13, 14, Z, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 5, 6, 7, 10, 11, 12, 13, 14, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 5, 6, 7, 9, 10, 11, 14, Z, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 5, 6, 7, 9, 10, 11, 12, 13, 14, Z, Z, Z, Z, Z },
+    { 2, 3, 5, 6, 7, 8, 9, 10, 11, 14, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 5, 6, 7, 8, 9, 10, 11, 13, 14, Z, Z, Z, Z, Z },
+    { 2, 3, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, Z, Z, Z, Z },
+    { 2, 3, 4, 5, 6, 7, 10, 11, 14, Z, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 4, 5, 6, 7, 10, 11, 13, 14, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 4, 5, 6, 7, 10, 11, 12, 13, 14, Z, Z, Z, Z, Z },
+    { 2, 3, 4, 5, 6, 7, 9, 10, 11, 14, Z, Z, Z, Z, Z, Z },
+    { 2, 3, 4, 5, 6, 7, 9, 10, 11, 13, 14, Z, Z, Z, Z, Z },
+    { 2, 3, 4, 5, 6, 7, 9, 10, 11, 12, 13, 14, Z, Z, Z, Z },
+    { 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 14, Z, Z, Z, Z, Z },
+    { 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 14, Z, Z, Z, Z },
+    { 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, Z, Z, Z },
+    { 1, 2, 3, 6, 7, 10, 11, 14, Z, Z, Z, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 6, 7, 10, 11, 13, 14, Z, Z, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 6, 7, 10, 11, 12, 13, 14, Z, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 6, 7, 9, 10, 11, 14, Z, Z, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 6, 7, 9, 10, 11, 13, 14, Z, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 6, 7, 9, 10, 11, 12, 13, 14, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 6, 7, 8, 9, 10, 11, 14, Z, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 6, 7, 8, 9, 10, 11, 13, 14, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 6, 7, 8, 9, 10, 11, 12, 13, 14, Z, Z, Z, Z },
+    { 1, 2, 3, 5, 6, 7, 10, 11, 14, Z, Z, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 5, 6, 7, 10, 11, 13, 14, Z, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 5, 6, 7, 10, 11, 12, 13, 14, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 5, 6, 7, 9, 10, 11, 14, Z, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 5, 6, 7, 9, 10, 11, 12, 13, 14, Z, Z, Z, Z },
+    { 1, 2, 3, 5, 6, 7, 8, 9, 10, 11, 14, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 5, 6, 7, 8, 9, 10, 11, 13, 14, Z, Z, Z, Z },
+    { 1, 2, 3, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, Z, Z, Z },
+    { 1, 2, 3, 4, 5, 6, 7, 10, 11, 14, Z, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 4, 5, 6, 7, 10, 11, 13, 14, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 4, 5, 6, 7, 10, 11, 12, 13, 14, Z, Z, Z, Z },
+    { 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 14, Z, Z, Z, Z, Z },
+    { 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 13, 14, Z, Z, Z, Z },
+    { 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 12, 13, 14, Z, Z, Z },
+    { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 14, Z, Z, Z, Z },
+    { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 14, Z, Z, Z },
+    { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, Z, Z },
+    { 0, 1, 2, 3, 6, 7, 10, 11, 14, Z, Z, Z, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 6, 7, 10, 11, 13, 14, Z, Z, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 6, 7, 10, 11, 12, 13, 14, Z, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 6, 7, 9, 10, 11, 14, Z, Z, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 6, 7, 9, 10, 11, 13, 14, Z, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 6, 7, 9, 10, 11, 12, 13, 14, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 6, 7, 8, 9, 10, 11, 14, Z, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 6, 7, 8, 9, 10, 11, 13, 14, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 6, 7, 8, 9, 10, 11, 12, 13, 14, Z, Z, Z },
+    { 0, 1, 2, 3, 5, 6, 7, 10, 11, 14, Z, Z, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 5, 6, 7, 10, 11, 13, 14, Z, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 5, 6, 7, 10, 11, 12, 13, 14, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 5, 6, 7, 9, 10, 11, 14, Z, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 5, 6, 7, 9, 10, 11, 12, 13, 14, Z, Z, Z },
+    { 0, 1, 2, 3, 5, 6, 7, 8, 9, 10, 11, 14, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 5, 6, 7, 8, 9, 10, 11, 13, 14, Z, Z, Z },
+    { 0, 1, 2, 3, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, Z, Z },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 10, 11, 14, Z, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 10, 11, 13, 14, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 10, 11, 12, 13, 14, Z, Z, Z },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 14, Z, Z, Z, Z },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 13, 14, Z, Z, Z },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 12, 13, 14, Z, Z },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 14, Z, Z, Z },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 14, Z, Z },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, Z },
+};
+#undef Z
+
+/*
+ * i_str_load16 returns a pointer to at least 16 readable bytes starting with
+ * str. If the load would cross a page boundary, str is copied into buf.
+ */
+static inline const char *
+i_str_load16(const char *str, char *buf)
+{
+    if (((uintptr_t)str & 4095) <= 4096 - 16) {
+        return (str);
+    }
+
+    memset(buf, 0, 16);
+    memcpy(buf, str, strnlen(str, 15));
+
+    return (buf);
+}
+
+/*
+ * i_ipv4_shuffle_mask validates the dot and digit bitmasks of a dotted-quad
+ * with the length len and builds the pshufb mask, which gathers the octets 
+ * into four right aligned 32-bit lanes.
+ */
+static inline int
+i_ipv4_shuffle_mask(const char *str, unsigned int dots, unsigned int digits,
+                    unsigned int len, uint32_t lanes[4])
+{
+    unsigned int all = (1u << len) - 1, start = 0, end = 0, i = 0;
+
+    dots &= all;
+    digits &= all;
+
+    if (__builtin_popcount(dots) != 3 || (dots | digits) != all) {
+        return (EINVAL);
+    }
+
+    for (i = 0; i < 4; i++) {
+        end = (i < 3) ? (unsigned int)__builtin_ctz(dots) : len;
+        dots &= dots - 1;
+
+        if (end - start == 0 || end - start > 3 ||
+            (end - start > 1 && str[start] == '0')) {
+            return (EINVAL);
+        }
+
+        lanes[i] = i_octet_lane[end - start] + start * 0x01010101u;
+        start = end + 1;
+    }
+
+    return (0);
+}
+
+/*
+ * i_ipv4_fmt_index returns the i_fmt_shuffle index of an address in host 
+ * byte order.
+ */
+static inline unsigned int
+i_ipv4_fmt_index(uint32_t addr)
+{
+    unsigned int idx = 0, octet = 0;
+    int i = 0;
+
+    for (i = 3; i >= 0; i--) {
+        octet = (addr >> (i * 8)) & 0xff;
+        idx = idx * 3 + (octet >= 10) + (octet >= 100);
+    }
+
+    return (idx);
+}
+
+__attribute__((target("sse4.1")))
+static inline unsigned int
+i_sse4_str_masks(__m128i v, unsigned int *dots, unsigned int *digits)
+{
+    const __m128i dv = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+
+    *dots = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+    *digits = _mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_min_epu8(dv, _mm_set1_epi8(9)), dv));
+
+    /* The address ends with the prefix delimiter or the null character. */
+    return (_mm_movemask_epi8(_mm_or_si128(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('/')),
+        _mm_cmpeq_epi8(v, _mm_setzero_si128()))));
+}
+
+/*
+ * i_parse_ipv4_cidr_sse4 parses a dotted-quad the same way as the scalar
+ * implementation. The digits are gathered with pshufb and converted with
+ * pmaddubsw and pmaddwd.
+ */
+__attribute__((target("sse4.1")))
+static int
+i_parse_ipv4_cidr_sse4(const char *str, uint32_t *addr, uint8_t *prefix)
+{
+    char buf[16];
+    const char *p = i_str_load16(str, buf);
+    __m128i v = _mm_loadu_si128((const __m128i *)p), octets;
+    unsigned int term = 0, dots = 0, digits = 0, len = 0;
+    uint32_t lanes[4];
+
+    if ((term = i_sse4_str_masks(v, &dots, &digits)) == 0) {
+        return (EINVAL);
+    }
+    len = __builtin_ctz(term);
+
+    if (i_ipv4_shuffle_mask(p, dots, digits, len, lanes) != 0) {
+        return (EINVAL);
+    }
+
+    octets = _mm_shuffle_epi8(_mm_sub_epi8(v, _mm_set1_epi8('0')),
+        _mm_loadu_si128((const __m128i *)lanes));
+    octets = _mm_maddubs_epi16(octets, _mm_set1_epi32(0x00010a64));
+    octets = _mm_madd_epi16(octets, _mm_set1_epi16(1));
+
+    if (_mm_movemask_epi8(_mm_cmpgt_epi32(octets, _mm_set1_epi32(255))) != 0 ||
+        i_parse_ipv4_prefix(str + len, prefix) != 0) {
+        return (EINVAL);
+    }
+
+    /* Collect the low byte of each lane in host byte order. */
+    octets = _mm_shuffle_epi8(octets, _mm_setr_epi8(12, 8, 4, 0, -1, -1, -1, 
+        -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    *addr = (uint32_t)_mm_cvtsi128_si32(octets);
+
+    return (0);
+}
+
+/*
+ * i_parse_ipv4_cidr_avx2 parses two dotted-quads at once, one in each 128-bit
+ * lane. The error of each address is returned in errs.
+ */
+__attribute__((target("avx2")))
+static void
+i_parse_ipv4_cidr_avx2(const char *const str[2], uint32_t addr[2],
+                       uint8_t prefix[2], int errs[2])
+{
+    char buf[2][16];
+    const char *p[2] = { i_str_load16(str[0], buf[0]), 
+                         i_str_load16(str[1], buf[1]) };
+    __m256i v, dv, octets;
+    unsigned int term = 0, dots = 0, digits = 0, len = 0, over = 0;
+    uint32_t lanes[8];
+    int i = 0;
+
+    v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+        _mm_loadu_si128((const __m128i *)p[0])), 
+        _mm_loadu_si128((const __m128i *)p[1]), 1);
+    dv = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+
+    term = _mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')),
+        _mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+    dots = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')));
+    digits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+        _mm256_min_epu8(dv, _mm256_set1_epi8(9)), dv));
+
+    for (i = 0; i < 2; i++) {
+        errs[i] = EINVAL;
+        lanes[i * 4] = lanes[i * 4 + 1] = lanes[i * 4 + 2] = 
+            lanes[i * 4 + 3] = 0x80808080;
+
+        if (((term >> (i * 16)) & 0xffff) == 0) {
+            continue;
+        }
+        len = __builtin_ctz((term >> (i * 16)) & 0xffff);
+
+        if (i_ipv4_shuffle_mask(p[i], dots >> (i * 16), digits >> (i * 16), 
+            len, &lanes[i * 4]) != 0 || 
+            i_parse_ipv4_prefix(str[i] + len, &prefix[i]) != 0) {
+            continue;
+        }
+
+        errs[i] = 0;
+    }
+
+    if (errs[0] != 0 && errs[1] != 0) {
+        return;
+    }
+
+    octets = _mm256_shuffle_epi8(dv, 
+        _mm256_loadu_si256((const __m256i *)lanes));
+    octets = _mm256_maddubs_epi16(octets, _mm256_set1_epi32(0x00010a64));
+    octets = _mm256_madd_epi16(octets, _mm256_set1_epi16(1));
+    over = _mm256_movemask_epi8(_mm256_cmpgt_epi32(octets, 
+        _mm256_set1_epi32(255)));
+    octets = _mm256_shuffle_epi8(octets, _mm256_setr_epi8(
+        12, 8, 4, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        12, 8, 4, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+
+    addr[0] = (uint32_t)_mm256_extract_epi32(octets, 0);
+    addr[1] = (uint32_t)_mm256_extract_epi32(octets, 4);
+
+    for (i = 0; i < 2; i++) {
+        if (((over >> (i * 16)) & 0xffff) != 0) {
+            errs[i] = EINVAL;
+        }
+    }
+}
+
+/*
+ * i_ipv4_addr_to_str_sse4 formats an address in host byte order. The digits
+ * of all four octets are computed at once with reciprocal multiplications and
+ * compacted with pshufb. str has to hold at least 16 bytes.
+ */
+__attribute__((target("sse4.1")))
+static void
+i_ipv4_addr_to_str_sse4(uint32_t addr, char *str)
+{
+    __m128i v, h, t, o;
+
+    v = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(__builtin_bswap32(addr)));
+
+    /* v / 100 == (v * 41) >> 12 and r / 10 == (r * 103) >> 10 for r < 100 */
+    h = _mm_srli_epi32(_mm_mullo_epi32(v, _mm_set1_epi32(41)), 12);
+    v = _mm_sub_epi32(v, _mm_mullo_epi32(h, _mm_set1_epi32(100)));
+    t = _mm_srli_epi32(_mm_mullo_epi32(v, _mm_set1_epi32(103)), 10);
+    o = _mm_sub_epi32(v, _mm_mullo_epi32(t, _mm_set1_epi32(10)));
+
+    v = _mm_or_si128(_mm_or_si128(h, _mm_slli_epi32(t, 8)), 
+        _mm_slli_epi32(o, 16));
+    v = _mm_add_epi32(v, _mm_set1_epi32(0x2e303030));
+
+    _mm_storeu_si128((__m128i *)str, _mm_shuffle_epi8(v, 
+        _mm_load_si128((const __m128i *)i_fmt_shuffle[i_ipv4_fmt_index(addr)])));
+}
+
+/*
+ * i_ipv4_addr_to_str_avx2 formats two addresses at once like 
+ * i_ipv4_addr_to_str_sse4, one in each 128-bit lane.
+ */
+__attribute__((target("avx2")))
+static void
+i_ipv4_addr_to_str_avx2(const uint32_t addr[2], char *str0, char *str1)
+{
+    __m256i v, h, t, o, mask;
+
+    v = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(
+        ((uint64_t)__builtin_bswap32(addr[1]) << 32) | 
+        __builtin_bswap32(addr[0])));
+
+    h = _mm256_srli_epi32(_mm256_mullo_epi32(v, _mm256_set1_epi32(41)), 12);
+    v = _mm256_sub_epi32(v, _mm256_mullo_epi32(h, _mm256_set1_epi32(100)));
+    t = _mm256_srli_epi32(_mm256_mullo_epi32(v, _mm256_set1_epi32(103)), 10);
+    o = _mm256_sub_epi32(v, _mm256_mullo_epi32(t, _mm256_set1_epi32(10)));
+
+    v = _mm256_or_si256(_mm256_or_si256(h, _mm256_slli_epi32(t, 8)), 
+        _mm256_slli_epi32(o, 16));
+    v = _mm256_add_epi32(v, _mm256_set1_epi32(0x2e303030));
+
+    mask = _mm256_inserti128_si256(_mm256_castsi128_si256(
+        _mm_load_si128((const __m128i *)i_fmt_shuffle[i_ipv4_fmt_index(addr[0])])),
+        _mm_load_si128((const __m128i *)i_fmt_shuffle[i_ipv4_fmt_index(addr[1])]),
+        1);
+    v = _mm256_shuffle_epi8(v, mask);
+
+    _mm_storeu_si128((__m128i *)str0, _mm256_castsi256_si128(v));
+    _mm_storeu_si128((__m128i *)str1, _mm256_extracti128_si256(v, 1));
+}
+
+#endif  /* INETX_BATCH_X86 */
+
+/*
+ * i_parse_ipv4_cidr_one parses a single string with the given implementation.
+ */
+static int
+i_parse_ipv4_cidr_one(inetx_batch_impl_t impl, const char *str, 
+                      uint32_t *addr, uint8_t *prefix)
+{
+    if (str == NULL) {
+        return (EINVAL);
+    }
+
+#ifdef INETX_BATCH_X86
+    if (impl != INETX_BATCH_IMPL_SCALAR) {
+        return (i_parse_ipv4_cidr_sse4(str, addr, prefix));
+    }
+#endif
+
+    return (i_parse_ipv4_cidr_scalar(str, addr, prefix));
+}
+
+/* 
+ * inetx_parse_ipv4_cidr_batch parses n dotted-quad or CIDR strings into 
+ * addresses in host byte order and prefixes. A string without a prefix has the 
+ * prefix 32, host bits are kept as they are. Failed entries are set to zero and
+ * the error of every entry is stored in errs, which may be NULL. Returns EINVAL
+ * if at least one entry failed.
+ */
+int
+inetx_parse_ipv4_cidr_batch(const char *const *strs, size_t n, uint32_t *addrs,
+                            uint8_t *prefixes, int *errs)
+{
+    inetx_batch_impl_t impl = INETX_BATCH_IMPL_SCALAR;
+    int err = 0, entry_errs[2] = {0};
+    size_t i = 0, j = 0, step = 1;
+
+    if ((strs == NULL || addrs == NULL || prefixes == NULL) && n > 0) {
+        return (EINVAL);
+    }
+
+    impl = i_batch_impl_resolve();
+
+    for (i = 0; i < n; i += step) {
+        step = 1;
+
+#ifdef INETX_BATCH_X86
+        if (impl == INETX_BATCH_IMPL_AVX2 && i + 1 < n && strs[i] != NULL &&
+            strs[i + 1] != NULL) {
+            i_parse_ipv4_cidr_avx2(&strs[i], &addrs[i], 
+                &prefixes[i], entry_errs);
+            step = 2;
+        }
+        else
+#endif
+        {
+            entry_errs[0] = i_parse_ipv4_cidr_one(impl, strs[i], &addrs[i], 
+                &prefixes[i]);
+        }
+
+        for (j = 0; j < step; j++) {
+            if (entry_errs[j] != 0) {
+                addrs[i + j] = 0;
+                prefixes[i + j] = 0;
+                err = EINVAL;
+            }
+
+            if (errs != NULL) {
+                errs[i + j] = entry_errs[j];
+            }
+        }
+    }
+
+    return (err);
+}
+
+/* 
+ * inetx_ipv4_addr_to_str_batch formats n addresses in host byte order into
+ * null terminated dotted-quads. strs is an array of n slots with a size of
+ * str_sz bytes each, which has to be at least INET_ADDRSTRLEN.
+ */
+int
+inetx_ipv4_addr_to_str_batch(const uint32_t *addrs, size_t n, char *strs,
+                             size_t str_sz)
+{
+    inetx_batch_impl_t impl = INETX_BATCH_IMPL_SCALAR;
+    size_t i = 0;
+
+    if (((addrs == NULL || strs == NULL) && n > 0) || 
+        str_sz < INET_ADDRSTRLEN) {
+        return (EINVAL);
+    }
+
+    impl = i_batch_impl_resolve();
+
+#ifdef INETX_BATCH_X86
+    if (impl == INETX_BATCH_IMPL_AVX2) {
+        for (; i + 1 < n; i += 2) {
+            i_ipv4_addr_to_str_avx2(&addrs[i], strs + i * str_sz, 
+                strs + (i + 1) * str_sz);
+        }
+    }
+
+    if (impl != INETX_BATCH_IMPL_SCALAR) {
+        for (; i < n; i++) {
+            i_ipv4_addr_to_str_sse4(addrs[i], strs + i * str_sz);
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        i_ipv4_addr_to_str_scalar(addrs[i], strs + i * str_sz);
+    }
+
+    return (0);
+}
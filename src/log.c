@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "log.h"
+
+/* Interval in which the writer thread drains the rings. */
+#define LOG_FLUSH_INTERVAL_MS 50
+
+/* Size of the output buffer of the writer thread. */
+#define LOG_OUTPUT_SIZE 65536
+
+int log_level = LOG_LEVEL_INFO;
+
+static const char *i_log_level_names[] = { "error", "warn", "info", "debug" };
+
+/*
+ * i_log_record is a log statement as binary record. The message is formatted
+ * by the logging thread, because the arguments may not outlive the call, but
+ * the timestamp and line are formatted and written by the writer thread.
+ */
+struct i_log_record {
+    struct timespec lr_time;
+    const char *lr_file;
+    int lr_line;
+    int lr_level;
+    pid_t lr_tid;
+    char lr_msg[LOG_MESSAGE_MAX];
+};
+
+/*
+ * i_log_ring is the single producer, single consumer ring of a thread. The
+ * ring of an exited thread is marked free and adopted by the next new thread,
+ * so rings are never freed while the writer may read them.
+ */
+struct i_log_ring {
+    atomic_size_t lr_head;  /* Next record written by the thread */
+    atomic_size_t lr_tail;  /* Next record read by the writer */
+    atomic_bool lr_free;
+    struct i_log_ring *lr_next;
+    struct i_log_record lr_records[LOG_RING_SIZE];
+};
+
+/*
+ * i_log_writer is the state of the writer thread, started by log_start.
+ */
+static struct {
+    pthread_mutex_t lw_lock;  /* Serializes log_start and log_stop */
+    size_t lw_users;
+    pthread_t lw_thread;
+    sem_t lw_wakeup;          /* Never destroyed, late posts are harmless */
+    bool lw_sem_ready;
+    atomic_bool lw_stop;
+    int lw_fd;
+    bool lw_close_fd;
+} i_log_writer = { .lw_lock = PTHREAD_MUTEX_INITIALIZER, .lw_fd = -1 };
+
+static atomic_bool i_log_running;
+static _Atomic(struct i_log_ring *) i_log_rings;
+static atomic_size_t i_log_nrings;
+static atomic_uint_fast64_t i_log_records;
+static atomic_uint_fast64_t i_log_dropped;
+static atomic_uint_fast64_t i_log_written;
+
+static pthread_once_t i_log_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t i_log_key;
+static _Thread_local struct i_log_ring *i_log_ring;
+
+static void
+i_log_ring_release(void *arg)
+{
+    atomic_store_explicit(&(((struct i_log_ring *)arg)->lr_free), true,
+        memory_order_release);
+}
+
+static void
+i_log_key_create(void)
+{
+    pthread_key_create(&i_log_key, i_log_ring_release);
+}
+
+/*
+ * i_log_ring_get returns the ring of the calling thread. The first call of a
+ * thread adopts a free ring or adds a new one to the list of rings. Returns
+ * NULL if no memory is left.
+ */
+static struct i_log_ring *
+i_log_ring_get(void)
+{
+    struct i_log_ring *ring = NULL;
+    bool expected = true;
+
+    if (i_log_ring != NULL) {
+        return (i_log_ring);
+    }
+
+    pthread_once(&i_log_key_once, i_log_key_create);
+
+    for (ring = atomic_load(&i_log_rings); ring != NULL;
+         ring = ring->lr_next) {
+        expected = true;
+        if (atomic_compare_exchange_strong(&(ring->lr_free), &expected,
+            false)) {
+            break;
+        }
+    }
+
+    if (ring == NULL) {
+        if ((ring = calloc(1, sizeof(struct i_log_ring))) == NULL) {
+            return (NULL);
+        }
+
+        ring->lr_next = atomic_load(&i_log_rings);
+        while (!atomic_compare_exchange_weak(&i_log_rings, &(ring->lr_next),
+               ring)) {
+        }
+        atomic_fetch_add(&i_log_nrings, 1);
+    }
+
+    pthread_setspecific(i_log_key, ring);
+    i_log_ring = ring;
+    return (ring);
+}
+
+/*
+ * i_log_format writes a record as a line into buf and returns its length.
+ */
+static size_t
+i_log_format(const struct i_log_record *rec, char *buf, size_t size)
+{
+    const char *file = strrchr(rec->lr_file, '/');
+    struct tm tm;
+    int n = 0;
+
+    gmtime_r(&(rec->lr_time.tv_sec), &tm);
+    n = snprintf(buf, size, "%04d-%02d-%02dT%02d:%02d:%02d.%06ldZ %s %s:%d "
+        "[%d] %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+        tm.tm_hour, tm.tm_min, tm.tm_sec, rec->lr_time.tv_nsec / 1000,
+        log_level_name(rec->lr_level), file != NULL ? file + 1 : rec->lr_file,
+        rec->lr_line, (int)rec->lr_tid, rec->lr_msg);
+
+    return (n < 0 ? 0 : ((size_t)n < size ? (size_t)n : size - 1));
+}
+
+static void
+i_log_output(int fd, const char *buf, size_t len)
+{
+    ssize_t n = 0;
+
+    while (len > 0) {
+        if ((n = write(fd, buf, len)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+/*
+ * i_log_drain formats the records of all rings and writes them in large
+ * chunks. The order is kept per thread only.
+ */
+static void
+i_log_drain(int fd)
+{
+    static char out[LOG_OUTPUT_SIZE];
+    struct i_log_ring *ring = NULL;
+    const size_t line_max = LOG_MESSAGE_MAX + 128;
+    size_t len = 0, head = 0, tail = 0;
+
+    for (ring = atomic_load(&i_log_rings); ring != NULL;
+         ring = ring->lr_next) {
+        head = atomic_load_explicit(&(ring->lr_head), memory_order_acquire);
+        tail = atomic_load_explicit(&(ring->lr_tail), memory_order_relaxed);
+
+        for (; tail != head; tail++) {
+            if (len + line_max > sizeof(out)) {
+                i_log_output(fd, out, len);
+                len = 0;
+            }
+            len += i_log_format(&(ring->lr_records[tail &
+                (LOG_RING_SIZE - 1)]), out + len, sizeof(out) - len);
+            atomic_fetch_add_explicit(&i_log_written, 1,
+                memory_order_relaxed);
+        }
+
+        atomic_store_explicit(&(ring->lr_tail), tail, memory_order_release);
+    }
+
+    i_log_output(fd, out, len);
+}
+
+static void *
+i_log_thread(void *arg)
+{
+    struct timespec deadline;
+    bool stop = false;
+
+    (void)arg;
+
+    while (!stop) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (LOG_FLUSH_INTERVAL_MS % 1000) * 1000000L;
+        deadline.tv_sec += LOG_FLUSH_INTERVAL_MS / 1000 +
+            deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        while (sem_timedwait(&(i_log_writer.lw_wakeup), &deadline) != 0 &&
+               errno == EINTR) {
+        }
+
+        /* Read the flag before draining, so no record is left behind. */
+        stop = atomic_load(&(i_log_writer.lw_stop));
+        i_log_drain(i_log_writer.lw_fd);
+    }
+
+    return (NULL);
+}
+
+/*
+ * log_start starts the writer thread, which writes the records to the file
+ * at path or to stderr if path is NULL. Until the writer runs, records are
+ * written directly by the logging thread. Calls are counted, only the first
+ * one opens the output and log_stop has to be called as often.
+ */
+int
+log_start(const char *path)
+{
+    int err = 0;
+
+    pthread_mutex_lock(&(i_log_writer.lw_lock));
+
+    if (i_log_writer.lw_users > 0) {
+        i_log_writer.lw_users++;
+        goto out_unlock;
+    }
+
+    i_log_writer.lw_fd = STDERR_FILENO;
+    i_log_writer.lw_close_fd = false;
+    if (path != NULL) {
+        if ((i_log_writer.lw_fd = open(path, O_WRONLY | O_APPEND | O_CREAT |
+             O_CLOEXEC, 0640)) < 0) {
+            err = errno;
+            goto out_unlock;
+        }
+        i_log_writer.lw_close_fd = true;
+    }
+
+    if (!i_log_writer.lw_sem_ready) {
+        if (sem_init(&(i_log_writer.lw_wakeup), 0, 0) != 0) {
+            err = errno;
+            goto out_close;
+        }
+        i_log_writer.lw_sem_ready = true;
+    }
+
+    atomic_store(&(i_log_writer.lw_stop), false);
+    if ((err = pthread_create(&(i_log_writer.lw_thread), NULL, i_log_thread,
+         NULL)) != 0) {
+        goto out_close;
+    }
+
+    i_log_writer.lw_users = 1;
+    atomic_store(&i_log_running, true);
+    goto out_unlock;
+
+out_close:
+    if (i_log_writer.lw_close_fd) {
+        close(i_log_writer.lw_fd);
+    }
+    i_log_writer.lw_fd = -1;
+out_unlock:
+    pthread_mutex_unlock(&(i_log_writer.lw_lock));
+    return (err);
+}
+
+/*
+ * log_stop stops the writer thread with the last call. The records queued
+ * so far are written before it returns.
+ */
+void
+log_stop(void)
+{
+    pthread_mutex_lock(&(i_log_writer.lw_lock));
+
+    if (i_log_writer.lw_users == 0 || --i_log_writer.lw_users > 0) {
+        pthread_mutex_unlock(&(i_log_writer.lw_lock));
+        return;
+    }
+
+    atomic_store(&i_log_running, false);
+    atomic_store(&(i_log_writer.lw_stop), true);
+    sem_post(&(i_log_writer.lw_wakeup));
+    pthread_join(i_log_writer.lw_thread, NULL);
+
+    /* Records of threads, which saw the writer running just before. */
+    i_log_drain(i_log_writer.lw_fd);
+
+    if (i_log_writer.lw_close_fd) {
+        close(i_log_writer.lw_fd);
+    }
+    i_log_writer.lw_fd = -1;
+
+    pthread_mutex_unlock(&(i_log_writer.lw_lock));
+}
+
+/*
+ * log_set_level changes the runtime level, records above it are discarded
+ * before their arguments are evaluated.
+ */
+void
+log_set_level(int level)
+{
+    if (level < LOG_LEVEL_ERROR) {
+        level = LOG_LEVEL_ERROR;
+    }
+    if (level > LOG_LEVEL_DEBUG) {
+        level = LOG_LEVEL_DEBUG;
+    }
+
+    __atomic_store_n(&log_level, level, __ATOMIC_RELAXED);
+}
+
+/*
+ * log_parse_level parses a level name like "warn".
+ */
+int
+log_parse_level(const char *name, int *level)
+{
+    int i = 0;
+
+    if (name == NULL || level == NULL) {
+        return (EINVAL);
+    }
+
+    for (i = LOG_LEVEL_ERROR; i <= LOG_LEVEL_DEBUG; i++) {
+        if (strcasecmp(name, i_log_level_names[i]) == 0) {
+            *level = i;
+            return (0);
+        }
+    }
+
+    return (EINVAL);
+}
+
+const char *
+log_level_name(int level)
+{
+    if (level < LOG_LEVEL_ERROR || level > LOG_LEVEL_DEBUG) {
+        return ("unknown");
+    }
+
+    return (i_log_level_names[level]);
+}
+
+/*
+ * log_write queues a record for the writer thread, use the log_* macros
+ * instead. It never blocks: if the ring of the thread is full, the record is
+ * dropped and counted. Without a running writer the record is written
+ * directly to stderr.
+ */
+void
+log_write(int level, const char *file, int line, const char *fmt, ...)
+{
+    struct i_log_record local, *rec = &local;
+    struct i_log_ring *ring = NULL;
+    char buf[LOG_MESSAGE_MAX + 128];
+    size_t head = 0;
+    va_list ap;
+
+    if (atomic_load_explicit(&i_log_running, memory_order_acquire) &&
+        (ring = i_log_ring_get()) != NULL) {
+        head = atomic_load_explicit(&(ring->lr_head), memory_order_relaxed);
+        if (head - atomic_load_explicit(&(ring->lr_tail),
+            memory_order_acquire) >= LOG_RING_SIZE) {
+            atomic_fetch_add_explicit(&i_log_dropped, 1,
+                memory_order_relaxed);
+            return;
+        }
+        rec = &(ring->lr_records[head & (LOG_RING_SIZE - 1)]);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &(rec->lr_time));
+    rec->lr_file = file;
+    rec->lr_line = line;
+    rec->lr_level = level;
+    rec->lr_tid = (pid_t)syscall(SYS_gettid);
+
+    va_start(ap, fmt);
+    vsnprintf(rec->lr_msg, sizeof(rec->lr_msg), fmt, ap);
+    va_end(ap);
+
+    if (rec == &local) {
+        i_log_output(STDERR_FILENO, buf, i_log_format(rec, buf, sizeof(buf)));
+        return;
+    }
+
+    atomic_store_explicit(&(ring->lr_head), head + 1, memory_order_release);
+    atomic_fetch_add_explicit(&i_log_records, 1, memory_order_relaxed);
+
+    /* Wake the writer early, before the ring overflows. */
+    if (head - atomic_load_explicit(&(ring->lr_tail), memory_order_relaxed)
+        == LOG_RING_SIZE / 2) {
+        sem_post(&(i_log_writer.lw_wakeup));
+    }
+}
+
+/*
+ * log_get_stats copies the counters of the logger.
+ */
+void
+log_get_stats(struct log_stats *stats)
+{
+    stats->ls_records = atomic_load(&i_log_records);
+    stats->ls_dropped = atomic_load(&i_log_dropped);
+    stats->ls_written = atomic_load(&i_log_written);
+    stats->ls_rings = atomic_load(&i_log_nrings);
+}
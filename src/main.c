@@ -3,21 +3,330 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <msgpack.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <strings.h>
+#include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "ovpn_client_config.h"
 #include "dao.h"
 #include "vector.h"
 #include "inetx.h"
 #include "model.h"
+#include "network_overlap.h"
+#include "ccd.h"
+#include "dbwatch.h"
+#include "import.h"
+#include "shmdir.h"
 
-int
-main(int argc, char **argv)
+#define EASYVPN_DEFAULT_DB "./easyvpn.db"
+
+/*
+ * command maps a command line mode of the easyvpn binary to its function. The
+ * function receives the arguments following the command name.
+ */
+struct command {
+    const char *cmd_name;
+    const char *cmd_usage;
+    int (*cmd_func)(int, char **);
+};
+
+/*
+ * cmd_check_overlaps reports all overlapping networks of different clients.
+ * Exits with 1 if overlaps were found.
+ */
+static int
+cmd_check_overlaps(int argc, char **argv)
+{
+    const char *db_filename = (argc > 0) ? argv[0] : EASYVPN_DEFAULT_DB;
+    dao_config_t *dao = NULL;
+    vector_t *overlaps = NULL;
+    size_t invalid = 0;
+    int err = 0;
+
+    if ((err = vector_alloc(&overlaps, sizeof(struct network_overlap))) != 0) {
+        return (2);
+    }
+
+    if ((err = dao_alloc(&dao, db_filename)) != 0 ||
+        (err = network_overlap_check_db(dao, overlaps, &invalid)) != 0) {
+        fprintf(stderr, "Failed to check networks: %s\n", strerror(err));
+        dao_free(dao);
+        vector_free(overlaps);
+        return (2);
+    }
+
+    network_overlap_print(stdout, overlaps);
+    fprintf(stderr, "%zu overlapping pairs, %zu invalid networks\n", 
+        vector_size(overlaps), invalid);
+
+    err = vector_empty(overlaps) ? 0 : 1;
+
+    dao_free(dao);
+    vector_free(overlaps);
+    return (err);
+}
+
+/*
+ * cmd_pregen writes the client-connect configs of all active clients into a
+ * config directory and reports the throughput.
+ */
+static int
+cmd_pregen(int argc, char **argv)
+{
+    struct ccd_pregen_stats stats = {0};
+    size_t threads = 0;
+    int err = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: easyvpn pregen <db> <dir> [threads]\n");
+        return (2);
+    }
+
+    if (argc > 2) {
+        threads = strtoul(argv[2], NULL, 10);
+    }
+
+    if ((err = ccd_pregenerate(argv[0], argv[1], threads, &stats)) != 0) {
+        fprintf(stderr, "Failed to generate configs: %s\n", strerror(err));
+        if (stats.ps_clients == 0) {
+            return (2);
+        }
+    }
+
+    fprintf(stderr, "%zu of %zu configs generated, %zu failed, %zu threads, "
+        "%.3f s, %.0f configs/s\n", stats.ps_generated, stats.ps_clients, 
+        stats.ps_failed, stats.ps_threads, stats.ps_seconds, 
+        stats.ps_seconds > 0 ? stats.ps_generated / stats.ps_seconds : 0);
+
+    return (stats.ps_failed > 0 ? 1 : 0);
+}
+
+/*
+ * cmd_import inserts the clients of a CSV file, or stdin if the file is "-", 
+ * within a single transaction. See import.c for the format.
+ */
+static int
+cmd_import(int argc, char **argv)
+{
+    struct import_stats stats = {0};
+    dao_config_t *dao = NULL;
+    FILE *stream = stdin;
+    int err = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: easyvpn import <db> <csv|->\n");
+        return (2);
+    }
+
+    if (strcmp(argv[1], "-") != 0 && (stream = fopen(argv[1], "r")) == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", argv[1], strerror(errno));
+        return (2);
+    }
+
+    if ((err = dao_alloc(&dao, argv[0])) == 0) {
+        err = import_csv(dao, stream, &stats);
+    }
+
+    if (err != 0) {
+        fprintf(stderr, "Failed to import clients: %s\n", strerror(err));
+    } else {
+        fprintf(stderr, "%zu clients, %zu networks imported from %zu lines "
+            "in %.3f s\n", stats.is_clients, stats.is_networks, 
+            stats.is_lines, stats.is_seconds);
+    }
+
+    dao_free(dao);
+    if (stream != stdin) {
+        fclose(stream);
+    }
+
+    return (err != 0 ? 1 : 0);
+}
+
+/*
+ * publish_watch is the state of "easyvpn publish ... watch".
+ */
+struct publish_watch {
+    dao_config_t *pw_dao;
+    const char *pw_name;
+    long long pw_generation;  /* Change feed generation of the snapshot */
+};
+
+/*
+ * publish_on_change publishes a new snapshot if the client tables changed 
+ * since the last one.
+ */
+static void
+publish_on_change(void *arg)
+{
+    struct publish_watch *pw = arg;
+    long long generation = 0;
+    uint64_t published = 0;
+    int err = 0;
+
+    if ((err = dao_change_generation(pw->pw_dao, &generation)) != 0 ||
+        generation == pw->pw_generation) {
+        return;
+    }
+
+    if ((err = shmdir_publish(pw->pw_name, pw->pw_dao, &published)) != 0) {
+        fprintf(stderr, "Failed to publish %s: %s\n", pw->pw_name, 
+            strerror(err));
+        return;
+    }
+
+    pw->pw_generation = generation;
+    fprintf(stderr, "Published generation %" PRIu64 " of %s\n", published, 
+        pw->pw_name);
+}
+
+/*
+ * publish_watch_run republishes the shared directory whenever the database
+ * changes, until SIGINT or SIGTERM.
+ */
+static int
+publish_watch_run(dao_config_t *dao, const char *name)
+{
+    struct publish_watch pw = { dao, name, 0 };
+    const char *paths[2];
+    char wal_path[PATH_MAX];
+    dbwatch_t *dw = NULL;
+    sigset_t signals;
+    int err = 0, sig = 0;
+
+    /* The watcher thread inherits the blocked signals. */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    paths[0] = dao_db_filename(dao);
+    paths[1] = wal_path;
+    snprintf(wal_path, sizeof(wal_path), "%s-wal", paths[0]);
+
+    if ((err = dao_change_feed_ensure(dao)) != 0 ||
+        (err = dao_change_generation(dao, &(pw.pw_generation))) != 0 ||
+        (err = dbwatch_open(&dw, paths, 2, publish_on_change, &pw)) != 0) {
+        return (err);
+    }
+
+    /* Changes before the watch started are published right away. */
+    pw.pw_generation--;
+    publish_on_change(&pw);
+
+    sigwait(&signals, &sig);
+    dbwatch_close(dw);
+
+    return (0);
+}
+
+/*
+ * cmd_publish publishes the active clients and their networks as a shared 
+ * directory for the plugin instances on this host. With "watch" it stays 
+ * running and republishes on every change of the database. "-d" removes the
+ * shared directory instead.
+ */
+static int
+cmd_publish(int argc, char **argv)
+{
+    dao_config_t *dao = NULL;
+    uint64_t generation = 0;
+    int err = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: easyvpn publish <db|-d> <name> [watch]\n");
+        return (2);
+    }
+
+    if (strcmp(argv[0], "-d") == 0) {
+        if ((err = shmdir_unlink(argv[1])) != 0) {
+            fprintf(stderr, "Failed to remove %s: %s\n", argv[1], 
+                strerror(err));
+        }
+        return (err != 0 ? 1 : 0);
+    }
+
+    if (argc > 2 && strcmp(argv[2], "watch") == 0) {
+        if ((err = dao_alloc(&dao, argv[0])) == 0) {
+            err = publish_watch_run(dao, argv[1]);
+        }
+    } else if ((err = dao_alloc(&dao, argv[0])) == 0) {
+        err = shmdir_publish(argv[1], dao, &generation);
+    }
+
+    if (err != 0) {
+        fprintf(stderr, "Failed to publish %s: %s\n", argv[1], strerror(err));
+    } else if (generation > 0) {
+        fprintf(stderr, "Published generation %" PRIu64 " of %s\n", 
+            generation, argv[1]);
+    }
+
+    dao_free(dao);
+    return (err != 0 ? 1 : 0);
+}
+
+/*
+ * cmd_ctl sends a command to the control socket of a running plugin and 
+ * prints the answer.
+ */
+static int
+cmd_ctl(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    FILE *stream = NULL;
+    char line[512];
+    int fd = -1, i = 0;
+
+    if (argc < 2 || strlen(argv[0]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Usage: easyvpn ctl <socket> <command> [param]\n");
+        return (2);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, argv[0]);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        (stream = fdopen(fd, "r+")) == NULL) {
+        fprintf(stderr, "Failed to connect %s: %s\n", argv[0], 
+            strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return (2);
+    }
+
+    for (i = 1; i < argc; i++) {
+        fprintf(stream, "%s%s", argv[i], (i + 1 < argc) ? " " : "\n");
+    }
+    fflush(stream);
+
+    /* The answer ends with an empty line. */
+    while (fgets(line, sizeof(line), stream) != NULL && line[0] != '\n') {
+        fputs(line, stdout);
+        if (strcmp(line, "error\n") == 0) {
+            i = -1;
+        }
+    }
+
+    fclose(stream);
+    return (i < 0 ? 1 : 0);
+}
+
+static int
+cmd_demo(int argc, char **argv)
 {
     /* vector_t *vec1 = NULL;
     struct in6_addr addr = {}, *elem = NULL;
@@ -65,6 +374,14 @@ main(int argc, char **argv)
     ovpn_client_config_add_route(client1, "2001:db8:85a4::/56", "2001:db8:0:0:1::2", 10);
     ovpn_client_config_add_route(client1, "::/0", "2001:db8:0:0:1::2", 10);
 
+    struct ovpn_client_config_canon canon1;
+    ovpn_client_config_canonicalize(client1, &canon1);
+    fprintf(stderr, "canonicalize: networks masked %zu, duplicates %zu, "
+        "covered %zu; routes masked %zu, duplicates %zu, covered %zu\n",
+        canon1.canon_networks_masked, canon1.canon_networks_duplicates, 
+        canon1.canon_networks_covered, canon1.canon_routes_masked, 
+        canon1.canon_routes_duplicates, canon1.canon_routes_covered);
+
     ovpn_client_config_build(client1, stdout);
 
     /* ====================================================================== */
@@ -146,3 +463,38 @@ main(int argc, char **argv)
 
     return (0);
 }
+
+static const struct command commands[] = {
+    { "check-overlaps", "[db]", cmd_check_overlaps },
+    { "pregen", "<db> <dir> [threads]", cmd_pregen },
+    { "import", "<db> <csv|->", cmd_import },
+    { "publish", "<db|-d> <name> [watch]", cmd_publish },
+    { "ctl", "<socket> <command> [param]", cmd_ctl },
+    { "demo", "", cmd_demo },
+    { NULL, NULL, NULL }
+};
+
+int
+main(int argc, char **argv)
+{
+    const struct command *cmd = NULL;
+
+    /* Without a command run the demo. */
+    if (argc < 2) {
+        return (cmd_demo(0, NULL));
+    }
+
+    for (cmd = commands; cmd->cmd_name != NULL; cmd++) {
+        if (strcmp(argv[1], cmd->cmd_name) == 0) {
+            return (cmd->cmd_func(argc - 2, argv + 2));
+        }
+    }
+
+    fprintf(stderr, "Usage:\n");
+    for (cmd = commands; cmd->cmd_name != NULL; cmd++) {
+        fprintf(stderr, "  %s %s %s\n", argv[0], cmd->cmd_name, 
+            cmd->cmd_usage);
+    }
+
+    return (2);
+}
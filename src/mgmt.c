@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "mgmt.h"
+
+/*
+ * mgmt is a connection to the management interface of OpenVPN on a unix
+ * socket, see the management option of OpenVPN. Only one client can be
+ * connected to the interface at a time, so connections are kept short.
+ */
+struct mgmt {
+    FILE *m_in;
+    int m_fd;
+    char *m_line;
+    size_t m_line_sz;
+};
+
+/*
+ * i_mgmt_readline reads the next answer line without the trailing newline.
+ * Real-time notifications, starting with '>', are skipped.
+ */
+static int
+i_mgmt_readline(mgmt_t *mgmt)
+{
+    ssize_t len = 0;
+
+    do {
+        if ((len = getline(&(mgmt->m_line), &(mgmt->m_line_sz), mgmt->m_in))
+            <= 0) {
+            return (ferror(mgmt->m_in) && errno != 0 ? errno : ECONNRESET);
+        }
+
+        while (len > 0 && (mgmt->m_line[len - 1] == '\n' ||
+               mgmt->m_line[len - 1] == '\r')) {
+            mgmt->m_line[--len] = '\0';
+        }
+    } while (mgmt->m_line[0] == '>');
+
+    return (0);
+}
+
+static int
+i_mgmt_command(mgmt_t *mgmt, const char *cmd)
+{
+    size_t len = strlen(cmd), written = 0;
+    ssize_t n = 0;
+
+    while (written < len) {
+        if ((n = write(mgmt->m_fd, cmd + written, len - written)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno);
+        }
+        written += n;
+    }
+
+    return (0);
+}
+
+/*
+ * mgmt_open connects to the management interface at the unix socket path.
+ */
+int
+mgmt_open(mgmt_t **mgmtp, const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct timeval timeout = { MGMT_TIMEOUT, 0 };
+    int err = 0;
+
+    if (mgmtp == NULL || path == NULL ||
+        strlen(path) >= sizeof(addr.sun_path)) {
+        return (EINVAL);
+    }
+
+    if ((*mgmtp = calloc(1, sizeof(mgmt_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    strcpy(addr.sun_path, path);
+    if (((*mgmtp)->m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0))
+        < 0) {
+        err = errno;
+        free(*mgmtp);
+        *mgmtp = NULL;
+        return (err);
+    }
+
+    setsockopt((*mgmtp)->m_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+        sizeof(timeout));
+    setsockopt((*mgmtp)->m_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+        sizeof(timeout));
+
+    if (connect((*mgmtp)->m_fd, (struct sockaddr *)&addr, sizeof(addr))
+        != 0) {
+        err = errno;
+        goto out_close;
+    }
+
+    /* The reading stream owns a duplicate, so both can be closed. */
+    if (((*mgmtp)->m_in = fdopen(dup((*mgmtp)->m_fd), "r")) == NULL) {
+        err = errno;
+        goto out_close;
+    }
+
+    return (0);
+
+out_close:
+    mgmt_close(*mgmtp);
+    *mgmtp = NULL;
+    return (err);
+}
+
+/*
+ * mgmt_close disconnects from the management interface.
+ */
+void
+mgmt_close(mgmt_t *mgmt)
+{
+    if (mgmt == NULL) {
+        return;
+    }
+
+    if (mgmt->m_in != NULL) {
+        i_mgmt_command(mgmt, "quit\n");
+        fclose(mgmt->m_in);
+    }
+
+    close(mgmt->m_fd);
+    free(mgmt->m_line);
+    free(mgmt);
+}
+
+/*
+ * i_mgmt_column returns the index of a column of a tab separated HEADER line
+ * or -1. The index counts the fields after the row type. Fields may be empty,
+ * so they are split with strsep.
+ */
+static int
+i_mgmt_column(char *header, const char *name)
+{
+    char *field = NULL;
+    int idx = -2;
+
+    for (; (field = strsep(&header, "\t")) != NULL; idx++) {
+        if (idx >= 0 && strcmp(field, name) == 0) {
+            return (idx);
+        }
+    }
+
+    return (-1);
+}
+
+/*
+ * mgmt_clients appends the connected clients as mgmt_client to clients. The
+ * columns are taken from the header of "status 3", which differs between the
+ * versions of OpenVPN.
+ */
+int
+mgmt_clients(mgmt_t *mgmt, vector_t *clients)
+{
+    struct mgmt_client client;
+    char *field = NULL, *row = NULL, *end = NULL;
+    int cn_col = -1, cid_col = -1, idx = 0, err = 0;
+
+    if (mgmt == NULL || clients == NULL) {
+        return (EINVAL);
+    }
+
+    if ((err = i_mgmt_command(mgmt, "status 3\n")) != 0) {
+        return (err);
+    }
+
+    while ((err = i_mgmt_readline(mgmt)) == 0 &&
+           strcmp(mgmt->m_line, "END") != 0) {
+        if (strncmp(mgmt->m_line, "ERROR:", 6) == 0) {
+            return (EPROTO);
+        }
+
+        if (strncmp(mgmt->m_line, "HEADER\tCLIENT_LIST\t", 19) == 0) {
+            cn_col = i_mgmt_column(strdupa(mgmt->m_line), "Common Name");
+            cid_col = i_mgmt_column(strdupa(mgmt->m_line), "Client ID");
+            continue;
+        }
+
+        if (strncmp(mgmt->m_line, "CLIENT_LIST\t", 12) != 0 || cn_col < 0 ||
+            cid_col < 0) {
+            continue;
+        }
+
+        memset(&client, 0, sizeof(client));
+        client.mc_cid = ULONG_MAX;
+        row = mgmt->m_line;
+        strsep(&row, "\t");
+        for (idx = 0; (field = strsep(&row, "\t")) != NULL; idx++) {
+            if (idx == cn_col) {
+                snprintf(client.mc_cn, sizeof(client.mc_cn), "%s", field);
+            } else if (idx == cid_col) {
+                client.mc_cid = strtoul(field, &end, 10);
+                if (end == field || *end != '\0') {
+                    client.mc_cid = ULONG_MAX;
+                }
+            }
+        }
+
+        /* Clients without a client id can't be addressed, e.g. UNDEF. */
+        if (client.mc_cid != ULONG_MAX && client.mc_cn[0] != '\0' &&
+            (err = vector_push_back(clients, &client)) != 0) {
+            return (err);
+        }
+    }
+
+    return (err);
+}
+
+/*
+ * mgmt_push_update sends options to a connected client without a reconnect,
+ * with the push-update-cid command of OpenVPN 2.7. The options are comma
+ * separated, an option with a leading '-' is removed from the client.
+ */
+int
+mgmt_push_update(mgmt_t *mgmt, unsigned long cid, const char *options)
+{
+    char *cmd = NULL;
+    int err = 0;
+
+    if (mgmt == NULL || options == NULL || strchr(options, '"') != NULL ||
+        strchr(options, '\n') != NULL) {
+        return (EINVAL);
+    }
+
+    if (asprintf(&cmd, "push-update-cid %lu \"%s\"\n", cid, options) < 0) {
+        return (ENOMEM);
+    }
+
+    if ((err = i_mgmt_command(mgmt, cmd)) == 0) {
+        while ((err = i_mgmt_readline(mgmt)) == 0 &&
+               strncmp(mgmt->m_line, "SUCCESS:", 8) != 0) {
+            if (strncmp(mgmt->m_line, "ERROR:", 6) == 0) {
+                err = EPROTO;
+                break;
+            }
+        }
+    }
+
+    free(cmd);
+    return (err);
+}
@@ -0,0 +1,365 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "model.h"
+#include "negcache.h"
+#include "vector.h"
+
+/* Bits per active CN and hash functions of the filter, about 1% false hits. */
+#define NEGCACHE_FILTER_BITS_PER_CN 10
+#define NEGCACHE_FILTER_HASHES      7
+
+/* Slots probed in the miss set for a lookup or an insert. */
+#define NEGCACHE_MISS_PROBES 8
+
+/*
+ * negcache_miss is a recently missed CN, identified by its hash.
+ */
+struct negcache_miss {
+    uint64_t nm_hash;
+    time_t nm_expires;
+};
+
+/*
+ * negcache rejects unknown and inactive CNs without querying the database. 
+ * The Bloom filter contains the CNs of all active clients. A CN which isn't 
+ * in the filter is definitely unknown or inactive. CNs which pass the filter 
+ * but missed in the database are remembered for a TTL in the miss set.
+ *
+ * The filter is replaced by negcache_build under the write lock. The miss 
+ * set has its own mutex.
+ */
+struct negcache {
+    pthread_rwlock_t nc_lock;
+    uint64_t *nc_filter;          /* NULL if not built or invalidated */
+    uint64_t nc_filter_mask;      /* Number of filter bits minus one */
+    size_t nc_filter_cns;
+    pthread_mutex_t nc_miss_lock;
+    struct negcache_miss nc_misses[NEGCACHE_MISS_SLOTS];
+    unsigned int nc_miss_ttl;
+    atomic_uint_fast64_t nc_filter_rejects;
+    atomic_uint_fast64_t nc_miss_rejects;
+    atomic_uint_fast64_t nc_passes;
+    atomic_uint_fast64_t nc_miss_count;
+    atomic_uint_fast64_t nc_builds;
+};
+
+/*
+ * i_negcache_hash hashes a CN with FNV-1a and a final mix, so the upper and 
+ * the lower half can be used as independent hashes.
+ */
+static uint64_t
+i_negcache_hash(const char *cn)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (*cn != '\0') {
+        h ^= (unsigned char)*cn++;
+        h *= 0x100000001b3ULL;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    /* Zero marks an empty miss slot. */
+    return (h != 0 ? h : 1);
+}
+
+static void
+i_negcache_filter_add(uint64_t *filter, uint64_t mask, uint64_t h)
+{
+    uint64_t bit = 0;
+    size_t i = 0;
+
+    for (i = 0; i < NEGCACHE_FILTER_HASHES; i++) {
+        bit = ((h & 0xffffffff) + i * ((h >> 32) | 1)) & mask;
+        filter[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+}
+
+/*
+ * negcache_alloc allocates an empty negative cache. Until negcache_build is
+ * called only the miss set rejects CNs.
+ */
+int
+negcache_alloc(negcache_t **ncp, unsigned int miss_ttl)
+{
+    if (ncp == NULL) {
+        return (EINVAL);
+    }
+
+    if ((*ncp = calloc(1, sizeof(negcache_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    pthread_rwlock_init(&((*ncp)->nc_lock), NULL);
+    pthread_mutex_init(&((*ncp)->nc_miss_lock), NULL);
+    (*ncp)->nc_miss_ttl = (miss_ttl > 0) ? miss_ttl : NEGCACHE_DEFAULT_MISS_TTL;
+
+    return (0);
+}
+
+void
+negcache_free(negcache_t *nc)
+{
+    if (nc == NULL) {
+        return;
+    }
+
+    free(nc->nc_filter);
+    pthread_mutex_destroy(&(nc->nc_miss_lock));
+    pthread_rwlock_destroy(&(nc->nc_lock));
+
+    free(nc);
+}
+
+/*
+ * negcache_build (re)builds the filter from the active CNs of the database and 
+ * clears the miss set. It has to be called whenever the client directory is 
+ * reloaded.
+ */
+int
+negcache_build(negcache_t *nc, dao_config_t *daocfg)
+{
+    vector_t *cns = NULL;
+    const char *cn = NULL;
+    uint64_t *filter = NULL, bits = 64;
+    int err = 0;
+
+    if (nc == NULL || daocfg == NULL) {
+        return (EINVAL);
+    }
+
+    if ((err = vector_alloc(&cns, RFC5280_CN_MAX_LENGTH)) != 0) {
+        return (err);
+    }
+
+    if ((err = dao_vpn_client_find_active_cns(daocfg, cns)) != 0) {
+        goto out_free;
+    }
+
+    /* Round the filter size up to a power of two for masking. */
+    while (bits < vector_size(cns) * NEGCACHE_FILTER_BITS_PER_CN) {
+        bits <<= 1;
+    }
+
+    if ((filter = calloc(bits / 64, sizeof(uint64_t))) == NULL) {
+        err = ENOMEM;
+        goto out_free;
+    }
+
+    for (cn = vector_begin(cns); cn != vector_end(cns); 
+         cn = vector_next(cns, (void *)cn)) {
+        i_negcache_filter_add(filter, bits - 1, i_negcache_hash(cn));
+    }
+
+    pthread_rwlock_wrlock(&(nc->nc_lock));
+    free(nc->nc_filter);
+    nc->nc_filter = filter;
+    nc->nc_filter_mask = bits - 1;
+    nc->nc_filter_cns = vector_size(cns);
+    pthread_rwlock_unlock(&(nc->nc_lock));
+
+    pthread_mutex_lock(&(nc->nc_miss_lock));
+    memset(nc->nc_misses, 0, sizeof(nc->nc_misses));
+    pthread_mutex_unlock(&(nc->nc_miss_lock));
+
+    atomic_fetch_add(&(nc->nc_builds), 1);
+
+out_free:
+    vector_free(cns);
+    return (err);
+}
+
+/*
+ * negcache_invalidate drops the filter and the miss set. Until the next 
+ * negcache_build every CN is passed to the database.
+ */
+void
+negcache_invalidate(negcache_t *nc)
+{
+    if (nc == NULL) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&(nc->nc_lock));
+    free(nc->nc_filter);
+    nc->nc_filter = NULL;
+    nc->nc_filter_cns = 0;
+    pthread_rwlock_unlock(&(nc->nc_lock));
+
+    pthread_mutex_lock(&(nc->nc_miss_lock));
+    memset(nc->nc_misses, 0, sizeof(nc->nc_misses));
+    pthread_mutex_unlock(&(nc->nc_miss_lock));
+}
+
+static bool
+i_negcache_filter_contains(negcache_t *nc, uint64_t h)
+{
+    uint64_t bit = 0;
+    size_t i = 0;
+
+    assert(nc->nc_filter != NULL);
+
+    for (i = 0; i < NEGCACHE_FILTER_HASHES; i++) {
+        bit = ((h & 0xffffffff) + i * ((h >> 32) | 1)) & nc->nc_filter_mask;
+        if ((nc->nc_filter[bit / 64] & ((uint64_t)1 << (bit % 64))) == 0) {
+            return (false);
+        }
+    }
+
+    return (true);
+}
+
+/*
+ * negcache_reject checks if a CN is known to be unknown or inactive. If it 
+ * returns false, the CN has to be looked up in the database.
+ */
+bool
+negcache_reject(negcache_t *nc, const char *cn)
+{
+    uint64_t h = 0;
+    time_t now = 0;
+    size_t i = 0, slot = 0;
+    bool reject = false;
+
+    if (nc == NULL || cn == NULL) {
+        return (false);
+    }
+
+    h = i_negcache_hash(cn);
+
+    pthread_rwlock_rdlock(&(nc->nc_lock));
+    reject = (nc->nc_filter != NULL && !i_negcache_filter_contains(nc, h));
+    pthread_rwlock_unlock(&(nc->nc_lock));
+
+    if (reject) {
+        atomic_fetch_add(&(nc->nc_filter_rejects), 1);
+        return (true);
+    }
+
+    now = time(NULL);
+
+    pthread_mutex_lock(&(nc->nc_miss_lock));
+    for (i = 0; i < NEGCACHE_MISS_PROBES && !reject; i++) {
+        slot = (h + i) & (NEGCACHE_MISS_SLOTS - 1);
+        reject = (nc->nc_misses[slot].nm_hash == h && 
+            nc->nc_misses[slot].nm_expires > now);
+    }
+    pthread_mutex_unlock(&(nc->nc_miss_lock));
+
+    atomic_fetch_add(reject ? &(nc->nc_miss_rejects) : &(nc->nc_passes), 1);
+
+    return (reject);
+}
+
+/*
+ * negcache_add_miss records a CN, which wasn't found or is inactive. If all 
+ * probed slots are in use, the slot expiring first is replaced.
+ */
+void
+negcache_add_miss(negcache_t *nc, const char *cn)
+{
+    struct negcache_miss *miss = NULL, *victim = NULL;
+    uint64_t h = 0;
+    time_t now = 0;
+    size_t i = 0;
+
+    if (nc == NULL || cn == NULL) {
+        return;
+    }
+
+    h = i_negcache_hash(cn);
+    now = time(NULL);
+
+    pthread_mutex_lock(&(nc->nc_miss_lock));
+    for (i = 0; i < NEGCACHE_MISS_PROBES; i++) {
+        miss = &(nc->nc_misses[(h + i) & (NEGCACHE_MISS_SLOTS - 1)]);
+
+        if (miss->nm_hash == h || miss->nm_expires <= now) {
+            victim = miss;
+            break;
+        }
+
+        if (victim == NULL || miss->nm_expires < victim->nm_expires) {
+            victim = miss;
+        }
+    }
+
+    victim->nm_hash = h;
+    victim->nm_expires = now + nc->nc_miss_ttl;
+    pthread_mutex_unlock(&(nc->nc_miss_lock));
+
+    atomic_fetch_add(&(nc->nc_miss_count), 1);
+}
+
+/*
+ * negcache_add_active adds the CN of a newly active client to the filter. 
+ * Deactivated clients can't be removed from the filter, they are rejected by
+ * the database lookup instead. The filter exceeds its false positive rate if
+ * many CNs are added after negcache_build.
+ */
+void
+negcache_add_active(negcache_t *nc, const char *cn)
+{
+    if (nc == NULL || cn == NULL) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&(nc->nc_lock));
+    if (nc->nc_filter != NULL) {
+        i_negcache_filter_add(nc->nc_filter, nc->nc_filter_mask, 
+            i_negcache_hash(cn));
+        nc->nc_filter_cns++;
+    }
+    pthread_rwlock_unlock(&(nc->nc_lock));
+}
+
+/*
+ * negcache_clear_misses forgets all recent misses, e.g. after clients were 
+ * added or activated.
+ */
+void
+negcache_clear_misses(negcache_t *nc)
+{
+    if (nc == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(nc->nc_miss_lock));
+    memset(nc->nc_misses, 0, sizeof(nc->nc_misses));
+    pthread_mutex_unlock(&(nc->nc_miss_lock));
+}
+
+/*
+ * negcache_get_stats copies the counters of the negative cache.
+ */
+void
+negcache_get_stats(negcache_t *nc, struct negcache_stats *stats)
+{
+    if (nc == NULL || stats == NULL) {
+        return;
+    }
+
+    stats->ns_filter_rejects = atomic_load(&(nc->nc_filter_rejects));
+    stats->ns_miss_rejects = atomic_load(&(nc->nc_miss_rejects));
+    stats->ns_passes = atomic_load(&(nc->nc_passes));
+    stats->ns_misses = atomic_load(&(nc->nc_miss_count));
+    stats->ns_builds = atomic_load(&(nc->nc_builds));
+
+    pthread_rwlock_rdlock(&(nc->nc_lock));
+    stats->ns_filter_cns = nc->nc_filter_cns;
+    pthread_rwlock_unlock(&(nc->nc_lock));
+}
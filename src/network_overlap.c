@@ -0,0 +1,264 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inetx.h"
+#include "network_overlap.h"
+#include "prefix.h"
+
+/* Deepest possible nesting of IPv6 prefixes, /0 to /128. */
+#define NETWORK_OVERLAP_MAX_DEPTH 129
+
+/*
+ * i_interval is the masked prefix of a network. idx points to the network in
+ * the input vector.
+ */
+struct i_interval {
+    struct prefix px;
+    size_t idx;
+};
+
+/*
+ * i_interval_cmp orders the intervals by family, start ascending and length
+ * ascending. A containing network is always sorted before its subnets.
+ */
+static int
+i_interval_cmp(const void *a, const void *b)
+{
+    return (prefix_cmp(&(((const struct i_interval *)a)->px), 
+        &(((const struct i_interval *)b)->px)));
+}
+
+/*
+ * i_parse_networks converts the network strings into intervals. IPv4 networks
+ * are parsed with the batch parser, all others with inetx_parse_prefix.
+ * Unparseable networks are skipped and counted in invalid.
+ */
+static int
+i_parse_networks(vector_t *networks, vector_t *intervals, size_t *invalid)
+{
+    const struct vpn_client_network *network = NULL;
+    struct i_interval ival = {0};
+    struct inetx_prefix prefix;
+    const char **strs = NULL;
+    uint32_t *addrs = NULL;
+    uint8_t *prefixes = NULL;
+    size_t n = vector_size(networks), i = 0;
+    int *errs = NULL, err = 0;
+
+    if ((strs = calloc(n + 1, sizeof(char *))) == NULL ||
+        (addrs = calloc(n + 1, sizeof(uint32_t))) == NULL ||
+        (prefixes = calloc(n + 1, sizeof(uint8_t))) == NULL ||
+        (errs = calloc(n + 1, sizeof(int))) == NULL) {
+        err = ENOMEM;
+        goto out_free;
+    }
+
+    for (i = 0; i < n; i++) {
+        strs[i] = ((struct vpn_client_network *)vector_at(networks, i))->
+            network_addr;
+    }
+
+    /* Errors are handled per network below. */
+    inetx_parse_ipv4_cidr_batch(strs, n, addrs, prefixes, errs);
+
+    for (i = 0; i < n; i++) {
+        network = vector_at(networks, i);
+
+        if (errs[i] == 0) {
+            prefix_set_ipv4(&(ival.px), addrs[i], prefixes[i]);
+        }
+        else if (inetx_parse_prefix(network->network_addr, &prefix) != 0 ||
+                 prefix_from_inetx(&(ival.px), &prefix) != 0) {
+            (*invalid)++;
+            continue;
+        }
+
+        prefix_mask(&(ival.px));
+        ival.idx = i;
+        if ((err = vector_push_back(intervals, &ival)) != 0) {
+            goto out_free;
+        }
+    }
+
+out_free:
+    free(errs);
+    free(prefixes);
+    free(addrs);
+    free(strs);
+    return (err);
+}
+
+/*
+ * i_run is a run of intervals with the same prefix, e.g. a network stored
+ * for several clients.
+ */
+struct i_run {
+    struct i_interval *first;
+    size_t count;
+};
+
+/*
+ * i_overlap_add adds the pair of networks if they belong to different 
+ * clients.
+ */
+static int
+i_overlap_add(vector_t *networks, vector_t *overlaps, size_t a_idx, 
+    size_t b_idx)
+{
+    struct vpn_client_network *a = vector_at(networks, a_idx);
+    struct vpn_client_network *b = vector_at(networks, b_idx);
+    struct network_overlap overlap;
+
+    if (a->client_id == b->client_id) {
+        return (0);
+    }
+
+    memcpy(&(overlap.no_a), a, sizeof(struct vpn_client_network));
+    memcpy(&(overlap.no_b), b, sizeof(struct vpn_client_network));
+    return (vector_push_back(overlaps, &overlap));
+}
+
+/*
+ * network_overlap_find searches the vpn_client_network entries for networks 
+ * of different clients, which overlap each other. Every overlapping pair is
+ * added to overlaps as network_overlap. Networks which can't be parsed are
+ * counted in invalid, which may be NULL.
+ *
+ * CIDR networks either nest or are disjoint. After sorting the prefixes by
+ * start, a sweep with a stack of the currently open networks finds all pairs
+ * in O(n log n + k) for k overlapping pairs. Equal prefixes are one entry of
+ * the stack, so every entry is longer than the one below and the stack never
+ * holds more than NETWORK_OVERLAP_MAX_DEPTH entries.
+ */
+int
+network_overlap_find(vector_t *networks, vector_t *overlaps, size_t *invalid)
+{
+    vector_t *intervals = NULL;
+    struct i_interval *ival = NULL, *end = NULL;
+    struct i_run stack[NETWORK_OVERLAP_MAX_DEPTH], run;
+    size_t depth = 0, i = 0, j = 0, k = 0, local_invalid = 0;
+    int err = 0;
+
+    if (networks == NULL || overlaps == NULL) {
+        return (EINVAL);
+    }
+
+    if (invalid == NULL) {
+        invalid = &local_invalid;
+    }
+    *invalid = 0;
+
+    if ((err = vector_alloc(&intervals, sizeof(struct i_interval))) != 0) {
+        return (err);
+    }
+
+    if ((err = i_parse_networks(networks, intervals, invalid)) != 0) {
+        goto out_free;
+    }
+
+    vector_sort(intervals, i_interval_cmp);
+
+    end = vector_end(intervals);
+    for (ival = vector_begin(intervals); ival != end; ival += run.count) {
+        /* Equal prefixes are sorted next to each other. */
+        run.first = ival;
+        for (run.count = 1; ival + run.count != end && 
+             prefix_cmp(&(ival->px), &(ival[run.count].px)) == 0; 
+             run.count++) {
+        }
+
+        /* Close all networks which end before the current one. */
+        while (depth > 0 && !prefix_contains(&(stack[depth - 1].first->px), 
+               &(ival->px))) {
+            depth--;
+        }
+
+        /* All remaining open networks contain the current ones. */
+        for (i = 0; i < depth; i++) {
+            for (j = 0; j < stack[i].count; j++) {
+                for (k = 0; k < run.count; k++) {
+                    if ((err = i_overlap_add(networks, overlaps, 
+                         stack[i].first[j].idx, run.first[k].idx)) != 0) {
+                        goto out_free;
+                    }
+                }
+            }
+        }
+
+        /* Equal networks overlap each other. */
+        for (j = 0; j < run.count; j++) {
+            for (k = j + 1; k < run.count; k++) {
+                if ((err = i_overlap_add(networks, overlaps, 
+                     run.first[j].idx, run.first[k].idx)) != 0) {
+                    goto out_free;
+                }
+            }
+        }
+
+        if (depth == NETWORK_OVERLAP_MAX_DEPTH) {
+            err = EOVERFLOW;
+            goto out_free;
+        }
+        stack[depth++] = run;
+    }
+
+out_free:
+    vector_free(intervals);
+    return (err);
+}
+
+/*
+ * network_overlap_check_db loads all client networks of the database and 
+ * searches them for overlapping networks of different clients.
+ */
+int
+network_overlap_check_db(dao_config_t *daocfg, vector_t *overlaps, 
+                         size_t *invalid)
+{
+    vector_t *networks = NULL;
+    int err = 0;
+
+    if (daocfg == NULL || overlaps == NULL) {
+        return (EINVAL);
+    }
+
+    if ((err = vector_alloc(&networks, sizeof(struct vpn_client_network))) 
+        != 0) {
+        return (err);
+    }
+
+    if ((err = dao_vpn_client_network_find_all(daocfg, networks)) == 0) {
+        err = network_overlap_find(networks, overlaps, invalid);
+    }
+
+    vector_free(networks);
+    return (err);
+}
+
+/*
+ * network_overlap_print writes one line per overlapping pair to a stream.
+ */
+void
+network_overlap_print(FILE *stream, vector_t *overlaps)
+{
+    struct network_overlap *elem = NULL;
+
+    assert(stream != NULL);
+    assert(overlaps != NULL);
+
+    for (elem = vector_begin(overlaps); elem != vector_end(overlaps);
+         elem = vector_next(overlaps, elem)) {
+        fprintf(stream, "client %d network %s (id %d) overlaps "
+            "client %d network %s (id %d)\n", elem->no_a.client_id, 
+            elem->no_a.network_addr, elem->no_a.id, elem->no_b.client_id,
+            elem->no_b.network_addr, elem->no_b.id);
+    }
+}
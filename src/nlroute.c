@@ -0,0 +1,780 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "model.h"
+#include "nlroute.h"
+
+/* Initial number of buckets of the route and the client map. */
+#define I_NLROUTE_BUCKETS_INIT 256
+
+/* Space of a route message with destination and output interface. */
+#define I_NLROUTE_MSG_SPACE (NLMSG_SPACE(sizeof(struct rtmsg)) + \
+    RTA_SPACE(sizeof(struct in6_addr)) + RTA_SPACE(sizeof(uint32_t)))
+
+#ifndef NETLINK_CAP_ACK
+#define NETLINK_CAP_ACK 10
+#endif
+
+/*
+ * i_nlroute_entry is an installed route with the number of clients using it.
+ * Clients may share a network, the route stays until the last one is gone.
+ */
+struct i_nlroute_entry {
+    struct prefix re_px;
+    size_t re_refs;
+    struct i_nlroute_entry *re_next;
+};
+
+/*
+ * i_nlroute_client contains the routes installed for a client.
+ */
+struct i_nlroute_client {
+    char nc_cn[RFC5280_CN_MAX_LENGTH];
+    struct prefix *nc_pxs;
+    size_t nc_count;
+    struct i_nlroute_client *nc_next;
+};
+
+/*
+ * nlroute installs the routes of the client networks through the tun device
+ * with rtnetlink. Route messages are queued into a batch and sent with a
+ * single send call, the acknowledgements are read afterwards. All calls are
+ * serialized by nl_lock, so connects can't interleave their batches.
+ */
+struct nlroute {
+    pthread_mutex_t nl_lock;
+    int nl_fd;
+    uint32_t nl_ifindex;
+    uint32_t nl_seq;
+    char *nl_buf;          /* Queued messages */
+    size_t nl_len;
+    size_t nl_msgs;
+    size_t nl_last;        /* Offset of the last queued message */
+    int nl_type;           /* RTM_NEWROUTE or RTM_DELROUTE */
+    char *nl_rbuf;         /* Acknowledgements and dumps */
+    struct i_nlroute_entry **nl_routes;
+    size_t nl_routes_cap;  /* A power of two */
+    struct i_nlroute_client **nl_clients;
+    size_t nl_clients_cap;
+    struct nlroute_stats nl_stats;
+};
+
+static size_t
+i_nlroute_px_hash(const struct prefix *px)
+{
+    uint64_t h = (uint64_t)(px->px_addr >> 64) * 0x9e3779b97f4a7c15ULL;
+
+    h ^= (uint64_t)px->px_addr;
+    h ^= ((uint64_t)px->px_family << 8) | px->px_length;
+    h *= 0xff51afd7ed558ccdULL;
+
+    return (h ^ (h >> 33));
+}
+
+static size_t
+i_nlroute_cn_hash(const char *cn)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (; *cn != '\0'; cn++) {
+        h = (h ^ (unsigned char)*cn) * 1099511628211ULL;
+    }
+
+    return (h);
+}
+
+static bool
+i_nlroute_px_equal(const struct prefix *a, const struct prefix *b)
+{
+    return (a->px_addr == b->px_addr && a->px_family == b->px_family &&
+        a->px_length == b->px_length);
+}
+
+/*
+ * i_nlroute_flush sends the queued batch. Only the last message requests an
+ * acknowledgement, the kernel answers the others only if it refuses them.
+ * A thousand acknowledgements wouldn't fit the receive buffer, errors only
+ * overflow it if most routes fail. Routes the kernel refuses are counted,
+ * the first error is returned. Deleting a route, which is already gone, is
+ * no error.
+ */
+static int
+i_nlroute_flush(nlroute_t *nl)
+{
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    struct nlmsghdr *nh = NULL;
+    struct nlmsgerr *nlerr = NULL;
+    uint32_t first_seq = nl->nl_seq - nl->nl_msgs + 1;
+    size_t failed = 0;
+    ssize_t n = 0;
+    bool done = false;
+    int err = 0, code = 0;
+
+    if (nl->nl_msgs == 0) {
+        return (0);
+    }
+
+    ((struct nlmsghdr *)(nl->nl_buf + nl->nl_last))->nlmsg_flags |= 
+        NLM_F_ACK;
+
+    while ((n = sendto(nl->nl_fd, nl->nl_buf, nl->nl_len, 0,
+            (struct sockaddr *)&kernel, sizeof(kernel))) < 0 &&
+           errno == EINTR) {
+    }
+
+    if (n < 0) {
+        err = errno;
+        nl->nl_stats.ns_failed += nl->nl_msgs;
+        goto out_reset;
+    }
+    nl->nl_stats.ns_batches++;
+
+    while (!done) {
+        if ((n = recv(nl->nl_fd, nl->nl_rbuf, NLROUTE_BATCH_SIZE, 0)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == ENOBUFS) {
+                /* Errors were lost, the final acknowledgement follows. */
+                err = (err != 0) ? err : ENOBUFS;
+                continue;
+            }
+            err = (errno == EAGAIN) ? ETIMEDOUT : errno;
+            break;
+        }
+
+        for (nh = (struct nlmsghdr *)nl->nl_rbuf; NLMSG_OK(nh, (size_t)n);
+             nh = NLMSG_NEXT(nh, n)) {
+            /* Answers of an earlier, timed out batch are skipped. */
+            if (nh->nlmsg_type != NLMSG_ERROR || 
+                nh->nlmsg_seq - first_seq >= nl->nl_msgs) {
+                continue;
+            }
+
+            nlerr = NLMSG_DATA(nh);
+            code = -nlerr->error;
+            done = done || nh->nlmsg_seq == nl->nl_seq;
+
+            if (code != 0 && (nl->nl_type == RTM_NEWROUTE ||
+                (code != ESRCH && code != ENOENT))) {
+                failed++;
+                err = (err != 0) ? err : code;
+            }
+        }
+    }
+
+    /* Without the final acknowledgement the result of the rest is unknown. */
+    nl->nl_stats.ns_failed += failed;
+    if (done && nl->nl_type == RTM_NEWROUTE) {
+        nl->nl_stats.ns_added += nl->nl_msgs - failed;
+    } else if (done) {
+        nl->nl_stats.ns_removed += nl->nl_msgs - failed;
+    }
+
+out_reset:
+    nl->nl_len = 0;
+    nl->nl_msgs = 0;
+    return (err);
+}
+
+static void
+i_nlroute_attr(struct nlmsghdr *nh, unsigned short type, const void *data,
+               size_t len)
+{
+    struct rtattr *rta = (struct rtattr *)((char *)nh +
+        NLMSG_ALIGN(nh->nlmsg_len));
+
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+/*
+ * i_nlroute_queue adds a route message to the batch. A full batch or a batch
+ * of the other message type is sent first.
+ */
+static int
+i_nlroute_queue(nlroute_t *nl, int type, const struct prefix *px)
+{
+    struct nlmsghdr *nh = NULL;
+    struct rtmsg *rtm = NULL;
+    uint8_t addr[sizeof(struct in6_addr)];
+    int err = 0;
+
+    if ((nl->nl_msgs > 0 && nl->nl_type != type) ||
+        nl->nl_len + I_NLROUTE_MSG_SPACE > NLROUTE_BATCH_SIZE) {
+        err = i_nlroute_flush(nl);
+    }
+    nl->nl_type = type;
+
+    nh = (struct nlmsghdr *)(nl->nl_buf + nl->nl_len);
+    memset(nh, 0, I_NLROUTE_MSG_SPACE);
+    nh->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    nh->nlmsg_type = type;
+    nh->nlmsg_flags = NLM_F_REQUEST |
+        (type == RTM_NEWROUTE ? NLM_F_CREATE | NLM_F_REPLACE : 0);
+    nh->nlmsg_seq = ++nl->nl_seq;
+
+    rtm = NLMSG_DATA(nh);
+    rtm->rtm_family = px->px_family;
+    rtm->rtm_dst_len = px->px_length;
+    rtm->rtm_table = RT_TABLE_MAIN;
+    rtm->rtm_protocol = NLROUTE_PROTOCOL;
+    rtm->rtm_type = RTN_UNICAST;
+
+    /* A delete with scope nowhere matches the route of any scope. */
+    if (type == RTM_DELROUTE) {
+        rtm->rtm_scope = RT_SCOPE_NOWHERE;
+    } else {
+        rtm->rtm_scope = (px->px_family == AF_INET) ? RT_SCOPE_LINK :
+            RT_SCOPE_UNIVERSE;
+    }
+
+    prefix_get_addr(px, addr);
+    i_nlroute_attr(nh, RTA_DST, addr, px->px_family == AF_INET ?
+        sizeof(struct in_addr) : sizeof(struct in6_addr));
+    i_nlroute_attr(nh, RTA_OIF, &(nl->nl_ifindex), sizeof(uint32_t));
+
+    nl->nl_last = nl->nl_len;
+    nl->nl_len += NLMSG_ALIGN(nh->nlmsg_len);
+    nl->nl_msgs++;
+
+    return (err);
+}
+
+/*
+ * nlroute_open opens a rtnetlink socket for the routes through the device
+ * ifname, usually the tun device of OpenVPN. CAP_NET_ADMIN is required, e.g.
+ * in the network namespace of an unprivileged user namespace.
+ */
+int
+nlroute_open(nlroute_t **nlp, const char *ifname)
+{
+    struct sockaddr_nl local = { .nl_family = AF_NETLINK };
+    struct timeval timeout = { NLROUTE_TIMEOUT, 0 };
+    int one = 1, rcvbuf = NLROUTE_RCVBUF_SIZE, err = 0;
+
+    if (nlp == NULL || ifname == NULL) {
+        return (EINVAL);
+    }
+
+    if ((*nlp = calloc(1, sizeof(nlroute_t))) == NULL) {
+        return (ENOMEM);
+    }
+    (*nlp)->nl_fd = -1;
+    pthread_mutex_init(&((*nlp)->nl_lock), NULL);
+
+    if (((*nlp)->nl_ifindex = if_nametoindex(ifname)) == 0) {
+        err = errno;
+        goto out_close;
+    }
+
+    if (((*nlp)->nl_buf = malloc(NLROUTE_BATCH_SIZE)) == NULL ||
+        ((*nlp)->nl_rbuf = malloc(NLROUTE_BATCH_SIZE)) == NULL ||
+        ((*nlp)->nl_routes = calloc(I_NLROUTE_BUCKETS_INIT,
+         sizeof(struct i_nlroute_entry *))) == NULL ||
+        ((*nlp)->nl_clients = calloc(I_NLROUTE_BUCKETS_INIT,
+         sizeof(struct i_nlroute_client *))) == NULL) {
+        err = ENOMEM;
+        goto out_close;
+    }
+    (*nlp)->nl_routes_cap = I_NLROUTE_BUCKETS_INIT;
+    (*nlp)->nl_clients_cap = I_NLROUTE_BUCKETS_INIT;
+
+    if (((*nlp)->nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+         NETLINK_ROUTE)) < 0 ||
+        bind((*nlp)->nl_fd, (struct sockaddr *)&local, sizeof(local)) != 0) {
+        err = errno;
+        goto out_close;
+    }
+
+    /* Errors without the request, so more of them fit the buffer. */
+    setsockopt((*nlp)->nl_fd, SOL_NETLINK, NETLINK_CAP_ACK, &one,
+        sizeof(one));
+    setsockopt((*nlp)->nl_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, 
+        sizeof(rcvbuf));
+    setsockopt((*nlp)->nl_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, 
+        sizeof(timeout));
+
+    return (0);
+
+out_close:
+    nlroute_close(*nlp);
+    *nlp = NULL;
+    return (err);
+}
+
+/*
+ * nlroute_close closes the socket. Installed routes are left to the kernel,
+ * they disappear with the tun device and nlroute_reconcile removes leftovers
+ * of a crashed process.
+ */
+void
+nlroute_close(nlroute_t *nl)
+{
+    struct i_nlroute_entry *entry = NULL, *next_entry = NULL;
+    struct i_nlroute_client *client = NULL, *next_client = NULL;
+    size_t i = 0;
+
+    if (nl == NULL) {
+        return;
+    }
+
+    for (i = 0; nl->nl_routes != NULL && i < nl->nl_routes_cap; i++) {
+        for (entry = nl->nl_routes[i]; entry != NULL; entry = next_entry) {
+            next_entry = entry->re_next;
+            free(entry);
+        }
+    }
+
+    for (i = 0; nl->nl_clients != NULL && i < nl->nl_clients_cap; i++) {
+        for (client = nl->nl_clients[i]; client != NULL;
+             client = next_client) {
+            next_client = client->nc_next;
+            free(client->nc_pxs);
+            free(client);
+        }
+    }
+
+    if (nl->nl_fd >= 0) {
+        close(nl->nl_fd);
+    }
+
+    pthread_mutex_destroy(&(nl->nl_lock));
+    free(nl->nl_clients);
+    free(nl->nl_routes);
+    free(nl->nl_rbuf);
+    free(nl->nl_buf);
+    free(nl);
+}
+
+/*
+ * i_nlroute_grow doubles the buckets of the route map. A failed allocation
+ * keeps the longer chains.
+ */
+static void
+i_nlroute_grow(nlroute_t *nl)
+{
+    struct i_nlroute_entry **buckets = NULL, *entry = NULL, *next = NULL;
+    size_t cap = nl->nl_routes_cap * 2, i = 0, b = 0;
+
+    if ((buckets = calloc(cap, sizeof(struct i_nlroute_entry *))) == NULL) {
+        return;
+    }
+
+    for (i = 0; i < nl->nl_routes_cap; i++) {
+        for (entry = nl->nl_routes[i]; entry != NULL; entry = next) {
+            next = entry->re_next;
+            b = i_nlroute_px_hash(&(entry->re_px)) & (cap - 1);
+            entry->re_next = buckets[b];
+            buckets[b] = entry;
+        }
+    }
+
+    free(nl->nl_routes);
+    nl->nl_routes = buckets;
+    nl->nl_routes_cap = cap;
+}
+
+/*
+ * i_nlroute_ref takes a reference to a route and queues its installation,
+ * if it's the first one.
+ */
+static int
+i_nlroute_ref(nlroute_t *nl, const struct prefix *px)
+{
+    struct i_nlroute_entry **bucket = NULL, *entry = NULL;
+
+    bucket = &(nl->nl_routes[i_nlroute_px_hash(px) &
+        (nl->nl_routes_cap - 1)]);
+    for (entry = *bucket; entry != NULL; entry = entry->re_next) {
+        if (i_nlroute_px_equal(&(entry->re_px), px)) {
+            entry->re_refs++;
+            return (0);
+        }
+    }
+
+    if ((entry = calloc(1, sizeof(struct i_nlroute_entry))) == NULL) {
+        return (ENOMEM);
+    }
+
+    entry->re_px = *px;
+    entry->re_refs = 1;
+    entry->re_next = *bucket;
+    *bucket = entry;
+
+    if (++nl->nl_stats.ns_routes > nl->nl_routes_cap) {
+        i_nlroute_grow(nl);
+    }
+
+    return (i_nlroute_queue(nl, RTM_NEWROUTE, px));
+}
+
+/*
+ * i_nlroute_unref drops a reference to a route and queues its removal with
+ * the last one.
+ */
+static int
+i_nlroute_unref(nlroute_t *nl, const struct prefix *px)
+{
+    struct i_nlroute_entry **link = NULL, *entry = NULL;
+
+    for (link = &(nl->nl_routes[i_nlroute_px_hash(px) &
+         (nl->nl_routes_cap - 1)]); (entry = *link) != NULL;
+         link = &(entry->re_next)) {
+        if (i_nlroute_px_equal(&(entry->re_px), px)) {
+            break;
+        }
+    }
+
+    if (entry == NULL || --entry->re_refs > 0) {
+        return (0);
+    }
+
+    *link = entry->re_next;
+    free(entry);
+    nl->nl_stats.ns_routes--;
+
+    return (i_nlroute_queue(nl, RTM_DELROUTE, px));
+}
+
+static struct i_nlroute_client **
+i_nlroute_client_find(nlroute_t *nl, const char *cn)
+{
+    struct i_nlroute_client **link = NULL;
+
+    for (link = &(nl->nl_clients[i_nlroute_cn_hash(cn) &
+         (nl->nl_clients_cap - 1)]); *link != NULL;
+         link = &((*link)->nc_next)) {
+        if (strcmp((*link)->nc_cn, cn) == 0) {
+            break;
+        }
+    }
+
+    return (link);
+}
+
+/*
+ * i_nlroute_client_grow doubles the buckets of the client map.
+ */
+static void
+i_nlroute_client_grow(nlroute_t *nl)
+{
+    struct i_nlroute_client **buckets = NULL, *client = NULL, *next = NULL;
+    size_t cap = nl->nl_clients_cap * 2, i = 0, b = 0;
+
+    if ((buckets = calloc(cap, sizeof(struct i_nlroute_client *))) == NULL) {
+        return;
+    }
+
+    for (i = 0; i < nl->nl_clients_cap; i++) {
+        for (client = nl->nl_clients[i]; client != NULL; client = next) {
+            next = client->nc_next;
+            b = i_nlroute_cn_hash(client->nc_cn) & (cap - 1);
+            client->nc_next = buckets[b];
+            buckets[b] = client;
+        }
+    }
+
+    free(nl->nl_clients);
+    nl->nl_clients = buckets;
+    nl->nl_clients_cap = cap;
+}
+
+/*
+ * nlroute_client_set installs the routes of a client's networks and removes
+ * its routes, which aren't part of them anymore. The prefixes are aggregated
+ * first, so adjacent and covered networks cost a single route. All changes
+ * are sent in batches, deletes after adds. Routes the kernel refuses are
+ * returned as error, but stay registered for nlroute_reconcile.
+ */
+int
+nlroute_client_set(nlroute_t *nl, const char *cn, const struct prefix *pxs,
+                   size_t n)
+{
+    struct i_nlroute_client **link = NULL, *client = NULL;
+    struct prefix *set = NULL;
+    size_t i = 0;
+    int err = 0, ret = 0;
+
+    if (nl == NULL || cn == NULL || strlen(cn) >= RFC5280_CN_MAX_LENGTH ||
+        (pxs == NULL && n > 0)) {
+        return (EINVAL);
+    }
+
+    if (n > 0) {
+        if ((set = malloc(n * sizeof(struct prefix))) == NULL) {
+            return (ENOMEM);
+        }
+        memcpy(set, pxs, n * sizeof(struct prefix));
+        n = prefix_aggregate(set, n);
+    }
+
+    pthread_mutex_lock(&(nl->nl_lock));
+
+    if ((client = *(link = i_nlroute_client_find(nl, cn))) == NULL) {
+        if (n == 0) {
+            goto out_unlock;
+        }
+
+        if ((client = calloc(1, sizeof(struct i_nlroute_client))) == NULL) {
+            ret = ENOMEM;
+            goto out_unlock;
+        }
+        strcpy(client->nc_cn, cn);
+        client->nc_next = *link;
+        *link = client;
+
+        if (++nl->nl_stats.ns_clients > nl->nl_clients_cap) {
+            i_nlroute_client_grow(nl);
+            link = i_nlroute_client_find(nl, cn);
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        if ((err = i_nlroute_ref(nl, &(set[i]))) != 0 && ret == 0) {
+            ret = err;
+        }
+    }
+
+    for (i = 0; i < client->nc_count; i++) {
+        if ((err = i_nlroute_unref(nl, &(client->nc_pxs[i]))) != 0 &&
+            ret == 0) {
+            ret = err;
+        }
+    }
+
+    if ((err = i_nlroute_flush(nl)) != 0 && ret == 0) {
+        ret = err;
+    }
+
+    free(client->nc_pxs);
+    client->nc_pxs = set;
+    client->nc_count = n;
+    set = NULL;
+
+    if (n == 0) {
+        *link = client->nc_next;
+        free(client);
+        nl->nl_stats.ns_clients--;
+    }
+
+out_unlock:
+    pthread_mutex_unlock(&(nl->nl_lock));
+    free(set);
+    return (ret);
+}
+
+/*
+ * nlroute_client_clear removes the routes of a disconnected client.
+ */
+int
+nlroute_client_clear(nlroute_t *nl, const char *cn)
+{
+    return (nlroute_client_set(nl, cn, NULL, 0));
+}
+
+/*
+ * i_nlroute_dump reads our routes through the device from the main table.
+ */
+static int
+i_nlroute_dump(nlroute_t *nl, struct prefix **pxsp, size_t *np)
+{
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    struct {
+        struct nlmsghdr nh;
+        struct rtmsg rtm;
+    } req;
+    struct nlmsghdr *nh = NULL;
+    struct rtmsg *rtm = NULL;
+    struct rtattr *rta = NULL;
+    struct prefix *pxs = NULL, *tmp = NULL;
+    uint8_t dst[sizeof(struct in6_addr)];
+    uint32_t oif = 0, table = 0;
+    size_t n = 0, cap = 0;
+    ssize_t len = 0;
+    int attrlen = 0, err = 0;
+    bool done = false;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    req.nh.nlmsg_type = RTM_GETROUTE;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = ++nl->nl_seq;
+    req.rtm.rtm_family = AF_UNSPEC;
+
+    if (sendto(nl->nl_fd, &req, req.nh.nlmsg_len, 0,
+        (struct sockaddr *)&kernel, sizeof(kernel)) < 0) {
+        return (errno);
+    }
+
+    while (!done) {
+        if ((len = recv(nl->nl_fd, nl->nl_rbuf, NLROUTE_BATCH_SIZE, 0)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            err = (errno == EAGAIN) ? ETIMEDOUT : errno;
+            goto out_free;
+        }
+
+        for (nh = (struct nlmsghdr *)nl->nl_rbuf; NLMSG_OK(nh, (size_t)len);
+             nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_seq != req.nh.nlmsg_seq) {
+                continue;
+            } else if (nh->nlmsg_type == NLMSG_DONE) {
+                done = true;
+                break;
+            } else if (nh->nlmsg_type == NLMSG_ERROR) {
+                err = -((struct nlmsgerr *)NLMSG_DATA(nh))->error;
+                goto out_free;
+            } else if (nh->nlmsg_type != RTM_NEWROUTE) {
+                continue;
+            }
+
+            rtm = NLMSG_DATA(nh);
+            if (rtm->rtm_protocol != NLROUTE_PROTOCOL ||
+                (rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6)) {
+                continue;
+            }
+
+            memset(dst, 0, sizeof(dst));
+            oif = 0;
+            table = rtm->rtm_table;
+            attrlen = RTM_PAYLOAD(nh);
+            for (rta = RTM_RTA(rtm); RTA_OK(rta, attrlen);
+                 rta = RTA_NEXT(rta, attrlen)) {
+                if (rta->rta_type == RTA_DST &&
+                    RTA_PAYLOAD(rta) <= sizeof(dst)) {
+                    memcpy(dst, RTA_DATA(rta), RTA_PAYLOAD(rta));
+                } else if (rta->rta_type == RTA_OIF) {
+                    memcpy(&oif, RTA_DATA(rta), sizeof(oif));
+                } else if (rta->rta_type == RTA_TABLE) {
+                    memcpy(&table, RTA_DATA(rta), sizeof(table));
+                }
+            }
+
+            if (oif != nl->nl_ifindex || table != RT_TABLE_MAIN) {
+                continue;
+            }
+
+            if (n == cap) {
+                cap = (cap == 0) ? 64 : cap * 2;
+                if ((tmp = realloc(pxs, cap * sizeof(struct prefix)))
+                    == NULL) {
+                    err = ENOMEM;
+                    goto out_free;
+                }
+                pxs = tmp;
+            }
+
+            if (prefix_set(&(pxs[n]), rtm->rtm_family, dst,
+                rtm->rtm_dst_len) == 0) {
+                n++;
+            }
+        }
+    }
+
+    *pxsp = pxs;
+    *np = n;
+    return (0);
+
+out_free:
+    free(pxs);
+    return (err);
+}
+
+/*
+ * nlroute_reconcile makes our routes through the device in the kernel equal
+ * to the registered routes: routes left over by a previous process are
+ * removed, missing routes are installed. Call it at startup, or to repair
+ * routes after the kernel refused them.
+ */
+int
+nlroute_reconcile(nlroute_t *nl)
+{
+    struct i_nlroute_entry *entry = NULL;
+    struct prefix *kernel = NULL, *wanted = NULL;
+    size_t nkernel = 0, nwanted = 0, i = 0, j = 0;
+    int cmp = 0, err = 0, ret = 0;
+
+    if (nl == NULL) {
+        return (EINVAL);
+    }
+
+    pthread_mutex_lock(&(nl->nl_lock));
+
+    if ((ret = i_nlroute_dump(nl, &kernel, &nkernel)) != 0) {
+        goto out_unlock;
+    }
+
+    if ((wanted = calloc(nl->nl_stats.ns_routes + 1, sizeof(struct prefix)))
+        == NULL) {
+        ret = ENOMEM;
+        goto out_unlock;
+    }
+
+    for (i = 0; i < nl->nl_routes_cap; i++) {
+        for (entry = nl->nl_routes[i]; entry != NULL;
+             entry = entry->re_next) {
+            wanted[nwanted++] = entry->re_px;
+        }
+    }
+
+    prefix_sort(kernel, nkernel);
+    prefix_sort(wanted, nwanted);
+
+    /* Removals first, then the missing routes. */
+    for (i = 0, j = 0; i < nkernel; ) {
+        cmp = (j < nwanted) ? prefix_cmp(&(kernel[i]), &(wanted[j])) : -1;
+        if (cmp < 0 && (err = i_nlroute_queue(nl, RTM_DELROUTE,
+            &(kernel[i]))) != 0 && ret == 0) {
+            ret = err;
+        }
+        i += (cmp <= 0);
+        j += (cmp >= 0);
+    }
+
+    for (i = 0, j = 0; j < nwanted; ) {
+        cmp = (i < nkernel) ? prefix_cmp(&(kernel[i]), &(wanted[j])) : 1;
+        if (cmp > 0 && (err = i_nlroute_queue(nl, RTM_NEWROUTE,
+            &(wanted[j]))) != 0 && ret == 0) {
+            ret = err;
+        }
+        i += (cmp <= 0);
+        j += (cmp >= 0);
+    }
+
+    if ((err = i_nlroute_flush(nl)) != 0 && ret == 0) {
+        ret = err;
+    }
+
+out_unlock:
+    pthread_mutex_unlock(&(nl->nl_lock));
+    free(wanted);
+    free(kernel);
+    return (ret);
+}
+
+/*
+ * nlroute_get_stats copies the counters.
+ */
+void
+nlroute_get_stats(nlroute_t *nl, struct nlroute_stats *stats)
+{
+    pthread_mutex_lock(&(nl->nl_lock));
+    *stats = nl->nl_stats;
+    pthread_mutex_unlock(&(nl->nl_lock));
+}
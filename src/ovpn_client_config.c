@@ -8,34 +8,12 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
+#include <unistd.h>
 
 #include "ovpn_client_config.h"
-
-struct ovpn_client_network {
-    address_family_t vpncn_family;
-    union {
-        struct in_addr vpncn_ipv4_addr;
-        struct in6_addr vpncn_ipv6_addr;
-    };
-    size_t vpncn_prefix;
-};
-
-struct ovpn_client_route {
-    address_family_t vpncr_family;
-    union {
-        struct {
-            struct in_addr vpncr_ipv4_addr;
-            struct in_addr vpncr_ipv4_gateway_addr;
-        };
-        struct {
-            struct in6_addr vpncr_ipv6_addr;
-            struct in6_addr vpncr_ipv6_gateway_addr;
-        };
-    };
-    size_t vpncr_prefix;
-    short vpncr_metric;
-};
+#include "prefix.h"
 
 struct ovpn_client_config {
     struct in_addr vpncc_ipv4_addr;
@@ -425,6 +403,92 @@ i_fprintf_vpncc_push_routes(FILE *stream, const ovpn_client_config_t *vpncc)
     return (0);
 }
 
+/*
+ * i_fprintf_vpncc_iter_push_routes writes the push route entries returned by
+ * a route iterator.
+ */
+static int
+i_fprintf_vpncc_iter_push_routes(FILE *stream, 
+                                 ovpn_client_route_iter_fn route_iter,
+                                 void *route_iter_ctx)
+{
+    struct ovpn_client_route route = {0};
+    int err = 0;
+
+    assert(stream != NULL);
+    assert(route_iter != NULL);
+
+    while ((err = route_iter(route_iter_ctx, &route)) == 0) {
+        if (route.vpncr_family != ADDRESS_FAMILY_IPV4 && 
+            route.vpncr_family != ADDRESS_FAMILY_IPV6) {
+            return (EINVAL);
+        }
+
+        if ((err = i_fprintf_vpncc_push_route(stream, &route)) != 0) { 
+            return (err);
+        }
+    }
+
+    return (err == ENOENT ? 0 : err);
+}
+
+/*
+ * ovpn_client_route_print writes the push route entry of a route, exactly as
+ * it appears in a built config.
+ */
+int
+ovpn_client_route_print(FILE *stream, const struct ovpn_client_route *route)
+{
+    if (stream == NULL || route == NULL || 
+        (route->vpncr_family != ADDRESS_FAMILY_IPV4 && 
+         route->vpncr_family != ADDRESS_FAMILY_IPV6)) {
+        return (EINVAL);
+    }
+
+    return (i_fprintf_vpncc_push_route(stream, route));
+}
+
+/*
+ * i_fprintf_vpncc writes all options of the OpenVPN client config to a 
+ * stream. The routes of the iterator, if set, follow the routes of the config.
+ */
+static int
+i_fprintf_vpncc(FILE *stream, const ovpn_client_config_t *vpncc,
+                ovpn_client_route_iter_fn route_iter, void *route_iter_ctx)
+{
+    int err = 0;
+
+    assert(stream != NULL);
+    assert(vpncc != NULL);
+
+    /* Write the ifconfig-push option */
+    if ((err = i_fprintf_vpncc_ifconfig_push(stream, vpncc)) != 0) {
+        return (err);
+    }
+
+    if (vpncc->vpncc_has_ipv6_addr == true &&
+        (err = i_fprintf_vpncc_ifconfig_ipv6_push(stream, vpncc)) != 0) {
+        return (err);
+    }
+
+    /* Write the iroute entries */
+    if ((err = i_fprintf_vpncc_iroutes(stream, vpncc)) != 0) {
+        return (err);
+    }
+
+    /* Write the push route entries */
+    if ((err = i_fprintf_vpncc_push_routes(stream, vpncc)) != 0) {
+        return (err);
+    }
+
+    if (route_iter != NULL && (err = i_fprintf_vpncc_iter_push_routes(stream,
+        route_iter, route_iter_ctx)) != 0) {
+        return (err);
+    }
+
+    return (0);
+}
+
 /*
  * Writes the OpenVPN client config to a stream
  */
@@ -445,23 +509,7 @@ ovpn_client_config_build(ovpn_client_config_t *vpncc, FILE *stream)
         return (errno);
     }
 
-    /* Write the ifconfig-push option */
-    if ((err = i_fprintf_vpncc_ifconfig_push(local_stream, vpncc)) != 0) {
-        goto out_free_buffer;
-    }
-
-    if (vpncc->vpncc_has_ipv6_addr == true &&
-        (err = i_fprintf_vpncc_ifconfig_ipv6_push(local_stream, vpncc)) != 0) {
-        goto out_free_buffer;
-    }
-
-    /* Write the iroute entries */
-    if ((err = i_fprintf_vpncc_iroutes(local_stream, vpncc)) != 0) {
-        goto out_free_buffer;
-    }
-
-    /* Write the push route entries */
-    if ((err = i_fprintf_vpncc_push_routes(local_stream, vpncc)) != 0) {
+    if ((err = i_fprintf_vpncc(local_stream, vpncc, NULL, NULL)) != 0) {
         goto out_free_buffer;
     }
 
@@ -475,6 +523,113 @@ out_free_buffer:
     return (err);
 }
 
+/*
+ * i_build_stream_cookie connects the stdio stream of the streaming builder
+ * with the write function. The first write error is kept in err.
+ */
+struct i_build_stream_cookie {
+    ovpn_client_config_write_fn write_fn;
+    void *write_ctx;
+    int err;
+};
+
+static ssize_t
+i_build_stream_write(void *cookie, const char *buf, size_t size)
+{
+    struct i_build_stream_cookie *c = cookie;
+    size_t written = 0;
+    ssize_t n = 0;
+
+    /* Write the whole chunk, the write function may write partially. */
+    while (written < size) {
+        if ((n = c->write_fn(c->write_ctx, buf + written, size - written)) 
+            < 0) {
+            c->err = (errno != 0) ? errno : EIO;
+            return (-1);
+        } else if (n == 0) {
+            /* No progress, retrying would never end. */
+            c->err = EIO;
+            return (-1);
+        }
+        written += n;
+    }
+
+    return (written);
+}
+
+/*
+ * Writes the OpenVPN client config in chunks of OVPN_CLIENT_CONFIG_CHUNK_SIZE
+ * bytes to the write function. The routes of the route iterator, which may be 
+ * NULL, are written after the routes of the config without being stored in 
+ * between, so the memory usage is bounded regardless of the number of routes. 
+ * Unlike ovpn_client_config_build the output is partially written on error.
+ */
+int
+ovpn_client_config_build_stream(ovpn_client_config_t *vpncc, 
+                                ovpn_client_config_write_fn write_fn, 
+                                void *write_ctx, 
+                                ovpn_client_route_iter_fn route_iter, 
+                                void *route_iter_ctx)
+{
+    struct i_build_stream_cookie cookie = {0};
+    cookie_io_functions_t io_funcs = { .write = i_build_stream_write };
+    char buf[OVPN_CLIENT_CONFIG_CHUNK_SIZE];
+    FILE *stream = NULL;
+    int err = 0;
+
+    if (vpncc == NULL || write_fn == NULL) {
+        return (EINVAL);
+    }
+
+    cookie.write_fn = write_fn;
+    cookie.write_ctx = write_ctx;
+
+    if ((stream = fopencookie(&cookie, "w", io_funcs)) == NULL) {
+        return (errno);
+    }
+
+    /* The fixed buffer makes stdio emit full chunks only. */
+    setvbuf(stream, buf, _IOFBF, sizeof(buf));
+
+    err = i_fprintf_vpncc(stream, vpncc, route_iter, route_iter_ctx);
+
+    /* Flush the last chunk. */
+    if (fclose(stream) != 0 && err == 0) {
+        err = (cookie.err != 0) ? cookie.err : EIO;
+    }
+
+    return (err != 0 ? err : cookie.err);
+}
+
+static ssize_t
+i_build_fd_write(void *ctx, const char *buf, size_t size)
+{
+    ssize_t n = 0;
+
+    while ((n = write(*(int *)ctx, buf, size)) < 0 && errno == EINTR) {
+        continue;
+    }
+
+    return (n);
+}
+
+/*
+ * Writes the OpenVPN client config in chunks to a file descriptor, see 
+ * ovpn_client_config_build_stream.
+ */
+int
+ovpn_client_config_build_fd(ovpn_client_config_t *vpncc, int fd,
+                            ovpn_client_route_iter_fn route_iter, 
+                            void *route_iter_ctx)
+{
+    if (vpncc == NULL || fd < 0) {
+        return (EINVAL);
+    }
+
+    return (ovpn_client_config_build_stream(vpncc, i_build_fd_write, &fd,
+        route_iter, route_iter_ctx));
+}
+
 /*
  * Set the IPv6 address of the client.
  */
@@ -503,23 +658,41 @@ ovpn_client_config_set_ipv6_addr(ovpn_client_config_t *vpncc,
     return (0);
 }
 
+/*
+ * i_network_from_prefix stores a parsed prefix of the expected family, or of 
+ * any family if af is 0, as network entry.
+ */
+static int
+i_network_from_prefix(struct ovpn_client_network *entry, 
+                      const struct inetx_prefix *prefix, int af)
+{
+    if (af != 0 && (int)prefix->ip_family != af) {
+        return (EINVAL);
+    }
+
+    memset(entry, 0, sizeof(struct ovpn_client_network));
+    entry->vpncn_family = prefix->ip_family;
+    entry->vpncn_ipv6_addr = prefix->ip_ipv6_addr;
+    entry->vpncn_prefix = prefix->ip_length;
+
+    return (0);
+}
+
 int
 ovpn_client_config_add_ipv4_network(ovpn_client_config_t *vpncc, 
                                     const char *str)
 {
     struct ovpn_client_network entry = {0};
+    struct inetx_prefix prefix;
     int err = 0;
 
     if (vpncc == NULL || str == NULL) {
         return (EINVAL);
     }
 
-    /* Set the corresponding address family. */
-    entry.vpncn_family = ADDRESS_FAMILY_IPV4;
-
     /* Parse the network CIDR to get IP and prefix */
-    if ((err = inetx_parse_ipv4_cidr(str, &(entry.vpncn_ipv4_addr), 
-         &(entry.vpncn_prefix))) != 0) {
+    if ((err = inetx_parse_prefix(str, &prefix)) != 0 ||
+        (err = i_network_from_prefix(&entry, &prefix, AF_INET)) != 0) {
         return (err);
     }
 
@@ -532,18 +705,16 @@ ovpn_client_config_add_ipv6_network(ovpn_client_config_t *vpncc,
                                     const char *str)
 {
     struct ovpn_client_network entry = {0};
+    struct inetx_prefix prefix;
     int err = 0;
 
     if (vpncc == NULL || str == NULL) {
         return (EINVAL);
     }
 
-    /* Set the corresponding address family. */
-    entry.vpncn_family = ADDRESS_FAMILY_IPV6;
-
     /* Parse address and prefix. */
-    if ((err = inetx_parse_ipv6_cidr(str, &(entry.vpncn_ipv6_addr), 
-         &(entry.vpncn_prefix))) != 0) {
+    if ((err = inetx_parse_prefix(str, &prefix)) != 0 ||
+        (err = i_network_from_prefix(&entry, &prefix, AF_INET6)) != 0) {
         return (err);
     }
 
@@ -551,67 +722,114 @@ ovpn_client_config_add_ipv6_network(ovpn_client_config_t *vpncc,
     return (vector_push_back(vpncc->vpncc_networks, &entry));
 }
 
+/*
+ * Parses an IPv4 or IPv6 network string into a network entry. The family is
+ * detected while parsing, the string is read only once. An address without
+ * prefix length is a host network.
+ */
 int
-ovpn_client_config_add_network(ovpn_client_config_t *vpncc, const char *str)
+ovpn_client_network_parse(struct ovpn_client_network *entry, const char *str)
 {
-    int err = 0, af = 0;
+    struct inetx_prefix prefix;
+    int err = 0;
 
-    if (vpncc == NULL || str == NULL) {
+    if (entry == NULL || str == NULL) {
         return (EINVAL);
     }
 
-    /* Predict address familiy */
-    if ((err = inetx_predict_address_family(str, &af)) != 0) {
+    memset(entry, 0, sizeof(struct ovpn_client_network));
+
+    if ((err = inetx_parse_prefix(str, &prefix)) != 0) {
         return (err);
     }
 
-    /* Add new network based on family. */
-    switch (af) {
-    case AF_INET:
-        err  = ovpn_client_config_add_ipv4_network(vpncc, str);
-        break;
-    case AF_INET6:
-        err = ovpn_client_config_add_ipv6_network(vpncc, str);
-        break;
-    default:
-        err = ENOTSUP;
-        break;
+    return (i_network_from_prefix(entry, &prefix, 0));
+}
+
+/*
+ * Adds an already parsed network entry to the client config.
+ */
+int
+ovpn_client_config_add_network_entry(ovpn_client_config_t *vpncc, 
+                                     const struct ovpn_client_network *entry)
+{
+    if (vpncc == NULL || entry == NULL || 
+        (entry->vpncn_family != ADDRESS_FAMILY_IPV4 && 
+         entry->vpncn_family != ADDRESS_FAMILY_IPV6)) {
+        return (EINVAL);
     }
 
-    return (err);
+    return (vector_push_back(vpncc->vpncc_networks, (void *)entry));
 }
 
 int
-ovpn_client_config_add_ipv4_route(ovpn_client_config_t *vpncc, const char *str, 
-                                 const char *gateway_str, short metric)
+ovpn_client_config_add_network(ovpn_client_config_t *vpncc, const char *str)
 {
-    struct ovpn_client_route entry = {0};
+    struct ovpn_client_network entry = {0};
     int err = 0;
 
     if (vpncc == NULL || str == NULL) {
         return (EINVAL);
     }
 
-    /* Set the corresponding address family */
-    entry.vpncr_family = ADDRESS_FAMILY_IPV4;
-
-    if ((err = inetx_parse_ipv4_cidr(str, &(entry.vpncr_ipv4_addr), 
-         &(entry.vpncr_prefix))) != 0) {
+    if ((err = ovpn_client_network_parse(&entry, str)) != 0) {
         return (err);
     }
 
-    if (gateway_str != NULL && (err = inetx_str_to_ipv4_addr(gateway_str, 
-         &(entry.vpncr_ipv4_gateway_addr))) != 0) {
+    /* Finally add the new entry to the vector and return the result. */
+    return (vector_push_back(vpncc->vpncc_networks, &entry));
+}
+
+/*
+ * i_add_route parses a route and its optional gateway and adds it to the 
+ * client config. If af isn't 0, the route has to be of this family. The 
+ * gateway has to be of the same family as the route.
+ */
+static int
+i_add_route(ovpn_client_config_t *vpncc, int af, const char *str, 
+            const char *gateway_str, short metric)
+{
+    struct ovpn_client_route entry = {0};
+    struct inetx_prefix prefix, gateway;
+    int err = 0;
+
+    if (vpncc == NULL || str == NULL) {
+        return (EINVAL);
+    }
+
+    if ((err = inetx_parse_prefix(str, &prefix)) != 0) {
         return (err);
     }
 
-    if (gateway_str == NULL) {
-        entry.vpncr_ipv4_gateway_addr.s_addr = INADDR_ANY;
+    if (af != 0 && (int)prefix.ip_family != af) {
+        return (EINVAL);
+    }
+
+    /* The address family of addr and gateway_addr has to be the same! */
+    if (gateway_str != NULL && 
+        ((err = inetx_parse_addr(gateway_str, &gateway)) != 0 ||
+         gateway.ip_family != prefix.ip_family)) {
+        return (err != 0 ? err : EINVAL);
+    }
+
+    /* Set the corresponding address family */
+    entry.vpncr_family = prefix.ip_family;
+    entry.vpncr_prefix = prefix.ip_length;
+
+    if (prefix.ip_family == ADDRESS_FAMILY_IPV4) {
+        entry.vpncr_ipv4_addr = prefix.ip_ipv4_addr;
+        entry.vpncr_ipv4_gateway_addr.s_addr = (gateway_str != NULL) ? 
+            gateway.ip_ipv4_addr.s_addr : INADDR_ANY;
+    } else {
+        entry.vpncr_ipv6_addr = prefix.ip_ipv6_addr;
+        entry.vpncr_ipv6_gateway_addr = (gateway_str != NULL) ? 
+            gateway.ip_ipv6_addr : in6addr_any;
     }
 
     /* If invalid metric or metric without a gateway is set, then error. */
-    if (metric < 0 || (metric > 0 && 
-         entry.vpncr_ipv4_gateway_addr.s_addr == INADDR_ANY)) {
+    if (metric < 0 || (metric > 0 && (prefix.ip_family == ADDRESS_FAMILY_IPV4 ?
+         entry.vpncr_ipv4_gateway_addr.s_addr == INADDR_ANY :
+         IN6_IS_ADDR_UNSPECIFIED(&(entry.vpncr_ipv6_gateway_addr))))) {
         return (EINVAL);
     }
 
@@ -621,88 +839,266 @@ ovpn_client_config_add_ipv4_route(ovpn_client_config_t *vpncc, const char *str,
     return (vector_push_back(vpncc->vpncc_routes, &entry));
 }
 
+int
+ovpn_client_config_add_ipv4_route(ovpn_client_config_t *vpncc, const char *str, 
+                                 const char *gateway_str, short metric)
+{
+    return (i_add_route(vpncc, AF_INET, str, gateway_str, metric));
+}
+
 int 
 ovpn_client_config_add_ipv6_route(ovpn_client_config_t *vpncc, const char *str, 
                                  const char *gateway_str, short metric)
 {
-    struct ovpn_client_route entry = {0};
-    int err = 0;
+    return (i_add_route(vpncc, AF_INET6, str, gateway_str, metric));
+}
 
-    if (vpncc == NULL || str == NULL) {
-        return (EINVAL);
+int
+ovpn_client_config_add_route(ovpn_client_config_t *vpncc, const char *str,
+                            const char *gateway_str, short metric)
+{
+    return (i_add_route(vpncc, 0, str, gateway_str, metric));
+}
+
+/*
+ * i_addr_mask clears the host bits of an IPv4 or IPv6 address. Returns true
+ * if at least one host bit was set.
+ */
+static bool
+i_addr_mask(address_family_t family, void *addr, size_t prefix)
+{
+    struct prefix px;
+
+    assert(addr != NULL);
+
+    if (prefix_set(&px, family, addr, prefix) != 0 || !prefix_mask(&px)) {
+        return (false);
     }
 
-    /* Set the corresponding address family */
-    entry.vpncr_family = ADDRESS_FAMILY_IPV6;
+    prefix_get_addr(&px, addr);
+    return (true);
+}
 
-    if ((err = inetx_parse_ipv6_cidr(str, &(entry.vpncr_ipv6_addr), 
-         &(entry.vpncr_prefix))) != 0) {
-        return (err);
+/*
+ * i_addr_cmp compares two addresses of the same family in network order.
+ */
+static int
+i_addr_cmp(address_family_t family, const void *a, const void *b)
+{
+    uint32_t a4 = 0, b4 = 0;
+
+    if (family == ADDRESS_FAMILY_IPV4) {
+        a4 = ntohl(((const struct in_addr *)a)->s_addr);
+        b4 = ntohl(((const struct in_addr *)b)->s_addr);
+        return ((a4 > b4) - (a4 < b4));
     }
 
-    if (gateway_str != NULL &&
-        (err = inetx_str_to_ipv6_addr(gateway_str, 
-         &(entry.vpncr_ipv6_gateway_addr))) != 0) {
-        return (err);
+    return (memcmp(a, b, sizeof(struct in6_addr)));
+}
+
+/*
+ * i_addr_contains checks if the network outer/outer_prefix contains the 
+ * network inner/inner_prefix.
+ */
+static bool
+i_addr_contains(address_family_t family, const void *outer, 
+                size_t outer_prefix, const void *inner, size_t inner_prefix)
+{
+    struct prefix outer_px, inner_px;
+
+    return (prefix_set(&outer_px, family, outer, outer_prefix) == 0 &&
+        prefix_set(&inner_px, family, inner, inner_prefix) == 0 &&
+        prefix_contains(&outer_px, &inner_px));
+}
+
+/*
+ * i_route_gateway returns a pointer to the family specific gateway address.
+ */
+static const void *
+i_route_gateway(const struct ovpn_client_route *route)
+{
+    if (route->vpncr_family == ADDRESS_FAMILY_IPV4) {
+        return (&(route->vpncr_ipv4_gateway_addr));
     }
 
-    if (gateway_str == NULL) {
-        /* TODO: Check if assignment is done properly */
-        entry.vpncr_ipv6_gateway_addr = in6addr_any;
+    return (&(route->vpncr_ipv6_gateway_addr));
+}
+
+static int
+i_network_cmp(const void *a, const void *b)
+{
+    const struct ovpn_client_network *na = a, *nb = b;
+    int cmp = 0;
+
+    if (na->vpncn_family != nb->vpncn_family) {
+        return ((na->vpncn_family > nb->vpncn_family) - 
+            (na->vpncn_family < nb->vpncn_family));
     }
 
-    /* If invalid metric or metric without a gateway is set, then error. */
-    if (metric < 0 || (metric > 0 && 
-         IN6_IS_ADDR_UNSPECIFIED(&(entry.vpncr_ipv6_gateway_addr)))) {
-        return (EINVAL);
+    if ((cmp = i_addr_cmp(na->vpncn_family, &(na->vpncn_ipv4_addr), 
+         &(nb->vpncn_ipv4_addr))) != 0) {
+        return (cmp);
     }
 
-    entry.vpncr_metric = metric;
+    return ((na->vpncn_prefix > nb->vpncn_prefix) - 
+        (na->vpncn_prefix < nb->vpncn_prefix));
+}
 
-    /* Finally add the new entry to the vector and return the result. */
-    return (vector_push_back(vpncc->vpncc_routes, &entry));
+/*
+ * i_route_cmp orders routes by family, gateway and metric first. Routes of 
+ * the same gateway and metric are ordered by address and prefix, so a 
+ * covering route is always sorted before the routes it covers.
+ */
+static int
+i_route_cmp(const void *a, const void *b)
+{
+    const struct ovpn_client_route *ra = a, *rb = b;
+    int cmp = 0;
+
+    if (ra->vpncr_family != rb->vpncr_family) {
+        return ((ra->vpncr_family > rb->vpncr_family) - 
+            (ra->vpncr_family < rb->vpncr_family));
+    }
+
+    if ((cmp = i_addr_cmp(ra->vpncr_family, i_route_gateway(ra), 
+         i_route_gateway(rb))) != 0) {
+        return (cmp);
+    }
+
+    if (ra->vpncr_metric != rb->vpncr_metric) {
+        return ((ra->vpncr_metric > rb->vpncr_metric) - 
+            (ra->vpncr_metric < rb->vpncr_metric));
+    }
+
+    if ((cmp = i_addr_cmp(ra->vpncr_family, &(ra->vpncr_ipv4_addr), 
+         &(rb->vpncr_ipv4_addr))) != 0) {
+        return (cmp);
+    }
+
+    return ((ra->vpncr_prefix > rb->vpncr_prefix) - 
+        (ra->vpncr_prefix < rb->vpncr_prefix));
 }
 
-int
-ovpn_client_config_add_route(ovpn_client_config_t *vpncc, const char *str,
-                            const char *gateway_str, short metric)
+static void
+i_canonicalize_networks(vector_t *networks, 
+                        struct ovpn_client_config_canon *canon)
 {
-    int err = 0, af = 0, af_gateway = 0;
+    struct ovpn_client_network *elem = NULL, *last = NULL;
+    size_t i = 0, n = 0;
 
-    if (vpncc == NULL || str == NULL) {
-        return (EINVAL);
+    assert(networks != NULL);
+    assert(canon != NULL);
+
+    for (elem = vector_begin(networks); elem != vector_end(networks); 
+         elem = vector_next(networks, elem)) {
+        if (i_addr_mask(elem->vpncn_family, &(elem->vpncn_ipv4_addr), 
+            elem->vpncn_prefix)) {
+            canon->canon_networks_masked++;
+        }
     }
 
-    /* Predict address familiy */
-    if ((err = inetx_predict_address_family(str, &af)) != 0) {
-        return (err);
+    vector_sort(networks, i_network_cmp);
+
+    /* 
+     * Sweep the sorted networks. If a network is covered by any kept network,
+     * it's covered by the last kept one. 
+     */
+    for (i = 0; i < vector_size(networks); i++) {
+        elem = vector_at(networks, i);
+
+        if (last != NULL && i_network_cmp(last, elem) == 0) {
+            canon->canon_networks_duplicates++;
+            continue;
+        }
+
+        if (last != NULL && last->vpncn_family == elem->vpncn_family &&
+            i_addr_contains(last->vpncn_family, &(last->vpncn_ipv4_addr), 
+            last->vpncn_prefix, &(elem->vpncn_ipv4_addr), elem->vpncn_prefix)) {
+            canon->canon_networks_covered++;
+            continue;
+        }
+
+        last = vector_at(networks, n++);
+        if (last != elem) {
+            memcpy(last, elem, sizeof(struct ovpn_client_network));
+        }
     }
 
-    /* Predict address familiy of gateway, if gateway is set. */
-    if (gateway_str != NULL && 
-        (err = inetx_predict_address_family(gateway_str, &af_gateway)) != 0) {
-        return (err);
+    vector_truncate(networks, n);
+}
+
+static void
+i_canonicalize_routes(vector_t *routes, struct ovpn_client_config_canon *canon)
+{
+    struct ovpn_client_route *elem = NULL, *last = NULL;
+    size_t i = 0, n = 0;
+
+    assert(routes != NULL);
+    assert(canon != NULL);
+
+    for (elem = vector_begin(routes); elem != vector_end(routes); 
+         elem = vector_next(routes, elem)) {
+        if (i_addr_mask(elem->vpncr_family, &(elem->vpncr_ipv4_addr), 
+            elem->vpncr_prefix)) {
+            canon->canon_routes_masked++;
+        }
     }
 
-    /* The address family of addr and gateway_addr has to be the same! */
-    if (gateway_str != NULL && (af != af_gateway)) {
+    vector_sort(routes, i_route_cmp);
+
+    for (i = 0; i < vector_size(routes); i++) {
+        elem = vector_at(routes, i);
+
+        if (last != NULL && i_route_cmp(last, elem) == 0) {
+            canon->canon_routes_duplicates++;
+            continue;
+        }
+
+        /* Only a route with the same gateway and metric covers another one. */
+        if (last != NULL && last->vpncr_family == elem->vpncr_family &&
+            last->vpncr_metric == elem->vpncr_metric &&
+            i_addr_cmp(elem->vpncr_family, i_route_gateway(last), 
+            i_route_gateway(elem)) == 0 &&
+            i_addr_contains(last->vpncr_family, &(last->vpncr_ipv4_addr), 
+            last->vpncr_prefix, &(elem->vpncr_ipv4_addr), elem->vpncr_prefix)) {
+            canon->canon_routes_covered++;
+            continue;
+        }
+
+        last = vector_at(routes, n++);
+        if (last != elem) {
+            memcpy(last, elem, sizeof(struct ovpn_client_route));
+        }
+    }
+
+    vector_truncate(routes, n);
+}
+
+/*
+ * Canonicalizes the networks and routes of the client config. Host bits are
+ * cleared, the entries are sorted and exact duplicates as well as entries 
+ * covered by a broader entry are removed. A route is only covered by a route 
+ * with the same gateway and metric. The removed entries are counted in canon,
+ * which may be NULL. Runs in O(n log n).
+ */
+int
+ovpn_client_config_canonicalize(ovpn_client_config_t *vpncc, 
+                                struct ovpn_client_config_canon *canon)
+{
+    struct ovpn_client_config_canon local_canon = {0};
+
+    if (vpncc == NULL) {
         return (EINVAL);
     }
 
-    /* Add new route based on family. */
-    switch (af) {
-    case AF_INET:
-        err = ovpn_client_config_add_ipv4_route(vpncc, str, gateway_str, 
-            metric);
-        break;
-    case AF_INET6:
-        err = ovpn_client_config_add_ipv6_route(vpncc, str, gateway_str, 
-            metric);
-        break;
-    default:
-        err = ENOTSUP;
-        break;
+    if (canon == NULL) {
+        canon = &local_canon;
     }
 
-    return (err);
+    memset(canon, 0, sizeof(struct ovpn_client_config_canon));
+
+    i_canonicalize_networks(vpncc->vpncc_networks, canon);
+    i_canonicalize_routes(vpncc->vpncc_routes, canon);
+
+    return (0);
 }
@@ -0,0 +1,1595 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "acct.h"
+#include "addrpool.h"
+#include "admit.h"
+#include "batchq.h"
+#include "ccd.h"
+#include "ctlsock.h"
+#include "dao.h"
+#include "dbwatch.h"
+#include "log.h"
+#include "mgmt.h"
+#include "model.h"
+#include "negcache.h"
+#include "network_overlap.h"
+#include "nlroute.h"
+#include "plugin.h"
+#include "rtable.h"
+#include "shmdir.h"
+#include "trace.h"
+#include "vector.h"
+
+/* Overlapping networks logged at startup, the rest is only counted. */
+#define PLUGIN_OVERLAP_LOG_MAX 100
+
+/* Lease changes the writer queue holds, has to be a power of two. */
+#define PLUGIN_LEASE_QUEUE_SIZE 1024
+
+/* Milliseconds after which changed leases are stored at the latest. */
+#define PLUGIN_LEASE_FLUSH_INTERVAL_MS 1000
+
+/* 
+ * plugin_ctx contains the state of a plugin instance, which is kept between
+ * the OpenVPN plugin events.
+ */
+struct plugin_ctx {
+    dao_config_t *pc_dao;
+    ccd_directory_t *pc_directory;  /* Replaced under pc_cache_lock */
+    negcache_t *pc_negcache;
+    addrpool_t *pc_addrpool;  /* NULL if every client has static addresses */
+    batchq_t *pc_lease_queue; /* Wakes up the lease writer, or NULL */
+    dao_config_t *pc_lease_dao; /* Connection of the lease writer */
+    rtable_t *pc_rtable;      /* Connected clients and their routes */
+    ctlsock_t *pc_ctlsock;    /* NULL if no control socket is open */
+    acct_t *pc_acct;          /* Session accounting writer */
+    long long pc_generation;  /* Change feed generation of the caches */
+    shmdir_t *pc_shmdir;      /* Shared directory, replaces the caches */
+    admit_t *pc_admit;        /* Admission control of connects */
+    nlroute_t *pc_nlroute;    /* NULL if no kernel routes are installed */
+    trace_t *pc_trace;        /* NULL if events aren't recorded */
+
+    /* 
+     * Reloads and syncs run on the OpenVPN thread or on the watcher thread.
+     * They are serialized by pc_reload_lock and build new caches aside. Only
+     * the switch to the new directory takes pc_cache_lock, which connects 
+     * hold while they use the directory.
+     */
+    pthread_mutex_t pc_reload_lock;
+    pthread_rwlock_t pc_cache_lock;
+    dbwatch_t *pc_dbwatch;      /* NULL if the database isn't watched */
+    dao_config_t *pc_watch_dao; /* Connection of the watcher thread */
+    dao_config_t *pc_replica;   /* Replaced under pc_cache_lock, or NULL */
+    long long pc_replica_generation;
+    atomic_uint_fast64_t pc_replica_refreshes;
+    atomic_uint_fast64_t pc_syncs;
+    atomic_uint_fast64_t pc_reloads;
+
+    /* Live updates of connected clients, set under pc_reload_lock. */
+    char *pc_mgmt_path;         /* NULL if changes aren't pushed */
+    atomic_uint_fast64_t pc_updates_pushed;
+    atomic_uint_fast64_t pc_updates_failed;
+
+    /* Background warm-up, the caches belong to it until it is joined. */
+    pthread_t pc_warmup_thread;
+    bool pc_warmup_running;
+    atomic_int pc_warmup_state;
+    atomic_bool pc_warmup_cancel;
+    int pc_warmup_error;
+    double pc_warmup_seconds;
+    atomic_uint_fast64_t pc_direct_connects;
+};
+
+static const char *i_plugin_warmup_names[] = {
+    "pending", "overlaps", "directory", "negcache", "ready", "failed"
+};
+
+/*
+ * i_plugin_check_overlaps warns about overlapping client networks. Overlapping
+ * iroutes make the OpenVPN internal routing ambiguous, but they don't prevent
+ * the plugin from working.
+ */
+static int
+i_plugin_check_overlaps(dao_config_t *daocfg)
+{
+    vector_t *overlaps = NULL;
+    struct network_overlap *elem = NULL;
+    size_t invalid = 0, i = 0;
+    int err = 0;
+
+    assert(daocfg != NULL);
+
+    if ((err = vector_alloc(&overlaps, sizeof(struct network_overlap))) != 0) {
+        return (err);
+    }
+
+    if ((err = network_overlap_check_db(daocfg, overlaps, &invalid)) != 0) {
+        goto out_free;
+    }
+
+    if (!vector_empty(overlaps)) {
+        log_warn("Found %zu overlapping client networks", 
+            vector_size(overlaps));
+    }
+
+    /* Log a sample only, the log rings drop records when flooded. */
+    for (i = 0; i < vector_size(overlaps) && i < PLUGIN_OVERLAP_LOG_MAX; 
+         i++) {
+        elem = vector_at(overlaps, i);
+        log_warn("Client %d network %s (id %d) overlaps client %d network "
+            "%s (id %d)", elem->no_a.client_id, elem->no_a.network_addr, 
+            elem->no_a.id, elem->no_b.client_id, elem->no_b.network_addr, 
+            elem->no_b.id);
+    }
+
+    if (invalid > 0) {
+        log_warn("Found %zu invalid client networks", invalid);
+    }
+
+out_free:
+    vector_free(overlaps);
+    return (err);
+}
+
+/*
+ * i_plugin_swap_directory switches the connects to a new client directory and
+ * frees the previous one once no connect uses it anymore.
+ */
+static void
+i_plugin_swap_directory(plugin_ctx_t *ctx, ccd_directory_t *directory)
+{
+    ccd_directory_t *old = NULL;
+
+    pthread_rwlock_wrlock(&(ctx->pc_cache_lock));
+    old = ctx->pc_directory;
+    ctx->pc_directory = directory;
+    pthread_rwlock_unlock(&(ctx->pc_cache_lock));
+
+    ccd_directory_free(old);
+}
+
+/*
+ * i_plugin_warmup_progress reports a warm-up phase. Reloads of ready caches 
+ * don't change the state, the previous caches keep serving until the switch.
+ */
+static void
+i_plugin_warmup_progress(plugin_ctx_t *ctx, enum plugin_warmup_state state)
+{
+    if (atomic_load(&(ctx->pc_warmup_state)) != PLUGIN_WARMUP_READY) {
+        atomic_store_explicit(&(ctx->pc_warmup_state), state, 
+            memory_order_release);
+    }
+}
+
+/*
+ * i_plugin_load loads the client directory and builds the negative cache. The
+ * negative cache is invalidated first, so a failed load never rejects a client
+ * which became active in the meantime. The caller holds pc_reload_lock or is 
+ * the warm-up thread.
+ */
+static int
+i_plugin_load(plugin_ctx_t *ctx, dao_config_t *daocfg)
+{
+    ccd_directory_t *directory = NULL;
+    int err = 0;
+
+    negcache_invalidate(ctx->pc_negcache);
+    i_plugin_warmup_progress(ctx, PLUGIN_WARMUP_DIRECTORY);
+
+    /* Changes during the load are applied again by the next sync. */
+    if ((err = dao_change_generation(daocfg, &(ctx->pc_generation))) != 0 ||
+        (err = ccd_directory_load(&directory, daocfg)) != 0) {
+        goto out_failed;
+    }
+
+    i_plugin_swap_directory(ctx, directory);
+
+    i_plugin_warmup_progress(ctx, PLUGIN_WARMUP_NEGCACHE);
+    if ((err = negcache_build(ctx->pc_negcache, daocfg)) != 0) {
+        goto out_failed;
+    }
+
+    atomic_fetch_add(&(ctx->pc_reloads), 1);
+    i_plugin_warmup_progress(ctx, PLUGIN_WARMUP_READY);
+    return (0);
+
+out_failed:
+    i_plugin_warmup_progress(ctx, PLUGIN_WARMUP_FAILED);
+    return (err);
+}
+
+/*
+ * i_plugin_warmup_thread checks the client networks and loads the caches with
+ * its own database connection, so plugin_open doesn't block OpenVPN.
+ */
+static void *
+i_plugin_warmup_thread(void *arg)
+{
+    plugin_ctx_t *ctx = arg;
+    dao_config_t *daocfg = NULL;
+    struct timespec start, end;
+    int err = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if ((err = dao_alloc(&daocfg, dao_db_filename(ctx->pc_dao))) != 0 ||
+        (err = dao_db_open(daocfg)) != 0) {
+        goto out_done;
+    }
+
+    atomic_store(&(ctx->pc_warmup_state), PLUGIN_WARMUP_OVERLAPS);
+    if ((err = i_plugin_check_overlaps(daocfg)) != 0) {
+        goto out_done;
+    }
+
+    if (atomic_load(&(ctx->pc_warmup_cancel))) {
+        err = ECANCELED;
+        goto out_done;
+    }
+
+    err = i_plugin_load(ctx, daocfg);
+
+out_done:
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ctx->pc_warmup_error = err;
+    ctx->pc_warmup_seconds = (end.tv_sec - start.tv_sec) + 
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (err != 0) {
+        log_error("Failed to warm up the client caches: %s", 
+            strerror(err));
+        atomic_store_explicit(&(ctx->pc_warmup_state), PLUGIN_WARMUP_FAILED, 
+            memory_order_release);
+    }
+
+    dao_free(daocfg);
+    return (NULL);
+}
+
+/*
+ * i_plugin_warmup_join waits for the warm-up thread. The caller holds 
+ * pc_reload_lock.
+ */
+static void
+i_plugin_warmup_join(plugin_ctx_t *ctx)
+{
+    if (ctx->pc_warmup_running) {
+        pthread_join(ctx->pc_warmup_thread, NULL);
+        ctx->pc_warmup_running = false;
+    }
+}
+
+/*
+ * plugin_warmup_wait waits for the background warm-up and returns its error.
+ */
+int
+plugin_warmup_wait(plugin_ctx_t *ctx)
+{
+    if (ctx == NULL) {
+        return (EINVAL);
+    }
+
+    pthread_mutex_lock(&(ctx->pc_reload_lock));
+    i_plugin_warmup_join(ctx);
+    pthread_mutex_unlock(&(ctx->pc_reload_lock));
+
+    return (ctx->pc_warmup_error);
+}
+
+/*
+ * plugin_get_warmup_stats reports the progress of the warm-up. It may be 
+ * called from any thread.
+ */
+void
+plugin_get_warmup_stats(plugin_ctx_t *ctx, struct plugin_warmup_stats *stats)
+{
+    memset(stats, 0, sizeof(struct plugin_warmup_stats));
+
+    stats->ws_state = atomic_load_explicit(&(ctx->pc_warmup_state), 
+        memory_order_acquire);
+    stats->ws_direct_connects = atomic_load(&(ctx->pc_direct_connects));
+
+    /* The thread sets the results before the final state. */
+    if (stats->ws_state == PLUGIN_WARMUP_READY || 
+        stats->ws_state == PLUGIN_WARMUP_FAILED) {
+        stats->ws_error = ctx->pc_warmup_error;
+        stats->ws_seconds = ctx->pc_warmup_seconds;
+    }
+}
+
+/*
+ * plugin_open allocates the plugin context, opens the SQLite database and 
+ * starts loading the client directory in the background. See 
+ * plugin_warmup_wait to wait for the load.
+ */
+int
+plugin_open(plugin_ctx_t **ctxp, const char *db_filename)
+{
+    int err = 0;
+
+    if (ctxp == NULL || db_filename == NULL) {
+        return (EINVAL);
+    }
+
+    if ((*ctxp = calloc(1, sizeof(plugin_ctx_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    /* Connects must not wait for stderr, log from a writer thread. */
+    if ((err = log_start(NULL)) != 0) {
+        free(*ctxp);
+        *ctxp = NULL;
+        return (err);
+    }
+
+    pthread_mutex_init(&((*ctxp)->pc_reload_lock), NULL);
+    pthread_rwlock_init(&((*ctxp)->pc_cache_lock), NULL);
+
+    if ((err = dao_alloc(&((*ctxp)->pc_dao), db_filename)) != 0 ||
+        (err = dao_db_open((*ctxp)->pc_dao)) != 0 ||
+        (err = dao_change_feed_ensure((*ctxp)->pc_dao)) != 0) {
+        goto out_close;
+    }
+
+    if ((err = negcache_alloc(&((*ctxp)->pc_negcache), 
+        NEGCACHE_DEFAULT_MISS_TTL)) != 0) {
+        goto out_close;
+    }
+
+    if ((err = rtable_alloc(&((*ctxp)->pc_rtable))) != 0 ||
+        (err = acct_open(&((*ctxp)->pc_acct), db_filename)) != 0 ||
+        (err = admit_alloc(&((*ctxp)->pc_admit), 0, 0)) != 0) {
+        goto out_close;
+    }
+
+    if ((err = pthread_create(&((*ctxp)->pc_warmup_thread), NULL, 
+         i_plugin_warmup_thread, *ctxp)) != 0) {
+        goto out_close;
+    }
+    (*ctxp)->pc_warmup_running = true;
+
+    return (0);
+
+out_close:
+    plugin_close(*ctxp);
+    *ctxp = NULL;
+    return (err);
+}
+
+/*
+ * plugin_close closes the SQLite database and frees the plugin context.
+ */
+void
+plugin_close(plugin_ctx_t *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+
+    /* Stop the control socket first, it queries the routing table. */
+    ctlsock_close(ctx->pc_ctlsock);
+
+    /* A sync of the watcher may wait for the warm-up, cancel it first. */
+    atomic_store(&(ctx->pc_warmup_cancel), true);
+    dbwatch_close(ctx->pc_dbwatch);
+    dao_free(ctx->pc_watch_dao);
+    plugin_warmup_wait(ctx);
+    dao_free(ctx->pc_replica);
+
+    rtable_free(ctx->pc_rtable);
+    nlroute_close(ctx->pc_nlroute);
+    trace_close(ctx->pc_trace);
+    acct_close(ctx->pc_acct);
+    admit_free(ctx->pc_admit);
+
+    /* The writer stores the changed leases a last time. */
+    batchq_close(ctx->pc_lease_queue);
+    dao_free(ctx->pc_lease_dao);
+    addrpool_free(ctx->pc_addrpool);
+    negcache_free(ctx->pc_negcache);
+    ccd_directory_free(ctx->pc_directory);
+    shmdir_close(ctx->pc_shmdir);
+    dao_free(ctx->pc_dao);
+
+    pthread_rwlock_destroy(&(ctx->pc_cache_lock));
+    pthread_mutex_destroy(&(ctx->pc_reload_lock));
+    free(ctx->pc_mgmt_path);
+    free(ctx);
+
+    log_stop();
+}
+
+/*
+ * i_plugin_query_dao returns the connection for the queries of connects, the
+ * replica if there is one. Writes always use pc_dao. The caller holds 
+ * pc_cache_lock for reading.
+ */
+static dao_config_t *
+i_plugin_query_dao(plugin_ctx_t *ctx)
+{
+    return (ctx->pc_replica != NULL ? ctx->pc_replica : ctx->pc_dao);
+}
+
+/*
+ * i_plugin_refresh_replica copies the database into a new replica if the 
+ * client tables changed since the last copy. Connects keep using the previous
+ * replica until the switch. Other writes, e.g. the session accounting, don't 
+ * cause a copy. The caller holds pc_reload_lock.
+ */
+static int
+i_plugin_refresh_replica(plugin_ctx_t *ctx, dao_config_t *daocfg)
+{
+    dao_config_t *replica = NULL, *old = NULL;
+    long long generation = 0;
+    int err = 0;
+
+    if (ctx->pc_replica == NULL) {
+        return (0);
+    }
+
+    if ((err = dao_change_generation(daocfg, &generation)) != 0 ||
+        generation == ctx->pc_replica_generation) {
+        return (err);
+    }
+
+    /* The generation of the copy itself, it may be newer already. */
+    if ((err = dao_alloc(&replica, dao_db_filename(ctx->pc_dao))) != 0 ||
+        (err = dao_replica_open(replica)) != 0 ||
+        (err = dao_change_generation(replica, &generation)) != 0) {
+        dao_free(replica);
+        return (err);
+    }
+
+    pthread_rwlock_wrlock(&(ctx->pc_cache_lock));
+    old = ctx->pc_replica;
+    ctx->pc_replica = replica;
+    pthread_rwlock_unlock(&(ctx->pc_cache_lock));
+
+    ctx->pc_replica_generation = generation;
+    atomic_fetch_add(&(ctx->pc_replica_refreshes), 1);
+    dao_free(old);
+
+    return (0);
+}
+
+/*
+ * plugin_reload reloads the client directory from the database. A running 
+ * warm-up is waited for first. Connects keep using the previous directory 
+ * until the new one is loaded.
+ */
+int
+plugin_reload(plugin_ctx_t *ctx)
+{
+    int err = 0;
+
+    if (ctx == NULL) {
+        return (EINVAL);
+    }
+
+    pthread_mutex_lock(&(ctx->pc_reload_lock));
+    i_plugin_warmup_join(ctx);
+
+    /* The publisher of the shared directory does the reloads. */
+    if (ctx->pc_shmdir == NULL) {
+        if ((err = i_plugin_refresh_replica(ctx, ctx->pc_dao)) != 0) {
+            log_error("Failed to refresh database replica: %s", 
+                strerror(err));
+        }
+        err = i_plugin_load(ctx, ctx->pc_dao);
+    }
+
+    pthread_mutex_unlock(&(ctx->pc_reload_lock));
+    return (err);
+}
+
+/*
+ * i_plugin_sync_clients updates the negative cache for changed clients. New 
+ * and activated CNs are added to the filter and all recent misses are 
+ * forgotten, because one of them may refer to a changed client.
+ */
+static int
+i_plugin_sync_clients(plugin_ctx_t *ctx, dao_config_t *daocfg, 
+    vector_t *client_ids)
+{
+    struct vpn_client client;
+    int *id = NULL, err = 0;
+
+    for (id = vector_begin(client_ids); id != vector_end(client_ids); 
+         id = vector_next(client_ids, id)) {
+        err = dao_vpn_client_find_by_id(daocfg, *id, &client);
+        if (err == ENOENT) {
+            continue;
+        } else if (err != 0) {
+            return (err);
+        }
+
+        if (client.is_active) {
+            negcache_add_active(ctx->pc_negcache, client.cn);
+        }
+    }
+
+    if (!vector_empty(client_ids)) {
+        negcache_clear_misses(ctx->pc_negcache);
+    }
+
+    return (0);
+}
+
+/*
+ * i_plugin_delta contains the route changes of a client with changed 
+ * networks as push-update options, e.g. "route 10.1.0.0 255.255.0.0,-route 
+ * 10.2.0.0 255.255.0.0". The changes are pushed to all other clients.
+ */
+struct i_plugin_delta {
+    char pd_cn[RFC5280_CN_MAX_LENGTH];
+    char *pd_options;
+};
+
+static void
+i_plugin_deltas_free(vector_t *deltas)
+{
+    struct i_plugin_delta *delta = NULL;
+
+    if (deltas == NULL) {
+        return;
+    }
+
+    for (delta = vector_begin(deltas); delta != vector_end(deltas);
+         delta = vector_next(deltas, delta)) {
+        free(delta->pd_options);
+    }
+
+    vector_free(deltas);
+}
+
+/*
+ * i_plugin_route_options appends the push-update options of routes. The 
+ * routes are rendered as in a config and the push quoting is stripped, 
+ * removed routes get a leading '-'.
+ */
+static int
+i_plugin_route_options(FILE *stream, vector_t *routes, bool remove)
+{
+    struct ovpn_client_route *route = NULL;
+    char line[INET6_ADDRSTRLEN * 2 + 32], *begin = NULL, *end = NULL;
+    FILE *tmp = NULL;
+    int err = 0;
+
+    for (route = vector_begin(routes); route != vector_end(routes);
+         route = vector_next(routes, route)) {
+        memset(line, 0, sizeof(line));
+        if ((tmp = fmemopen(line, sizeof(line) - 1, "w")) == NULL) {
+            return (errno);
+        }
+        err = ovpn_client_route_print(tmp, route);
+        fclose(tmp);
+
+        /* push "route 10.1.0.0 255.255.0.0" */
+        if (err != 0 || (begin = strchr(line, '"')) == NULL || 
+            (end = strrchr(line, '"')) == begin) {
+            return (err != 0 ? err : EINVAL);
+        }
+        *end = '\0';
+
+        fprintf(stream, "%s%s%s", ftello(stream) > 0 ? "," : "", 
+            remove ? "-" : "", begin + 1);
+    }
+
+    return (0);
+}
+
+/*
+ * i_plugin_diff renders the route changes of every changed client between 
+ * the current and the updated directory. Clients without route changes, e.g.
+ * only their addresses changed, get no delta. client_ids is sorted.
+ */
+static int
+i_plugin_diff(plugin_ctx_t *ctx, dao_config_t *daocfg, 
+              ccd_directory_t *updated, vector_t *client_ids, 
+              vector_t *deltas)
+{
+    struct i_plugin_delta delta;
+    struct vpn_client client;
+    vector_t *added = NULL, *removed = NULL;
+    int *id = NULL, *last = NULL;
+    FILE *stream = NULL;
+    size_t len = 0;
+    int err = 0;
+
+    if ((err = vector_alloc(&added, sizeof(struct ovpn_client_route))) != 0 ||
+        (err = vector_alloc(&removed, sizeof(struct ovpn_client_route))) 
+        != 0) {
+        goto out_free;
+    }
+
+    for (id = vector_begin(client_ids); id != vector_end(client_ids); 
+         id = vector_next(client_ids, id)) {
+        if (last != NULL && *last == *id) {
+            continue;
+        }
+        last = id;
+
+        vector_truncate(added, 0);
+        vector_truncate(removed, 0);
+        if ((err = ccd_directory_diff(ctx->pc_directory, updated, *id, added,
+             removed)) != 0) {
+            goto out_free;
+        }
+
+        if (vector_empty(added) && vector_empty(removed)) {
+            continue;
+        }
+
+        /* 
+         * A deleted client isn't connected, nothing to exclude. Any other 
+         * error fails the diff, else the client gets its own networks pushed.
+         */
+        memset(&delta, 0, sizeof(delta));
+        if ((err = dao_vpn_client_find_by_id(daocfg, *id, &client)) == 0) {
+            snprintf(delta.pd_cn, sizeof(delta.pd_cn), "%s", client.cn);
+        } else if (err != ENOENT) {
+            goto out_free;
+        }
+        err = 0;
+
+        if ((stream = open_memstream(&(delta.pd_options), &len)) == NULL) {
+            err = errno;
+            goto out_free;
+        }
+
+        if ((err = i_plugin_route_options(stream, removed, true)) != 0 ||
+            (err = i_plugin_route_options(stream, added, false)) != 0) {
+            fclose(stream);
+            free(delta.pd_options);
+            goto out_free;
+        }
+        fclose(stream);
+
+        if ((err = vector_push_back(deltas, &delta)) != 0) {
+            free(delta.pd_options);
+            goto out_free;
+        }
+    }
+
+out_free:
+    vector_free(removed);
+    vector_free(added);
+    return (err);
+}
+
+/*
+ * i_plugin_push_updates pushes the route changes to the connected clients 
+ * through the management interface of OpenVPN. Each client gets the changes
+ * of all other clients in one command; clients whose routes didn't change, 
+ * because only their own networks changed, are left alone. Clients which 
+ * fail to update keep their routes until they reconnect.
+ */
+static void
+i_plugin_push_updates(plugin_ctx_t *ctx, vector_t *deltas, 
+                      long long generation)
+{
+    struct mgmt_client *client = NULL;
+    struct i_plugin_delta *delta = NULL;
+    vector_t *clients = NULL;
+    mgmt_t *mgmt = NULL;
+    FILE *stream = NULL;
+    char *options = NULL;
+    size_t len = 0, pushed = 0, failed = 0;
+    int err = 0;
+
+    if ((err = vector_alloc(&clients, sizeof(struct mgmt_client))) != 0 ||
+        (err = mgmt_open(&mgmt, ctx->pc_mgmt_path)) != 0 ||
+        (err = mgmt_clients(mgmt, clients)) != 0) {
+        log_error("Failed to list clients at %s: %s", ctx->pc_mgmt_path, 
+            strerror(err));
+        goto out_free;
+    }
+
+    for (client = vector_begin(clients); client != vector_end(clients);
+         client = vector_next(clients, client)) {
+        if ((stream = open_memstream(&options, &len)) == NULL) {
+            failed++;
+            continue;
+        }
+
+        for (delta = vector_begin(deltas); delta != vector_end(deltas);
+             delta = vector_next(deltas, delta)) {
+            if (strcmp(delta->pd_cn, client->mc_cn) != 0) {
+                fprintf(stream, "%s%s", ftello(stream) > 0 ? "," : "", 
+                    delta->pd_options);
+            }
+        }
+        fclose(stream);
+
+        if (len > 0) {
+            if ((err = mgmt_push_update(mgmt, client->mc_cid, options)) 
+                != 0) {
+                log_warn("Failed to update routes of %s: %s", 
+                    client->mc_cn, strerror(err));
+                failed++;
+            } else {
+                pushed++;
+            }
+        }
+
+        free(options);
+        options = NULL;
+    }
+
+    log_info("Pushed route changes of generation %lld to %zu clients, "
+        "%zu failed, %zu unchanged", generation, pushed, failed, 
+        vector_size(clients) - pushed - failed);
+
+out_free:
+    atomic_fetch_add(&(ctx->pc_updates_pushed), pushed);
+    atomic_fetch_add(&(ctx->pc_updates_failed), failed);
+    mgmt_close(mgmt);
+    vector_free(clients);
+}
+
+/*
+ * i_plugin_sync applies the changes since the last sync or reload with the 
+ * given database connection. The caller holds pc_reload_lock.
+ */
+static int
+i_plugin_sync(plugin_ctx_t *ctx, dao_config_t *daocfg)
+{
+    vector_t *changes = NULL, *network_ids = NULL, *client_ids = NULL,
+             *deltas = NULL;
+    ccd_directory_t *directory = NULL;
+    struct vpn_change *change = NULL;
+    long long generation = 0;
+    int err = 0;
+
+    i_plugin_warmup_join(ctx);
+
+    if (ctx->pc_shmdir != NULL) {
+        return (0);
+    }
+
+    /* A failed copy keeps the previous replica, the caches are synced. */
+    if ((err = i_plugin_refresh_replica(ctx, daocfg)) != 0) {
+        log_error("Failed to refresh database replica: %s", strerror(err));
+    }
+
+    /* A failed load is retried instead of patching the caches. */
+    if (atomic_load(&(ctx->pc_warmup_state)) != PLUGIN_WARMUP_READY) {
+        return (i_plugin_load(ctx, daocfg));
+    }
+
+    if ((err = vector_alloc(&changes, sizeof(struct vpn_change))) != 0 ||
+        (err = vector_alloc(&network_ids, sizeof(int))) != 0 ||
+        (err = vector_alloc(&client_ids, sizeof(int))) != 0) {
+        goto out_free;
+    }
+
+    err = dao_change_find_since(daocfg, ctx->pc_generation, changes);
+    if (err == ESTALE) {
+        err = i_plugin_load(ctx, daocfg);
+        goto out_free;
+    } else if (err != 0 || vector_empty(changes)) {
+        goto out_free;
+    }
+
+    for (change = vector_begin(changes); change != vector_end(changes); 
+         change = vector_next(changes, change)) {
+        if (change->operation == VPN_CHANGE_RELOAD) {
+            err = i_plugin_load(ctx, daocfg);
+            goto out_free;
+        }
+
+        if ((err = vector_push_back(change->is_network ? network_ids : 
+             client_ids, &(change->client_id))) != 0) {
+            goto out_free;
+        }
+        generation = change->generation;
+    }
+
+    if (!vector_empty(network_ids) || !vector_empty(client_ids)) {
+        if ((err = ccd_directory_apply(ctx->pc_directory, daocfg, network_ids,
+             client_ids, &directory)) != 0) {
+            goto out_free;
+        }
+
+        /* Diff before the switch, the current directory is freed by it. */
+        if (ctx->pc_mgmt_path != NULL && !vector_empty(network_ids) &&
+            ((err = vector_alloc(&deltas, sizeof(struct i_plugin_delta))) 
+             != 0 || (err = i_plugin_diff(ctx, daocfg, directory, 
+             network_ids, deltas)) != 0)) {
+            ccd_directory_free(directory);
+            goto out_free;
+        }
+
+        i_plugin_swap_directory(ctx, directory);
+    }
+
+    if ((err = i_plugin_sync_clients(ctx, daocfg, client_ids)) != 0) {
+        goto out_free;
+    }
+
+    ctx->pc_generation = generation;
+    atomic_fetch_add(&(ctx->pc_syncs), 1);
+
+    /* Connects after the switch already get the new routes. */
+    if (deltas != NULL && !vector_empty(deltas)) {
+        i_plugin_push_updates(ctx, deltas, generation);
+    }
+
+out_free:
+    i_plugin_deltas_free(deltas);
+    vector_free(client_ids);
+    vector_free(network_ids);
+    vector_free(changes);
+    return (err);
+}
+
+/*
+ * plugin_sync applies the changes of the client tables since the last sync 
+ * or reload to the client directory and the negative cache. Only the changed
+ * clients are read from the database. A bulk load or a pruned change log 
+ * causes a full reload.
+ */
+int
+plugin_sync(plugin_ctx_t *ctx)
+{
+    int err = 0;
+
+    if (ctx == NULL) {
+        return (EINVAL);
+    }
+
+    pthread_mutex_lock(&(ctx->pc_reload_lock));
+    err = i_plugin_sync(ctx, ctx->pc_dao);
+    pthread_mutex_unlock(&(ctx->pc_reload_lock));
+
+    return (err);
+}
+
+/*
+ * i_plugin_watch_handler applies the changes of the database on the watcher 
+ * thread. Writes which don't touch the client tables, e.g. the session 
+ * accounting, cost a single query of the change log.
+ */
+static void
+i_plugin_watch_handler(void *arg)
+{
+    plugin_ctx_t *ctx = arg;
+    int err = 0;
+
+    pthread_mutex_lock(&(ctx->pc_reload_lock));
+    err = i_plugin_sync(ctx, ctx->pc_watch_dao);
+    pthread_mutex_unlock(&(ctx->pc_reload_lock));
+
+    if (err != 0) {
+        log_error("Failed to apply database changes: %s", 
+            strerror(err));
+    }
+}
+
+/*
+ * plugin_watch_start watches the database and its WAL for changes. Changes 
+ * are applied in the background shortly after they settled, connects 
+ * continue meanwhile. Nothing is polled, an unchanged database costs no work.
+ */
+int
+plugin_watch_start(plugin_ctx_t *ctx)
+{
+    const char *paths[2];
+    char wal_path[PATH_MAX];
+    int err = 0;
+
+    if (ctx == NULL || ctx->pc_dbwatch != NULL) {
+        return (EINVAL);
+    }
+
+    paths[0] = dao_db_filename(ctx->pc_dao);
+    if (snprintf(wal_path, sizeof(wal_path), "%s-wal", paths[0]) 
+        >= (int)sizeof(wal_path)) {
+        return (ENAMETOOLONG);
+    }
+    paths[1] = wal_path;
+
+    if ((err = dao_alloc(&(ctx->pc_watch_dao), paths[0])) != 0 ||
+        (err = dao_db_open(ctx->pc_watch_dao)) != 0 ||
+        (err = dbwatch_open(&(ctx->pc_dbwatch), paths, 2, 
+         i_plugin_watch_handler, ctx)) != 0) {
+        dao_free(ctx->pc_watch_dao);
+        ctx->pc_watch_dao = NULL;
+        return (err);
+    }
+
+    return (0);
+}
+
+/*
+ * i_plugin_store_leases runs on the lease writer and stores the changed 
+ * leases with the connection of the writer. The queued client ids only wake 
+ * it up, the pool itself knows which leases changed.
+ */
+static void
+i_plugin_store_leases(batchq_t *queue, void *arg)
+{
+    plugin_ctx_t *ctx = arg;
+    int client_id = 0;
+
+    while (batchq_dequeue(queue, &client_id)) {
+    }
+
+    if (addrpool_dirty_count(ctx->pc_addrpool) == 0) {
+        return;
+    }
+
+    if (addrpool_flush(ctx->pc_addrpool, ctx->pc_lease_dao) != 0) {
+        log_error("Failed to store address leases");
+    }
+}
+
+/*
+ * plugin_set_pool enables dynamic addresses for clients without a static IPv4 
+ * address. The IPv6 pool is optional. Leases stored in the database are 
+ * restored, so reconnecting clients keep their addresses. Changed leases are 
+ * stored by a writer thread with its own database connection.
+ */
+int
+plugin_set_pool(plugin_ctx_t *ctx, const char *ipv4_pool, 
+    const char *ipv6_pool)
+{
+    addrpool_t *pool = NULL;
+    int err = 0;
+
+    if (ctx == NULL || ctx->pc_addrpool != NULL) {
+        return (EINVAL);
+    }
+
+    if ((err = addrpool_alloc(&pool, ipv4_pool, ipv6_pool)) != 0) {
+        return (err);
+    }
+
+    if ((err = addrpool_load(pool, ctx->pc_dao)) != 0 ||
+        (err = dao_alloc(&(ctx->pc_lease_dao), 
+         dao_db_filename(ctx->pc_dao))) != 0) {
+        addrpool_free(pool);
+        return (err);
+    }
+
+    ctx->pc_addrpool = pool;
+
+    if ((err = batchq_open(&(ctx->pc_lease_queue), PLUGIN_LEASE_QUEUE_SIZE, 
+        sizeof(int), ADDRPOOL_FLUSH_BATCH, PLUGIN_LEASE_FLUSH_INTERVAL_MS, 
+        i_plugin_store_leases, ctx)) != 0) {
+        ctx->pc_addrpool = NULL;
+        addrpool_free(pool);
+        dao_free(ctx->pc_lease_dao);
+        ctx->pc_lease_dao = NULL;
+        return (err);
+    }
+
+    return (0);
+}
+
+/*
+ * plugin_attach_shm switches the instance to a shared directory published by 
+ * "easyvpn publish" or shmdir_publish. Connecting clients are then looked up 
+ * in the shared snapshot instead of the database and the own client directory 
+ * and negative cache are released. Several instances on one host share a 
+ * single copy of the directory this way.
+ */
+int
+plugin_attach_shm(plugin_ctx_t *ctx, const char *name)
+{
+    shmdir_t *shmdir = NULL;
+    int err = 0;
+
+    if (ctx == NULL || name == NULL || ctx->pc_shmdir != NULL) {
+        return (EINVAL);
+    }
+
+    pthread_mutex_lock(&(ctx->pc_reload_lock));
+    i_plugin_warmup_join(ctx);
+
+    if ((err = shmdir_open(&shmdir, name)) == 0) {
+        /* Connects read pc_shmdir under the cache lock. */
+        pthread_rwlock_wrlock(&(ctx->pc_cache_lock));
+        ctx->pc_shmdir = shmdir;
+        pthread_rwlock_unlock(&(ctx->pc_cache_lock));
+
+        i_plugin_swap_directory(ctx, NULL);
+        negcache_invalidate(ctx->pc_negcache);
+    }
+
+    pthread_mutex_unlock(&(ctx->pc_reload_lock));
+    return (err);
+}
+
+/*
+ * plugin_set_admission limits the rate of connects to rate connects per 
+ * second with bursts of up to burst connects. Connects served from the caches
+ * may use the last ADMIT_WARM_RESERVE of the burst, connects which have to 
+ * query the database may not. Connects above the limit and retries of a CN 
+ * still connecting are rejected, OpenVPN retries them later. A rate of 0 
+ * disables the limit.
+ */
+int
+plugin_set_admission(plugin_ctx_t *ctx, double rate, double burst)
+{
+    if (ctx == NULL || rate < 0 || burst < 0) {
+        return (EINVAL);
+    }
+
+    admit_set_rate(ctx->pc_admit, rate, burst);
+    return (0);
+}
+
+/*
+ * plugin_set_mgmt pushes the route changes of later syncs to the connected 
+ * clients through the OpenVPN management interface at the unix socket path,
+ * instead of waiting for their reconnect. OpenVPN 2.7 or later is required 
+ * for the push-update-cid command. A NULL path stops the updates.
+ */
+int
+plugin_set_mgmt(plugin_ctx_t *ctx, const char *path)
+{
+    char *copy = NULL;
+
+    if (ctx == NULL) {
+        return (EINVAL);
+    }
+
+    if (path != NULL && (copy = strdup(path)) == NULL) {
+        return (ENOMEM);
+    }
+
+    pthread_mutex_lock(&(ctx->pc_reload_lock));
+    free(ctx->pc_mgmt_path);
+    ctx->pc_mgmt_path = copy;
+    pthread_mutex_unlock(&(ctx->pc_reload_lock));
+
+    return (0);
+}
+
+/*
+ * plugin_set_routes installs kernel routes for the networks of connected 
+ * clients through the tun device ifname, so the server host routes them into
+ * the tunnel without "route" options. Routes left over by a previous process
+ * are removed. Call it before the first connect, CAP_NET_ADMIN is required.
+ */
+int
+plugin_set_routes(plugin_ctx_t *ctx, const char *ifname)
+{
+    nlroute_t *nl = NULL;
+    int err = 0;
+
+    if (ctx == NULL || ifname == NULL || ctx->pc_nlroute != NULL) {
+        return (EINVAL);
+    }
+
+    if ((err = nlroute_open(&nl, ifname)) != 0) {
+        return (err);
+    }
+
+    if ((err = nlroute_reconcile(nl)) != 0) {
+        nlroute_close(nl);
+        return (err);
+    }
+
+    ctx->pc_nlroute = nl;
+    return (0);
+}
+
+/*
+ * plugin_set_trace records every connect and disconnect to the trace file at
+ * path, for a replay with trace_replay. Recording doesn't block the events, 
+ * if the writer falls behind, events are dropped. Call it before the first 
+ * connect.
+ */
+int
+plugin_set_trace(plugin_ctx_t *ctx, const char *path)
+{
+    if (ctx == NULL || path == NULL || ctx->pc_trace != NULL) {
+        return (EINVAL);
+    }
+
+    return (trace_open(&(ctx->pc_trace), path));
+}
+
+/*
+ * plugin_set_replica answers the database queries of connects from an 
+ * in-memory replica, so connects neither read the disk nor wait for the locks
+ * of admin writers. The replica is copied again when the client tables 
+ * change, by the watcher or plugin_sync. Writes still go to the file. Call it
+ * before the first connect.
+ */
+int
+plugin_set_replica(plugin_ctx_t *ctx)
+{
+    dao_config_t *replica = NULL;
+    long long generation = 0;
+    int err = 0;
+
+    if (ctx == NULL || ctx->pc_replica != NULL) {
+        return (EINVAL);
+    }
+
+    if ((err = dao_alloc(&replica, dao_db_filename(ctx->pc_dao))) != 0 ||
+        (err = dao_replica_open(replica)) != 0 ||
+        (err = dao_change_generation(replica, &generation)) != 0) {
+        dao_free(replica);
+        return (err);
+    }
+
+    /* A running watcher refreshes the replica under the same lock. */
+    pthread_mutex_lock(&(ctx->pc_reload_lock));
+    ctx->pc_replica = replica;
+    ctx->pc_replica_generation = generation;
+    pthread_mutex_unlock(&(ctx->pc_reload_lock));
+
+    return (0);
+}
+
+/*
+ * i_plugin_route_client installs the kernel routes of a connecting client. 
+ * A failure is logged, but doesn't reject the client. The caller holds 
+ * pc_cache_lock for reading.
+ */
+static void
+i_plugin_route_client(plugin_ctx_t *ctx, ccd_directory_t *directory, 
+    const struct vpn_client *client)
+{
+    vector_t *pxs = NULL;
+    int err = 0;
+
+    if ((err = vector_alloc(&pxs, sizeof(struct prefix))) != 0 ||
+        (err = ccd_client_prefixes(directory, i_plugin_query_dao(ctx), 
+         client->id, pxs)) != 0 || 
+        (err = nlroute_client_set(ctx->pc_nlroute, client->cn, 
+         vector_begin(pxs), vector_size(pxs))) != 0) {
+        log_error("Failed to install routes of %s: %s", client->cn, 
+            strerror(err));
+    }
+
+    vector_free(pxs);
+}
+
+/*
+ * i_plugin_refresh_shm maps a newly published snapshot of the shared 
+ * directory. The previous snapshot is unmapped, so this takes pc_cache_lock 
+ * for writing like a switch of the own directory. A failed refresh keeps the 
+ * previous snapshot.
+ */
+static void
+i_plugin_refresh_shm(plugin_ctx_t *ctx)
+{
+    int err = 0;
+
+    pthread_rwlock_wrlock(&(ctx->pc_cache_lock));
+
+    /* Another connect may have refreshed it meanwhile. */
+    if (shmdir_stale(ctx->pc_shmdir) &&
+        (err = shmdir_refresh(ctx->pc_shmdir)) != 0) {
+        log_error("Failed to refresh shared directory: %s", strerror(err));
+    }
+
+    pthread_rwlock_unlock(&(ctx->pc_cache_lock));
+}
+
+/*
+ * i_plugin_find_client looks up an active client and the directory to build 
+ * its config from. The directory is NULL if the config has to be built from 
+ * the database. Unknown and inactive CNs return EACCES. The caller holds 
+ * pc_cache_lock for reading and has checked the negative cache.
+ */
+static int
+i_plugin_find_client(plugin_ctx_t *ctx, const char *cn, 
+    struct vpn_client *client, ccd_directory_t **directoryp)
+{
+    int err = 0;
+
+    if (ctx->pc_shmdir != NULL) {
+        err = shmdir_find_client(ctx->pc_shmdir, cn, client);
+        *directoryp = shmdir_directory(ctx->pc_shmdir);
+        return (err == ENOENT ? EACCES : err);
+    }
+
+    /* Until the caches are ready, every connect queries the database. */
+    if (atomic_load_explicit(&(ctx->pc_warmup_state), memory_order_acquire) 
+        != PLUGIN_WARMUP_READY) {
+        atomic_fetch_add(&(ctx->pc_direct_connects), 1);
+
+        err = dao_vpn_client_find_by_cn(i_plugin_query_dao(ctx), cn, client);
+        *directoryp = NULL;
+        return (err == ENOENT || (err == 0 && !client->is_active) ? 
+            EACCES : err);
+    }
+
+    /* The directory holds the active clients only. */
+    if ((err = ccd_directory_find_client(ctx->pc_directory, cn, client)) == 
+        ENOENT) {
+        negcache_add_miss(ctx->pc_negcache, cn);
+        return (EACCES);
+    }
+
+    *directoryp = ctx->pc_directory;
+    return (err);
+}
+
+/*
+ * i_plugin_lease_changed tells the lease writer about a changed lease without
+ * waiting. A change dropped by a full queue is stored with the next batch.
+ */
+static void
+i_plugin_lease_changed(plugin_ctx_t *ctx, int client_id)
+{
+    batchq_submit(ctx->pc_lease_queue, &client_id);
+}
+
+/*
+ * plugin_client_connect writes the client config of the given CN to fd. 
+ * Unknown and inactive CNs are rejected with EACCES. Repeated attempts of such
+ * CNs are rejected by the negative cache without querying the database. 
+ * Clients without a static IPv4 address get their addresses from the pool.
+ * Connects are subject to the admission control, see plugin_set_admission.
+ */
+int
+plugin_client_connect(plugin_ctx_t *ctx, const char *cn, int fd)
+{
+    struct vpn_client client;
+    struct vpn_session session;
+    ccd_directory_t *directory = NULL;
+    bool warm = false, leased = false;
+    int err = 0;
+
+    if (ctx == NULL || cn == NULL || fd < 0) {
+        return (EINVAL);
+    }
+
+    if (ctx->pc_trace != NULL) {
+        trace_submit(ctx->pc_trace, TRACE_CONNECT, cn, 0, 0);
+    }
+
+    memset(&client, 0, sizeof(client));
+
+    /* The directory may be replaced by the watcher, but not while in use. */
+    pthread_rwlock_rdlock(&(ctx->pc_cache_lock));
+
+    /* A newer shared snapshot is mapped without readers of the current one. */
+    if (ctx->pc_shmdir != NULL && shmdir_stale(ctx->pc_shmdir)) {
+        pthread_rwlock_unlock(&(ctx->pc_cache_lock));
+        i_plugin_refresh_shm(ctx);
+        pthread_rwlock_rdlock(&(ctx->pc_cache_lock));
+    }
+
+    warm = ctx->pc_shmdir != NULL || atomic_load_explicit(
+        &(ctx->pc_warmup_state), memory_order_acquire) == PLUGIN_WARMUP_READY;
+
+    /* Known unknown CNs are rejected before they take any admission. */
+    if (warm && ctx->pc_shmdir == NULL && 
+        negcache_reject(ctx->pc_negcache, cn)) {
+        err = EACCES;
+        goto out_unlock;
+    }
+
+    if ((err = admit_enter(ctx->pc_admit, cn, warm)) != 0) {
+        goto out_unlock;
+    }
+
+    err = i_plugin_find_client(ctx, cn, &client, &directory);
+    if (err != 0) {
+        goto out_leave;
+    }
+
+    if (client.ipv4_addr[0] == '\0') {
+        if (ctx->pc_addrpool == NULL) {
+            err = EADDRNOTAVAIL;
+            goto out_leave;
+        }
+
+        if ((err = addrpool_acquire(ctx->pc_addrpool, &client)) != 0) {
+            goto out_leave;
+        }
+        leased = true;
+    }
+
+    err = (directory != NULL ? ccd_build(directory, &client, fd) : 
+        ccd_build_direct(i_plugin_query_dao(ctx), &client, fd));
+
+    if (err == 0 && ctx->pc_nlroute != NULL) {
+        i_plugin_route_client(ctx, directory, &client);
+    }
+
+out_leave:
+    admit_leave(ctx->pc_admit, cn);
+out_unlock:
+    pthread_rwlock_unlock(&(ctx->pc_cache_lock));
+
+    if (err == 0) {
+        err = rtable_client_add(ctx->pc_rtable, cn, client.id);
+    }
+
+    /* OpenVPN sends no disconnect for a rejected client. */
+    if (leased && err != 0) {
+        addrpool_release(ctx->pc_addrpool, client.id);
+    }
+
+    if (leased) {
+        i_plugin_lease_changed(ctx, client.id);
+    }
+
+    if (err != 0) {
+        return (err);
+    }
+
+    /* Accounting is best effort, a full queue must not reject the client. */
+    memset(&session, 0, sizeof(session));
+    memcpy(session.cn, client.cn, sizeof(session.cn));
+    memcpy(session.ipv4_addr, client.ipv4_addr, sizeof(session.ipv4_addr));
+    memcpy(session.ipv6_addr, client.ipv6_addr, sizeof(session.ipv6_addr));
+    session.started_at = time(NULL);
+    acct_submit(ctx->pc_acct, &session);
+
+    return (0);
+}
+
+/*
+ * plugin_client_disconnect removes the given CN and its routes from the 
+ * routing table, records the end of its session with the byte counters of the
+ * disconnect event and returns its pool addresses.
+ */
+int
+plugin_client_disconnect(plugin_ctx_t *ctx, const char *cn, 
+    uint64_t bytes_received, uint64_t bytes_sent)
+{
+    struct rtable_client online;
+    struct vpn_session session;
+    int client_id = 0, err = 0;
+
+    if (ctx == NULL || cn == NULL) {
+        return (EINVAL);
+    }
+
+    if (ctx->pc_trace != NULL) {
+        trace_submit(ctx->pc_trace, TRACE_DISCONNECT, cn, bytes_received, 
+            bytes_sent);
+    }
+
+    memset(&session, 0, sizeof(session));
+    if (rtable_client_remove(ctx->pc_rtable, cn, &online) == 0) {
+        session.started_at = online.rc_since;
+        client_id = online.rc_client_id;
+    }
+
+    if (ctx->pc_nlroute != NULL && 
+        (err = nlroute_client_clear(ctx->pc_nlroute, cn)) != 0) {
+        log_error("Failed to remove routes of %s: %s", cn, strerror(err));
+    }
+
+    session.is_end = 1;
+    strncpy(session.cn, cn, sizeof(session.cn) - 1);
+    session.ended_at = time(NULL);
+    session.bytes_received = bytes_received;
+    session.bytes_sent = bytes_sent;
+    acct_submit(ctx->pc_acct, &session);
+
+    /* The id of the connect, the client may be renamed or deleted now. */
+    if (ctx->pc_addrpool == NULL || client_id == 0) {
+        return (0);
+    }
+
+    if ((err = addrpool_release(ctx->pc_addrpool, client_id)) != 0) {
+        return (err == ENOENT ? 0 : err);
+    }
+
+    i_plugin_lease_changed(ctx, client_id);
+    return (0);
+}
+
+/*
+ * plugin_learn_address handles the learn-address event. The operation is one 
+ * of "add", "update" or "delete", the address is a virtual address or an 
+ * iroute prefix of the client with the given CN. The CN is ignored on delete.
+ */
+int
+plugin_learn_address(plugin_ctx_t *ctx, const char *op, const char *addr, 
+    const char *cn)
+{
+    if (ctx == NULL || op == NULL || addr == NULL) {
+        return (EINVAL);
+    }
+
+    if (strcmp(op, "add") == 0 || strcmp(op, "update") == 0) {
+        return (cn != NULL ? rtable_learn(ctx->pc_rtable, addr, cn) : EINVAL);
+    } else if (strcmp(op, "delete") == 0) {
+        return (rtable_unlearn(ctx->pc_rtable, addr));
+    }
+
+    return (EINVAL);
+}
+
+/*
+ * i_plugin_control answers the commands of the control socket:
+ *
+ *   owner <addr>  CN of the client owning the address
+ *   online        Connected clients with connect time and number of routes
+ *   stats         Size of the routing table and the caches
+ *   loglevel <l>  Set the log level to error, warn, info or debug
+ */
+static int
+i_plugin_control(void *arg, char *line, FILE *out)
+{
+    plugin_ctx_t *ctx = arg;
+    struct rtable_client *client = NULL;
+    struct rtable_stats stats;
+    struct acct_stats acct_stats;
+    struct plugin_warmup_stats warmup_stats;
+    struct admit_stats admit_stats;
+    struct section_stats section_stats;
+    struct log_stats log_stats;
+    struct nlroute_stats nlroute_stats;
+    struct trace_stats trace_stats;
+    struct negcache_stats negcache_stats;
+    struct addrpool_stats addrpool_stats;
+    struct shmdir_stats shmdir_stats;
+    vector_t *clients = NULL;
+    char cn[RFC5280_CN_MAX_LENGTH], *cmd = NULL, *param = NULL, 
+         *saveptr = NULL;
+    int level = 0, err = 0;
+
+    if ((cmd = strtok_r(line, " ", &saveptr)) == NULL) {
+        return (EINVAL);
+    }
+    param = strtok_r(NULL, " ", &saveptr);
+
+    if (strcmp(cmd, "owner") == 0 && param != NULL) {
+        if ((err = rtable_lookup(ctx->pc_rtable, param, cn, sizeof(cn))) 
+            == 0) {
+            fprintf(out, "%s\n", cn);
+        }
+        return (err == ENOENT ? 0 : err);
+    } else if (strcmp(cmd, "online") == 0) {
+        if ((err = vector_alloc(&clients, sizeof(struct rtable_client))) != 0) {
+            return (err);
+        }
+
+        if ((err = rtable_online(ctx->pc_rtable, clients)) == 0) {
+            for (client = vector_begin(clients); client != vector_end(clients);
+                 client = vector_next(clients, client)) {
+                fprintf(out, "%s %ld %zu\n", client->rc_cn, 
+                    (long)client->rc_since, client->rc_routes);
+            }
+        }
+
+        vector_free(clients);
+        return (err);
+    } else if (strcmp(cmd, "stats") == 0) {
+        rtable_get_stats(ctx->pc_rtable, &stats);
+        acct_get_stats(ctx->pc_acct, &acct_stats);
+        fprintf(out, "clients %zu\nhosts %zu\nprefixes %zu\n", 
+            stats.rs_clients, stats.rs_hosts, stats.rs_prefixes);
+        fprintf(out, "sessions_queued %" PRIu64 "\n"
+            "sessions_dropped %" PRIu64 "\nsessions_committed %" PRIu64 "\n"
+            "sessions_failed %" PRIu64 "\n", acct_stats.as_queued, 
+            acct_stats.as_dropped, acct_stats.as_committed, 
+            acct_stats.as_failed);
+
+        plugin_get_warmup_stats(ctx, &warmup_stats);
+        fprintf(out, "warmup_state %s\nwarmup_seconds %.3f\n"
+            "warmup_direct_connects %" PRIu64 "\n", 
+            i_plugin_warmup_names[warmup_stats.ws_state], 
+            warmup_stats.ws_seconds, warmup_stats.ws_direct_connects);
+        fprintf(out, "cache_reloads %" PRIu64 "\ncache_syncs %" PRIu64 "\n", 
+            (uint64_t)atomic_load(&(ctx->pc_reloads)), 
+            (uint64_t)atomic_load(&(ctx->pc_syncs)));
+        fprintf(out, "updates_pushed %" PRIu64 "\nupdates_failed %" PRIu64 
+            "\n", (uint64_t)atomic_load(&(ctx->pc_updates_pushed)), 
+            (uint64_t)atomic_load(&(ctx->pc_updates_failed)));
+
+        admit_get_stats(ctx->pc_admit, &admit_stats);
+        fprintf(out, "admit_warm %" PRIu64 "\nadmit_cold %" PRIu64 "\n"
+            "admit_rate_rejects %" PRIu64 "\nadmit_dup_rejects %" PRIu64 "\n"
+            "admit_full_rejects %" PRIu64 "\nadmit_in_flight %zu\n"
+            "admit_max_in_flight %zu\nadmit_tokens %.1f\n", 
+            admit_stats.as_warm, admit_stats.as_cold, 
+            admit_stats.as_rate_rejects, admit_stats.as_dup_rejects, 
+            admit_stats.as_full_rejects, admit_stats.as_in_flight, 
+            admit_stats.as_max_in_flight, admit_stats.as_tokens);
+
+        pthread_rwlock_rdlock(&(ctx->pc_cache_lock));
+        ccd_directory_get_section_stats(ctx->pc_directory, &section_stats);
+        pthread_rwlock_unlock(&(ctx->pc_cache_lock));
+        fprintf(out, "sections %zu\nsection_bytes %zu\nsection_refs %zu\n",
+            section_stats.ss_sections, section_stats.ss_bytes, 
+            section_stats.ss_refs);
+
+        negcache_get_stats(ctx->pc_negcache, &negcache_stats);
+        fprintf(out, "negcache_filter_rejects %" PRIu64 "\n"
+            "negcache_miss_rejects %" PRIu64 "\nnegcache_passes %" PRIu64 
+            "\nnegcache_misses %" PRIu64 "\nnegcache_builds %" PRIu64 "\n"
+            "negcache_filter_cns %zu\n", negcache_stats.ns_filter_rejects, 
+            negcache_stats.ns_miss_rejects, negcache_stats.ns_passes, 
+            negcache_stats.ns_misses, negcache_stats.ns_builds, 
+            negcache_stats.ns_filter_cns);
+
+        log_get_stats(&log_stats);
+        fprintf(out, "log_level %s\nlog_records %" PRIu64 "\n"
+            "log_dropped %" PRIu64 "\n", log_level_name(log_level), 
+            log_stats.ls_records, log_stats.ls_dropped);
+
+        if (ctx->pc_nlroute != NULL) {
+            nlroute_get_stats(ctx->pc_nlroute, &nlroute_stats);
+            fprintf(out, "kernel_routes %zu\nkernel_routes_added %" PRIu64 
+                "\nkernel_routes_removed %" PRIu64 "\n"
+                "kernel_routes_failed %" PRIu64 "\n"
+                "kernel_route_batches %" PRIu64 "\n", nlroute_stats.ns_routes,
+                nlroute_stats.ns_added, nlroute_stats.ns_removed, 
+                nlroute_stats.ns_failed, nlroute_stats.ns_batches);
+        }
+
+        if (ctx->pc_addrpool != NULL) {
+            addrpool_get_stats(ctx->pc_addrpool, &addrpool_stats);
+            fprintf(out, "pool_ipv4_size %zu\npool_ipv4_used %zu\n"
+                "pool_ipv6_size %zu\npool_ipv6_used %zu\npool_leases %zu\n"
+                "pool_dirty %zu\n", addrpool_stats.aps_ipv4_size, 
+                addrpool_stats.aps_ipv4_used, addrpool_stats.aps_ipv6_size, 
+                addrpool_stats.aps_ipv6_used, addrpool_stats.aps_leases, 
+                addrpool_stats.aps_dirty);
+        }
+
+        if (ctx->pc_trace != NULL) {
+            trace_get_stats(ctx->pc_trace, &trace_stats);
+            fprintf(out, "trace_queued %" PRIu64 "\ntrace_dropped %" PRIu64 
+                "\ntrace_written %" PRIu64 "\n", trace_stats.ts_queued, 
+                trace_stats.ts_dropped, trace_stats.ts_written);
+        }
+
+        /* The shared directory is switched and remapped under the lock. */
+        pthread_rwlock_rdlock(&(ctx->pc_cache_lock));
+        if (ctx->pc_shmdir != NULL) {
+            shmdir_get_stats(ctx->pc_shmdir, &shmdir_stats);
+            fprintf(out, "shm_generation %" PRIu64 "\nshm_remaps %" PRIu64 
+                "\nshm_clients %zu\nshm_bytes %zu\n", 
+                shmdir_stats.ss_generation, shmdir_stats.ss_remaps, 
+                shmdir_stats.ss_clients, shmdir_stats.ss_bytes);
+        }
+        pthread_rwlock_unlock(&(ctx->pc_cache_lock));
+
+        if (ctx->pc_replica != NULL) {
+            fprintf(out, "replica_refreshes %" PRIu64 "\n", 
+                (uint64_t)atomic_load(&(ctx->pc_replica_refreshes)));
+        }
+        return (0);
+    } else if (strcmp(cmd, "loglevel") == 0 && param != NULL) {
+        if ((err = log_parse_level(param, &level)) == 0) {
+            log_set_level(level);
+        }
+        return (err);
+    }
+
+    return (EINVAL);
+}
+
+/*
+ * plugin_control_open serves queries of the routing table on a local control
+ * socket at the given path. See i_plugin_control for the commands.
+ */
+int
+plugin_control_open(plugin_ctx_t *ctx, const char *path)
+{
+    if (ctx == NULL || path == NULL || ctx->pc_ctlsock != NULL) {
+        return (EINVAL);
+    }
+
+    return (ctlsock_open(&(ctx->pc_ctlsock), path, i_plugin_control, ctx));
+}
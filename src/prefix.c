@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <string.h>
+
+#include "prefix.h"
+
+#define I_PREFIX_IPV4_SHIFT 96
+
+/* Partitions up to this size are sorted by insertion. */
+#define I_PREFIX_INSERTION_SORT 16
+
+static prefix_addr_t
+i_prefix_load(const uint8_t *bytes, int family)
+{
+    uint64_t hi = 0, lo = 0;
+    uint32_t v4 = 0;
+
+    if (family == AF_INET) {
+        memcpy(&v4, bytes, sizeof(v4));
+        return ((prefix_addr_t)be32toh(v4) << I_PREFIX_IPV4_SHIFT);
+    }
+
+    memcpy(&hi, bytes, sizeof(hi));
+    memcpy(&lo, bytes + 8, sizeof(lo));
+    return (((prefix_addr_t)be64toh(hi) << 64) | be64toh(lo));
+}
+
+static void
+i_prefix_store(prefix_addr_t addr, int family, uint8_t *bytes)
+{
+    uint64_t hi = htobe64((uint64_t)(addr >> 64));
+    uint64_t lo = htobe64((uint64_t)addr);
+    uint32_t v4 = htobe32((uint32_t)(addr >> I_PREFIX_IPV4_SHIFT));
+
+    if (family == AF_INET) {
+        memcpy(bytes, &v4, sizeof(v4));
+        return;
+    }
+
+    memcpy(bytes, &hi, sizeof(hi));
+    memcpy(bytes + 8, &lo, sizeof(lo));
+}
+
+/*
+ * i_prefix_hostmask returns the host bits of a prefix length from 0 to 128.
+ * The shift is split in two, because a shift by 128 is undefined.
+ */
+static prefix_addr_t
+i_prefix_hostmask(size_t length)
+{
+    return ((~(prefix_addr_t)0 >> (length >> 1)) >> ((length + 1) >> 1));
+}
+
+/*
+ * prefix_set stores an address in network byte order of the given family and
+ * a prefix length. Host bits are kept.
+ */
+int
+prefix_set(struct prefix *px, int family, const void *addr, size_t length)
+{
+    if (px == NULL || addr == NULL || (family != AF_INET &&
+        family != AF_INET6) || length > (family == AF_INET ? 32 : 128)) {
+        return (EINVAL);
+    }
+
+    px->px_addr = i_prefix_load(addr, family);
+    px->px_family = family;
+    px->px_length = length;
+
+    return (0);
+}
+
+/*
+ * prefix_set_ipv4 stores an IPv4 address in host byte order and a prefix
+ * length up to 32.
+ */
+void
+prefix_set_ipv4(struct prefix *px, uint32_t addr, size_t length)
+{
+    px->px_addr = (prefix_addr_t)addr << I_PREFIX_IPV4_SHIFT;
+    px->px_family = AF_INET;
+    px->px_length = length;
+}
+
+/*
+ * prefix_get_addr stores the address in network byte order, 4 bytes for IPv4
+ * and 16 bytes for IPv6.
+ */
+void
+prefix_get_addr(const struct prefix *px, void *addr)
+{
+    i_prefix_store(px->px_addr, px->px_family, addr);
+}
+
+int
+prefix_from_inetx(struct prefix *px, const struct inetx_prefix *inetx)
+{
+    if (inetx == NULL) {
+        return (EINVAL);
+    }
+
+    return (prefix_set(px, inetx->ip_family, &(inetx->ip_ipv6_addr),
+        inetx->ip_length));
+}
+
+void
+prefix_to_inetx(const struct prefix *px, struct inetx_prefix *inetx)
+{
+    memset(inetx, 0, sizeof(struct inetx_prefix));
+    inetx->ip_family = px->px_family;
+    inetx->ip_length = px->px_length;
+    i_prefix_store(px->px_addr, px->px_family,
+        inetx->ip_ipv6_addr.s6_addr);
+}
+
+/*
+ * prefix_netmask returns the netmask of a prefix length. The mask of an IPv4
+ * prefix is the same, as its address is left aligned.
+ */
+prefix_addr_t
+prefix_netmask(size_t length)
+{
+    return (~i_prefix_hostmask(length));
+}
+
+/*
+ * prefix_get_netmask stores the netmask of the prefix in network byte order,
+ * the IPv6 equivalent of inetx_ipv4_prefix_to_netmask.
+ */
+void
+prefix_get_netmask(const struct prefix *px, void *addr)
+{
+    i_prefix_store(prefix_netmask(px->px_length), px->px_family, addr);
+}
+
+/*
+ * prefix_last returns the last address of the prefix.
+ */
+prefix_addr_t
+prefix_last(const struct prefix *px)
+{
+    return (px->px_addr | i_prefix_hostmask(px->px_length));
+}
+
+/*
+ * prefix_mask clears the host bits of the prefix. Returns true if at least
+ * one host bit was set.
+ */
+bool
+prefix_mask(struct prefix *px)
+{
+    prefix_addr_t masked = px->px_addr & prefix_netmask(px->px_length);
+    bool changed = (masked != px->px_addr);
+
+    px->px_addr = masked;
+    return (changed);
+}
+
+/*
+ * prefix_contains checks if the prefix outer contains the prefix inner. A
+ * prefix contains itself. Host bits of both prefixes are ignored.
+ */
+bool
+prefix_contains(const struct prefix *outer, const struct prefix *inner)
+{
+    return ((outer->px_family == inner->px_family) &
+        (outer->px_length <= inner->px_length) &
+        (((outer->px_addr ^ inner->px_addr) &
+          prefix_netmask(outer->px_length)) == 0));
+}
+
+/*
+ * prefix_adjacent checks if the prefix b starts right after the end of the
+ * prefix a. Both prefixes have to be masked.
+ */
+bool
+prefix_adjacent(const struct prefix *a, const struct prefix *b)
+{
+    prefix_addr_t last = prefix_last(a);
+
+    /* The last address of a prefix ending the family has all bits set. */
+    return ((a->px_family == b->px_family) & (~last != 0) &
+        (last + 1 == b->px_addr));
+}
+
+/*
+ * prefix_merge checks if the prefixes a and b are the two halves of a shorter
+ * prefix and stores this prefix in merged. Both prefixes have to be masked.
+ * merged may be a or b.
+ */
+bool
+prefix_merge(const struct prefix *a, const struct prefix *b,
+             struct prefix *merged)
+{
+    size_t length = a->px_length, parent = length - (length > 0);
+    bool halves = (a->px_family == b->px_family) &
+        (a->px_length == b->px_length) & (length > 0) &
+        ((a->px_addr ^ b->px_addr) == i_prefix_hostmask(parent) -
+         i_prefix_hostmask(length));
+
+    if (halves) {
+        merged->px_addr = a->px_addr & prefix_netmask(parent);
+        merged->px_family = a->px_family;
+        merged->px_length = parent;
+    }
+
+    return (halves);
+}
+
+/*
+ * prefix_next moves a masked prefix to the following prefix of the same
+ * length. Returns ERANGE after the last prefix of the family.
+ */
+int
+prefix_next(struct prefix *px)
+{
+    prefix_addr_t step = i_prefix_hostmask(px->px_length) + 1;
+
+    /* The step of /0 is 0, the addition wraps after the last prefix. */
+    if (step == 0 || px->px_addr + step < px->px_addr) {
+        return (ERANGE);
+    }
+
+    px->px_addr += step;
+    return (0);
+}
+
+/*
+ * prefix_prev moves a masked prefix to the preceding prefix of the same
+ * length. Returns ERANGE before the first prefix of the family.
+ */
+int
+prefix_prev(struct prefix *px)
+{
+    prefix_addr_t step = i_prefix_hostmask(px->px_length) + 1;
+
+    if (step == 0 || px->px_addr < step) {
+        return (ERANGE);
+    }
+
+    px->px_addr -= step;
+    return (0);
+}
+
+/*
+ * prefix_cmp orders prefixes by family, address and length. A prefix is
+ * sorted before all prefixes it contains.
+ */
+int
+prefix_cmp(const void *a, const void *b)
+{
+    const struct prefix *pa = a, *pb = b;
+
+    if (pa->px_family != pb->px_family) {
+        return ((pa->px_family > pb->px_family) -
+            (pa->px_family < pb->px_family));
+    }
+
+    if (pa->px_addr != pb->px_addr) {
+        return ((pa->px_addr > pb->px_addr) - (pa->px_addr < pb->px_addr));
+    }
+
+    return ((pa->px_length > pb->px_length) -
+        (pa->px_length < pb->px_length));
+}
+
+static inline bool
+i_prefix_less(const struct prefix *a, const struct prefix *b)
+{
+    if (a->px_family != b->px_family) {
+        return (a->px_family < b->px_family);
+    }
+    if (a->px_addr != b->px_addr) {
+        return (a->px_addr < b->px_addr);
+    }
+    return (a->px_length < b->px_length);
+}
+
+static inline void
+i_prefix_swap(struct prefix *a, struct prefix *b)
+{
+    struct prefix tmp = *a;
+
+    *a = *b;
+    *b = tmp;
+}
+
+static void
+i_prefix_insertion_sort(struct prefix *pxs, size_t n)
+{
+    struct prefix tmp;
+    size_t i = 0, j = 0;
+
+    for (i = 1; i < n; i++) {
+        tmp = pxs[i];
+        for (j = i; j > 0 && i_prefix_less(&tmp, &(pxs[j - 1])); j--) {
+            pxs[j] = pxs[j - 1];
+        }
+        pxs[j] = tmp;
+    }
+}
+
+/*
+ * i_prefix_quicksort sorts with the comparison inlined, which is several
+ * times faster than qsort. It recurses into the smaller partition only, so
+ * the stack depth is logarithmic. The Hoare partition stops on prefixes equal
+ * to the pivot, which keeps sorted input and duplicates from degrading it.
+ */
+static void
+i_prefix_quicksort(struct prefix *pxs, size_t n)
+{
+    struct prefix pivot;
+    ptrdiff_t i = 0, j = 0;
+
+    while (n > I_PREFIX_INSERTION_SORT) {
+        /* Median of three as pivot */
+        if (i_prefix_less(&(pxs[n / 2]), &(pxs[0]))) {
+            i_prefix_swap(&(pxs[n / 2]), &(pxs[0]));
+        }
+        if (i_prefix_less(&(pxs[n - 1]), &(pxs[0]))) {
+            i_prefix_swap(&(pxs[n - 1]), &(pxs[0]));
+        }
+        if (i_prefix_less(&(pxs[n - 1]), &(pxs[n / 2]))) {
+            i_prefix_swap(&(pxs[n - 1]), &(pxs[n / 2]));
+        }
+        pivot = pxs[n / 2];
+
+        for (i = -1, j = n; ; ) {
+            do {
+                i++;
+            } while (i_prefix_less(&(pxs[i]), &pivot));
+            do {
+                j--;
+            } while (i_prefix_less(&pivot, &(pxs[j])));
+
+            if (i >= j) {
+                break;
+            }
+            i_prefix_swap(&(pxs[i]), &(pxs[j]));
+        }
+
+        /* pxs[0, j] <= pivot <= pxs[j + 1, n) */
+        if ((size_t)j + 1 < n - (j + 1)) {
+            i_prefix_quicksort(pxs, j + 1);
+            pxs += j + 1;
+            n -= j + 1;
+        } else {
+            i_prefix_quicksort(pxs + j + 1, n - (j + 1));
+            n = j + 1;
+        }
+    }
+
+    i_prefix_insertion_sort(pxs, n);
+}
+
+/*
+ * prefix_sort sorts prefixes in the order of prefix_cmp.
+ */
+void
+prefix_sort(struct prefix *pxs, size_t n)
+{
+    if (pxs != NULL) {
+        i_prefix_quicksort(pxs, n);
+    }
+}
+
+/*
+ * prefix_aggregate summarizes the prefixes to the smallest set of prefixes,
+ * which covers the same addresses. Host bits are cleared, covered prefixes
+ * are removed and adjacent halves are merged into their parent. The result
+ * is stored sorted at the start of pxs and its count is returned.
+ *
+ * After sorting, a prefix is either contained by the last kept prefix or
+ * follows it. The kept prefixes are a stack, which is merged whenever its
+ * two topmost prefixes are halves of a shorter one.
+ */
+size_t
+prefix_aggregate(struct prefix *pxs, size_t n)
+{
+    size_t i = 0, top = 0;
+
+    for (i = 0; i < n; i++) {
+        prefix_mask(&(pxs[i]));
+    }
+
+    prefix_sort(pxs, n);
+
+    for (i = 0; i < n; i++) {
+        if (top > 0 && prefix_contains(&(pxs[top - 1]), &(pxs[i]))) {
+            continue;
+        }
+
+        pxs[top++] = pxs[i];
+
+        while (top > 1 &&
+               prefix_merge(&(pxs[top - 2]), &(pxs[top - 1]),
+               &(pxs[top - 2]))) {
+            top--;
+        }
+    }
+
+    return (top);
+}
@@ -0,0 +1,831 @@
+/* 
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inetx.h"
+#include "rtable.h"
+
+/* Initial number of buckets of a host shard and the client map. */
+#define I_RTABLE_BUCKETS_INIT 64
+
+/*
+ * rtable_key is a learned host address or iroute prefix. Host bits of 
+ * prefixes are cleared.
+ */
+struct rtable_key {
+    uint8_t rk_family;  /* AF_INET or AF_INET6 */
+    uint8_t rk_prefix;
+    uint8_t rk_addr[16];
+};
+
+struct rtable_host {
+    struct rtable_key rh_key;
+    char rh_cn[RFC5280_CN_MAX_LENGTH];
+    struct rtable_host *rh_next;
+};
+
+/*
+ * rtable_shard is a part of the host address map with its own lock, so 
+ * readers and writers of different shards never meet.
+ */
+struct rtable_shard {
+    pthread_rwlock_t sh_lock;
+    struct rtable_host **sh_buckets;
+    size_t sh_cap;    /* Number of buckets, a power of two */
+    size_t sh_count;
+};
+
+/*
+ * rtable_node is a node of the binary prefix trie. A node at depth n stands 
+ * for the prefix of length n given by the path from the root.
+ */
+struct rtable_node {
+    struct rtable_node *rn_child[2];
+    bool rn_used;
+    char rn_cn[RFC5280_CN_MAX_LENGTH];
+};
+
+struct rtable_client_entry {
+    struct rtable_client ce_client;
+    struct rtable_key *ce_keys;  /* Learned routes of the client */
+    size_t ce_keys_count;
+    size_t ce_keys_cap;
+    struct rtable_client_entry *ce_next;
+};
+
+/*
+ * rtable maps the virtual addresses and iroute prefixes of connected clients 
+ * to their CN. Host addresses are kept in a sharded hash map, prefixes in a 
+ * trie per address family, which is searched for the longest match.
+ *
+ * Lookups only take read locks, so concurrent queries never block each other.
+ * All modifications are serialized by rt_write_lock and take the write lock 
+ * of a shard, the trie or the client map only while changing it.
+ */
+struct rtable {
+    pthread_mutex_t rt_write_lock;
+    struct rtable_shard rt_shards[RTABLE_HOST_SHARDS];
+    pthread_rwlock_t rt_trie_lock;
+    struct rtable_node *rt_trie[2];  /* IPv4 and IPv6 root */
+    pthread_rwlock_t rt_clients_lock;
+    struct rtable_client_entry **rt_clients;
+    size_t rt_clients_cap;
+    size_t rt_clients_count;
+    size_t rt_hosts;
+    size_t rt_prefixes;
+};
+
+static uint64_t
+i_rtable_hash(const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (len-- > 0) {
+        h ^= *p++;
+        h *= 0x100000001b3ULL;
+    }
+
+    return (h ^ (h >> 32));
+}
+
+static size_t
+i_rtable_key_len(const struct rtable_key *key)
+{
+    return (key->rk_family == AF_INET ? 4 : 16);
+}
+
+static bool
+i_rtable_key_is_host(const struct rtable_key *key)
+{
+    return (key->rk_prefix == i_rtable_key_len(key) * 8);
+}
+
+static bool
+i_rtable_key_equal(const struct rtable_key *a, const struct rtable_key *b)
+{
+    return (a->rk_family == b->rk_family && a->rk_prefix == b->rk_prefix &&
+        memcmp(a->rk_addr, b->rk_addr, i_rtable_key_len(a)) == 0);
+}
+
+/*
+ * i_rtable_key_parse parses an address as passed by the learn-address event. 
+ * Addresses without a prefix are host addresses.
+ */
+static int
+i_rtable_key_parse(const char *str, struct rtable_key *key)
+{
+    struct inetx_prefix prefix;
+    size_t i = 0;
+    int err = 0, af = 0;
+
+    memset(key, 0, sizeof(struct rtable_key));
+
+    if ((err = inetx_parse_prefix(str, &prefix)) != 0) {
+        return (err);
+    }
+
+    af = prefix.ip_family;
+    key->rk_prefix = prefix.ip_length;
+    memcpy(key->rk_addr, &(prefix.ip_ipv6_addr), af == AF_INET ? 4 : 16);
+    key->rk_family = af;
+
+    for (i = key->rk_prefix; i < i_rtable_key_len(key) * 8; i++) {
+        key->rk_addr[i / 8] &= ~(0x80 >> (i % 8));
+    }
+
+    return (0);
+}
+
+static struct rtable_shard *
+i_rtable_shard(rtable_t *rt, const struct rtable_key *key, uint64_t *hash)
+{
+    *hash = i_rtable_hash(key->rk_addr, i_rtable_key_len(key));
+    return (&(rt->rt_shards[*hash % RTABLE_HOST_SHARDS]));
+}
+
+static struct rtable_host **
+i_rtable_host_find(struct rtable_shard *shard, uint64_t hash, 
+    const struct rtable_key *key)
+{
+    struct rtable_host **host = NULL;
+
+    host = &(shard->sh_buckets[(hash / RTABLE_HOST_SHARDS) & 
+        (shard->sh_cap - 1)]);
+    while (*host != NULL && !i_rtable_key_equal(&((*host)->rh_key), key)) {
+        host = &((*host)->rh_next);
+    }
+
+    return (host);
+}
+
+static int
+i_rtable_shard_grow(struct rtable_shard *shard)
+{
+    struct rtable_host **buckets = NULL, *host = NULL, *next = NULL;
+    size_t cap = shard->sh_cap * 2, i = 0, b = 0;
+
+    if ((buckets = calloc(cap, sizeof(struct rtable_host *))) == NULL) {
+        return (ENOMEM);
+    }
+
+    for (i = 0; i < shard->sh_cap; i++) {
+        for (host = shard->sh_buckets[i]; host != NULL; host = next) {
+            next = host->rh_next;
+            b = (i_rtable_hash(host->rh_key.rk_addr, 
+                i_rtable_key_len(&(host->rh_key))) / RTABLE_HOST_SHARDS) & 
+                (cap - 1);
+            host->rh_next = buckets[b];
+            buckets[b] = host;
+        }
+    }
+
+    free(shard->sh_buckets);
+    shard->sh_buckets = buckets;
+    shard->sh_cap = cap;
+
+    return (0);
+}
+
+/*
+ * i_rtable_route_set stores the owner of a route. The previous owner is 
+ * copied to prev_cn, which is empty for a new route.
+ */
+static int
+i_rtable_route_set(rtable_t *rt, const struct rtable_key *key, const char *cn,
+    char *prev_cn)
+{
+    struct rtable_shard *shard = NULL;
+    struct rtable_host **host = NULL, *new_host = NULL;
+    struct rtable_node **node = NULL;
+    uint64_t hash = 0;
+    size_t i = 0;
+    int err = 0;
+
+    prev_cn[0] = '\0';
+
+    if (i_rtable_key_is_host(key)) {
+        shard = i_rtable_shard(rt, key, &hash);
+        pthread_rwlock_wrlock(&(shard->sh_lock));
+
+        if (*(host = i_rtable_host_find(shard, hash, key)) != NULL) {
+            strcpy(prev_cn, (*host)->rh_cn);
+            strcpy((*host)->rh_cn, cn);
+            goto out_unlock_shard;
+        }
+
+        if (shard->sh_count >= shard->sh_cap && 
+            (err = i_rtable_shard_grow(shard)) != 0) {
+            goto out_unlock_shard;
+        }
+
+        if ((new_host = calloc(1, sizeof(struct rtable_host))) == NULL) {
+            err = ENOMEM;
+            goto out_unlock_shard;
+        }
+
+        new_host->rh_key = *key;
+        strcpy(new_host->rh_cn, cn);
+
+        host = i_rtable_host_find(shard, hash, key);
+        *host = new_host;
+        shard->sh_count++;
+        rt->rt_hosts++;
+
+out_unlock_shard:
+        pthread_rwlock_unlock(&(shard->sh_lock));
+        return (err);
+    }
+
+    pthread_rwlock_wrlock(&(rt->rt_trie_lock));
+
+    node = &(rt->rt_trie[key->rk_family == AF_INET ? 0 : 1]);
+    for (i = 0; i < key->rk_prefix; i++) {
+        node = &((*node)->rn_child[(key->rk_addr[i / 8] >> (7 - i % 8)) & 1]);
+        if (*node == NULL && 
+            (*node = calloc(1, sizeof(struct rtable_node))) == NULL) {
+            /* Empty nodes are harmless and reused by the next insert. */
+            err = ENOMEM;
+            goto out_unlock_trie;
+        }
+    }
+
+    if ((*node)->rn_used) {
+        strcpy(prev_cn, (*node)->rn_cn);
+    } else {
+        rt->rt_prefixes++;
+    }
+
+    (*node)->rn_used = true;
+    strcpy((*node)->rn_cn, cn);
+
+out_unlock_trie:
+    pthread_rwlock_unlock(&(rt->rt_trie_lock));
+    return (err);
+}
+
+/*
+ * i_rtable_route_del removes a route. If owner isn't NULL, the route is only 
+ * removed if it's owned by it. The removed owner is copied to prev_cn.
+ */
+static int
+i_rtable_route_del(rtable_t *rt, const struct rtable_key *key, 
+    const char *owner, char *prev_cn)
+{
+    struct rtable_shard *shard = NULL;
+    struct rtable_host **host = NULL, *old_host = NULL;
+    struct rtable_node **path[129], *node = NULL;
+    uint64_t hash = 0;
+    size_t i = 0;
+    int err = 0;
+
+    prev_cn[0] = '\0';
+
+    if (i_rtable_key_is_host(key)) {
+        shard = i_rtable_shard(rt, key, &hash);
+        pthread_rwlock_wrlock(&(shard->sh_lock));
+
+        host = i_rtable_host_find(shard, hash, key);
+        if (*host == NULL || 
+            (owner != NULL && strcmp((*host)->rh_cn, owner) != 0)) {
+            err = ENOENT;
+        } else {
+            old_host = *host;
+            *host = old_host->rh_next;
+            strcpy(prev_cn, old_host->rh_cn);
+            free(old_host);
+            shard->sh_count--;
+            rt->rt_hosts--;
+        }
+
+        pthread_rwlock_unlock(&(shard->sh_lock));
+        return (err);
+    }
+
+    pthread_rwlock_wrlock(&(rt->rt_trie_lock));
+
+    path[0] = &(rt->rt_trie[key->rk_family == AF_INET ? 0 : 1]);
+    for (i = 0; i < key->rk_prefix && *path[i] != NULL; i++) {
+        path[i + 1] = &((*path[i])->rn_child[
+            (key->rk_addr[i / 8] >> (7 - i % 8)) & 1]);
+    }
+
+    node = *path[i];
+    if (i < key->rk_prefix || node == NULL || !node->rn_used || 
+        (owner != NULL && strcmp(node->rn_cn, owner) != 0)) {
+        err = ENOENT;
+        goto out_unlock_trie;
+    }
+
+    strcpy(prev_cn, node->rn_cn);
+    node->rn_used = false;
+    rt->rt_prefixes--;
+
+    /* Prune the nodes, which lead to no other prefix, but keep the root. */
+    for (; i > 0; i--) {
+        node = *path[i];
+        if (node->rn_used || node->rn_child[0] != NULL || 
+            node->rn_child[1] != NULL) {
+            break;
+        }
+        free(node);
+        *path[i] = NULL;
+    }
+
+out_unlock_trie:
+    pthread_rwlock_unlock(&(rt->rt_trie_lock));
+    return (err);
+}
+
+static void
+i_rtable_trie_free(struct rtable_node *node)
+{
+    if (node == NULL) {
+        return;
+    }
+
+    i_rtable_trie_free(node->rn_child[0]);
+    i_rtable_trie_free(node->rn_child[1]);
+    free(node);
+}
+
+static struct rtable_client_entry **
+i_rtable_client_find(rtable_t *rt, const char *cn)
+{
+    struct rtable_client_entry **entry = NULL;
+
+    entry = &(rt->rt_clients[i_rtable_hash(cn, strlen(cn)) & 
+        (rt->rt_clients_cap - 1)]);
+    while (*entry != NULL && strcmp((*entry)->ce_client.rc_cn, cn) != 0) {
+        entry = &((*entry)->ce_next);
+    }
+
+    return (entry);
+}
+
+static int
+i_rtable_clients_grow(rtable_t *rt)
+{
+    struct rtable_client_entry **clients = NULL, *entry = NULL, *next = NULL;
+    size_t cap = rt->rt_clients_cap * 2, i = 0, b = 0;
+
+    if ((clients = calloc(cap, sizeof(struct rtable_client_entry *))) 
+        == NULL) {
+        return (ENOMEM);
+    }
+
+    for (i = 0; i < rt->rt_clients_cap; i++) {
+        for (entry = rt->rt_clients[i]; entry != NULL; entry = next) {
+            next = entry->ce_next;
+            b = i_rtable_hash(entry->ce_client.rc_cn, 
+                strlen(entry->ce_client.rc_cn)) & (cap - 1);
+            entry->ce_next = clients[b];
+            clients[b] = entry;
+        }
+    }
+
+    free(rt->rt_clients);
+    rt->rt_clients = clients;
+    rt->rt_clients_cap = cap;
+
+    return (0);
+}
+
+/*
+ * i_rtable_client_get returns the entry of a connected client and adds it if 
+ * necessary. The caller has to hold rt_write_lock.
+ */
+static int
+i_rtable_client_get(rtable_t *rt, const char *cn, 
+    struct rtable_client_entry **entryp)
+{
+    struct rtable_client_entry **entry = NULL;
+    int err = 0;
+
+    if (*(entry = i_rtable_client_find(rt, cn)) != NULL) {
+        *entryp = *entry;
+        return (0);
+    }
+
+    pthread_rwlock_wrlock(&(rt->rt_clients_lock));
+
+    if (rt->rt_clients_count >= rt->rt_clients_cap && 
+        (err = i_rtable_clients_grow(rt)) != 0) {
+        goto out_unlock;
+    }
+
+    entry = i_rtable_client_find(rt, cn);
+    if ((*entry = calloc(1, sizeof(struct rtable_client_entry))) == NULL) {
+        err = ENOMEM;
+        goto out_unlock;
+    }
+
+    strncpy((*entry)->ce_client.rc_cn, cn, RFC5280_CN_MAX_LENGTH - 1);
+    (*entry)->ce_client.rc_since = time(NULL);
+    rt->rt_clients_count++;
+    *entryp = *entry;
+
+out_unlock:
+    pthread_rwlock_unlock(&(rt->rt_clients_lock));
+    return (err);
+}
+
+static int
+i_rtable_client_key_add(rtable_t *rt, struct rtable_client_entry *entry, 
+    const struct rtable_key *key)
+{
+    struct rtable_key *keys = NULL;
+    size_t cap = 0;
+    int err = 0;
+
+    pthread_rwlock_wrlock(&(rt->rt_clients_lock));
+
+    if (entry->ce_keys_count == entry->ce_keys_cap) {
+        cap = (entry->ce_keys_cap > 0) ? entry->ce_keys_cap * 2 : 4;
+        if ((keys = realloc(entry->ce_keys, cap * sizeof(struct rtable_key))) 
+            == NULL) {
+            err = ENOMEM;
+            goto out_unlock;
+        }
+        entry->ce_keys = keys;
+        entry->ce_keys_cap = cap;
+    }
+
+    entry->ce_keys[entry->ce_keys_count++] = *key;
+    entry->ce_client.rc_routes = entry->ce_keys_count;
+
+out_unlock:
+    pthread_rwlock_unlock(&(rt->rt_clients_lock));
+    return (err);
+}
+
+static void
+i_rtable_client_key_del(rtable_t *rt, const char *cn, 
+    const struct rtable_key *key)
+{
+    struct rtable_client_entry *entry = NULL;
+    size_t i = 0;
+
+    if ((entry = *i_rtable_client_find(rt, cn)) == NULL) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&(rt->rt_clients_lock));
+
+    for (i = 0; i < entry->ce_keys_count; i++) {
+        if (i_rtable_key_equal(&(entry->ce_keys[i]), key)) {
+            entry->ce_keys[i] = entry->ce_keys[--entry->ce_keys_count];
+            break;
+        }
+    }
+    entry->ce_client.rc_routes = entry->ce_keys_count;
+
+    pthread_rwlock_unlock(&(rt->rt_clients_lock));
+}
+
+/*
+ * rtable_alloc allocates an empty routing table.
+ */
+int
+rtable_alloc(rtable_t **rtp)
+{
+    size_t i = 0;
+
+    if (rtp == NULL) {
+        return (EINVAL);
+    }
+
+    if ((*rtp = calloc(1, sizeof(rtable_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    pthread_mutex_init(&((*rtp)->rt_write_lock), NULL);
+    pthread_rwlock_init(&((*rtp)->rt_trie_lock), NULL);
+    pthread_rwlock_init(&((*rtp)->rt_clients_lock), NULL);
+
+    for (i = 0; i < RTABLE_HOST_SHARDS; i++) {
+        pthread_rwlock_init(&((*rtp)->rt_shards[i].sh_lock), NULL);
+        (*rtp)->rt_shards[i].sh_cap = I_RTABLE_BUCKETS_INIT;
+        if (((*rtp)->rt_shards[i].sh_buckets = calloc(I_RTABLE_BUCKETS_INIT, 
+             sizeof(struct rtable_host *))) == NULL) {
+            goto out_free;
+        }
+    }
+
+    (*rtp)->rt_clients_cap = I_RTABLE_BUCKETS_INIT;
+    if (((*rtp)->rt_clients = calloc(I_RTABLE_BUCKETS_INIT, 
+         sizeof(struct rtable_client_entry *))) == NULL ||
+        ((*rtp)->rt_trie[0] = calloc(1, sizeof(struct rtable_node))) == NULL ||
+        ((*rtp)->rt_trie[1] = calloc(1, sizeof(struct rtable_node))) == NULL) {
+        goto out_free;
+    }
+
+    return (0);
+
+out_free:
+    rtable_free(*rtp);
+    *rtp = NULL;
+    return (ENOMEM);
+}
+
+void
+rtable_free(rtable_t *rt)
+{
+    struct rtable_host *host = NULL, *next_host = NULL;
+    struct rtable_client_entry *entry = NULL, *next_entry = NULL;
+    size_t i = 0, b = 0;
+
+    if (rt == NULL) {
+        return;
+    }
+
+    for (i = 0; i < RTABLE_HOST_SHARDS; i++) {
+        for (b = 0; rt->rt_shards[i].sh_buckets != NULL && 
+             b < rt->rt_shards[i].sh_cap; b++) {
+            for (host = rt->rt_shards[i].sh_buckets[b]; host != NULL; 
+                 host = next_host) {
+                next_host = host->rh_next;
+                free(host);
+            }
+        }
+        free(rt->rt_shards[i].sh_buckets);
+        pthread_rwlock_destroy(&(rt->rt_shards[i].sh_lock));
+    }
+
+    for (b = 0; rt->rt_clients != NULL && b < rt->rt_clients_cap; b++) {
+        for (entry = rt->rt_clients[b]; entry != NULL; entry = next_entry) {
+            next_entry = entry->ce_next;
+            free(entry->ce_keys);
+            free(entry);
+        }
+    }
+    free(rt->rt_clients);
+
+    i_rtable_trie_free(rt->rt_trie[0]);
+    i_rtable_trie_free(rt->rt_trie[1]);
+
+    pthread_rwlock_destroy(&(rt->rt_clients_lock));
+    pthread_rwlock_destroy(&(rt->rt_trie_lock));
+    pthread_mutex_destroy(&(rt->rt_write_lock));
+
+    free(rt);
+}
+
+/*
+ * rtable_client_add marks a client as connected. The database id is kept 
+ * until the disconnect, so the client can be released even if it was 
+ * renamed or deleted meanwhile.
+ */
+int
+rtable_client_add(rtable_t *rt, const char *cn, int client_id)
+{
+    struct rtable_client_entry *entry = NULL;
+    int err = 0;
+
+    if (rt == NULL || cn == NULL || cn[0] == '\0') {
+        return (EINVAL);
+    }
+
+    pthread_mutex_lock(&(rt->rt_write_lock));
+    if ((err = i_rtable_client_get(rt, cn, &entry)) == 0) {
+        pthread_rwlock_wrlock(&(rt->rt_clients_lock));
+        entry->ce_client.rc_client_id = client_id;
+        pthread_rwlock_unlock(&(rt->rt_clients_lock));
+    }
+    pthread_mutex_unlock(&(rt->rt_write_lock));
+
+    return (err);
+}
+
+/*
+ * rtable_client_remove removes a disconnected client and all of its routes. 
+ * The removed client is copied to client, if it isn't NULL. Returns ENOENT if
+ * the client isn't connected.
+ */
+int
+rtable_client_remove(rtable_t *rt, const char *cn, struct rtable_client *client)
+{
+    struct rtable_client_entry **entry = NULL, *old_entry = NULL;
+    char prev_cn[RFC5280_CN_MAX_LENGTH];
+    size_t i = 0;
+    int err = 0;
+
+    if (rt == NULL || cn == NULL) {
+        return (EINVAL);
+    }
+
+    pthread_mutex_lock(&(rt->rt_write_lock));
+
+    if (*(entry = i_rtable_client_find(rt, cn)) == NULL) {
+        err = ENOENT;
+        goto out_unlock;
+    }
+
+    old_entry = *entry;
+    if (client != NULL) {
+        *client = old_entry->ce_client;
+    }
+
+    for (i = 0; i < old_entry->ce_keys_count; i++) {
+        i_rtable_route_del(rt, &(old_entry->ce_keys[i]), cn, prev_cn);
+    }
+
+    pthread_rwlock_wrlock(&(rt->rt_clients_lock));
+    *entry = old_entry->ce_next;
+    rt->rt_clients_count--;
+    pthread_rwlock_unlock(&(rt->rt_clients_lock));
+
+    free(old_entry->ce_keys);
+    free(old_entry);
+
+out_unlock:
+    pthread_mutex_unlock(&(rt->rt_write_lock));
+    return (err);
+}
+
+/*
+ * rtable_learn stores an address or iroute prefix of a client, as announced 
+ * by the learn-address add and update operations. A route learned by another
+ * client before is moved.
+ */
+int
+rtable_learn(rtable_t *rt, const char *addr, const char *cn)
+{
+    struct rtable_client_entry *entry = NULL;
+    struct rtable_key key;
+    char prev_cn[RFC5280_CN_MAX_LENGTH];
+    int err = 0;
+
+    if (rt == NULL || addr == NULL || cn == NULL || cn[0] == '\0' || 
+        strlen(cn) >= RFC5280_CN_MAX_LENGTH) {
+        return (EINVAL);
+    }
+
+    if ((err = i_rtable_key_parse(addr, &key)) != 0) {
+        return (err);
+    }
+
+    pthread_mutex_lock(&(rt->rt_write_lock));
+
+    if ((err = i_rtable_client_get(rt, cn, &entry)) != 0 ||
+        (err = i_rtable_route_set(rt, &key, cn, prev_cn)) != 0) {
+        goto out_unlock;
+    }
+
+    if (strcmp(prev_cn, cn) == 0) {
+        goto out_unlock;
+    }
+
+    if (prev_cn[0] != '\0') {
+        i_rtable_client_key_del(rt, prev_cn, &key);
+    }
+
+    if ((err = i_rtable_client_key_add(rt, entry, &key)) != 0) {
+        i_rtable_route_del(rt, &key, cn, prev_cn);
+    }
+
+out_unlock:
+    pthread_mutex_unlock(&(rt->rt_write_lock));
+    return (err);
+}
+
+/*
+ * rtable_unlearn removes an address or iroute prefix, as announced by the 
+ * learn-address delete operation.
+ */
+int
+rtable_unlearn(rtable_t *rt, const char *addr)
+{
+    struct rtable_key key;
+    char prev_cn[RFC5280_CN_MAX_LENGTH];
+    int err = 0;
+
+    if (rt == NULL || addr == NULL) {
+        return (EINVAL);
+    }
+
+    if ((err = i_rtable_key_parse(addr, &key)) != 0) {
+        return (err);
+    }
+
+    pthread_mutex_lock(&(rt->rt_write_lock));
+
+    if ((err = i_rtable_route_del(rt, &key, NULL, prev_cn)) == 0) {
+        i_rtable_client_key_del(rt, prev_cn, &key);
+    }
+
+    pthread_mutex_unlock(&(rt->rt_write_lock));
+    return (err);
+}
+
+/*
+ * rtable_lookup copies the CN of the client owning an address to cn. A learned
+ * host address wins over the longest matching iroute prefix. Returns ENOENT 
+ * if no client owns the address.
+ */
+int
+rtable_lookup(rtable_t *rt, const char *addr, char *cn, size_t cn_sz)
+{
+    struct rtable_shard *shard = NULL;
+    struct rtable_host *host = NULL;
+    struct rtable_node *node = NULL, *match = NULL;
+    struct rtable_key key;
+    uint64_t hash = 0;
+    size_t i = 0;
+    int err = 0;
+
+    if (rt == NULL || addr == NULL || cn == NULL || cn_sz == 0) {
+        return (EINVAL);
+    }
+
+    if ((err = i_rtable_key_parse(addr, &key)) != 0) {
+        return (err);
+    }
+
+    if (i_rtable_key_is_host(&key)) {
+        shard = i_rtable_shard(rt, &key, &hash);
+        pthread_rwlock_rdlock(&(shard->sh_lock));
+        if ((host = *i_rtable_host_find(shard, hash, &key)) != NULL) {
+            strncpy(cn, host->rh_cn, cn_sz - 1);
+            cn[cn_sz - 1] = '\0';
+        }
+        pthread_rwlock_unlock(&(shard->sh_lock));
+
+        if (host != NULL) {
+            return (0);
+        }
+    }
+
+    pthread_rwlock_rdlock(&(rt->rt_trie_lock));
+
+    node = rt->rt_trie[key.rk_family == AF_INET ? 0 : 1];
+    for (i = 0; node != NULL; i++) {
+        if (node->rn_used) {
+            match = node;
+        }
+        if (i == key.rk_prefix) {
+            break;
+        }
+        node = node->rn_child[(key.rk_addr[i / 8] >> (7 - i % 8)) & 1];
+    }
+
+    if (match != NULL) {
+        strncpy(cn, match->rn_cn, cn_sz - 1);
+        cn[cn_sz - 1] = '\0';
+    } else {
+        err = ENOENT;
+    }
+
+    pthread_rwlock_unlock(&(rt->rt_trie_lock));
+    return (err);
+}
+
+/*
+ * rtable_online stores the connected clients as struct rtable_client in 
+ * results.
+ */
+int
+rtable_online(rtable_t *rt, vector_t *results)
+{
+    struct rtable_client_entry *entry = NULL;
+    size_t b = 0;
+    int err = 0;
+
+    if (rt == NULL || results == NULL) {
+        return (EINVAL);
+    }
+
+    pthread_rwlock_rdlock(&(rt->rt_clients_lock));
+
+    for (b = 0; b < rt->rt_clients_cap && err == 0; b++) {
+        for (entry = rt->rt_clients[b]; entry != NULL && err == 0; 
+             entry = entry->ce_next) {
+            err = vector_push_back(results, &(entry->ce_client));
+        }
+    }
+
+    pthread_rwlock_unlock(&(rt->rt_clients_lock));
+    return (err);
+}
+
+void
+rtable_get_stats(rtable_t *rt, struct rtable_stats *stats)
+{
+    if (rt == NULL || stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(rt->rt_write_lock));
+    stats->rs_clients = rt->rt_clients_count;
+    stats->rs_hosts = rt->rt_hosts;
+    stats->rs_prefixes = rt->rt_prefixes;
+    pthread_mutex_unlock(&(rt->rt_write_lock));
+}
@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "section.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/* Initial number of hash buckets, a power of two. */
+#define I_SECTION_BUCKETS 256
+
+/*
+ * i_section is the stored section, followed by its bytes. The public section
+ * is the first member, so a section pointer converts back to the entry.
+ */
+struct i_section {
+    struct section is_section;
+    uint64_t is_hash;
+    size_t is_refs;
+    struct i_section *is_next;
+    char is_data[];
+};
+
+/*
+ * section_store interns sections by content. The store itself is reference
+ * counted, so directories of several generations can share it.
+ */
+struct section_store {
+    pthread_mutex_t ss_lock;
+    struct i_section **ss_buckets;
+    size_t ss_nbuckets;
+    size_t ss_refs;
+    struct section_stats ss_stats;
+};
+
+/*
+ * i_section_hash hashes a block with FNV-1a.
+ */
+static uint64_t
+i_section_hash(const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    uint64_t h = 14695981039346656037ULL;
+    size_t i = 0;
+
+    for (i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+
+    return (h);
+}
+
+/*
+ * section_store_alloc creates an empty store with one reference.
+ */
+int
+section_store_alloc(section_store_t **storep)
+{
+    int err = 0;
+
+    if (storep == NULL) {
+        return (EINVAL);
+    }
+
+    if ((*storep = calloc(1, sizeof(section_store_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    if (((*storep)->ss_buckets = calloc(I_SECTION_BUCKETS,
+         sizeof(struct i_section *))) == NULL) {
+        err = ENOMEM;
+        goto out_free;
+    }
+
+    if ((err = pthread_mutex_init(&((*storep)->ss_lock), NULL)) != 0) {
+        goto out_free;
+    }
+
+    (*storep)->ss_nbuckets = I_SECTION_BUCKETS;
+    (*storep)->ss_refs = 1;
+    return (0);
+
+out_free:
+    free((*storep)->ss_buckets);
+    free(*storep);
+    *storep = NULL;
+    return (err);
+}
+
+/*
+ * section_store_retain adds a reference to the store and returns it.
+ */
+section_store_t *
+section_store_retain(section_store_t *store)
+{
+    pthread_mutex_lock(&(store->ss_lock));
+    store->ss_refs++;
+    pthread_mutex_unlock(&(store->ss_lock));
+
+    return (store);
+}
+
+/*
+ * section_store_free drops a reference to the store. The last reference frees
+ * the store together with all sections left in it.
+ */
+void
+section_store_free(section_store_t *store)
+{
+    struct i_section *sec = NULL, *next = NULL;
+    size_t refs = 0, i = 0;
+
+    if (store == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(store->ss_lock));
+    refs = --store->ss_refs;
+    pthread_mutex_unlock(&(store->ss_lock));
+
+    if (refs > 0) {
+        return;
+    }
+
+    for (i = 0; i < store->ss_nbuckets; i++) {
+        for (sec = store->ss_buckets[i]; sec != NULL; sec = next) {
+            next = sec->is_next;
+            free(sec);
+        }
+    }
+
+    pthread_mutex_destroy(&(store->ss_lock));
+    free(store->ss_buckets);
+    free(store);
+}
+
+/*
+ * i_section_store_grow doubles the buckets, once the store holds more
+ * sections than buckets. A failed allocation just keeps the longer chains.
+ */
+static void
+i_section_store_grow(section_store_t *store)
+{
+    struct i_section **buckets = NULL, *sec = NULL, *next = NULL;
+    size_t n = store->ss_nbuckets * 2, i = 0;
+
+    if ((buckets = calloc(n, sizeof(struct i_section *))) == NULL) {
+        return;
+    }
+
+    for (i = 0; i < store->ss_nbuckets; i++) {
+        for (sec = store->ss_buckets[i]; sec != NULL; sec = next) {
+            next = sec->is_next;
+            sec->is_next = buckets[sec->is_hash & (n - 1)];
+            buckets[sec->is_hash & (n - 1)] = sec;
+        }
+    }
+
+    free(store->ss_buckets);
+    store->ss_buckets = buckets;
+    store->ss_nbuckets = n;
+}
+
+/*
+ * section_intern returns the section with the given bytes and takes a
+ * reference to it. An equal section is shared, otherwise the bytes are copied
+ * into a new section. Every reference is dropped with section_release.
+ */
+int
+section_intern(section_store_t *store, const void *data, size_t len,
+               const struct section **secp)
+{
+    struct i_section *sec = NULL, **bucket = NULL;
+    uint64_t hash = 0;
+
+    if (store == NULL || (data == NULL && len > 0) || secp == NULL) {
+        return (EINVAL);
+    }
+
+    /* Hash outside of the lock, the blocks may be large. */
+    hash = i_section_hash(data, len);
+
+    pthread_mutex_lock(&(store->ss_lock));
+    store->ss_stats.ss_interned++;
+
+    bucket = &(store->ss_buckets[hash & (store->ss_nbuckets - 1)]);
+    for (sec = *bucket; sec != NULL; sec = sec->is_next) {
+        if (sec->is_hash == hash && sec->is_section.sc_len == len &&
+            memcmp(sec->is_data, data, len) == 0) {
+            store->ss_stats.ss_shared++;
+            goto out_found;
+        }
+    }
+
+    if ((sec = malloc(sizeof(struct i_section) + len)) == NULL) {
+        pthread_mutex_unlock(&(store->ss_lock));
+        return (ENOMEM);
+    }
+
+    if (len > 0) {
+        memcpy(sec->is_data, data, len);
+    }
+    sec->is_section.sc_data = sec->is_data;
+    sec->is_section.sc_len = len;
+    sec->is_hash = hash;
+    sec->is_refs = 0;
+    sec->is_next = *bucket;
+    *bucket = sec;
+
+    store->ss_stats.ss_sections++;
+    store->ss_stats.ss_bytes += len;
+    if (store->ss_stats.ss_sections > store->ss_nbuckets) {
+        i_section_store_grow(store);
+    }
+
+out_found:
+    sec->is_refs++;
+    store->ss_stats.ss_refs++;
+    pthread_mutex_unlock(&(store->ss_lock));
+
+    *secp = &(sec->is_section);
+    return (0);
+}
+
+/*
+ * section_retain takes another reference to an interned section.
+ */
+const struct section *
+section_retain(section_store_t *store, const struct section *section)
+{
+    pthread_mutex_lock(&(store->ss_lock));
+    ((struct i_section *)section)->is_refs++;
+    store->ss_stats.ss_refs++;
+    pthread_mutex_unlock(&(store->ss_lock));
+
+    return (section);
+}
+
+/*
+ * section_release drops a reference to a section. The section is removed
+ * from the store with its last reference.
+ */
+void
+section_release(section_store_t *store, const struct section *section)
+{
+    struct i_section *sec = (struct i_section *)section, **link = NULL;
+
+    if (store == NULL || section == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(store->ss_lock));
+    store->ss_stats.ss_refs--;
+
+    if (--sec->is_refs > 0) {
+        pthread_mutex_unlock(&(store->ss_lock));
+        return;
+    }
+
+    for (link = &(store->ss_buckets[sec->is_hash &
+         (store->ss_nbuckets - 1)]); *link != sec;
+         link = &((*link)->is_next)) {
+        continue;
+    }
+    *link = sec->is_next;
+
+    store->ss_stats.ss_sections--;
+    store->ss_stats.ss_bytes -= section->sc_len;
+    pthread_mutex_unlock(&(store->ss_lock));
+
+    free(sec);
+}
+
+/*
+ * section_store_get_stats copies the current statistics of the store.
+ */
+void
+section_store_get_stats(section_store_t *store, struct section_stats *stats)
+{
+    pthread_mutex_lock(&(store->ss_lock));
+    *stats = store->ss_stats;
+    pthread_mutex_unlock(&(store->ss_lock));
+}
+
+/*
+ * section_writev writes all buffers to a file descriptor, at most IOV_MAX
+ * buffers per call. Partial writes are continued, so the iovec array is
+ * modified. Returns EIO if nothing was written while bytes remain.
+ */
+int
+section_writev(int fd, struct iovec *iov, size_t n)
+{
+    ssize_t written = 0;
+
+    if (fd < 0 || (iov == NULL && n > 0)) {
+        return (EINVAL);
+    }
+
+    while (n > 0) {
+        /* Empty buffers are skipped, so writing nothing is an error. */
+        if (iov->iov_len == 0) {
+            iov++;
+            n--;
+            continue;
+        }
+
+        if ((written = writev(fd, iov, n < IOV_MAX ? n : IOV_MAX)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno);
+        } else if (written == 0) {
+            return (EIO);
+        }
+
+        /* Skip the written buffers and cut the partially written one. */
+        for (; n > 0 && (size_t)written >= iov->iov_len; iov++, n--) {
+            written -= iov->iov_len;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return (0);
+}
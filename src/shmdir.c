@@ -0,0 +1,583 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmdir.h"
+#include "vector.h"
+
+/*
+ * A shared directory consists of a small header segment and one data segment
+ * per published generation:
+ *
+ *   /easyvpn-<name>          struct i_shmdir_header
+ *   /easyvpn-<name>-<gen>    struct i_shmdir_image, clients, networks
+ *
+ * A publisher writes a complete data segment, stores its generation in the
+ * header and unlinks the previous data segment. Readers compare the header
+ * generation with the generation they have mapped and map the new segment on
+ * a change. Unlinked segments stay valid until their last reader unmaps them,
+ * so a reader never sees a partial snapshot. Publishers are serialized by a
+ * lock on the header segment.
+ */
+
+#define I_SHMDIR_MAGIC    0x45564453  /* "EVDS" */
+#define I_SHMDIR_VERSION  1
+#define I_SHMDIR_ALIGN    64
+
+/* Readers of another build must not interpret the snapshot. */
+#define I_SHMDIR_LAYOUT \
+    ((uint32_t)(I_SHMDIR_VERSION << 24 | sizeof(void *) << 16 | \
+     sizeof(struct vpn_client)))
+
+/* Attempts to map a generation which was replaced before it was opened. */
+#define I_SHMDIR_MAP_TRIES 8
+
+#define I_SHMDIR_ROUNDUP(x) \
+    (((x) + I_SHMDIR_ALIGN - 1) & ~((size_t)I_SHMDIR_ALIGN - 1))
+
+struct i_shmdir_header {
+    uint32_t sh_magic;
+    uint32_t sh_layout;
+    _Atomic uint64_t sh_generation;  /* 0 until the first publish */
+};
+
+struct i_shmdir_image {
+    uint32_t si_magic;
+    uint32_t si_layout;
+    uint64_t si_generation;
+    uint64_t si_clients;          /* Number of clients, ordered by CN */
+    uint64_t si_clients_offset;
+    uint64_t si_networks_offset;  /* Image of the ccd directory */
+    uint64_t si_networks_size;
+};
+
+/*
+ * shmdir is the reader side of a shared directory. A reader may be used by
+ * several threads at once, except for shmdir_refresh, which replaces its 
+ * mapping. See shmdir_stale to check for a refresh without it.
+ */
+struct shmdir {
+    char sd_name[SHMDIR_NAME_MAX];
+    struct i_shmdir_header *sd_header;
+    const struct i_shmdir_image *sd_image;  /* NULL until mapped */
+    size_t sd_image_size;
+    ccd_directory_t *sd_directory;
+    uint64_t sd_remaps;
+};
+
+/*
+ * i_shmdir_segment_name formats the name of the header segment or, with a
+ * generation greater than 0, of a data segment.
+ */
+static int
+i_shmdir_segment_name(char *buf, size_t size, const char *name,
+    uint64_t generation)
+{
+    int n = 0;
+
+    if (name == NULL || name[0] == '\0' || strchr(name, '/') != NULL ||
+        strlen(name) >= SHMDIR_NAME_MAX) {
+        return (EINVAL);
+    }
+
+    if (generation == 0) {
+        n = snprintf(buf, size, "/easyvpn-%s", name);
+    } else {
+        n = snprintf(buf, size, "/easyvpn-%s-%" PRIu64, name, generation);
+    }
+
+    return (n < 0 || (size_t)n >= size ? ENAMETOOLONG : 0);
+}
+
+/*
+ * i_shmdir_header_open opens and maps the header segment. The publisher
+ * creates and locks it.
+ */
+static int
+i_shmdir_header_open(const char *name, int publish,
+    struct i_shmdir_header **headerp, int *fdp)
+{
+    char path[SHMDIR_NAME_MAX + 16];
+    struct stat st;
+    void *addr = NULL;
+    int fd = -1, err = 0;
+
+    if ((err = i_shmdir_segment_name(path, sizeof(path), name, 0)) != 0) {
+        return (err);
+    }
+
+    if ((fd = shm_open(path, publish ? O_RDWR | O_CREAT : O_RDONLY, 0644))
+        == -1) {
+        return (errno);
+    }
+
+    if (publish && (flock(fd, LOCK_EX) == -1 || fchmod(fd, 0644) == -1)) {
+        err = errno;
+        goto out_close;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        err = errno;
+        goto out_close;
+    }
+
+    if ((size_t)st.st_size < sizeof(struct i_shmdir_header)) {
+        if (!publish) {
+            err = ENOENT;
+            goto out_close;
+        }
+
+        if (ftruncate(fd, sizeof(struct i_shmdir_header)) == -1) {
+            err = errno;
+            goto out_close;
+        }
+    }
+
+    if ((addr = mmap(NULL, sizeof(struct i_shmdir_header),
+         publish ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0))
+        == MAP_FAILED) {
+        err = errno;
+        goto out_close;
+    }
+    *headerp = addr;
+
+    if (publish && (*headerp)->sh_magic == 0) {
+        (*headerp)->sh_magic = I_SHMDIR_MAGIC;
+        (*headerp)->sh_layout = I_SHMDIR_LAYOUT;
+    }
+
+    if ((*headerp)->sh_magic != I_SHMDIR_MAGIC ||
+        (*headerp)->sh_layout != I_SHMDIR_LAYOUT) {
+        /* A header which is still being created is not published yet. */
+        err = (*headerp)->sh_magic == 0 ? ENOENT : EPROTO;
+        munmap(addr, sizeof(struct i_shmdir_header));
+        goto out_close;
+    }
+
+    /* The publisher keeps the descriptor, it holds the lock. */
+    if (fdp != NULL) {
+        *fdp = fd;
+        return (0);
+    }
+
+out_close:
+    close(fd);
+    return (err);
+}
+
+/*
+ * i_shmdir_image_write creates the data segment of a generation and writes
+ * the clients and the directory image into it.
+ */
+static int
+i_shmdir_image_write(const char *name, uint64_t generation,
+    vector_t *clients, ccd_directory_t *directory)
+{
+    char path[SHMDIR_NAME_MAX + 32];
+    struct i_shmdir_image *image = NULL;
+    size_t clients_offset = 0, networks_offset = 0, size = 0;
+    void *addr = NULL;
+    int fd = -1, err = 0;
+
+    if ((err = i_shmdir_segment_name(path, sizeof(path), name, generation))
+        != 0) {
+        return (err);
+    }
+
+    clients_offset = I_SHMDIR_ROUNDUP(sizeof(struct i_shmdir_image));
+    networks_offset = I_SHMDIR_ROUNDUP(clients_offset +
+        vector_size(clients) * sizeof(struct vpn_client));
+    size = networks_offset + ccd_directory_image_size(directory);
+
+    /* A leftover of an aborted publish is replaced. */
+    shm_unlink(path);
+
+    if ((fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0644)) == -1) {
+        return (errno);
+    }
+
+    if (fchmod(fd, 0644) == -1 || ftruncate(fd, size) == -1) {
+        err = errno;
+        goto out_unlink;
+    }
+
+    if ((addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))
+        == MAP_FAILED) {
+        err = errno;
+        goto out_unlink;
+    }
+
+    image = addr;
+    image->si_magic = I_SHMDIR_MAGIC;
+    image->si_layout = I_SHMDIR_LAYOUT;
+    image->si_generation = generation;
+    image->si_clients = vector_size(clients);
+    image->si_clients_offset = clients_offset;
+    image->si_networks_offset = networks_offset;
+    image->si_networks_size = ccd_directory_image_size(directory);
+
+    if (!vector_empty(clients)) {
+        memcpy((char *)addr + clients_offset, vector_begin(clients),
+            vector_size(clients) * sizeof(struct vpn_client));
+    }
+    ccd_directory_image_write(directory, (char *)addr + networks_offset);
+
+    munmap(addr, size);
+    close(fd);
+    return (0);
+
+out_unlink:
+    close(fd);
+    shm_unlink(path);
+    return (err);
+}
+
+/*
+ * shmdir_publish reads the active clients and their networks and publishes
+ * them as the next generation of the shared directory. Readers switch to the
+ * new snapshot on their next refresh. The published generation is stored in
+ * generationp if not NULL.
+ */
+int
+shmdir_publish(const char *name, dao_config_t *daocfg, uint64_t *generationp)
+{
+    char path[SHMDIR_NAME_MAX + 32];
+    struct i_shmdir_header *header = NULL;
+    ccd_directory_t *directory = NULL;
+    uint64_t generation = 0;
+    int fd = -1, err = 0;
+
+    if (name == NULL || daocfg == NULL) {
+        return (EINVAL);
+    }
+
+    /* The directory holds the active clients ordered by CN. */
+    if ((err = ccd_directory_load(&directory, daocfg)) != 0) {
+        return (err);
+    }
+
+    if ((err = i_shmdir_header_open(name, 1, &header, &fd)) != 0) {
+        goto out_free;
+    }
+
+    generation = atomic_load(&(header->sh_generation)) + 1;
+
+    if ((err = i_shmdir_image_write(name, generation,
+         ccd_directory_clients(directory), directory)) != 0) {
+        goto out_unmap;
+    }
+
+    /* The snapshot is complete before readers can see its generation. */
+    atomic_store_explicit(&(header->sh_generation), generation,
+        memory_order_release);
+
+    if (generation > 1 && i_shmdir_segment_name(path, sizeof(path), name,
+        generation - 1) == 0) {
+        shm_unlink(path);
+    }
+
+    if (generationp != NULL) {
+        *generationp = generation;
+    }
+
+out_unmap:
+    munmap(header, sizeof(struct i_shmdir_header));
+    close(fd);
+out_free:
+    ccd_directory_free(directory);
+    return (err);
+}
+
+/*
+ * shmdir_unlink removes the shared directory. Readers keep their current
+ * snapshot but can't refresh anymore.
+ */
+int
+shmdir_unlink(const char *name)
+{
+    char path[SHMDIR_NAME_MAX + 32];
+    struct i_shmdir_header *header = NULL;
+    uint64_t generation = 0;
+    int fd = -1, err = 0;
+
+    if ((err = i_shmdir_header_open(name, 1, &header, &fd)) != 0) {
+        return (err);
+    }
+
+    generation = atomic_load(&(header->sh_generation));
+    if (generation > 0 && i_shmdir_segment_name(path, sizeof(path), name,
+        generation) == 0) {
+        shm_unlink(path);
+    }
+
+    i_shmdir_segment_name(path, sizeof(path), name, 0);
+    if (shm_unlink(path) == -1) {
+        err = errno;
+    }
+
+    munmap(header, sizeof(struct i_shmdir_header));
+    close(fd);
+    return (err);
+}
+
+/*
+ * i_shmdir_map maps the data segment of a generation and replaces the
+ * current snapshot of the reader. ENOENT means that the generation has been
+ * replaced in the meantime.
+ */
+static int
+i_shmdir_map(shmdir_t *shmdir, uint64_t generation)
+{
+    char path[SHMDIR_NAME_MAX + 32];
+    const struct i_shmdir_image *image = NULL;
+    ccd_directory_t *directory = NULL;
+    struct stat st;
+    void *addr = NULL;
+    size_t size = 0;
+    int fd = -1, err = 0;
+
+    if ((err = i_shmdir_segment_name(path, sizeof(path), shmdir->sd_name,
+         generation)) != 0) {
+        return (err);
+    }
+
+    if ((fd = shm_open(path, O_RDONLY, 0)) == -1) {
+        return (errno);
+    }
+
+    if (fstat(fd, &st) == -1) {
+        err = errno;
+        close(fd);
+        return (err);
+    }
+    size = st.st_size;
+
+    if (size < sizeof(struct i_shmdir_image)) {
+        close(fd);
+        return (EPROTO);
+    }
+
+    addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return (errno);
+    }
+
+    image = addr;
+    if (image->si_magic != I_SHMDIR_MAGIC ||
+        image->si_layout != I_SHMDIR_LAYOUT ||
+        image->si_generation != generation ||
+        image->si_clients_offset % I_SHMDIR_ALIGN != 0 ||
+        image->si_clients > (size - image->si_clients_offset) /
+            sizeof(struct vpn_client) ||
+        image->si_networks_offset < image->si_clients_offset +
+            image->si_clients * sizeof(struct vpn_client) ||
+        image->si_networks_offset > size ||
+        image->si_networks_size > size - image->si_networks_offset) {
+        err = EPROTO;
+        goto out_unmap;
+    }
+
+    if ((err = ccd_directory_map(&directory,
+         (const char *)addr + image->si_networks_offset,
+         image->si_networks_size)) != 0) {
+        goto out_unmap;
+    }
+
+    ccd_directory_free(shmdir->sd_directory);
+    if (shmdir->sd_image != NULL) {
+        munmap((void *)shmdir->sd_image, shmdir->sd_image_size);
+    }
+
+    shmdir->sd_directory = directory;
+    shmdir->sd_image = image;
+    shmdir->sd_image_size = size;
+    shmdir->sd_remaps++;
+
+    return (0);
+
+out_unmap:
+    munmap(addr, size);
+    return (err);
+}
+
+/*
+ * shmdir_open maps the current snapshot of a shared directory. ENOENT means
+ * that nothing has been published yet.
+ */
+int
+shmdir_open(shmdir_t **shmdirp, const char *name)
+{
+    int err = 0;
+
+    if (shmdirp == NULL || name == NULL || strlen(name) >= SHMDIR_NAME_MAX) {
+        return (EINVAL);
+    }
+
+    if ((*shmdirp = calloc(1, sizeof(shmdir_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    strcpy((*shmdirp)->sd_name, name);
+
+    if ((err = i_shmdir_header_open(name, 0, &((*shmdirp)->sd_header),
+         NULL)) != 0 ||
+        (err = shmdir_refresh(*shmdirp)) != 0) {
+        shmdir_close(*shmdirp);
+        *shmdirp = NULL;
+        return (err);
+    }
+
+    return (0);
+}
+
+/*
+ * shmdir_close unmaps the snapshot and frees the reader.
+ */
+void
+shmdir_close(shmdir_t *shmdir)
+{
+    if (shmdir == NULL) {
+        return;
+    }
+
+    ccd_directory_free(shmdir->sd_directory);
+
+    if (shmdir->sd_image != NULL) {
+        munmap((void *)shmdir->sd_image, shmdir->sd_image_size);
+    }
+
+    if (shmdir->sd_header != NULL) {
+        munmap(shmdir->sd_header, sizeof(struct i_shmdir_header));
+    }
+
+    free(shmdir);
+}
+
+/*
+ * shmdir_stale tells if a newer generation than the mapped one has been 
+ * published. It doesn't change the reader, so it may run concurrently with
+ * lookups, and it costs a single atomic load.
+ */
+bool
+shmdir_stale(shmdir_t *shmdir)
+{
+    uint64_t generation = 0;
+
+    if (shmdir == NULL) {
+        return (false);
+    }
+
+    generation = atomic_load_explicit(&(shmdir->sd_header->sh_generation),
+        memory_order_acquire);
+
+    return (shmdir->sd_image == NULL ||
+        shmdir->sd_image->si_generation != generation);
+}
+
+/*
+ * shmdir_refresh maps the latest snapshot if a newer generation has been
+ * published. A mapped snapshot is kept if the new one can't be mapped. The
+ * check costs a single atomic load if nothing has changed.
+ */
+int
+shmdir_refresh(shmdir_t *shmdir)
+{
+    uint64_t generation = 0;
+    int tries = 0, err = 0;
+
+    if (shmdir == NULL) {
+        return (EINVAL);
+    }
+
+    for (tries = 0; tries < I_SHMDIR_MAP_TRIES; tries++) {
+        generation = atomic_load_explicit(&(shmdir->sd_header->sh_generation),
+            memory_order_acquire);
+
+        if (generation == 0) {
+            return (ENOENT);
+        }
+
+        if (shmdir->sd_image != NULL &&
+            shmdir->sd_image->si_generation == generation) {
+            return (0);
+        }
+
+        /* The generation may have been replaced before we opened it. */
+        if ((err = i_shmdir_map(shmdir, generation)) != ENOENT) {
+            return (err);
+        }
+    }
+
+    return (err);
+}
+
+static int
+i_shmdir_client_cmp(const void *key, const void *elem)
+{
+    return (strcmp(key, ((const struct vpn_client *)elem)->cn));
+}
+
+/*
+ * shmdir_find_client copies the active client with the given common name out
+ * of the mapped snapshot. Unknown and inactive CNs return ENOENT.
+ */
+int
+shmdir_find_client(shmdir_t *shmdir, const char *cn, struct vpn_client *model)
+{
+    const struct vpn_client *client = NULL;
+
+    if (shmdir == NULL || cn == NULL || model == NULL) {
+        return (EINVAL);
+    }
+
+    if ((client = bsearch(cn,
+         (const char *)shmdir->sd_image + shmdir->sd_image->si_clients_offset,
+         shmdir->sd_image->si_clients, sizeof(struct vpn_client),
+         i_shmdir_client_cmp)) == NULL) {
+        return (ENOENT);
+    }
+
+    memcpy(model, client, sizeof(struct vpn_client));
+    return (0);
+}
+
+/*
+ * shmdir_directory returns the client directory of the mapped snapshot. It is
+ * valid until the next refresh.
+ */
+ccd_directory_t *
+shmdir_directory(shmdir_t *shmdir)
+{
+    return (shmdir != NULL ? shmdir->sd_directory : NULL);
+}
+
+/*
+ * shmdir_get_stats describes the mapped snapshot.
+ */
+void
+shmdir_get_stats(shmdir_t *shmdir, struct shmdir_stats *stats)
+{
+    memset(stats, 0, sizeof(struct shmdir_stats));
+
+    if (shmdir == NULL || shmdir->sd_image == NULL) {
+        return;
+    }
+
+    stats->ss_generation = shmdir->sd_image->si_generation;
+    stats->ss_remaps = shmdir->sd_remaps;
+    stats->ss_clients = shmdir->sd_image->si_clients;
+    stats->ss_bytes = shmdir->sd_image_size;
+}
@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2018 Tschokko. All rights reserved.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "batchq.h"
+#include "log.h"
+#include "trace.h"
+
+/* Bytes the writer encodes before a write. */
+#define I_TRACE_BUFFER_SIZE 65536
+
+/* Largest encoded record: type, CN length, time, CN and byte counters. */
+#define I_TRACE_RECORD_MAX (2 + 8 + RFC5280_CN_MAX_LENGTH + 16)
+
+/*
+ * trace appends the connect and disconnect events to a file. Like acct,
+ * producers put the events into a batchq and never wait, the writer thread
+ * of the queue encodes and writes them in batches.
+ *
+ * The file starts with TRACE_MAGIC, followed by the records. A record is the
+ * type and the CN length as one byte each, the time as 64 bit little-endian
+ * integer and the CN. Disconnects append the received and sent bytes as 64
+ * bit little-endian integers. A trace is appended to on reopen, so it may
+ * contain several runs.
+ */
+struct trace {
+    batchq_t *t_queue;
+    int t_fd;
+    char *t_buf;
+    atomic_uint_fast64_t t_written;
+    atomic_uint_fast64_t t_failed;
+};
+
+/*
+ * trace_reader reads the events of a trace file.
+ */
+struct trace_reader {
+    FILE *tr_stream;
+};
+
+static void
+i_trace_put_u64(uint8_t *p, uint64_t v)
+{
+    size_t i = 0;
+
+    for (i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(v >> (i * 8));
+    }
+}
+
+static uint64_t
+i_trace_get_u64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    size_t i = 0;
+
+    for (i = 0; i < 8; i++) {
+        v |= (uint64_t)p[i] << (i * 8);
+    }
+
+    return (v);
+}
+
+/*
+ * i_trace_encode writes the record of an event to p and returns its length.
+ */
+static size_t
+i_trace_encode(const struct trace_event *event, uint8_t *p)
+{
+    size_t cn_len = strnlen(event->te_cn, RFC5280_CN_MAX_LENGTH - 1);
+    size_t len = 2 + 8 + cn_len;
+
+    p[0] = (uint8_t)event->te_type;
+    p[1] = (uint8_t)cn_len;
+    i_trace_put_u64(p + 2, event->te_time);
+    memcpy(p + 10, event->te_cn, cn_len);
+
+    if (event->te_type == TRACE_DISCONNECT) {
+        i_trace_put_u64(p + len, event->te_bytes_received);
+        i_trace_put_u64(p + len + 8, event->te_bytes_sent);
+        len += 16;
+    }
+
+    return (len);
+}
+
+static int
+i_trace_write(int fd, const char *buf, size_t len)
+{
+    ssize_t n = 0;
+
+    while (len > 0) {
+        if ((n = write(fd, buf, len)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno);
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return (0);
+}
+
+/*
+ * i_trace_flush drains the queue into the file.
+ */
+static void
+i_trace_flush(batchq_t *queue, void *arg)
+{
+    trace_t *trace = arg;
+    struct trace_event event;
+    size_t len = 0, count = 0;
+    int err = 0;
+
+    do {
+        len = 0;
+        count = 0;
+
+        while (len + I_TRACE_RECORD_MAX <= I_TRACE_BUFFER_SIZE &&
+               batchq_dequeue(queue, &event)) {
+            len += i_trace_encode(&event, (uint8_t *)trace->t_buf + len);
+            count++;
+        }
+
+        if (count == 0) {
+            break;
+        }
+
+        if ((err = i_trace_write(trace->t_fd, trace->t_buf, len)) != 0) {
+            log_error("Failed to write %zu trace events: %s", count,
+                strerror(err));
+            atomic_fetch_add(&(trace->t_failed), count);
+        } else {
+            atomic_fetch_add(&(trace->t_written), count);
+        }
+    } while (len + I_TRACE_RECORD_MAX > I_TRACE_BUFFER_SIZE);
+}
+
+/*
+ * i_trace_check_magic writes the magic to an empty file and checks it in an
+ * existing one.
+ */
+static int
+i_trace_check_magic(int fd)
+{
+    char magic[TRACE_MAGIC_LEN];
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        return (errno);
+    }
+
+    if (st.st_size == 0) {
+        return (i_trace_write(fd, TRACE_MAGIC, TRACE_MAGIC_LEN));
+    }
+
+    if (pread(fd, magic, TRACE_MAGIC_LEN, 0) != TRACE_MAGIC_LEN ||
+        memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0) {
+        return (EPROTO);
+    }
+
+    return (0);
+}
+
+/*
+ * trace_open starts recording events to the trace file at path. The file is
+ * created or appended to. Returns EPROTO if the file isn't a trace.
+ */
+int
+trace_open(trace_t **tracep, const char *path)
+{
+    int err = 0;
+
+    if (tracep == NULL || path == NULL) {
+        return (EINVAL);
+    }
+
+    if ((*tracep = calloc(1, sizeof(trace_t))) == NULL) {
+        return (ENOMEM);
+    }
+    (*tracep)->t_fd = -1;
+
+    if (((*tracep)->t_buf = malloc(I_TRACE_BUFFER_SIZE)) == NULL) {
+        err = ENOMEM;
+        goto out_free;
+    }
+
+    if (((*tracep)->t_fd = open(path, O_RDWR | O_CREAT | O_APPEND |
+         O_CLOEXEC, 0600)) < 0) {
+        err = errno;
+        goto out_free;
+    }
+
+    if ((err = i_trace_check_magic((*tracep)->t_fd)) != 0) {
+        goto out_free;
+    }
+
+    if ((err = batchq_open(&((*tracep)->t_queue), TRACE_QUEUE_SIZE,
+        sizeof(struct trace_event), TRACE_BATCH_SIZE, TRACE_FLUSH_INTERVAL_MS,
+        i_trace_flush, *tracep)) != 0) {
+        goto out_free;
+    }
+
+    return (0);
+
+out_free:
+    if ((*tracep)->t_fd >= 0) {
+        close((*tracep)->t_fd);
+    }
+    free((*tracep)->t_buf);
+    free(*tracep);
+    *tracep = NULL;
+    return (err);
+}
+
+/*
+ * trace_close writes all queued events and stops the writer.
+ */
+void
+trace_close(trace_t *trace)
+{
+    if (trace == NULL) {
+        return;
+    }
+
+    batchq_close(trace->t_queue);
+    close(trace->t_fd);
+    free(trace->t_buf);
+    free(trace);
+}
+
+/*
+ * trace_submit queues an event with the current time without blocking. The
+ * byte counters are ignored for connects. Returns EAGAIN if the queue is full
+ * and the event was dropped.
+ */
+int
+trace_submit(trace_t *trace, enum trace_event_type type, const char *cn,
+             uint64_t bytes_received, uint64_t bytes_sent)
+{
+    struct trace_event event;
+    struct timespec now;
+
+    if (trace == NULL || cn == NULL ||
+        (type != TRACE_CONNECT && type != TRACE_DISCONNECT)) {
+        return (EINVAL);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    event.te_time = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    event.te_type = type;
+    strncpy(event.te_cn, cn, RFC5280_CN_MAX_LENGTH - 1);
+    event.te_cn[RFC5280_CN_MAX_LENGTH - 1] = '\0';
+    event.te_bytes_received = bytes_received;
+    event.te_bytes_sent = bytes_sent;
+
+    return (batchq_submit(trace->t_queue, &event));
+}
+
+void
+trace_get_stats(trace_t *trace, struct trace_stats *stats)
+{
+    struct batchq_stats queue_stats;
+
+    if (trace == NULL || stats == NULL) {
+        return;
+    }
+
+    batchq_get_stats(trace->t_queue, &queue_stats);
+    stats->ts_queued = queue_stats.bs_queued;
+    stats->ts_dropped = queue_stats.bs_dropped;
+    stats->ts_written = atomic_load(&(trace->t_written));
+    stats->ts_failed = atomic_load(&(trace->t_failed));
+}
+
+/*
+ * trace_reader_open opens a trace file for reading. Returns EPROTO if the
+ * file isn't a trace.
+ */
+int
+trace_reader_open(trace_reader_t **readerp, const char *path)
+{
+    char magic[TRACE_MAGIC_LEN];
+    int err = 0;
+
+    if (readerp == NULL || path == NULL) {
+        return (EINVAL);
+    }
+
+    if ((*readerp = calloc(1, sizeof(trace_reader_t))) == NULL) {
+        return (ENOMEM);
+    }
+
+    if (((*readerp)->tr_stream = fopen(path, "r")) == NULL) {
+        err = errno;
+        free(*readerp);
+        *readerp = NULL;
+        return (err);
+    }
+
+    if (fread(magic, 1, TRACE_MAGIC_LEN, (*readerp)->tr_stream) !=
+        TRACE_MAGIC_LEN || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0) {
+        trace_reader_close(*readerp);
+        *readerp = NULL;
+        return (EPROTO);
+    }
+
+    return (0);
+}
+
+void
+trace_reader_close(trace_reader_t *reader)
+{
+    if (reader == NULL) {
+        return;
+    }
+
+    fclose(reader->tr_stream);
+    free(reader);
+}
+
+/*
+ * trace_reader_next reads the next event. Returns ENOENT at the end of the
+ * trace and EPROTO if a record is truncated or invalid.
+ */
+int
+trace_reader_next(trace_reader_t *reader, struct trace_event *event)
+{
+    uint8_t buf[I_TRACE_RECORD_MAX];
+    size_t n = 0, cn_len = 0;
+
+    if (reader == NULL || event == NULL) {
+        return (EINVAL);
+    }
+
+    if ((n = fread(buf, 1, 10, reader->tr_stream)) == 0) {
+        return (ferror(reader->tr_stream) ? EIO : ENOENT);
+    }
+
+    cn_len = buf[1];
+    if (n != 10 || (buf[0] != TRACE_CONNECT && buf[0] != TRACE_DISCONNECT) ||
+        cn_len >= RFC5280_CN_MAX_LENGTH) {
+        return (EPROTO);
+    }
+
+    n = cn_len + (buf[0] == TRACE_DISCONNECT ? 16 : 0);
+    if (fread(buf + 10, 1, n, reader->tr_stream) != n) {
+        return (EPROTO);
+    }
+
+    memset(event, 0, sizeof(struct trace_event));
+    event->te_type = buf[0];
+    event->te_time = i_trace_get_u64(buf + 2);
+    memcpy(event->te_cn, buf + 10, cn_len);
+
+    if (event->te_type == TRACE_DISCONNECT) {
+        event->te_bytes_received = i_trace_get_u64(buf + 10 + cn_len);
+        event->te_bytes_sent = i_trace_get_u64(buf + 18 + cn_len);
+    }
+
+    return (0);
+}
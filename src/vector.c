@@ -4,10 +4,12 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
 
+#include "log.h"
 #include "vector.h"
 
 #define VECTOR_INIT_CAPACITY 4
@@ -32,9 +34,8 @@ i_vec_resize(vector_t *vec, size_t capacity)
 
     assert(vec != NULL);
 
-#ifdef DEBUG
-    printf("i_vec_resize: %d to %d\n", vec->vec_capacity, capacity);
-#endif
+    log_debug("Resize vector from %zu to %zu elements", 
+        (size_t)vec->vec_capacity, capacity);
 
     /* Allocate new buffer for elems. */
     if ((elems = calloc(capacity, vec->vec_elem_size)) == NULL) {
@@ -195,6 +196,31 @@ vector_next(vector_t *vec, void *elem)
     return vector_end(vec);
 }
 
+/*
+ * vector_sort sorts the elements in place with the given compare function.
+ */
+void
+vector_sort(vector_t *vec, int (*compar)(const void *, const void *))
+{
+    assert(vec != NULL);
+    assert(compar != NULL);
+
+    qsort(vec->vec_elems, vec->vec_size, vec->vec_elem_size, compar);
+}
+
+/*
+ * vector_truncate shrinks the vector to the given size. The capacity is kept.
+ */
+void
+vector_truncate(vector_t *vec, size_t size)
+{
+    assert(vec != NULL);
+
+    if (size < vec->vec_size) {
+        vec->vec_size = size;
+    }
+}
+
 /* void
 vector_erase(vector_t *vec, size_t index)
 {